@@ -26,6 +26,8 @@
 #include <sys/mman.h>
 #include <sys/interrupt.h>
 #include <sys/file.h>
+#include <sys/list.h>
+#include <sys/time.h>
 #include <posix/utils.h>
 
 #include <phoenix/arch/imx6ull.h>
@@ -63,6 +65,14 @@
 
 #define MAIN_THD_PRIO           (2)
 
+#define OCRAM_BASE              (0x900000)
+#define OCRAM_END               (0x920000)
+#define OCRAM_PAGES             ((OCRAM_END - OCRAM_BASE)/SIZE_PAGE)
+#define OCRAM_PAGE_FREE         (-1)
+
+/* Reads waiting for an interrupt, answered by the interrupt dispatcher */
+#define NUM_OF_PENDING_READS    (64)
+
 /* Buffer Descriptor Commands for Bootload scripts */
 #define SDMA_CMD_C0_SET_DM                      (0x1)
 #define SDMA_CMD_C0_GET_DM                      (0x2)
@@ -125,20 +135,37 @@ typedef enum {
 	sdma_csm__dynamic               = 0x3,
 } sdma_csm_t;
 
+typedef struct _pending_read_t {
+	struct _pending_read_t *next, *prev;
+
+	msg_t msg;
+	unsigned rid;
+} pending_read_t;
+
 typedef struct {
 	int active;
 	int auto_bd_done;
 
 	sdma_buffer_desc_t *bd;
 	addr_t bd_paddr;
+	size_t bd_size;
 
 	id_t file_id;
 
-	handle_t intr_cond;
+	pending_read_t *readers;
+	sdma_ring_t *ring; /* Completion ring shared with clients, allocated on first request */
+	addr_t ring_paddr;
 	unsigned intr_cnt;
 	unsigned missed_intr_cnt;
 
 	unsigned read_cnt;
+	unsigned open_cnt;
+
+	/* Dispatcher wakeup to read response time since last stats print (in us),
+	 * doesn't cover the interrupt to dispatcher wakeup nor client scheduling */
+	time_t dispatch_sum;
+	time_t dispatch_max;
+	unsigned dispatch_cnt;
 } sdma_channel_t;
 
 struct driver_common_s
@@ -149,6 +176,9 @@ struct driver_common_s
 	uint32_t port;
 
 	sdma_channel_t channel[NUM_OF_SDMA_CHANNELS];
+
+	pending_read_t pending[NUM_OF_PENDING_READS];
+	pending_read_t *pending_free;
 	sdma_channel_ctrl_t *ccb; /* Pointer to channel control block array */
 	addr_t ccb_paddr;
 
@@ -163,7 +193,8 @@ struct driver_common_s
 	handle_t intr_cond;
 	handle_t lock;
 
-	addr_t ocram_next;
+	/* Channel owning each OCRAM page, 0 for the driver itself */
+	int8_t ocram_owner[OCRAM_PAGES];
 
 	int stats_period_s;
 	int use_syslog;
@@ -208,13 +239,6 @@ static void sdma_enable_channel(uint8_t channel_id)
 	common.regs->HSTART = (1 << channel_id);
 }
 
-static void __attribute__((unused)) sdma_disable_channel(uint8_t channel_id)
-{
-	common.regs->HSTART &= ~(1 << channel_id);
-	common.active_mask &= ~(1 << channel_id);
-	common.channel[channel_id].active = 0;
-}
-
 static int sdma_run_channel0_cmd(uint16_t count,
 								 uint8_t command,
 								 uint32_t buffer_addr,
@@ -254,6 +278,53 @@ static void sdma_set_channel_priority(uint8_t channel_id, uint8_t priority)
 	common.regs->SDMA_CHNPRI[channel_id] |= priority & CHNPRIn_PRIORITY_MASK;
 }
 
+/* Process status: channel the core runs and the one it switches to next, priority 0 when there is none */
+#define SDMA_PSW_CCR(psw)                       ((psw) & 0x1f)
+#define SDMA_PSW_CCP(psw)                       (((psw) >> 5) & 0x7)
+#define SDMA_PSW_NCR(psw)                       (((psw) >> 8) & 0x1f)
+#define SDMA_PSW_NCP(psw)                       (((psw) >> 13) & 0x7)
+
+/* Takes all triggers away from the channel, called with common.lock held.
+ * A running script still finishes its current BD (see sdma_wait_channel_stopped) */
+static void sdma_disable_channel(uint8_t channel_id)
+{
+	unsigned i;
+
+	common.channel[channel_id].active = 0;
+	common.active_mask &= ~(1 << channel_id);
+
+	/* No more event or host triggers, priority 0 keeps the scheduler away from it */
+	for (i = 0; i < NUM_OF_SDMA_REQUESTS; i++)
+		common.regs->CHNENBL[i] &= ~(1 << channel_id);
+	sdma_set_channel_priority(channel_id, 0);
+
+	/* Writing 1 clears HE and the pending event */
+	common.regs->STOP_STAT = (1 << channel_id);
+	common.regs->EVTPEND = (1 << channel_id);
+}
+
+/* Waits until the core neither runs the channel nor is about to, so its BDs
+ * and buffers can be released. Sleeps, called without common.lock */
+static int sdma_wait_channel_stopped(uint8_t channel_id)
+{
+	unsigned tries = 100;
+	uint32_t psw;
+
+	while (1) {
+		psw = common.regs->PSW;
+
+		if (!(common.regs->STOP_STAT & (1 << channel_id)) && !(common.regs->EVTPEND & (1 << channel_id)) &&
+				(SDMA_PSW_CCP(psw) == 0 || SDMA_PSW_CCR(psw) != channel_id) &&
+				(SDMA_PSW_NCP(psw) == 0 || SDMA_PSW_NCR(psw) != channel_id))
+			return EOK;
+
+		if (--tries == 0)
+			return -ETIME;
+
+		usleep(1000);
+	}
+}
+
 static int sdma_context_load(uint8_t channel_id, sdma_context_t *context)
 {
 	memcpy(common.tmp, context, sizeof(sdma_context_t));
@@ -282,20 +353,97 @@ static int sdma_context_dump(uint8_t channel_id, sdma_context_t *context)
 	return EOK;
 }
 
-#define OCRAM_BASE              (0x900000)
-#define OCRAM_END               (0x920000)
+/* Best fit over free page runs, keeps large runs for large requests */
+addr_t sdma_ocram_alloc(size_t size, int owner)
+{
+	unsigned n = (size + SIZE_PAGE - 1)/SIZE_PAGE;
+	unsigned i, start, best = 0, best_len = 0;
+
+	if (n == 0)
+		return 0;
+
+	i = 0;
+	while (i < OCRAM_PAGES) {
+		if (common.ocram_owner[i] != OCRAM_PAGE_FREE) {
+			i++;
+			continue;
+		}
+
+		for (start = i; i < OCRAM_PAGES && common.ocram_owner[i] == OCRAM_PAGE_FREE; i++)
+			;
+
+		if (i - start >= n && (best_len == 0 || i - start < best_len)) {
+			best = start;
+			best_len = i - start;
+		}
+	}
+
+	if (best_len == 0)
+		return 0;
+
+	for (i = best; i < best + n; i++)
+		common.ocram_owner[i] = owner;
 
-addr_t sdma_ocram_alloc(size_t size)
+	return OCRAM_BASE + best*SIZE_PAGE;
+}
+
+static int sdma_ocram_free(addr_t paddr, size_t size, int owner)
 {
 	unsigned n = (size + SIZE_PAGE - 1)/SIZE_PAGE;
-	addr_t paddr = 0;
+	unsigned i, first;
+
+	if (paddr < OCRAM_BASE || paddr >= OCRAM_END || (paddr & (SIZE_PAGE - 1)))
+		return -EINVAL;
+
+	first = (paddr - OCRAM_BASE)/SIZE_PAGE;
+	if (n == 0 || first + n > OCRAM_PAGES)
+		return -EINVAL;
+
+	for (i = first; i < first + n; i++) {
+		if (common.ocram_owner[i] != owner)
+			return -EPERM;
+	}
+
+	for (i = first; i < first + n; i++)
+		common.ocram_owner[i] = OCRAM_PAGE_FREE;
+
+	return EOK;
+}
+
+/* Frees all pages owned by the channel, returns number of pages */
+static unsigned sdma_ocram_reclaim(int owner)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < OCRAM_PAGES; i++) {
+		if (common.ocram_owner[i] == owner) {
+			common.ocram_owner[i] = OCRAM_PAGE_FREE;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+static void sdma_ocram_get_stats(sdma_ocram_stats_t *stats)
+{
+	unsigned i, run = 0, free = 0, largest = 0;
+
+	for (i = 0; i < OCRAM_PAGES; i++) {
+		if (common.ocram_owner[i] != OCRAM_PAGE_FREE) {
+			run = 0;
+			continue;
+		}
 
-	if (common.ocram_next + n*SIZE_PAGE <= OCRAM_END) {
-		paddr = common.ocram_next;
-		common.ocram_next += n*SIZE_PAGE;
+		free++;
+		if (++run > largest)
+			largest = run;
 	}
 
-	return paddr;
+	stats->size = OCRAM_PAGES*SIZE_PAGE;
+	stats->used = (OCRAM_PAGES - free)*SIZE_PAGE;
+	stats->largest_free = largest*SIZE_PAGE;
+	stats->fragmentation = free ? (free - largest)*1000/free : 0;
 }
 
 void *sdma_alloc_uncached(size_t size, addr_t *paddr, int ocram)
@@ -306,7 +454,7 @@ void *sdma_alloc_uncached(size_t size, addr_t *paddr, int ocram)
 
 	if (ocram) {
 		oid = OID_PHYSMEM;
-		_paddr = sdma_ocram_alloc(n*SIZE_PAGE);
+		_paddr = sdma_ocram_alloc(n*SIZE_PAGE, 0);
 		if (!_paddr)
 			return NULL;
 	}
@@ -382,6 +530,14 @@ static int sdma_intr(unsigned int intr, void *arg)
 						current->flags |= SDMA_BD_DONE;
 				} while (!((current++)->flags & SDMA_BD_WRAP));
 
+				/* Publish event before the counter, clients read it first */
+				sdma_ring_t *ring = cmn->channel[i].ring;
+				if (ring != NULL) {
+					ring->event[ring->intr_cnt % SDMA_RING_SIZE].bd =
+						(cmn->ccb[i].current_bd - cmn->channel[i].bd_paddr)/sizeof(sdma_buffer_desc_t);
+					ring->intr_cnt++;
+				}
+
 				/* Increase interrupt count to notify dispatcher that interrupt for
 				 * this channel occurred */
 				cmn->channel[i].intr_cnt++;
@@ -536,8 +692,12 @@ static int sdma_set_bd_array(uint8_t channel_id, addr_t paddr, unsigned cnt)
 		return -errno;
 	}
 
+	if (common.channel[channel_id].bd != NULL)
+		munmap(common.channel[channel_id].bd, common.channel[channel_id].bd_size);
+
 	common.channel[channel_id].bd = bd;
 	common.channel[channel_id].bd_paddr = paddr;
+	common.channel[channel_id].bd_size = n*SIZE_PAGE;
 
 	common.ccb[channel_id].base_bd = paddr;
 	common.ccb[channel_id].current_bd = paddr;
@@ -620,47 +780,205 @@ static int dev_init(void)
 	return 0;
 }
 
-static int dev_open(oid_t *oid, int flags)
+static int oid_to_channel(oid_t *oid)
 {
-	return EOK;
+	return oid->id;
 }
 
-static int dev_close(oid_t *oid, int flags)
+static int dev_open(oid_t *oid, int flags)
 {
-	/* TODO: unmap buffer descriptor array and buffers */
+	int channel = oid_to_channel(oid);
+
+	if (channel <= 0 || channel >= NUM_OF_SDMA_CHANNELS)
+		return -EINVAL;
+
+	mutexLock(common.lock);
+	common.channel[channel].open_cnt++;
+	mutexUnlock(common.lock);
 
 	return EOK;
 }
 
-static int oid_to_channel(oid_t *oid)
+/* Answers all reads waiting on the channel with err, called with common.lock held */
+static void dev_cancel(int channel, int err)
 {
-	return oid->id;
+	sdma_channel_t *ch = &common.channel[channel];
+	pending_read_t *pending;
+
+	while ((pending = ch->readers) != NULL) {
+		LIST_REMOVE(&ch->readers, pending);
+
+		pending->msg.o.io.err = err;
+		msgRespond(common.port, &pending->msg, pending->rid);
+
+		LIST_ADD(&common.pending_free, pending);
+	}
 }
 
-static int dev_read(oid_t *oid, void *data, size_t size)
+static int dev_close(oid_t *oid, int flags)
 {
-	int channel = oid_to_channel(oid);
-	unsigned intr_cnt;
+	int channel = oid_to_channel(oid), res;
+	sdma_channel_t *ch;
+	unsigned n;
+
+	if (channel <= 0 || channel >= NUM_OF_SDMA_CHANNELS)
+		return -EINVAL;
+
+	ch = &common.channel[channel];
+
+	mutexLock(common.lock);
+
+	if (ch->open_cnt == 0 || --ch->open_cnt > 0) {
+		mutexUnlock(common.lock);
+		return EOK;
+	}
+
+	/* No interrupt is coming for reads left by the last user */
+	dev_cancel(channel, -EPIPE);
+	sdma_disable_channel(channel);
+
+	mutexUnlock(common.lock);
+
+	/* Script could still access BDs and buffers in pages handed to another
+	 * channel. Waiting can take a while, dispatcher doesn't wait with us. */
+	res = sdma_wait_channel_stopped(channel);
 
 	mutexLock(common.lock);
-	condWait(common.channel[channel].intr_cond, common.lock, 0);
 
-	intr_cnt = common.channel[channel].intr_cnt;
+	if (res < 0) {
+		log_error("channel %d didn't stop, keeping its OCRAM pages", channel);
+	}
+	else if (ch->open_cnt == 0) {
+		/* Not reopened meanwhile, otherwise it all goes to the new user */
+		if (ch->bd != NULL) {
+			munmap(ch->bd, ch->bd_size);
+			ch->bd = NULL;
+			common.ccb[channel].base_bd = 0;
+			common.ccb[channel].current_bd = 0;
+		}
+
+		/* Next user maps a new one, interrupt handler only publishes to active channels */
+		if (ch->ring != NULL) {
+			sdma_free_uncached(ch->ring, sizeof(sdma_ring_t));
+			ch->ring = NULL;
+		}
+
+		if ((n = sdma_ocram_reclaim(channel)) > 0)
+			log_info("reclaimed %u OCRAM pages of channel %d", n, channel);
+	}
 
 	mutexUnlock(common.lock);
 
-	common.channel[channel].read_cnt++;
+	return EOK;
+}
+
+/* Queues read until the next interrupt of the channel, response is sent by
+ * the dispatcher (see dev_respond), so workers never block on reads */
+static int dev_read(msg_t *msg, unsigned rid)
+{
+	int channel = oid_to_channel(&msg->i.io.oid);
+	pending_read_t *pending;
+
+	if (channel <= 0 || channel >= NUM_OF_SDMA_CHANNELS)
+		return -EINVAL;
 
-	if (data != NULL && size == sizeof(unsigned)) {
-		memcpy(data, &intr_cnt, sizeof(unsigned));
-	} else if (data != NULL) {
+	if (msg->o.data != NULL && msg->o.size != sizeof(unsigned)) {
 		log_error("dev_read: invalid size");
 		return -EIO;
 	}
 
+	mutexLock(common.lock);
+
+	if ((pending = common.pending_free) == NULL) {
+		mutexUnlock(common.lock);
+		log_error("dev_read: too many pending reads");
+		return -ENOMEM;
+	}
+
+	LIST_REMOVE(&common.pending_free, pending);
+
+	pending->msg = *msg;
+	pending->rid = rid;
+	LIST_ADD(&common.channel[channel].readers, pending);
+
+	mutexUnlock(common.lock);
+
 	return EOK;
 }
 
+/* Answers all reads waiting on the channel, called with common.lock held */
+static void dev_respond(int channel, unsigned intr_cnt, time_t intr_time)
+{
+	sdma_channel_t *ch = &common.channel[channel];
+	pending_read_t *pending;
+	time_t now, dispatch;
+
+	while ((pending = ch->readers) != NULL) {
+		LIST_REMOVE(&ch->readers, pending);
+
+		if (pending->msg.o.data != NULL)
+			memcpy(pending->msg.o.data, &intr_cnt, sizeof(unsigned));
+
+		pending->msg.o.io.err = EOK;
+		msgRespond(common.port, &pending->msg, pending->rid);
+
+		LIST_ADD(&common.pending_free, pending);
+		ch->read_cnt++;
+
+		gettime(&now, NULL);
+		dispatch = now - intr_time;
+
+		ch->dispatch_sum += dispatch;
+		ch->dispatch_cnt++;
+		if (dispatch > ch->dispatch_max)
+			ch->dispatch_max = dispatch;
+	}
+}
+
+/* Called with common.lock held */
+static int sdma_ring_init(int channel)
+{
+	sdma_channel_t *ch;
+	sdma_ring_t *ring;
+	addr_t paddr;
+
+	if (channel <= 0 || channel >= NUM_OF_SDMA_CHANNELS)
+		return -EINVAL;
+
+	ch = &common.channel[channel];
+	if (ch->ring != NULL)
+		return EOK;
+
+	if ((ring = sdma_alloc_uncached(sizeof(sdma_ring_t), &paddr, 0)) == NULL) {
+		log_error("failed to allocate completion ring for channel %d", channel);
+		return -ENOMEM;
+	}
+
+	memset(ring, 0, sizeof(sdma_ring_t));
+	ring->intr_cnt = ch->intr_cnt;
+	ring->stamped = ch->intr_cnt;
+
+	ch->ring_paddr = paddr;
+	ch->ring = ring;
+
+	return EOK;
+}
+
+/* Sets time of ring events published since last call, called with common.lock held */
+static void sdma_ring_stamp(sdma_ring_t *ring, time_t time)
+{
+	uint32_t n, head = ring->intr_cnt;
+
+	n = ring->stamped;
+	if (head - n > SDMA_RING_SIZE)
+		n = head - SDMA_RING_SIZE;
+
+	for (; n != head; n++)
+		ring->event[n % SDMA_RING_SIZE].time = (uint32_t)time;
+
+	ring->stamped = head;
+}
+
 static int dev_ctl(msg_t *msg)
 {
 	int channel, res;
@@ -719,8 +1037,28 @@ static int dev_ctl(msg_t *msg)
 			sdma_enable_channel(channel);
 			return EOK;
 
+		case sdma_dev_ctl__ring_map:
+			if ((res = sdma_ring_init(channel)) < 0)
+				return res;
+			dev_ctl.ring_paddr = common.channel[channel].ring_paddr;
+			memcpy(msg->o.raw, &dev_ctl, sizeof(sdma_dev_ctl_t));
+			return EOK;
+
 		case sdma_dev_ctl__ocram_alloc:
-			dev_ctl.alloc.paddr = sdma_ocram_alloc(dev_ctl.alloc.size);
+			/* Owner is kept in int8_t, 0 is the driver itself */
+			if (channel <= 0 || channel >= NUM_OF_SDMA_CHANNELS)
+				return -EINVAL;
+			dev_ctl.alloc.paddr = sdma_ocram_alloc(dev_ctl.alloc.size, channel);
+			memcpy(msg->o.raw, &dev_ctl, sizeof(sdma_dev_ctl_t));
+			return EOK;
+
+		case sdma_dev_ctl__ocram_free:
+			if (channel <= 0 || channel >= NUM_OF_SDMA_CHANNELS)
+				return -EINVAL;
+			return sdma_ocram_free(dev_ctl.alloc.paddr, dev_ctl.alloc.size, channel);
+
+		case sdma_dev_ctl__ocram_stats:
+			sdma_ocram_get_stats(&dev_ctl.ocram_stats);
 			memcpy(msg->o.raw, &dev_ctl, sizeof(sdma_dev_ctl_t));
 			return EOK;
 
@@ -753,7 +1091,9 @@ static void worker_thread(void *arg)
 				break;
 
 			case mtRead:
-				msg.o.io.err = dev_read(&msg.i.io.oid, msg.o.data, msg.o.size);
+				/* On success response is deferred until the next interrupt */
+				if ((msg.o.io.err = dev_read(&msg, rid)) == EOK)
+					continue;
 				break;
 
 			case mtWrite:
@@ -774,22 +1114,42 @@ static void worker_thread(void *arg)
 static void stats_thread(void *arg)
 {
 	int i;
-	unsigned intr_cnt, read_cnt, missed_cnt;
+	unsigned intr_cnt, read_cnt, missed_cnt, dispatch_cnt;
+	time_t dispatch_sum, dispatch_max;
+	sdma_ocram_stats_t ocram;
 
 	while (1) {
 
 		sleep(common.stats_period_s);
 
+		mutexLock(common.lock);
+		sdma_ocram_get_stats(&ocram);
+		mutexUnlock(common.lock);
+
+		log_info("ocram: %u/%u KiB used; largest free %u KiB; fragmentation %u%%", ocram.used/1024, ocram.size/1024,
+			ocram.largest_free/1024, ocram.fragmentation/10);
+
 		/* Skip channel 0, since it's only used for configuration */
 		for (i = 1; i < NUM_OF_SDMA_CHANNELS; i++) {
 			if (!common.channel[i].active)
 				continue;
 
+			mutexLock(common.lock);
 			intr_cnt = common.channel[i].intr_cnt;
 			missed_cnt = common.channel[i].missed_intr_cnt;
 			read_cnt = common.channel[i].read_cnt;
+			dispatch_sum = common.channel[i].dispatch_sum;
+			dispatch_max = common.channel[i].dispatch_max;
+			dispatch_cnt = common.channel[i].dispatch_cnt;
+			common.channel[i].dispatch_sum = 0;
+			common.channel[i].dispatch_max = 0;
+			common.channel[i].dispatch_cnt = 0;
+			mutexUnlock(common.lock);
 
-			log_info("ch#%u stats: %u interrupts; %u missed; %u reads", i, intr_cnt, missed_cnt, read_cnt);
+			/* Only the dispatcher's own cost, gettime() can't be called from the interrupt handler.
+			 * Clients can time their own wakeup against the ring event time. */
+			log_info("ch#%u stats: %u interrupts; %u missed; %u reads; dispatch avg %u us, max %u us", i, intr_cnt, missed_cnt, read_cnt,
+				dispatch_cnt ? (unsigned)(dispatch_sum / dispatch_cnt) : 0, (unsigned)dispatch_max);
 		}
 	}
 }
@@ -798,7 +1158,7 @@ static int init(void)
 {
 	int res, i;
 
-	common.ocram_next = OCRAM_BASE;
+	memset(common.ocram_owner, OCRAM_PAGE_FREE, sizeof(common.ocram_owner));
 
 	if (common.use_syslog)
 		openlog("sdma-driver", LOG_NDELAY, LOG_DAEMON);
@@ -817,12 +1177,18 @@ static int init(void)
 		common.channel[i].intr_cnt = 0;
 		common.channel[i].read_cnt = 0;
 		common.channel[i].missed_intr_cnt = 0;
-		if (condCreate(&common.channel[i].intr_cond) != EOK) {
-			log_error("failed to create conditional variable for channel %d", i);
-			return -1;
-		}
+		common.channel[i].readers = NULL;
+		common.channel[i].open_cnt = 0;
+		common.channel[i].ring = NULL;
+		common.channel[i].dispatch_sum = 0;
+		common.channel[i].dispatch_max = 0;
+		common.channel[i].dispatch_cnt = 0;
 	}
 
+	common.pending_free = NULL;
+	for (i = 0; i < NUM_OF_PENDING_READS; i++)
+		LIST_ADD(&common.pending_free, &common.pending[i]);
+
 	if ((res = sdma_init()) < 0) {
 		log_error("SDMA initialization failed (%d [%s])", res, strerror(res));
 		return res;
@@ -1049,6 +1415,7 @@ int main(int argc, char *argv[])
 		return -EIO;
 
 	unsigned i, intr_cnt[NUM_OF_SDMA_CHANNELS], cnt;
+	time_t intr_time;
 	memset(intr_cnt, 0, sizeof(intr_cnt));
 
 	while (1) {
@@ -1072,7 +1439,13 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
+		/* Closest to the interrupt we can get outside of the handler */
+		gettime(&intr_time, NULL);
+
 		for (i = 0; i < NUM_OF_SDMA_CHANNELS; i++) {
+			if (common.channel[i].ring != NULL)
+				sdma_ring_stamp(common.channel[i].ring, intr_time);
+
 			cnt = common.channel[i].intr_cnt;
 
 			if (intr_cnt[i] == cnt) /* No interrupts for this channel */
@@ -1086,7 +1459,7 @@ int main(int argc, char *argv[])
 #endif
 			}
 
-			condSignal(common.channel[i].intr_cond);
+			dev_respond(i, cnt, intr_time);
 			intr_cnt[i] = cnt;
 		}
 
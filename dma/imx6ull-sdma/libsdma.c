@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <sys/msg.h>
 #include <sys/mman.h>
@@ -55,17 +56,23 @@ int sdma_open(sdma_t *s, const char *dev_name)
 	if ((fd = open(dev_name, O_RDWR)) < 0)
 		return -2;
 
-	if ((res = lookup(dev_name, NULL, &s->oid)) < 0)
+	if ((res = lookup(dev_name, NULL, &s->oid)) < 0) {
+		close(fd);
 		return -3;
+	}
+
+	s->fd = fd;
 
 	return 0;
 }
 
 int sdma_close(sdma_t *s)
 {
-	/* TODO: Implement sdma_channel_close */
+	if (s == NULL)
+		return -1;
 
-	return 0;
+	/* Server reclaims OCRAM of the channel on last close */
+	return close(s->fd);
 }
 
 int sdma_channel_configure(sdma_t *s, sdma_channel_config_t *cfg)
@@ -166,6 +173,73 @@ int sdma_wait_for_intr(sdma_t *s, uint32_t *cnt)
 	return 0;
 }
 
+const sdma_ring_t *sdma_ring_map(sdma_t *s)
+{
+	sdma_dev_ctl_t dev_ctl;
+	void *vaddr;
+
+	if (s == NULL)
+		return NULL;
+
+	dev_ctl.oid = s->oid;
+	dev_ctl.type = sdma_dev_ctl__ring_map;
+
+	if (sdma_dev_ctl(s, &dev_ctl, NULL, 0) < 0)
+		return NULL;
+
+	vaddr = mmap(NULL, SIZE_PAGE, PROT_READ, MAP_UNCACHED, OID_PHYSMEM, dev_ctl.ring_paddr);
+	if (vaddr == MAP_FAILED)
+		return NULL;
+
+	return vaddr;
+}
+
+int sdma_ring_unmap(const sdma_ring_t *ring)
+{
+	return munmap((void *)ring, SIZE_PAGE);
+}
+
+int sdma_ring_get(const sdma_ring_t *ring, uint32_t *seq, sdma_ring_event_t *events, unsigned n, unsigned *lost)
+{
+	uint32_t head, first, i;
+	unsigned skipped;
+
+	head = ring->intr_cnt;
+	__asm__ volatile ("dmb" ::: "memory");
+
+	/* Older events are already overwritten, the oldest slot is the one the next interrupt rewrites */
+	first = *seq;
+	if (head - first > SDMA_RING_SIZE - 1)
+		first = head - (SDMA_RING_SIZE - 1);
+
+	if (head - first > n)
+		head = first + n;
+
+	for (i = first; i != head; i++) {
+		events[i - first].bd = ring->event[i % SDMA_RING_SIZE].bd;
+		events[i - first].time = ring->event[i % SDMA_RING_SIZE].time;
+	}
+
+	/* Drop events server could overwrite while they were copied */
+	__asm__ volatile ("dmb" ::: "memory");
+	skipped = first - *seq;
+	i = ring->intr_cnt - (SDMA_RING_SIZE - 1);
+	if ((int32_t)(i - first) > 0) {
+		if ((int32_t)(i - head) > 0)
+			i = head;
+		skipped += i - first;
+		memmove(events, events + (i - first), (head - i) * sizeof(sdma_ring_event_t));
+		first = i;
+	}
+
+	if (lost != NULL)
+		*lost = skipped;
+
+	*seq = head;
+
+	return head - first;
+}
+
 addr_t sdma_ocram_alloc(sdma_t *s, size_t size)
 {
 	int res;
@@ -185,6 +259,41 @@ addr_t sdma_ocram_alloc(sdma_t *s, size_t size)
 }
 
 
+int sdma_ocram_free(sdma_t *s, addr_t paddr, size_t size)
+{
+	sdma_dev_ctl_t dev_ctl;
+
+	if (s == NULL)
+		return -1;
+
+	dev_ctl.oid = s->oid;
+	dev_ctl.type = sdma_dev_ctl__ocram_free;
+	dev_ctl.alloc.paddr = paddr;
+	dev_ctl.alloc.size = size;
+
+	return sdma_dev_ctl(s, &dev_ctl, NULL, 0);
+}
+
+int sdma_ocram_stats(sdma_t *s, sdma_ocram_stats_t *stats)
+{
+	int res;
+	sdma_dev_ctl_t dev_ctl;
+
+	if (s == NULL)
+		return -1;
+
+	dev_ctl.oid = s->oid;
+	dev_ctl.type = sdma_dev_ctl__ocram_stats;
+
+	if ((res = sdma_dev_ctl(s, &dev_ctl, NULL, 0)) < 0)
+		return res;
+
+	*stats = dev_ctl.ocram_stats;
+
+	return 0;
+}
+
+
 void *sdma_alloc_uncached(sdma_t *s, size_t size, addr_t *paddr, int ocram)
 {
 	uint32_t n = (size + SIZE_PAGE - 1)/SIZE_PAGE;
@@ -112,6 +112,28 @@ typedef struct {
 	unsigned priority;
 } sdma_channel_config_t;
 
+/* Completion ring, shared read-only with clients (see sdma_ring_map) */
+#define SDMA_RING_SIZE              (64)
+
+typedef struct {
+	volatile uint32_t bd; /* Index of BD the channel was at when interrupt was handled */
+	volatile uint32_t time; /* Time (in us, lower 32 bits) server noticed the interrupt */
+} sdma_ring_event_t;
+
+typedef struct {
+	volatile uint32_t intr_cnt; /* Interrupts so far, event n is at event[n % SDMA_RING_SIZE] */
+	volatile uint32_t stamped; /* Events below this count have valid time */
+	uint32_t reserved[2];
+	sdma_ring_event_t event[SDMA_RING_SIZE];
+} sdma_ring_t;
+
+typedef struct {
+	uint32_t size; /* OCRAM managed by the driver */
+	uint32_t used;
+	uint32_t largest_free; /* Largest contiguous free block */
+	uint32_t fragmentation; /* Free memory outside of the largest free block (per mille of free memory) */
+} sdma_ocram_stats_t;
+
 typedef enum {
 	sdma_dev_ctl__channel_cfg,
 	sdma_dev_ctl__data_mem_write,
@@ -120,7 +142,10 @@ typedef enum {
 	sdma_dev_ctl__context_set,
 	sdma_dev_ctl__enable,
 	sdma_dev_ctl__trigger,
-	sdma_dev_ctl__ocram_alloc
+	sdma_dev_ctl__ocram_alloc,
+	sdma_dev_ctl__ring_map,
+	sdma_dev_ctl__ocram_free,
+	sdma_dev_ctl__ocram_stats
 } sdma_dev_ctl_type_t;
 
 typedef struct {
@@ -140,6 +165,10 @@ typedef struct {
 			size_t size;
 			addr_t paddr;
 		} alloc;
+
+		addr_t ring_paddr;
+
+		sdma_ocram_stats_t ocram_stats;
 	};
 } sdma_dev_ctl_t;
 
@@ -18,6 +18,7 @@
 
 typedef struct {
 	oid_t oid;
+	int fd;
 } sdma_t;
 
 int sdma_open(sdma_t *s, const char *dev_name);
@@ -37,6 +38,23 @@ int sdma_trigger(sdma_t *s);
 /* cnt - number of interrupts for this channel registered up until this point */
 int sdma_wait_for_intr(sdma_t *s, uint32_t *cnt);
 
+/* OCRAM is allocated in pages and owned by the channel, pages which
+ * weren't freed are reclaimed when the last user closes the channel */
+addr_t sdma_ocram_alloc(sdma_t *s, size_t size);
+int sdma_ocram_free(sdma_t *s, addr_t paddr, size_t size);
+int sdma_ocram_stats(sdma_t *s, sdma_ocram_stats_t *stats);
+
+/* Maps completion ring of the channel, interrupts can be then counted
+ * without sending a message per interrupt */
+const sdma_ring_t *sdma_ring_map(sdma_t *s);
+int sdma_ring_unmap(const sdma_ring_t *ring);
+
+/* Copies up to n events newer than *seq and advances *seq, events
+ * overwritten before they were copied are counted in lost (if not NULL).
+ * At most SDMA_RING_SIZE - 1 events back can be copied, the oldest slot
+ * could be rewritten by the next interrupt. Returns number of copied events. */
+int sdma_ring_get(const sdma_ring_t *ring, uint32_t *seq, sdma_ring_event_t *events, unsigned n, unsigned *lost);
+
 void *sdma_alloc_uncached(sdma_t *s, size_t size, addr_t *paddr, int ocram);
 int sdma_free_uncached(void *vaddr, size_t size);
 
@@ -0,0 +1,20 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - ARM specifics
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+/* x86 keeps stores and loads in order, barriers only have to stop the compiler */
+__asm__ (".macro dmb\n.endm");
+
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - platform control definitions stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_PHOENIX_ARCH_IMX6ULL_H_
+#define _HOST_PHOENIX_ARCH_IMX6ULL_H_
+
+
+enum { pctl_set = 0, pctl_get };
+
+
+enum { pctl_devclock = 0 };
+
+
+enum { pctl_clk_sdma = 0 };
+
+
+typedef struct {
+	int action;
+	int type;
+
+	union {
+		struct {
+			int dev;
+			unsigned int state;
+		} devclock;
+	};
+} platformctl_t;
+
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - posix utilities stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_POSIX_UTILS_H_
+#define _HOST_POSIX_UTILS_H_
+
+/* va_list comes in through libphoenix headers, the driver relies on it */
+#include <stdarg.h>
+#include <sys/msg.h>
+
+
+static inline int create_dev(oid_t *oid, const char *path)
+{
+	return EOK;
+}
+
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - memory management stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MMAN_H_
+#define _HOST_SYS_MMAN_H_
+
+#include_next <sys/mman.h>
+#include <stdint.h>
+
+
+#define SIZE_PAGE 4096
+
+#define MAP_UNCACHED 0
+#define MAP_DEVICE   0
+#define OID_NULL     NULL
+#define OID_PHYSMEM  NULL
+
+
+/* Physical addresses are 32-bit as on the target */
+typedef uint32_t addr_t;
+
+
+/* Anonymous memory only, Phoenix passes an oid instead of a descriptor */
+#define mmap(vaddr, size, prot, flags, oid, offs) \
+	mmap((vaddr), (size), (prot), (flags) | MAP_PRIVATE | MAP_ANONYMOUS, ((void)(oid), (void)(offs), -1), 0)
+
+
+/* Lower half of the virtual address, only handed to the registers stand-in */
+static inline addr_t va2pa(void *va)
+{
+	return (addr_t)(uintptr_t)va;
+}
+
+
+#endif
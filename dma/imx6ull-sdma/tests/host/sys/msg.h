@@ -0,0 +1,93 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - messages stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MSG_H_
+#define _HOST_SYS_MSG_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+
+typedef struct {
+	uint32_t port;
+	id_t id;
+} oid_t;
+
+
+enum { mtRead, mtWrite, mtOpen, mtClose, mtDevCtl };
+
+
+typedef struct {
+	int type;
+
+	struct {
+		struct {
+			oid_t oid;
+		} io;
+
+		struct {
+			oid_t oid;
+			int flags;
+		} openclose;
+
+		void *data;
+		size_t size;
+	} i;
+
+	struct {
+		struct {
+			int err;
+		} io;
+
+		void *data;
+		size_t size;
+		unsigned char raw[64];
+	} o;
+} msg_t;
+
+
+/* No server runs in tests, the driver is called directly */
+static inline int portCreate(uint32_t *port)
+{
+	*port = 1;
+	return EOK;
+}
+
+
+static inline int msgSend(uint32_t port, msg_t *m)
+{
+	return -ENOSYS;
+}
+
+
+static inline int msgRecv(uint32_t port, msg_t *m, unsigned int *rid)
+{
+	return -ENOSYS;
+}
+
+
+static inline int msgRespond(uint32_t port, msg_t *m, unsigned int rid)
+{
+	return EOK;
+}
+
+
+static inline int lookup(const char *name, oid_t *file, oid_t *dev)
+{
+	return -ENOENT;
+}
+
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - threads stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_THREADS_H_
+#define _HOST_SYS_THREADS_H_
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+
+typedef unsigned int handle_t;
+
+
+/* Tests call the driver from a single thread, the lock only tracks whether it's held */
+static int host_locked __attribute__((unused));
+
+
+static inline int mutexCreate(handle_t *h)
+{
+	*h = 0;
+	return EOK;
+}
+
+
+static inline int mutexLock(handle_t h)
+{
+	host_locked++;
+	return EOK;
+}
+
+
+static inline int mutexUnlock(handle_t h)
+{
+	host_locked--;
+	return EOK;
+}
+
+
+static inline int condCreate(handle_t *h)
+{
+	*h = 0;
+	return EOK;
+}
+
+
+static inline int condSignal(handle_t h)
+{
+	return EOK;
+}
+
+
+/* Nothing signals in a single thread */
+static inline int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	return -ETIME;
+}
+
+
+static inline int beginthread(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg)
+{
+	return EOK;
+}
+
+
+static inline int priority(int priority)
+{
+	return EOK;
+}
+
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests - time stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_TIME_H_
+#define _HOST_SYS_TIME_H_
+
+#include_next <sys/time.h>
+#include <stddef.h>
+#include <time.h>
+
+
+/* Monotonic time in us */
+static inline int gettime(time_t *raw, time_t *offs)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	*raw = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	if (offs != NULL)
+		*offs = 0;
+
+	return 0;
+}
+
+
+#endif
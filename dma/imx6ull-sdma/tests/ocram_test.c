@@ -0,0 +1,306 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA OCRAM allocator and channel close host tests
+ *
+ * Runs the driver over anonymous memory in place of OCRAM and the SDMA
+ * registers. Checks best fit placement, ownership, stats and channel
+ * range checks of the OCRAM devctls, and that the last close releases
+ * the pages of a channel only once the core has left it, without
+ * holding the driver lock while it waits.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+
+#define main sdma_main
+#include "../imx6ull-sdma.c"
+#undef main
+
+#include "test.h"
+
+
+#define TEST_CHANNEL 5
+
+#define PAGE(n) (OCRAM_BASE + (n)*SIZE_PAGE)
+
+
+int test_failed;
+
+
+static struct {
+	int busy;           /* usleeps until the core leaves the channel */
+	int reopen;         /* dev_open() from another client during the next usleep */
+	unsigned usleeps;
+	unsigned locked;    /* usleeps with common.lock held */
+} model;
+
+
+/* Time passes only while the driver waits. STOP_STAT and EVTPEND are write 1
+ * to clear, the memory standing in for them keeps the bits until then. */
+int usleep(useconds_t us)
+{
+	oid_t oid = { 1, TEST_CHANNEL };
+
+	model.usleeps++;
+	model.locked += (host_locked != 0);
+
+	common.regs->STOP_STAT = 0;
+	common.regs->EVTPEND = 0;
+
+	if (model.busy > 0 && --model.busy == 0)
+		common.regs->PSW = 0;
+
+	if (model.reopen) {
+		model.reopen = 0;
+		dev_open(&oid, 0);
+	}
+
+	return 0;
+}
+
+
+static unsigned test_owned(int owner)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < OCRAM_PAGES; i++)
+		n += (common.ocram_owner[i] == owner);
+
+	return n;
+}
+
+
+static int test_devctl(int channel, sdma_dev_ctl_type_t type, size_t size, addr_t *paddr)
+{
+	sdma_dev_ctl_t ctl;
+	msg_t msg;
+	int res;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.type = type;
+	ctl.oid.port = 1;
+	ctl.oid.id = channel;
+	ctl.alloc.size = size;
+	ctl.alloc.paddr = (paddr != NULL) ? *paddr : 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = mtDevCtl;
+	memcpy(msg.o.raw, &ctl, sizeof(ctl));
+
+	mutexLock(common.lock);
+	res = dev_ctl(&msg);
+	mutexUnlock(common.lock);
+
+	memcpy(&ctl, msg.o.raw, sizeof(ctl));
+	if (paddr != NULL)
+		*paddr = (type == sdma_dev_ctl__ring_map) ? ctl.ring_paddr : ctl.alloc.paddr;
+
+	return res;
+}
+
+
+static int test_alloc(void)
+{
+	sdma_ocram_stats_t stats;
+	addr_t a, b, c, d;
+
+	/* Channel control blocks of the driver take the first page */
+	TEST_CHECK(common.ocram_owner[0] == 0 && test_owned(OCRAM_PAGE_FREE) == OCRAM_PAGES - 1);
+
+	TEST_CHECK((a = sdma_ocram_alloc(2*SIZE_PAGE, 1)) == PAGE(1));
+	TEST_CHECK((b = sdma_ocram_alloc(3*SIZE_PAGE - 100, 1)) == PAGE(3));
+	TEST_CHECK((c = sdma_ocram_alloc(1, 2)) == PAGE(6));
+	TEST_CHECK((d = sdma_ocram_alloc(5*SIZE_PAGE, 1)) == PAGE(7));
+	TEST_CHECK(sdma_ocram_alloc(0, 1) == 0);
+	TEST_CHECK(sdma_ocram_alloc(OCRAM_PAGES*SIZE_PAGE, 1) == 0);
+
+	/* Only the owner frees, whole pages inside OCRAM */
+	TEST_CHECK(sdma_ocram_free(c, SIZE_PAGE, 1) == -EPERM);
+	TEST_CHECK(sdma_ocram_free(b + 100, SIZE_PAGE, 1) == -EINVAL);
+	TEST_CHECK(sdma_ocram_free(b, 0, 1) == -EINVAL);
+	TEST_CHECK(sdma_ocram_free(PAGE(OCRAM_PAGES - 1), 2*SIZE_PAGE, 1) == -EINVAL);
+	TEST_CHECK(sdma_ocram_free(OCRAM_END, SIZE_PAGE, 1) == -EINVAL);
+	TEST_CHECK(sdma_ocram_free(b, 3*SIZE_PAGE, 1) == EOK);
+	TEST_CHECK(sdma_ocram_free(b, 3*SIZE_PAGE, 1) == -EPERM);
+
+	/* Best fit goes to the 3 page hole, not to the 20 pages at the end */
+	TEST_CHECK(sdma_ocram_alloc(2*SIZE_PAGE, 3) == PAGE(3));
+	TEST_CHECK(sdma_ocram_alloc(4*SIZE_PAGE, 3) == PAGE(12));
+	TEST_CHECK(sdma_ocram_alloc(SIZE_PAGE, 3) == PAGE(5));
+
+	/* Free pages 16..31, none left in between */
+	sdma_ocram_get_stats(&stats);
+	TEST_CHECK(stats.size == OCRAM_PAGES*SIZE_PAGE);
+	TEST_CHECK(stats.used == 16*SIZE_PAGE && stats.largest_free == 16*SIZE_PAGE && stats.fragmentation == 0);
+
+	/* 2 + 16 free pages */
+	TEST_CHECK(sdma_ocram_free(a, 2*SIZE_PAGE, 1) == EOK);
+	sdma_ocram_get_stats(&stats);
+	TEST_CHECK(stats.used == 14*SIZE_PAGE && stats.largest_free == 16*SIZE_PAGE && stats.fragmentation == 2*1000/18);
+
+	TEST_CHECK(sdma_ocram_reclaim(1) == 5 && sdma_ocram_reclaim(2) == 1 && sdma_ocram_reclaim(3) == 7);
+	TEST_CHECK(sdma_ocram_reclaim(1) == 0);
+	TEST_CHECK(test_owned(OCRAM_PAGE_FREE) == OCRAM_PAGES - 1);
+
+	(void)d;
+
+	return 0;
+}
+
+
+/* Owner is an int8_t, channels out of range must not become owners */
+static int test_range(void)
+{
+	addr_t paddr;
+
+	TEST_CHECK(test_devctl(200, sdma_dev_ctl__ocram_alloc, SIZE_PAGE, &paddr) == -EINVAL);
+	TEST_CHECK(test_devctl(NUM_OF_SDMA_CHANNELS, sdma_dev_ctl__ocram_alloc, SIZE_PAGE, &paddr) == -EINVAL);
+	TEST_CHECK(test_devctl(0, sdma_dev_ctl__ocram_alloc, SIZE_PAGE, &paddr) == -EINVAL);
+	TEST_CHECK(test_owned(OCRAM_PAGE_FREE) == OCRAM_PAGES - 1);
+
+	/* Driver's own page can't be freed through the channel 0 */
+	paddr = PAGE(0);
+	TEST_CHECK(test_devctl(0, sdma_dev_ctl__ocram_free, SIZE_PAGE, &paddr) == -EINVAL);
+	TEST_CHECK(common.ocram_owner[0] == 0);
+
+	TEST_CHECK(test_devctl(200, sdma_dev_ctl__ring_map, 0, &paddr) == -EINVAL);
+	TEST_CHECK(test_devctl(0, sdma_dev_ctl__ring_map, 0, &paddr) == -EINVAL);
+
+	TEST_CHECK(test_devctl(TEST_CHANNEL, sdma_dev_ctl__ocram_alloc, SIZE_PAGE, &paddr) == EOK);
+	TEST_CHECK(paddr == PAGE(1) && common.ocram_owner[1] == TEST_CHANNEL);
+	TEST_CHECK(test_devctl(TEST_CHANNEL, sdma_dev_ctl__ocram_free, SIZE_PAGE, &paddr) == EOK);
+	TEST_CHECK(test_owned(OCRAM_PAGE_FREE) == OCRAM_PAGES - 1);
+
+	return 0;
+}
+
+
+/* Opens the channel, gives it pages and a ring, and starts it */
+static int test_start(unsigned opens)
+{
+	oid_t oid = { 1, TEST_CHANNEL };
+	addr_t paddr;
+
+	while (opens-- > 0)
+		TEST_CHECK(dev_open(&oid, 0) == EOK);
+
+	TEST_CHECK(test_devctl(TEST_CHANNEL, sdma_dev_ctl__ocram_alloc, 3*SIZE_PAGE, &paddr) == EOK && paddr != 0);
+	TEST_CHECK(test_devctl(TEST_CHANNEL, sdma_dev_ctl__ring_map, 0, &paddr) == EOK && paddr != 0);
+	TEST_CHECK(test_devctl(TEST_CHANNEL, sdma_dev_ctl__enable, 0, NULL) == EOK);
+	TEST_CHECK(common.channel[TEST_CHANNEL].active && test_owned(TEST_CHANNEL) == 3);
+
+	model.usleeps = 0;
+	model.locked = 0;
+
+	return 0;
+}
+
+
+static int test_close(void)
+{
+	oid_t oid = { 1, TEST_CHANNEL };
+
+	TEST_CHECK(test_start(2) == 0);
+
+	/* Core runs the channel for a while after it's disabled */
+	common.regs->PSW = TEST_CHANNEL | (3 << 5);
+	model.busy = 5;
+
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(model.usleeps == 0 && test_owned(TEST_CHANNEL) == 3);
+
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(!common.channel[TEST_CHANNEL].active && common.channel[TEST_CHANNEL].open_cnt == 0);
+	TEST_CHECK(model.busy == 0 && model.usleeps == 5 && model.locked == 0);
+	TEST_CHECK(test_owned(TEST_CHANNEL) == 0 && common.channel[TEST_CHANNEL].ring == NULL);
+
+	/* Still the next channel of the scheduler */
+	TEST_CHECK(test_start(1) == 0);
+	common.regs->PSW = (TEST_CHANNEL << 8) | (2 << 13);
+	model.busy = 3;
+
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(model.usleeps == 3 && model.locked == 0 && test_owned(TEST_CHANNEL) == 0);
+
+	/* Idle core still needs the stop to take effect */
+	TEST_CHECK(test_start(1) == 0);
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(model.usleeps == 1 && test_owned(TEST_CHANNEL) == 0);
+
+	/* Another channel running doesn't hold it up */
+	TEST_CHECK(test_start(1) == 0);
+	common.regs->PSW = (TEST_CHANNEL + 1) | (3 << 5) | ((TEST_CHANNEL + 2) << 8) | (3 << 13);
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(model.usleeps == 1 && test_owned(TEST_CHANNEL) == 0);
+	common.regs->PSW = 0;
+
+	return 0;
+}
+
+
+static int test_closeHung(void)
+{
+	oid_t oid = { 1, TEST_CHANNEL };
+
+	/* Pages stay with a channel which doesn't stop */
+	TEST_CHECK(test_start(1) == 0);
+	common.regs->PSW = TEST_CHANNEL | (3 << 5);
+	model.busy = 1000;
+
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(model.usleeps == 99 && model.locked == 0);
+	TEST_CHECK(test_owned(TEST_CHANNEL) == 3 && common.channel[TEST_CHANNEL].ring != NULL);
+
+	/* Released by the next last close once it stops */
+	common.regs->PSW = 0;
+	model.busy = 0;
+	TEST_CHECK(dev_open(&oid, 0) == EOK);
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(test_owned(TEST_CHANNEL) == 0 && common.channel[TEST_CHANNEL].ring == NULL);
+
+	return 0;
+}
+
+
+/* Reopened while the close waits, the new user keeps the channel's pages */
+static int test_closeReopen(void)
+{
+	oid_t oid = { 1, TEST_CHANNEL };
+
+	TEST_CHECK(test_start(1) == 0);
+	common.regs->PSW = TEST_CHANNEL | (3 << 5);
+	model.busy = 2;
+	model.reopen = 1;
+
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(model.reopen == 0 && common.channel[TEST_CHANNEL].open_cnt == 1);
+	TEST_CHECK(test_owned(TEST_CHANNEL) == 3 && common.channel[TEST_CHANNEL].ring != NULL);
+
+	TEST_CHECK(dev_close(&oid, 0) == EOK);
+	TEST_CHECK(test_owned(TEST_CHANNEL) == 0 && common.channel[TEST_CHANNEL].ring == NULL);
+
+	return 0;
+}
+
+
+int main(void)
+{
+	if (init() != 0) {
+		printf("ocram_test: driver init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	TEST_CASE(test_alloc());
+	TEST_CASE(test_range());
+	TEST_CASE(test_close());
+	TEST_CASE(test_closeHung());
+	TEST_CASE(test_closeReopen());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA completion ring host tests
+ *
+ * Runs sdma_ring_get() against a producer publishing events the way
+ * sdma_intr does, first step by step (partial reads, overrun accounting,
+ * counter wrap), then from a thread racing the reader. Every copied event
+ * has to be the one its sequence number says, the rest has to be
+ * reported lost.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "../libsdma.c"
+#include "test.h"
+
+
+#define STRESS_EVENTS (1 << 20)
+#define TEST_TIMEOUT  60
+
+
+int test_failed;
+
+
+static struct {
+	sdma_ring_t ring;
+	sdma_ring_event_t events[2 * SDMA_RING_SIZE];
+
+	volatile uint32_t seq; /* Reader position, paces the producer */
+	volatile int done;
+	volatile int stop;
+} test_common;
+
+
+/* Slot first, counter last, as sdma_intr and the dispatcher stamp do. With
+ * yield the reader gets to run while the slot is half rewritten. */
+static void test_publish(sdma_ring_t *ring, unsigned int n, int yield)
+{
+	uint32_t seq = ring->intr_cnt;
+
+	while (n-- > 0) {
+		ring->event[seq % SDMA_RING_SIZE].bd = seq;
+		if (yield)
+			sched_yield();
+		ring->event[seq % SDMA_RING_SIZE].time = ~seq;
+		if (yield)
+			sched_yield();
+		__asm__ volatile ("dmb" ::: "memory");
+		ring->intr_cnt = ++seq;
+	}
+}
+
+
+static void test_reset(uint32_t cnt)
+{
+	memset(&test_common.ring, 0, sizeof(test_common.ring));
+	test_common.ring.intr_cnt = cnt;
+	test_common.ring.stamped = cnt;
+}
+
+
+/* Events copied by the last sdma_ring_get() have to follow the lost ones */
+static int test_check(uint32_t prev, uint32_t seq, int got, unsigned int lost)
+{
+	int i;
+
+	TEST_CHECK(got >= 0 && seq == prev + lost + got);
+
+	for (i = 0; i < got; i++) {
+		TEST_CHECK(test_common.events[i].bd == prev + lost + i);
+		TEST_CHECK(test_common.events[i].time == ~(prev + lost + i));
+	}
+
+	return 0;
+}
+
+
+static int test_partial(void)
+{
+	uint32_t seq, prev;
+	unsigned int lost;
+	int got;
+
+	test_reset(1000);
+	seq = 1000;
+
+	TEST_CHECK(sdma_ring_get(&test_common.ring, &seq, test_common.events, SDMA_RING_SIZE, &lost) == 0);
+	TEST_CHECK(seq == 1000 && lost == 0);
+
+	test_publish(&test_common.ring, 10, 0);
+
+	prev = seq;
+	got = sdma_ring_get(&test_common.ring, &seq, test_common.events, 4, &lost);
+	TEST_CHECK(got == 4 && lost == 0);
+	TEST_CHECK(test_check(prev, seq, got, lost) == 0);
+
+	prev = seq;
+	got = sdma_ring_get(&test_common.ring, &seq, test_common.events, SDMA_RING_SIZE, NULL);
+	TEST_CHECK(got == 6);
+	TEST_CHECK(test_check(prev, seq, got, 0) == 0);
+
+	TEST_CHECK(sdma_ring_get(&test_common.ring, &seq, test_common.events, SDMA_RING_SIZE, &lost) == 0);
+	TEST_CHECK(seq == 1010 && lost == 0);
+
+	return 0;
+}
+
+
+/* The oldest slot is the one the next interrupt rewrites, a lagging reader gets the newer ones only */
+static int test_overrun(void)
+{
+	uint32_t seq, prev;
+	unsigned int lost;
+	int got;
+
+	test_reset(0);
+	seq = 0;
+
+	test_publish(&test_common.ring, 3 * SDMA_RING_SIZE, 0);
+
+	prev = seq;
+	got = sdma_ring_get(&test_common.ring, &seq, test_common.events, 2 * SDMA_RING_SIZE, &lost);
+	TEST_CHECK(got == SDMA_RING_SIZE - 1 && lost == 2 * SDMA_RING_SIZE + 1);
+	TEST_CHECK(test_check(prev, seq, got, lost) == 0);
+	TEST_CHECK(seq == 3 * SDMA_RING_SIZE);
+
+	/* Lagging by exactly the usable part loses nothing */
+	test_publish(&test_common.ring, SDMA_RING_SIZE - 1, 0);
+
+	prev = seq;
+	got = sdma_ring_get(&test_common.ring, &seq, test_common.events, 2 * SDMA_RING_SIZE, &lost);
+	TEST_CHECK(got == SDMA_RING_SIZE - 1 && lost == 0);
+	TEST_CHECK(test_check(prev, seq, got, lost) == 0);
+
+	return 0;
+}
+
+
+static int test_wrap(void)
+{
+	uint32_t seq, prev;
+	unsigned int lost, total = 0;
+	int got;
+
+	test_reset(0xfffffff0);
+	seq = 0xfffffff0;
+
+	test_publish(&test_common.ring, 40, 0);
+
+	do {
+		prev = seq;
+		got = sdma_ring_get(&test_common.ring, &seq, test_common.events, 7, &lost);
+		TEST_CHECK(lost == 0);
+		TEST_CHECK(test_check(prev, seq, got, lost) == 0);
+		total += got;
+	} while (got > 0);
+
+	TEST_CHECK(total == 40 && seq == 0x18);
+
+	return 0;
+}
+
+
+static void *test_producer(void *arg)
+{
+	unsigned int left = STRESS_EVENTS, n;
+
+	while (left > 0 && !test_common.stop) {
+		n = 1 + rand() % SDMA_RING_SIZE;
+		if (n > left)
+			n = left;
+
+		test_publish(&test_common.ring, n, (rand() % 4) == 0);
+		left -= n;
+
+		/* Mostly lets the reader keep up, overruns it now and then */
+		if ((rand() % 8) != 0) {
+			while (test_common.ring.intr_cnt - test_common.seq > SDMA_RING_SIZE / 2 && !test_common.stop)
+				sched_yield();
+		}
+	}
+
+	test_common.done = 1;
+
+	return NULL;
+}
+
+
+/* Reader copies while the slots are being rewritten */
+static int test_race(void)
+{
+	unsigned long received = 0, lost_total = 0, overruns = 0;
+	uint32_t seq, prev, end;
+	unsigned int lost;
+	pthread_t tid;
+	int got;
+
+	test_reset(0xfff00000);
+	seq = 0xfff00000;
+	test_common.seq = seq;
+	end = seq + STRESS_EVENTS;
+	test_common.done = 0;
+	test_common.stop = 0;
+
+	pthread_create(&tid, NULL, test_producer, NULL);
+
+	while (!test_common.done || seq != test_common.ring.intr_cnt) {
+		prev = seq;
+		got = sdma_ring_get(&test_common.ring, &seq, test_common.events, 1 + rand() % (2 * SDMA_RING_SIZE), &lost);
+		if (test_check(prev, seq, got, lost) != 0) {
+			test_common.stop = 1;
+			pthread_join(tid, NULL);
+			printf("at %u: %d events, %u lost\n", prev, got, lost);
+			return -1;
+		}
+
+		test_common.seq = seq;
+		if (got == 0)
+			sched_yield();
+
+		received += got;
+		lost_total += lost;
+		overruns += (lost != 0);
+	}
+
+	pthread_join(tid, NULL);
+
+	printf("race: %lu events received, %lu lost in %lu overruns\n", received, lost_total, overruns);
+
+	TEST_CHECK(seq == end && received + lost_total == STRESS_EVENTS);
+
+	return 0;
+}
+
+
+static void test_timeout(int sig)
+{
+	printf("ring_test: timed out\n");
+	fflush(stdout);
+	_exit(EXIT_FAILURE);
+}
+
+
+int main(void)
+{
+	srand(1);
+	signal(SIGALRM, test_timeout);
+	alarm(TEST_TIMEOUT);
+
+	TEST_CASE(test_partial());
+	TEST_CASE(test_overrun());
+	TEST_CASE(test_wrap());
+	TEST_CASE(test_race());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL SDMA host tests
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+
+extern int test_failed;
+
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			return -1; \
+		} \
+	} while (0)
+
+
+#define TEST_CASE(test) \
+	do { \
+		int _err = (test); \
+		printf("%-32s -- %s\n", #test, (_err == 0) ? "PASSED" : "FAILED"); \
+		test_failed += (_err != 0); \
+	} while (0)
+
+
+#endif
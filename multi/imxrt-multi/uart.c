@@ -104,6 +104,9 @@ static inline int uart_getTXcount(uart_t *uart)
 static void uart_intrThread(void *arg)
 {
 	uart_t *uart = (uart_t *)arg;
+	unsigned char txbuf[32], rxbuf[32];
+	unsigned int i, n;
+	int txfree;
 
 	for (;;) {
 		/* wait for character or transmit data */
@@ -124,12 +127,20 @@ static void uart_intrThread(void *arg)
 		mutexUnlock(uart->lock);
 
 		/* RX */
-		while (uart_getRXcount(uart))
-			libtty_putchar(&uart->tty_common, *(uart->base + datar), NULL);
+		while ((n = uart_getRXcount(uart)) != 0) {
+			if (n > sizeof(rxbuf))
+				n = sizeof(rxbuf);
+			for (i = 0; i < n; ++i)
+				rxbuf[i] = *(uart->base + datar);
+			libtty_putchars(&uart->tty_common, rxbuf, n, NULL);
+		}
 
 		/* TX */
-		while (libtty_txready(&uart->tty_common) && uart_getTXcount(uart) < uart->txFifoSz)
-			*(uart->base + datar) = libtty_getchar(&uart->tty_common, NULL);
+		while (libtty_txready(&uart->tty_common) && (txfree = uart->txFifoSz - uart_getTXcount(uart)) > 0) {
+			n = libtty_getchars(&uart->tty_common, txbuf, (txfree < (int)sizeof(txbuf)) ? txfree : sizeof(txbuf), NULL);
+			for (i = 0; i < n; ++i)
+				*(uart->base + datar) = txbuf[i];
+		}
 	}
 }
 
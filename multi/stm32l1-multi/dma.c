@@ -0,0 +1,193 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L1 DMA driver
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+
+#include <errno.h>
+#include <stddef.h>
+#include <sys/threads.h>
+#include <sys/interrupt.h>
+#include <sys/platform.h>
+
+#include "common.h"
+#include "rcc.h"
+#include "dma.h"
+
+
+#define DMA_CHANNELS 7
+
+
+enum { isr = 0, ifcr, ccr1, cndtr1, cpar1, cmar1 };
+
+
+/* Channel registers are 5 words apart */
+#define CHAN_REG(reg, chan) ((reg) + 5 * ((chan) - 1))
+
+
+static const struct {
+	unsigned int base;
+	int pctl;
+	int channels;
+	int irq[DMA_CHANNELS];
+} dmainfo[] = {
+	{ 0x40026000, pctl_dma1, 7, { 16 + 11, 16 + 12, 16 + 13, 16 + 14, 16 + 15, 16 + 16, 16 + 17 } },
+	{ 0x40026400, pctl_dma2, 5, { 16 + 50, 16 + 51, 16 + 52, 16 + 53, 16 + 54 } }
+};
+
+
+struct {
+	volatile unsigned int *base;
+
+	volatile unsigned int events[DMA_CHANNELS];
+	volatile unsigned int errors[DMA_CHANNELS];
+	unsigned int dummy[DMA_CHANNELS];
+	int registered[DMA_CHANNELS];
+	handle_t inth[DMA_CHANNELS];
+} dma_common[2];
+
+
+static int dma_irqHandler(unsigned int n, void *arg)
+{
+	int dma = (int)arg / DMA_CHANNELS, chan = (int)arg % DMA_CHANNELS;
+	volatile unsigned int *base = dma_common[dma].base;
+	unsigned int flags = (*(base + isr) >> (4 * chan)) & 0xf;
+
+	*(base + ifcr) = flags << (4 * chan);
+
+	/* Half transfer */
+	if (flags & (1 << 2))
+		dma_common[dma].events[chan]++;
+
+	/* Transfer complete */
+	if (flags & (1 << 1))
+		dma_common[dma].events[chan]++;
+
+	if (flags & (1 << 3))
+		dma_common[dma].errors[chan]++;
+
+	return 1;
+}
+
+
+static int dma_valid(int dma, int chan)
+{
+	return (dma == dma1 || dma == dma2) && chan >= 1 && chan <= dmainfo[dma].channels;
+}
+
+
+int dma_configure(int dma, int chan, int dir, int mode, int priority, volatile void *paddr, int size, handle_t cond)
+{
+	volatile unsigned int *base;
+	unsigned int t, sz;
+
+	if (!dma_valid(dma, chan))
+		return -EINVAL;
+
+	switch (size) {
+		case 1: sz = 0; break;
+		case 2: sz = 1; break;
+		case 4: sz = 2; break;
+		default: return -EINVAL;
+	}
+
+	base = dma_common[dma].base;
+
+	*(base + CHAN_REG(ccr1, chan)) &= ~1;
+	dataBarier();
+
+	/* Memory increment, same item size on both sides, all interrupts */
+	t = (1 << 7) | (sz << 10) | (sz << 8) | ((priority & 0x3) << 12) | (1 << 3) | (1 << 1);
+
+	if (dir == dma_mem2per)
+		t |= 1 << 4;
+
+	if (mode == dma_circular)
+		t |= (1 << 5) | (1 << 2);
+
+	*(base + CHAN_REG(ccr1, chan)) = t;
+	*(base + CHAN_REG(cpar1, chan)) = (unsigned int)paddr;
+
+	dma_common[dma].events[chan - 1] = 0;
+	dma_common[dma].errors[chan - 1] = 0;
+
+	if (!dma_common[dma].registered[chan - 1]) {
+		interrupt(dmainfo[dma].irq[chan - 1], dma_irqHandler, (void *)(dma * DMA_CHANNELS + chan - 1), cond, &dma_common[dma].inth[chan - 1]);
+		dma_common[dma].registered[chan - 1] = 1;
+	}
+
+	return EOK;
+}
+
+
+void dma_start(int dma, int chan, volatile void *maddr, unsigned short count)
+{
+	volatile unsigned int *base = dma_common[dma].base;
+
+	*(base + CHAN_REG(ccr1, chan)) &= ~1;
+	dataBarier();
+
+	/* No buffer - transfer from/to a dummy word without memory increment */
+	if (maddr == NULL) {
+		dma_common[dma].dummy[chan - 1] = 0;
+		maddr = &dma_common[dma].dummy[chan - 1];
+		*(base + CHAN_REG(ccr1, chan)) &= ~(1 << 7);
+	}
+	else {
+		*(base + CHAN_REG(ccr1, chan)) |= 1 << 7;
+	}
+
+	*(base + ifcr) = 0xf << (4 * (chan - 1));
+	*(base + CHAN_REG(cmar1, chan)) = (unsigned int)maddr;
+	*(base + CHAN_REG(cndtr1, chan)) = count;
+	dataBarier();
+
+	*(base + CHAN_REG(ccr1, chan)) |= 1;
+}
+
+
+void dma_stop(int dma, int chan)
+{
+	*(dma_common[dma].base + CHAN_REG(ccr1, chan)) &= ~1;
+	dataBarier();
+}
+
+
+unsigned int dma_events(int dma, int chan)
+{
+	return dma_common[dma].events[chan - 1];
+}
+
+
+unsigned int dma_errors(int dma, int chan)
+{
+	return dma_common[dma].errors[chan - 1];
+}
+
+
+unsigned short dma_remaining(int dma, int chan)
+{
+	return *(dma_common[dma].base + CHAN_REG(cndtr1, chan));
+}
+
+
+void dma_init(void)
+{
+	int i, j;
+
+	for (i = dma1; i <= dma2; ++i) {
+		dma_common[i].base = (void *)dmainfo[i].base;
+
+		for (j = 0; j < DMA_CHANNELS; ++j)
+			dma_common[i].registered[j] = 0;
+
+		rcc_devClk(dmainfo[i].pctl, 1);
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L1 DMA driver
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _DMA_H_
+#define _DMA_H_
+
+#include <sys/threads.h>
+
+
+enum { dma1 = 0, dma2 };
+
+
+enum { dma_per2mem = 0, dma_mem2per };
+
+
+enum { dma_normal = 0, dma_circular };
+
+
+/* chan is 1..7 (1..5 on DMA2), size is peripheral and memory item size in bytes.
+ * cond is signalled on every half (circular mode) and full transfer, it's bound to the channel
+ * by the first call. */
+int dma_configure(int dma, int chan, int dir, int mode, int priority, volatile void *paddr, int size, handle_t cond);
+
+
+/* maddr NULL transfers zeros (mem2per) or discards data (per2mem) */
+void dma_start(int dma, int chan, volatile void *maddr, unsigned short count);
+
+
+void dma_stop(int dma, int chan);
+
+
+/* Number of half and full transfers completed since configuration */
+unsigned int dma_events(int dma, int chan);
+
+
+unsigned int dma_errors(int dma, int chan);
+
+
+unsigned short dma_remaining(int dma, int chan);
+
+
+void dma_init(void);
+
+
+#endif
@@ -15,6 +15,8 @@
 #ifndef _SPI_H_
 #define _SPI_H_
 
+#include "stm32-multi.h"
+
 
 enum { spi_read = 0, spi_write, spi_readwrite };
 
@@ -23,6 +25,11 @@ int spi_transaction(int spi, int dir, unsigned char cmd, unsigned int addr, unsi
 	unsigned char *ibuff, unsigned char *obuff, size_t bufflen);
 
 
+/* Runs segments back to back, returns number of bytes clocked */
+int spi_xferList(int spi, const spiseg_t *seg, unsigned int count, unsigned char *ibuff, size_t isize,
+	const unsigned char *obuff, size_t osize);
+
+
 int spi_configure(int spi, char mode, char bdiv, int enable);
 
 
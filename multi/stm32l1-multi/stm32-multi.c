@@ -31,6 +31,7 @@
 #include "rcc.h"
 #include "rtc.h"
 #include "uart.h"
+#include "dma.h"
 #include "spi.h"
 #include "exti.h"
 
@@ -113,6 +114,11 @@ static void handleMsg(msg_t *msg)
 			err = spi_configure(imsg->spi_def.spi, imsg->spi_def.mode, imsg->spi_def.bdiv, imsg->spi_def.enable);
 			break;
 
+		case spi_xfer:
+			err = spi_xferList(imsg->spi_xfer.spi, imsg->spi_xfer.seg, imsg->spi_xfer.count,
+				msg->o.data, msg->o.size, msg->i.data, msg->i.size);
+			break;
+
 		case exti_def:
 			err = exti_configure(imsg->exti_def.line, imsg->exti_def.mode, imsg->exti_def.edge);
 			break;
@@ -215,6 +221,7 @@ int main(void)
 	adc_init();
 	i2c_init();
 	flash_init();
+	dma_init();
 	spi_init();
 	exti_init();
 
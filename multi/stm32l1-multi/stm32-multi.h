@@ -19,7 +19,7 @@
 
 enum { adc_get = 0, rtc_setcal, rtc_get, rtc_set, lcd_get, lcd_set, i2c_get,
 	i2c_set, gpio_def, gpio_get, gpio_set, uart_def, uart_get, uart_set,
-	flash_get, flash_set, spi_get, spi_set, spi_rw, spi_def, exti_def, exti_map };
+	flash_get, flash_set, spi_get, spi_set, spi_rw, spi_def, exti_def, exti_map, spi_xfer };
 
 /* RTC */
 
@@ -181,6 +181,26 @@ typedef struct {
 } __attribute__((packed)) spidef_t;
 
 
+#define SPI_XFER_SEGMENTS 8
+
+
+/* Segment data is taken from i.data (spixfer_out) and/or stored in o.data (spixfer_in) */
+enum { spixfer_in = 0x1, spixfer_out = 0x2 };
+
+
+typedef struct {
+	unsigned short len;
+	unsigned char flags;
+} __attribute__((packed)) spiseg_t;
+
+
+typedef struct {
+	int spi;
+	unsigned int count;
+	spiseg_t seg[SPI_XFER_SEGMENTS];
+} __attribute__((packed)) spixfer_t;
+
+
 /* EXTI */
 
 
@@ -223,6 +243,7 @@ typedef struct {
 		gpioset_t gpio_set;
 		spirw_t spi_rw;
 		spidef_t spi_def;
+		spixfer_t spi_xfer;
 		extidef_t exti_def;
 		extimap_t exti_map;
 		unsigned int flash_addr;
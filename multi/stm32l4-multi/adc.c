@@ -13,12 +13,15 @@
 
 
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/threads.h>
 #include <sys/platform.h>
 #include <sys/pwman.h>
+#include <sys/time.h>
 
 #include "common.h"
+#include "dma.h"
 #include "rcc.h"
 #include "stm32-multi.h"
 
@@ -31,6 +34,27 @@ enum { isr = 0, ier, cr, cfgr, cfgr2, smpr1, smpr2, tr1 = smpr2 + 2, tr2, tr3, s
 enum { common_csr = common_offs, common_ccr = common_csr + 2, common_cdr };
 
 
+/* ADC_CCR internal channel enables */
+#define ADC_CCR_VREFEN (1 << 22)
+#define ADC_CCR_TSEN (1 << 23)
+
+
+/* Internal channels of ADC1 */
+enum { adc_chVref = 0, adc_chTemp = 17 };
+
+
+#define ADC_SCAN_DEPTH 32       /* Scans in DMA circular buffer, a half is processed at once */
+#define ADC_SCAN_MAXCONV 16     /* Regular sequence length, vref and temperature included */
+#define ADC_STREAM_LEN 64       /* Samples kept for stream readers */
+#define ADC_CONV_US 33          /* 640.5 + 12.5 cycles at 20 MHz, initial scan period estimate */
+#define ADC_DELAY_US 5          /* adc_delay() per us */
+#define ADC_TSTART_US 120       /* Temperature sensor startup, vref buffer takes 12 us of ADC wakeup */
+
+#define ADC_VREF_DRIFT 32       /* Recalibrate when VDDA changes by more than 1/32 */
+#define ADC_TEMP_DRIFT 35       /* Recalibrate when temperature sensor changes by ~10 C */
+#define ADC_TEMP_CHECK 64       /* Single conversions between temperature checks */
+
+
 //static const unsigned short * const ts_cal1 = (void *)0x1fff75a8;
 //static const unsigned short * const ts_cal2 = (void *)0x1fff75ca;
 static const unsigned short * const vrefint = (void *)0x1fff75aa;
@@ -40,7 +64,41 @@ struct {
 	volatile unsigned int *base;
 	unsigned int calibration[3];
 
+	/* Calibration is redone only on drift, these hold the first
+	 * vref and temperature readings after it (0 - not taken yet) */
+	unsigned int recalibrate;
+	unsigned short vrefCal;
+	unsigned short tempCal;
+	unsigned int conversions;
+
 	handle_t lock[3];
+
+	/* ADC1 continuous scan into DMA circular buffer, guarded by lock[adc1] */
+	struct {
+		int active;
+		unsigned int chanmask;
+		int n;
+		unsigned char chans[ADC_SCAN_MAXCONV];
+
+		unsigned int start;
+		unsigned int done;
+		time_t last;
+		time_t period;
+
+		unsigned short vref;
+		unsigned short temp;
+		unsigned short latest[ADC_SCAN_CHANNELS + 1];
+
+		unsigned int head;
+		adcsample_t samples[ADC_STREAM_LEN];
+
+		volatile unsigned short buff[ADC_SCAN_DEPTH * ADC_SCAN_MAXCONV];
+
+		handle_t dmacond;
+		handle_t cond;
+	} scan;
+
+	char stack[1024] __attribute__ ((aligned(8)));
 } adc_common;
 
 
@@ -68,7 +126,6 @@ static void adc_wakeup(int adc)
 {
 	volatile unsigned int *base = adc_common.base + adc_getOffs(adc);
 
-	mutexLock(adc_common.lock[adc]);
 	keepidle(1);
 
 	/* Exit deep power down */
@@ -102,24 +159,19 @@ static void adc_disable(int adc)
 	dataBarier();
 
 	keepidle(0);
-	mutexUnlock(adc_common.lock[adc]);
 }
 
 
 static void adc_calibration(int adc)
 {
 	volatile unsigned int *base = adc_common.base + adc_getOffs(adc);
-	useconds_t sleep = 1 * 1000;
 
 	*(base + cr) &= ~(1 << 30);
 	*(base + cr) |= 1 << 31;
 
-	/* No intterupt for calibration done. Have to wait manually... */
-	while (*(base + cr) & (1 << 31)) {
-		usleep(sleep);
-		if (sleep < 200 * 1000)
-			sleep *= 2;
-	}
+	/* No intterupt for calibration done, but it takes only ~116 ADC cycles (~6 us) */
+	while (*(base + cr) & (1 << 31))
+		adc_delay(2 * ADC_DELAY_US);
 
 	adc_common.calibration[adc] = *(base + calfact);
 }
@@ -167,34 +219,342 @@ static void adc_enable(int adc)
 }
 
 
-unsigned short adc_conversion(int adc, char chan)
+/* Powers internal channels only while they are sampled, called with all ADCs disabled */
+static void adc_sensors(unsigned int ccr)
 {
-	unsigned short vref, val;
-	unsigned int out;
+	volatile unsigned int *base = adc_common.base + common_ccr;
+
+	*base = (*base & ~(ADC_CCR_VREFEN | ADC_CCR_TSEN)) | ccr;
+	dataBarier();
 
+	if (ccr & ADC_CCR_TSEN)
+		adc_delay(ADC_TSTART_US * ADC_DELAY_US);
+}
+
+
+/* Wakes up ADC and enables it, calibrating first if drift was detected */
+static void adc_prepare(int adc)
+{
 	adc_wakeup(adc);
-	adc_calibration(adc);
-	adc_enable(adc);
 
-	if (adc != adc1) {
-		adc_wakeup(adc1);
-		adc_calibration(adc1);
-		adc_enable(adc1);
+	if (adc_common.recalibrate & (1 << adc)) {
+		adc_calibration(adc);
+		adc_common.recalibrate &= ~(1 << adc);
 	}
 
-	chan &= 0x1f;
+	adc_enable(adc);
+}
 
-	vref = adc_probeChannel(adc1, 0);
-	val = adc_probeChannel(adc, chan);
+
+static unsigned short adc_toMv(unsigned short vref, unsigned short val)
+{
+	unsigned int out;
+
+	if (vref == 0)
+		return 0;
 
 	out = (3000 * (*vrefint)) / vref;
-	out = (out * val) / ((1 << 12) - 1);
 
-	adc_disable(adc);
+	return (out * val) / ((1 << 12) - 1);
+}
+
+
+static int adc_drift(unsigned short val, unsigned short ref, unsigned short limit)
+{
+	return ((val > ref) ? val - ref : ref - val) > limit;
+}
+
+
+/* temp is 0 if it wasn't measured */
+static void adc_checkDrift(unsigned short vref, unsigned short temp)
+{
+	if (adc_common.vrefCal == 0)
+		adc_common.vrefCal = vref;
+
+	if (adc_common.tempCal == 0)
+		adc_common.tempCal = temp;
+
+	if (adc_drift(vref, adc_common.vrefCal, adc_common.vrefCal / ADC_VREF_DRIFT) ||
+			(temp != 0 && adc_drift(temp, adc_common.tempCal, ADC_TEMP_DRIFT))) {
+		adc_common.recalibrate = (1 << adc1) | (1 << adc2) | (1 << adc3);
+		adc_common.vrefCal = 0;
+		adc_common.tempCal = 0;
+	}
+}
+
+
+static void adc_scanStop(void)
+{
+	volatile unsigned int *base = adc_common.base + adc1_offs;
+
+	if (!adc_common.scan.active)
+		return;
+
+	*(base + cr) |= 1 << 4;
+	dataBarier();
+
+	/* Ongoing conversion is finished first */
+	while (*(base + cr) & (1 << 2))
+		adc_delay(ADC_CONV_US * ADC_DELAY_US / 4);
+
+	dma_stop(dma1, 1);
+
+	*(base + cfgr) &= ~((1 << 13) | (1 << 1) | 1);
+
+	adc_disable(adc1);
+	adc_sensors(0);
+
+	adc_common.scan.active = 0;
+	condBroadcast(adc_common.scan.cond);
+}
+
+
+static void adc_scanStart(void)
+{
+	volatile unsigned int *base = adc_common.base + adc1_offs;
+	unsigned int sqr[4] = { 0 };
+	unsigned char seq[ADC_SCAN_MAXCONV];
+	int i, n = adc_common.scan.n;
+
+	seq[0] = adc_chVref;
+	seq[1] = adc_chTemp;
+	memcpy(seq + 2, adc_common.scan.chans, n - 2);
+
+	/* Sequence positions 1..16 go to SQR1..SQR4, 5 per register (SQR1 starts with length) */
+	sqr[0] = n - 1;
+	for (i = 0; i < n; ++i)
+		sqr[(i + 1) / 5] |= (unsigned int)seq[i] << (6 * ((i + 1) % 5));
+
+	adc_sensors(ADC_CCR_VREFEN | ADC_CCR_TSEN);
+	adc_prepare(adc1);
+
+	*(base + sqr1) = sqr[0];
+	*(base + sqr2) = sqr[1];
+	*(base + sqr3) = sqr[2];
+	*(base + sqr4) = sqr[3];
+
+	/* Continuous conversions, DMA in circular mode */
+	*(base + cfgr) |= (1 << 13) | (1 << 1) | 1;
+	*(base + isr) |= 0x7ff;
+
+	dma_start(dma1, 1, adc_common.scan.buff, n * ADC_SCAN_DEPTH);
+
+	adc_common.scan.start = dma_events(dma1, 1);
+	adc_common.scan.done = adc_common.scan.start;
+	adc_common.scan.period = n * ADC_CONV_US;
+	gettime(&adc_common.scan.last, NULL);
+	adc_common.scan.active = 1;
+
+	dataBarier();
+	*(base + cr) |= 1 << 2;
+}
+
+
+/* Converts scans of a finished half of DMA buffer, end is estimated time of the last one */
+static void adc_scanProcess(unsigned int half, time_t end)
+{
+	volatile unsigned short *raw;
+	adcsample_t *sample;
+	unsigned int i, k, first = half * ADC_SCAN_DEPTH / 2;
+	unsigned short val;
+
+	for (i = first; i < first + ADC_SCAN_DEPTH / 2; ++i) {
+		raw = adc_common.scan.buff + i * adc_common.scan.n;
+
+		adc_common.scan.vref = raw[0];
+		adc_common.scan.temp = raw[1];
+
+		sample = &adc_common.scan.samples[adc_common.scan.head % ADC_STREAM_LEN];
+		sample->seq = adc_common.scan.head++;
+		sample->timestamp = end - (first + ADC_SCAN_DEPTH / 2 - 1 - i) * adc_common.scan.period;
+
+		for (k = 0; k < adc_common.scan.n - 2; ++k) {
+			val = adc_toMv(raw[0], raw[2 + k]);
+			sample->valmv[k] = val;
+			adc_common.scan.latest[adc_common.scan.chans[k]] = val;
+		}
+	}
+
+	adc_checkDrift(adc_common.scan.vref, adc_common.scan.temp);
+}
+
+
+static void adc_scanThread(void *arg)
+{
+	unsigned int events;
+	time_t now, period;
+
+	mutexLock(adc_common.lock[adc1]);
+
+	for (;;) {
+		while (!adc_common.scan.active || (events = dma_events(dma1, 1)) == adc_common.scan.done)
+			condWait(adc_common.scan.dmacond, adc_common.lock[adc1], 0);
+
+		gettime(&now, NULL);
+
+		/* Only the last two halves are still intact */
+		if (events - adc_common.scan.done > 2)
+			adc_common.scan.done = events - 2;
+
+		period = (now - adc_common.scan.last) / ((events - adc_common.scan.done) * ADC_SCAN_DEPTH / 2);
+		adc_common.scan.period = (3 * adc_common.scan.period + period) / 4;
+		adc_common.scan.last = now;
+
+		for (; adc_common.scan.done != events; ++adc_common.scan.done) {
+			adc_scanProcess((adc_common.scan.done - adc_common.scan.start) & 1,
+				now - (events - adc_common.scan.done - 1) * (ADC_SCAN_DEPTH / 2) * adc_common.scan.period);
+		}
+
+		condBroadcast(adc_common.scan.cond);
+
+		/* Restart to apply new calibration */
+		if (adc_common.recalibrate & (1 << adc1)) {
+			adc_scanStop();
+			adc_scanStart();
+		}
+	}
+}
+
+
+int adc_scanConfigure(int adc, unsigned int chanmask)
+{
+	int i, n = 2;
+
 	if (adc != adc1)
+		return -EINVAL;
+
+	for (i = 1; i <= ADC_SCAN_CHANNELS; ++i) {
+		if (chanmask & (1 << i))
+			++n;
+	}
+
+	if ((chanmask & ~(((1 << ADC_SCAN_CHANNELS) - 1) << 1)) || n > ADC_SCAN_MAXCONV)
+		return -EINVAL;
+
+	mutexLock(adc_common.lock[adc1]);
+
+	adc_scanStop();
+
+	if (chanmask) {
+		adc_common.scan.chanmask = chanmask;
+		adc_common.scan.n = n;
+
+		for (i = 1, n = 0; i <= ADC_SCAN_CHANNELS; ++i) {
+			if (chanmask & (1 << i))
+				adc_common.scan.chans[n++] = i;
+		}
+
+		adc_scanStart();
+	}
+
+	mutexUnlock(adc_common.lock[adc1]);
+
+	return EOK;
+}
+
+
+int adc_streamRead(unsigned int *seq, adcsample_t *samples, size_t size, unsigned int *lost, unsigned int *chanmask)
+{
+	unsigned int n, first, head;
+
+	if (size < sizeof(adcsample_t))
+		return -EINVAL;
+
+	mutexLock(adc_common.lock[adc1]);
+
+	/* Sequence from before restart of the server */
+	if ((int)(*seq - adc_common.scan.head) > 0)
+		*seq = adc_common.scan.head;
+
+	while (adc_common.scan.active && *seq == adc_common.scan.head)
+		condWait(adc_common.scan.cond, adc_common.lock[adc1], 0);
+
+	if (!adc_common.scan.active) {
+		mutexUnlock(adc_common.lock[adc1]);
+		return -EINVAL;
+	}
+
+	head = adc_common.scan.head;
+	first = *seq;
+
+	if (head - first > ADC_STREAM_LEN)
+		first = head - ADC_STREAM_LEN;
+
+	*lost = first - *seq;
+	*chanmask = adc_common.scan.chanmask;
+
+	n = min(head - first, size / sizeof(adcsample_t));
+
+	for (head = first; head != first + n; ++head)
+		samples[head - first] = adc_common.scan.samples[head % ADC_STREAM_LEN];
+
+	*seq = first + n;
+
+	mutexUnlock(adc_common.lock[adc1]);
+
+	return n;
+}
+
+
+int adc_conversion(int adc, char chan, unsigned short *valmv)
+{
+	unsigned short vref, val, temp = 0;
+	int err = EOK, tcheck = 0;
+
+	if (adc < adc1 || adc > adc3)
+		return -EINVAL;
+
+	chan &= 0x1f;
+
+	mutexLock(adc_common.lock[adc1]);
+
+	if (adc_common.scan.active) {
+		vref = adc_common.scan.vref;
+
+		/* ADC1 is busy with the scan, take its latest sample */
+		if (adc == adc1) {
+			if (chan >= 1 && chan <= ADC_SCAN_CHANNELS && (adc_common.scan.chanmask & (1 << chan)))
+				*valmv = adc_common.scan.latest[(int)chan];
+			else
+				err = -EBUSY;
+
+			mutexUnlock(adc_common.lock[adc1]);
+			return err;
+		}
+	}
+	else {
+		tcheck = (++adc_common.conversions % ADC_TEMP_CHECK == 0);
+
+		adc_sensors(ADC_CCR_VREFEN | (tcheck ? ADC_CCR_TSEN : 0));
+		adc_prepare(adc1);
+		vref = adc_probeChannel(adc1, adc_chVref);
+
+		if (tcheck)
+			temp = adc_probeChannel(adc1, adc_chTemp);
+	}
+
+	if (adc != adc1) {
+		mutexLock(adc_common.lock[adc]);
+		adc_prepare(adc);
+		val = adc_probeChannel(adc, chan);
+		adc_disable(adc);
+		mutexUnlock(adc_common.lock[adc]);
+	}
+	else {
+		val = adc_probeChannel(adc1, chan);
+	}
+
+	if (!adc_common.scan.active) {
 		adc_disable(adc1);
+		adc_sensors(0);
+		adc_checkDrift(vref, temp);
+	}
+
+	*valmv = adc_toMv(vref, val);
 
-	return out;
+	mutexUnlock(adc_common.lock[adc1]);
+
+	return EOK;
 }
 
 
@@ -205,7 +565,13 @@ int adc_init(void)
 	adc_common.base = (void *)0x50040000;
 	rcc_devClk(pctl_adc, 1);
 
-	*(adc_common.base + common_ccr) = (1 << 22) | (0xe << 18) | (0x3 << 16) | (0xf << 8);
+	/* Temperature sensor and vref are enabled only while sampled (see adc_sensors) */
+	*(adc_common.base + common_ccr) = (0xe << 18) | (0x3 << 16) | (0xf << 8);
+
+	adc_common.recalibrate = 0;
+	adc_common.vrefCal = 0;
+	adc_common.tempCal = 0;
+	adc_common.conversions = 0;
 
 	for (i = adc1; i <= adc3; ++i) {
 		mutexCreate(&adc_common.lock[i]);
@@ -214,5 +580,15 @@ int adc_init(void)
 		adc_disable(i);
 	}
 
+	adc_common.scan.active = 0;
+	adc_common.scan.head = 0;
+	condCreate(&adc_common.scan.cond);
+	condCreate(&adc_common.scan.dmacond);
+
+	/* ADC1 is request 0 of DMA1 channel 1 */
+	dma_configure(dma1, 1, dma_per2mem, dma_circular, 2, adc_common.base + adc1_offs + dr, sizeof(uint16_t), 0, adc_common.scan.dmacond);
+
+	beginthread(adc_scanThread, 1, adc_common.stack, sizeof(adc_common.stack), NULL);
+
 	return EOK;
 }
@@ -15,7 +15,18 @@
 #define _ADC_H_
 
 
-unsigned short adc_conversion(int adc, char chan);
+#include "stm32-multi.h"
+
+
+int adc_conversion(int adc, char chan, unsigned short *valmv);
+
+
+/* Starts continuous scan of channels in chanmask on ADC1, empty mask stops it */
+int adc_scanConfigure(int adc, unsigned int chanmask);
+
+
+/* Blocks until samples newer than *seq are available, returns their count */
+int adc_streamRead(unsigned int *seq, adcsample_t *samples, size_t size, unsigned int *lost, unsigned int *chanmask);
 
 
 int adc_init(void);
@@ -49,6 +49,10 @@
 #define SPI3 0
 #endif
 
+#ifndef I2C2
+#define I2C2 0
+#endif
+
 #ifndef FLASH_PROGRAM_1_ADDR
 #define FLASH_PROGRAM_1_ADDR 0x08000000
 #endif
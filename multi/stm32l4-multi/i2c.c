@@ -3,7 +3,7 @@
  *
  * STM32L4 I2C driver
  *
- * Copyright 2017, 2018 Phoenix Systems
+ * Copyright 2017, 2018, 2020 Phoenix Systems
  * Author: Aleksander Kaminski
  *
  * This file is part of Phoenix-RTOS.
@@ -20,165 +20,368 @@
 #include "stm32-multi.h"
 #include "common.h"
 #include "gpio.h"
+#include "dma.h"
 #include "i2c.h"
 #include "rcc.h"
 
 
-enum { cr1 = 0, cr2, oar1, oar2, dr, sr1, sr2, ccr, trise };
+/* Shorter payloads are moved by the interrupt handler */
+#define I2C_DMA_THRESHOLD 8
+
+/* Max NBYTES, longer segments are split using RELOAD */
+#define I2C_CHUNK 255
+
+/* Longest chunk takes ~23 ms at 100 kHz */
+#define I2C_TIMEOUT 100000
+
+/* Bound on polling DMA for the last byte after TC/TCR */
+#define I2C_DMA_SPIN 1000
+
+
+enum { cr1 = 0, cr2, oar1, oar2, timingr, timeoutr, isr, icr, pecr, rxdr, txdr };
+
+
+/* ISR flags */
+#define I2C_TXE   (1 << 0)
+#define I2C_TXIS  (1 << 1)
+#define I2C_RXNE  (1 << 2)
+#define I2C_NACKF (1 << 4)
+#define I2C_STOPF (1 << 5)
+#define I2C_TC    (1 << 6)
+#define I2C_TCR   (1 << 7)
+#define I2C_BERR  (1 << 8)
+#define I2C_ARLO  (1 << 9)
+#define I2C_OVR   (1 << 10)
+
+#define I2C_ERRORS (I2C_NACKF | I2C_BERR | I2C_ARLO | I2C_OVR)
+
+/* CR1 interrupt enables */
+#define I2C_TXIE   (1 << 1)
+#define I2C_RXIE   (1 << 2)
+#define I2C_EVENTS ((1 << 4) | (1 << 5) | (1 << 6) | (1 << 7))
 
 
 struct {
 	volatile unsigned int *base;
+	int dma;
+
+	/* Interrupt driven data phase */
+	unsigned char *volatile buff;
+	volatile unsigned int left;
+	unsigned int dataie;
 
 	handle_t lock;
 	handle_t irqlock;
 	handle_t irqcond;
 	handle_t inth;
+	handle_t errinth;
 } i2c_common;
 
 
 static int i2c_irq(unsigned int n, void *arg)
 {
-	/* Event irq disable */
-	*(i2c_common.base + cr2) &= ~(3 << 9);
+	unsigned int flags = *(i2c_common.base + isr);
+
+	if (i2c_common.left) {
+		if (flags & I2C_RXNE) {
+			*(i2c_common.buff++) = *(i2c_common.base + rxdr);
+			--i2c_common.left;
+		}
+		else if (flags & I2C_TXIS) {
+			*(i2c_common.base + txdr) = *(i2c_common.buff++);
+			--i2c_common.left;
+		}
+	}
+
+	if (!i2c_common.left)
+		*(i2c_common.base + cr1) &= ~(I2C_TXIE | I2C_RXIE);
+
+	if (!(flags & (I2C_TC | I2C_TCR | I2C_STOPF | I2C_ERRORS)))
+		return -1;
+
+	*(i2c_common.base + cr1) &= ~(I2C_TXIE | I2C_RXIE | I2C_EVENTS);
 
 	return 1;
 }
 
 
-static void i2c_waitForIrq(void)
+static unsigned int i2c_wait(unsigned int mask)
 {
+	unsigned int flags;
+	int err = EOK;
+
 	mutexLock(i2c_common.irqlock);
-	*(i2c_common.base + cr2) |= (3 << 9);
-	condWait(i2c_common.irqcond, i2c_common.irqlock, 0);
+	while (!((flags = *(i2c_common.base + isr)) & (mask | I2C_ERRORS)) && err == EOK) {
+		*(i2c_common.base + cr1) |= I2C_EVENTS | (i2c_common.left ? i2c_common.dataie : 0);
+		err = condWait(i2c_common.irqcond, i2c_common.irqlock, I2C_TIMEOUT);
+	}
 	mutexUnlock(i2c_common.irqlock);
+
+	return flags;
 }
 
 
 static void i2c_hwinit(void)
 {
-	unsigned int t;
+	unsigned int presc, tick;
+	int freq = rcc_getCpufreq();
 
-	/* Disable I2C periph */
+	/* Disable I2C periph, it resets communication and flags */
 	*(i2c_common.base + cr1) &= ~1;
 	dataBarier();
 
-	*(i2c_common.base + cr1) |= 1 << 15;
-	dataBarier();
-	*(i2c_common.base + cr1) &= ~(1 << 15);
+	*(i2c_common.base + cr1) = 0;
+
+	/* PCLK1 = HCLK, 100 kHz SCK with ~4 MHz timing clock */
+	presc = (freq + 3999999) / 4000000;
+	if (presc > 16)
+		presc = 16;
+	tick = 1000000000 / (freq / presc);
+
+	*(i2c_common.base + timingr) = ((presc - 1) << 28) | (0x4 << 20) | (0x2 << 16) |
+		((((4000 + tick - 1) / tick) - 1) << 8) | (((5000 + tick - 1) / tick) - 1);
+
+	/* Enable I2C periph */
+	*(i2c_common.base + cr1) |= 1;
 	dataBarier();
+}
 
-	/* Enable ACK after each byte */
-	*(i2c_common.base + cr2) |= 1 << 10;
 
-	/* Peripheral clock = 2 MHz */
-	t = *(i2c_common.base + cr2) & ~0x1ff;
-	*(i2c_common.base + cr2) = t | (1 << 2);
+static int i2c_error(unsigned int flags, int addressed)
+{
+	if (flags & I2C_ARLO)
+		return -EAGAIN;
 
-	/* 95,325 kHz SCK */
-	t = *(i2c_common.base + ccr) & ~((1 << 14) | 0x7ff);
-	*(i2c_common.base + ccr) = t | 0xb;
+	if (flags & I2C_NACKF)
+		return addressed ? -EIO : -ENXIO;
 
-	/* 500 ns SCL rise time */
-	t = *(i2c_common.base + trise) & ~0x1ff;
-	*(i2c_common.base + trise) = t | 3;
+	if (flags & (I2C_BERR | I2C_OVR))
+		return -EIO;
 
-	/* Enable I2C periph */
-	*(i2c_common.base + cr1) |= 1;
+	return -ETIMEDOUT;
 }
 
 
-unsigned int i2c_transaction(char op, char addr, char reg, void *buff, unsigned int count)
+/* Moves one chunk of up to I2C_CHUNK bytes, returns number of bytes moved or error */
+static int i2c_chunk(unsigned char addr, int rd, unsigned char *buff, unsigned int len, int start, int reload, int addressed)
 {
-	int i;
+	const int chan = rd ? 5 : 4;
+	const unsigned int done = reload ? I2C_TCR : I2C_TC;
+	unsigned int flags, t, spin;
+	int usedma = i2c_common.dma && len >= I2C_DMA_THRESHOLD, moved;
+
+	i2c_common.buff = buff;
+	i2c_common.left = usedma ? 0 : len;
+	i2c_common.dataie = rd ? I2C_RXIE : I2C_TXIE;
+
+	if (usedma) {
+		dma_start(dma1, chan, buff, len);
+		*(i2c_common.base + cr1) |= rd ? (1 << 15) : (1 << 14);
+	}
 
-	if (count < 1 || (op != _i2c_read && op != _i2c_write))
-		return 0;
+	t = (len << 16) | ((addr & 0x7f) << 1);
 
-	mutexLock(i2c_common.lock);
-	keepidle(1);
+	if (rd)
+		t |= 1 << 10;
 
-	if (*(i2c_common.base + sr2) & (1 << 1))
-		i2c_hwinit();
+	if (reload)
+		t |= 1 << 24;
 
-	*(i2c_common.base + cr2) |= (3 << 9);
+	if (start)
+		t |= 1 << 13;
 
-	/* Start condition generation */
-	*(i2c_common.base + cr1) |= (1 << 8);
+	*(i2c_common.base + cr2) = t;
 
-	while (!(*(i2c_common.base + sr1) & 1))
-		i2c_waitForIrq();
+	flags = i2c_wait(done);
 
-	*(i2c_common.base + dr) = addr << 1;
+	if (usedma) {
+		/* After TC/TCR the last byte can still be on its way to memory, it takes a few bus cycles */
+		for (spin = I2C_DMA_SPIN; (flags & done) && !(flags & I2C_ERRORS) && dma_remaining(dma1, chan) && spin; --spin)
+			;
 
-	while (!((*(i2c_common.base + sr1) & 2) && (*(i2c_common.base + sr2) & 1)))
-		i2c_waitForIrq();
+		*(i2c_common.base + cr1) &= ~((1 << 15) | (1 << 14));
+		moved = len - dma_remaining(dma1, chan);
+		dma_stop(dma1, chan);
+	}
+	else {
+		moved = len - i2c_common.left;
+		i2c_common.left = 0;
+	}
 
-	while (!(*(i2c_common.base + sr1) & (1 << 7)))
-		i2c_waitForIrq();
+	if (!(flags & done) || (flags & I2C_ERRORS))
+		return i2c_error(flags, addressed || moved);
 
-	*(i2c_common.base + dr) = reg;
+	if ((unsigned int)moved != len)
+		return -EIO;
 
-	if (op == _i2c_read) {
-		*(i2c_common.base + cr1) |= (1 << 8);
-		if (count > 1)
-			*(i2c_common.base + cr1) |= (1 << 10);
+	return moved;
+}
 
-		while (!(*(i2c_common.base + sr1) & 1))
-			i2c_waitForIrq();
 
-		*(i2c_common.base + dr) = (addr << 1) | 1;
+static void i2c_recover(int err)
+{
+	/* Master sends STOP by itself after NACK, otherwise it holds the bus until reinit */
+	if (*(i2c_common.base + isr) & I2C_NACKF) {
+		*(i2c_common.base + icr) = I2C_NACKF;
+		i2c_wait(I2C_STOPF);
+	}
 
-		while (!((*(i2c_common.base + sr1) & 2) && (*(i2c_common.base + sr2) & 1)))
-			i2c_waitForIrq();
+	*(i2c_common.base + icr) = (1 << 3) | I2C_ERRORS | I2C_STOPF;
+	*(i2c_common.base + isr) |= I2C_TXE;
 
-		for (i = 0; i < count; ++i) {
-			while (!(*(i2c_common.base + sr1) & (1 << 6)))
-				i2c_waitForIrq();
+	if (err != -ENXIO)
+		i2c_hwinit();
+}
 
-			if ((i + 2) >= count)
-				*(i2c_common.base + cr1) &= ~(1 << 10);
 
-			((char *)buff)[i] = *(i2c_common.base + dr);
-		}
+static int _i2c_xfer(unsigned char addr, i2cbuf_t *b, unsigned int count, signed char *status)
+{
+	unsigned int i, len, chunk;
+	unsigned char *buff;
+	int rd, start, addressed = 0, err = EOK, total = 0;
+
+	if (!I2C2 || count < 1 || count > I2C_XFER_SEGMENTS || (b[0].flags & i2cseg_nostart))
+		return -EINVAL;
+
+	for (i = 0; i < count; ++i) {
+		/* Segment continuing without start has to keep direction and move some data */
+		if ((b[i].flags & i2cseg_nostart) && (!b[i].len || ((b[i].flags ^ b[i - 1].flags) & i2cseg_read)))
+			return -EINVAL;
+
+		if (!b[i].len && ((b[i].flags & i2cseg_read) || (i + 1 < count && (b[i + 1].flags & i2cseg_nostart))))
+			return -EINVAL;
 	}
-	else {
-		for (i = 0; i < count; ++i) {
-			while (!(*(i2c_common.base + sr1) & (1 << 7)))
-				i2c_waitForIrq();
 
-			*(i2c_common.base + dr) = ((char *)buff)[i];
-		}
+	for (i = 0; i < count; ++i)
+		status[i] = -EAGAIN;
+
+	mutexLock(i2c_common.lock);
+	keepidle(1);
+
+	for (i = 0; i < count && err == EOK; ++i) {
+		rd = b[i].flags & i2cseg_read;
+		start = !(b[i].flags & i2cseg_nostart);
+		buff = b[i].buff;
+		len = b[i].len;
+
+		if (start)
+			addressed = 0;
+
+		do {
+			chunk = (len > I2C_CHUNK) ? I2C_CHUNK : len;
+			len -= chunk;
+
+			err = i2c_chunk(addr, rd, buff, chunk, start, len || (i + 1 < count && (b[i + 1].flags & i2cseg_nostart)), addressed);
+			if (err < 0)
+				break;
 
-		while (!(*(i2c_common.base + sr1) & (1 << 7)))
-			i2c_waitForIrq();
+			buff += err;
+			total += err;
+			start = 0;
+			addressed = 1;
+			err = EOK;
+		} while (len);
+
+		status[i] = err;
+	}
+
+	if (err == EOK) {
+		*(i2c_common.base + cr2) |= 1 << 14;
+		if (!(i2c_wait(I2C_STOPF) & I2C_STOPF))
+			err = -ETIMEDOUT;
+		*(i2c_common.base + icr) = I2C_STOPF;
 	}
 
-	*(i2c_common.base + cr1) |= (1 << 9);
+	if (err < 0)
+		i2c_recover(err);
 
 	keepidle(0);
 	mutexUnlock(i2c_common.lock);
 
-	return i;
+	return (err < 0) ? err : total;
+}
+
+
+int i2c_transaction(char op, char addr, char reg, void *buff, unsigned int count)
+{
+	signed char status[2];
+	i2cbuf_t b[2];
+	int err;
+
+	if (count < 1 || (op != _i2c_read && op != _i2c_write))
+		return -EINVAL;
+
+	b[0].buff = (unsigned char *)&reg;
+	b[0].len = 1;
+	b[0].flags = 0;
+
+	b[1].buff = buff;
+	b[1].len = count;
+	b[1].flags = (op == _i2c_read) ? i2cseg_read : i2cseg_nostart;
+
+	err = _i2c_xfer(addr, b, 2, status);
+
+	return (err < 0) ? err : (int)count;
+}
+
+
+int i2c_xferList(unsigned char addr, const i2cseg_t *seg, unsigned int count, unsigned char *ibuff, size_t isize,
+	const unsigned char *obuff, size_t osize, signed char *status)
+{
+	i2cbuf_t b[I2C_XFER_SEGMENTS];
+	size_t in = 0, out = 0;
+	unsigned int i;
+
+	if (count > I2C_XFER_SEGMENTS)
+		return -EINVAL;
+
+	for (i = 0; i < count; ++i) {
+		b[i].len = seg[i].len;
+		b[i].flags = seg[i].flags;
+
+		if (seg[i].flags & i2cseg_read) {
+			b[i].buff = ibuff + in;
+			in += seg[i].len;
+		}
+		else {
+			b[i].buff = (unsigned char *)obuff + out;
+			out += seg[i].len;
+		}
+	}
+
+	if (in > isize || out > osize)
+		return -EINVAL;
+
+	return _i2c_xfer(addr, b, count, status);
 }
 
 
 int i2c_init(void)
 {
+	if (!I2C2)
+		return EOK;
+
 	i2c_common.base = (void *)0x40005800;
 
 	rcc_devClk(pctl_i2c2, 1);
 
+	mutexCreate(&i2c_common.lock);
+	mutexCreate(&i2c_common.irqlock);
+	condCreate(&i2c_common.irqcond);
+
 	i2c_hwinit();
 
 	gpio_configPin(gpiob, 10, 2, 4, 1, 0, 0);
 	gpio_configPin(gpiob, 11, 2, 4, 1, 0, 0);
 
-	mutexCreate(&i2c_common.lock);
-	mutexCreate(&i2c_common.irqlock);
-	condCreate(&i2c_common.irqcond);
+	/* DMA1 channel 4 is I2C2_TX and 5 is I2C2_RX at request 3, both shared with SPI2 */
+	i2c_common.dma = !SPI2 &&
+		dma_configure(dma1, 4, dma_mem2per, dma_normal, 1, i2c_common.base + txdr, sizeof(uint8_t), 3, i2c_common.irqcond) == EOK &&
+		dma_configure(dma1, 5, dma_per2mem, dma_normal, 1, i2c_common.base + rxdr, sizeof(uint8_t), 3, i2c_common.irqcond) == EOK;
 
-	interrupt(49, i2c_irq, NULL, i2c_common.irqcond, &i2c_common.inth);
+	/* Event and error interrupts */
+	interrupt(16 + 33, i2c_irq, NULL, i2c_common.irqcond, &i2c_common.inth);
+	interrupt(16 + 34, i2c_irq, NULL, i2c_common.irqcond, &i2c_common.errinth);
 
 	return EOK;
 }
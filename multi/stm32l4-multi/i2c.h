@@ -3,7 +3,7 @@
  *
  * STM32L4 I2C driver
  *
- * Copyright 2017, 2018 Phoenix Systems
+ * Copyright 2017, 2018, 2020 Phoenix Systems
  * Author: Aleksander Kaminski
  *
  * This file is part of Phoenix-RTOS.
@@ -15,11 +15,26 @@
 #ifndef _I2C_H_
 #define _I2C_H_
 
+#include <stddef.h>
+#include "stm32-multi.h"
+
 
 enum { _i2c_read = 0, _i2c_write };
 
 
-extern unsigned int i2c_transaction(char op, char addr, char reg, void *buff, unsigned int count);
+typedef struct {
+	unsigned char *buff;
+	unsigned int len;
+	int flags; /* i2cseg_read, i2cseg_nostart */
+} i2cbuf_t;
+
+
+extern int i2c_transaction(char op, char addr, char reg, void *buff, unsigned int count);
+
+
+/* Segments are separated by repeated start, status gets per segment result */
+extern int i2c_xferList(unsigned char addr, const i2cseg_t *seg, unsigned int count, unsigned char *ibuff, size_t isize,
+	const unsigned char *obuff, size_t osize, signed char *status);
 
 
 extern int i2c_init(void);
@@ -23,6 +23,7 @@
 #include "stm32-multi.h"
 #include "common.h"
 #include "rcc.h"
+#include "dma.h"
 #include "spi.h"
 
 
@@ -30,10 +31,15 @@
 #define SPI2_POS (SPI1_POS + SPI1)
 #define SPI3_POS (SPI2_POS + SPI2)
 
+/* Shorter transfers are cheaper to poll than to set up DMA for */
+#define SPI_DMA_THRESHOLD 16
+#define SPI_DMA_CHUNK     0x8000
+
 
 struct {
 	volatile uint16_t *base;
 	volatile int ready;
+	int dma;
 
 	handle_t mutex;
 	handle_t irqLock;
@@ -51,6 +57,14 @@ static const int spiConfig[] = { SPI1, SPI2, SPI3 };
 static const int spiPos[] = { SPI1_POS, SPI2_POS, SPI3_POS };
 
 
+static const struct {
+	int dma;
+	int rxchan;
+	int txchan;
+	unsigned char reqmap;
+} spi2dma[] = { { dma1, 2, 3, 1 }, { dma1, 4, 5, 1 }, { dma2, 1, 2, 3 } };
+
+
 enum { cr1 = 0, cr2 = 2, sr = 4, dr = 6, crcpr = 8, rxcrcr = 10, txcrcr = 12 };
 
 
@@ -84,9 +98,80 @@ static unsigned char _spi_readwrite(int spi, unsigned char txd)
 }
 
 
+static int _spi_dma(int spi, unsigned char *ibuff, const unsigned char *obuff, size_t len)
+{
+	const int dma = spi2dma[spi_common[spi].dma].dma;
+	const int rx = spi2dma[spi_common[spi].dma].rxchan, tx = spi2dma[spi_common[spi].dma].txchan;
+	unsigned int events, errors;
+	unsigned short n;
+	int err = EOK;
+
+	/* 8-bit RX threshold, drop leftovers of polled transfers */
+	*(spi_common[spi].base + cr2) |= 1 << 12;
+	while (*(spi_common[spi].base + sr) & (0x3 << 9))
+		(void)*((volatile uint8_t *)(spi_common[spi].base + dr));
+	(void)*(spi_common[spi].base + sr);
+
+	while (len && err == EOK) {
+		n = (len > SPI_DMA_CHUNK) ? SPI_DMA_CHUNK : len;
+		events = dma_events(dma, rx);
+		errors = dma_errors(dma, rx) + dma_errors(dma, tx);
+
+		/* RX DMA has to be enabled before TX, see RM0351 */
+		*(spi_common[spi].base + cr2) |= 1 << 0;
+		dma_start(dma, rx, ibuff, n);
+		dma_start(dma, tx, (void *)obuff, n);
+		*(spi_common[spi].base + cr2) |= 1 << 1;
+
+		mutexLock(spi_common[spi].irqLock);
+		while (dma_events(dma, rx) == events) {
+			if (dma_errors(dma, rx) + dma_errors(dma, tx) != errors) {
+				err = -EIO;
+				break;
+			}
+			condWait(spi_common[spi].cond, spi_common[spi].irqLock, 0);
+		}
+		mutexUnlock(spi_common[spi].irqLock);
+
+		*(spi_common[spi].base + cr2) &= ~0x3;
+		dma_stop(dma, rx);
+		dma_stop(dma, tx);
+
+		if (ibuff != NULL)
+			ibuff += n;
+		if (obuff != NULL)
+			obuff += n;
+		len -= n;
+	}
+
+	*(spi_common[spi].base + cr2) &= ~(1 << 12);
+
+	return err;
+}
+
+
+/* ibuff or obuff NULL - received data is dropped or zeros are sent */
+static int _spi_transfer(int spi, unsigned char *ibuff, const unsigned char *obuff, size_t len)
+{
+	size_t i;
+	unsigned char rxd;
+
+	if (len >= SPI_DMA_THRESHOLD && spi_common[spi].dma >= 0)
+		return _spi_dma(spi, ibuff, obuff, len);
+
+	for (i = 0; i < len; ++i) {
+		rxd = _spi_readwrite(spi, (obuff != NULL) ? obuff[i] : 0);
+		if (ibuff != NULL)
+			ibuff[i] = rxd;
+	}
+
+	return EOK;
+}
+
+
 int spi_transaction(int spi, int dir, unsigned char cmd, unsigned int addr, unsigned char flags, unsigned char *ibuff, unsigned char *obuff, size_t bufflen)
 {
-	int i;
+	int i, err;
 
 	if (spi < spi1 || spi > spi3 || !spiConfig[spi])
 		return -EINVAL;
@@ -109,23 +194,58 @@ int spi_transaction(int spi, int dir, unsigned char cmd, unsigned int addr, unsi
 	if (flags & spi_dummy)
 		_spi_readwrite(spi, 0);
 
-	if (dir == spi_read) {
-		for (i = 0; i < bufflen; ++i)
-			ibuff[i] = _spi_readwrite(spi, 0);
-	}
-	else if (dir == spi_write) {
-		for (i = 0; i < bufflen; ++i)
-			_spi_readwrite(spi, obuff[i]);
+	if (dir == spi_read)
+		err = _spi_transfer(spi, ibuff, NULL, bufflen);
+	else if (dir == spi_write)
+		err = _spi_transfer(spi, NULL, obuff, bufflen);
+	else
+		err = _spi_transfer(spi, ibuff, obuff, bufflen);
+
+	keepidle(0);
+	mutexUnlock(spi_common[spi].mutex);
+
+	return (err < 0) ? err : bufflen;
+}
+
+
+int spi_xferList(int spi, const spiseg_t *seg, unsigned int count, unsigned char *ibuff, size_t isize, const unsigned char *obuff, size_t osize)
+{
+	unsigned int i;
+	size_t in = 0, out = 0, total = 0;
+	int err = EOK;
+
+	if (spi < spi1 || spi > spi3 || !spiConfig[spi] || count > SPI_XFER_SEGMENTS)
+		return -EINVAL;
+
+	for (i = 0; i < count; ++i) {
+		if (seg[i].flags & spixfer_in)
+			in += seg[i].len;
+		if (seg[i].flags & spixfer_out)
+			out += seg[i].len;
 	}
-	else {
-		for (i = 0; i < bufflen; ++i)
-			ibuff[i] = _spi_readwrite(spi, obuff[i]);
+
+	if (in > isize || out > osize)
+		return -EINVAL;
+
+	spi = spiPos[spi];
+
+	mutexLock(spi_common[spi].mutex);
+	keepidle(1);
+
+	for (i = 0; i < count && err == EOK; ++i) {
+		err = _spi_transfer(spi, (seg[i].flags & spixfer_in) ? ibuff : NULL, (seg[i].flags & spixfer_out) ? obuff : NULL, seg[i].len);
+
+		if (seg[i].flags & spixfer_in)
+			ibuff += seg[i].len;
+		if (seg[i].flags & spixfer_out)
+			obuff += seg[i].len;
+		total += seg[i].len;
 	}
 
 	keepidle(0);
 	mutexUnlock(spi_common[spi].mutex);
 
-	return bufflen;
+	return (err < 0) ? err : total;
 }
 
 
@@ -196,6 +316,14 @@ void spi_init(void)
 
 		interrupt(spiinfo[spi].irq, spi_irqHandler, (void *)i, spi_common[i].cond, &spi_common[i].inth);
 
+		/* DMA completion wakes the same cond */
+		spi_common[i].dma = spi;
+		if (dma_configure(spi2dma[spi].dma, spi2dma[spi].rxchan, dma_per2mem, dma_normal, 2,
+				spi_common[i].base + dr, sizeof(uint8_t), spi2dma[spi].reqmap, spi_common[i].cond) < 0 ||
+				dma_configure(spi2dma[spi].dma, spi2dma[spi].txchan, dma_mem2per, dma_normal, 1,
+				spi_common[i].base + dr, sizeof(uint8_t), spi2dma[spi].reqmap, spi_common[i].cond) < 0)
+			spi_common[i].dma = -1;
+
 		++i;
 	}
 }
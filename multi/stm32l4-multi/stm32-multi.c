@@ -24,6 +24,7 @@
 #include "common.h"
 
 #include "adc.h"
+#include "dma.h"
 #include "flash.h"
 #include "gpio.h"
 #include "i2c.h"
@@ -50,10 +51,10 @@ static void handleMsg(msg_t *msg)
 	multi_i_t *imsg = (multi_i_t *)msg->i.raw;
 	multi_o_t *omsg = (multi_o_t *)msg->o.raw;
 	int err = EOK;
-	unsigned int t;
+	unsigned int t, lost, mask;
+	unsigned short s;
 
 	switch (imsg->type) {
-#if 0
 		case i2c_get:
 			err = i2c_transaction(_i2c_read, imsg->i2c_msg.addr, imsg->i2c_msg.reg, msg->o.data, msg->o.size);
 			break;
@@ -62,6 +63,12 @@ static void handleMsg(msg_t *msg)
 			err = i2c_transaction(_i2c_write, imsg->i2c_msg.addr, imsg->i2c_msg.reg, msg->i.data, msg->i.size);
 			break;
 
+		case i2c_xfer:
+			err = i2c_xferList(imsg->i2c_xfer.addr, imsg->i2c_xfer.seg, imsg->i2c_xfer.count,
+				msg->o.data, msg->o.size, msg->i.data, msg->i.size, omsg->i2c_status);
+			break;
+
+#if 0
 		case exti_def:
 			err = exti_configure(imsg->exti_def.line, imsg->exti_def.mode, imsg->exti_def.edge);
 			break;
@@ -91,7 +98,20 @@ static void handleMsg(msg_t *msg)
 			break;
 
 		case adc_get:
-			omsg->adc_valmv = adc_conversion(imsg->adc_get.adcno, imsg->adc_get.channel);
+			err = adc_conversion(imsg->adc_get.adcno, imsg->adc_get.channel, &s);
+			omsg->adc_valmv = s;
+			break;
+
+		case adc_scan:
+			err = adc_scanConfigure(imsg->adc_scan.adcno, imsg->adc_scan.chanmask);
+			break;
+
+		case adc_stream:
+			t = imsg->adc_stream.seq;
+			err = adc_streamRead(&t, msg->o.data, msg->o.size, &lost, &mask);
+			omsg->adc_stream.seq = t;
+			omsg->adc_stream.lost = lost;
+			omsg->adc_stream.chanmask = mask;
 			break;
 
 		case spi_get:
@@ -113,6 +133,11 @@ static void handleMsg(msg_t *msg)
 			err = spi_configure(imsg->spi_def.spi, imsg->spi_def.mode, imsg->spi_def.bdiv, imsg->spi_def.enable);
 			break;
 
+		case spi_xfer:
+			err = spi_xferList(imsg->spi_xfer.spi, imsg->spi_xfer.seg, imsg->spi_xfer.count,
+				msg->o.data, msg->o.size, msg->i.data, msg->i.size);
+			break;
+
 		case gpio_def:
 			err = gpio_configPin(imsg->gpio_def.port, imsg->gpio_def.pin, imsg->gpio_def.mode,
 				imsg->gpio_def.af, imsg->gpio_def.otype, imsg->gpio_def.ospeed, imsg->gpio_def.pupd);
@@ -202,13 +227,14 @@ int main(void)
 	rcc_init();
 	uart_init();
 	gpio_init();
+	dma_init();
 	spi_init();
 	adc_init();
 	rtc_init();
 	flash_init();
+	i2c_init();
 
 /*
-	i2c_init();
 	exti_init();
 */
 
@@ -19,7 +19,7 @@
 
 enum { adc_get = 0, rtc_setcal, rtc_get, rtc_set, i2c_get, i2c_set, gpio_def, gpio_get,
 	gpio_set, uart_def, uart_get, uart_set, flash_get, flash_set, spi_get, spi_set,
-	spi_rw, spi_def, exti_def, exti_map };
+	spi_rw, spi_def, exti_def, exti_map, adc_scan, adc_stream, spi_xfer, i2c_xfer };
 
 /* RTC */
 
@@ -45,6 +45,26 @@ typedef struct {
 } __attribute__((packed)) i2cmsg_t;
 
 
+#define I2C_XFER_SEGMENTS 8
+
+
+/* Segment without i2cseg_nostart begins with (repeated) start and address */
+enum { i2cseg_read = 0x1, i2cseg_nostart = 0x2 };
+
+
+typedef struct {
+	unsigned short len;
+	unsigned char flags;
+} __attribute__((packed)) i2cseg_t;
+
+
+typedef struct {
+	unsigned char addr;
+	unsigned char count;
+	i2cseg_t seg[I2C_XFER_SEGMENTS];
+} __attribute__((packed)) i2cxfer_t;
+
+
 /* GPIO */
 
 
@@ -132,6 +152,26 @@ typedef struct {
 } __attribute__((packed)) spidef_t;
 
 
+#define SPI_XFER_SEGMENTS 8
+
+
+/* Segment data is taken from i.data (spixfer_out) and/or stored in o.data (spixfer_in) */
+enum { spixfer_in = 0x1, spixfer_out = 0x2 };
+
+
+typedef struct {
+	unsigned short len;
+	unsigned char flags;
+} __attribute__((packed)) spiseg_t;
+
+
+typedef struct {
+	int spi;
+	unsigned int count;
+	spiseg_t seg[SPI_XFER_SEGMENTS];
+} __attribute__((packed)) spixfer_t;
+
+
 /* EXTI */
 
 
@@ -160,12 +200,33 @@ typedef struct {
 enum { adc1 = 0, adc2, adc3 };
 
 
+#define ADC_SCAN_CHANNELS 16
+
+
 typedef struct {
 	int adcno;
 	int channel;
 } adcget_t;
 
 
+typedef struct {
+	int adcno;
+	unsigned int chanmask; /* Bit n enables channel n (1..16), 0 stops the scan */
+} adcscan_t;
+
+
+typedef struct {
+	unsigned int seq; /* First sample wanted */
+} adcstream_t;
+
+
+typedef struct {
+	unsigned int seq;
+	unsigned int timestamp; /* us, wraps around */
+	unsigned short valmv[ADC_SCAN_CHANNELS]; /* Scanned channels in ascending order */
+} __attribute__((packed)) adcsample_t;
+
+
 /* MULTI */
 
 
@@ -174,9 +235,12 @@ typedef struct {
 
 	union {
 		adcget_t adc_get;
+		adcscan_t adc_scan;
+		adcstream_t adc_stream;
 		int rtc_calib;
 		rtctimestamp_t rtc_timestamp;
 		i2cmsg_t i2c_msg;
+		i2cxfer_t i2c_xfer;
 		uartget_t uart_get;
 		uartset_t uart_set;
 		uartdef_t uart_def;
@@ -185,6 +249,7 @@ typedef struct {
 		gpioset_t gpio_set;
 		spirw_t spi_rw;
 		spidef_t spi_def;
+		spixfer_t spi_xfer;
 		extidef_t exti_def;
 		extimap_t exti_map;
 		unsigned int flash_addr;
@@ -197,7 +262,13 @@ typedef struct {
 
 	union {
 		unsigned short adc_valmv;
+		struct {
+			unsigned int seq; /* Next sample to ask for */
+			unsigned int lost; /* Samples overwritten before they were read */
+			unsigned int chanmask;
+		} adc_stream;
 		rtctimestamp_t rtc_timestamp;
+		signed char i2c_status[I2C_XFER_SEGMENTS];
 		unsigned int gpio_get;
 	};
 } __attribute__((packed)) multi_o_t;
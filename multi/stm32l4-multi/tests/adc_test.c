@@ -0,0 +1,447 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 ADC driver host tests
+ *
+ * Runs adc.c against a model of the three ADCs and DMA1 channel 1,
+ * conversions take the sampling time set by the driver at 20 MHz.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+
+#include "../adc.c"
+#include "sim.h"
+
+
+#define MODEL_CONV_US 32.65     /* 640.5 + 12.5 cycles */
+#define MODEL_CAL_US  6.0       /* ~116 cycles */
+#define MODEL_VREG_US 20.0      /* Voltage regulator startup */
+#define MODEL_TS_US   120.0     /* Temperature sensor startup */
+#define MODEL_STOP_US 16.0      /* Rest of the ongoing conversion, on average */
+
+#define MODEL_VREFINT 1655
+
+
+/* ADC_CR */
+#define ADEN     (1u << 0)
+#define ADDIS    (1u << 1)
+#define ADSTART  (1u << 2)
+#define ADSTP    (1u << 4)
+#define ADVREGEN (1u << 28)
+#define DEEPPWD  (1u << 29)
+#define ADCAL    (1u << 31)
+
+/* ADC_ISR */
+#define ADRDY (1u << 0)
+#define EOC   (1u << 2)
+#define EOS   (1u << 3)
+#define OVR   (1u << 4)
+
+/* ADC_CFGR */
+#define DMAEN  (1u << 0)
+#define DMACFG (1u << 1)
+#define CONT   (1u << 13)
+
+/* ADC_CCR */
+#define VREFEN (1u << 22)
+#define TSEN   (1u << 23)
+
+
+enum { dma_isr = 0, dma_ifcr, dma_ccr1, dma_cndtr1, dma_cpar1, dma_cmar1 };
+
+
+struct {
+	mmio_t adc;
+	mmio_t dma1;
+	mmio_t cal;
+
+	unsigned short vref;
+	unsigned short temp;
+	unsigned short value;
+
+	unsigned int calibrations;
+	unsigned int starts;
+
+	/* DMA1 channel 1 */
+	unsigned int len;
+	unsigned int pos;
+
+	unsigned int halves;
+	jmp_buf stop;
+} model;
+
+
+static volatile uint32_t *model_adc(int adc)
+{
+	return (volatile uint32_t *)model.adc.regs + adc_getOffs(adc);
+}
+
+
+static volatile uint32_t *model_dma(void)
+{
+	return model.dma1.regs;
+}
+
+
+static volatile uint32_t *model_ccr(void)
+{
+	return (volatile uint32_t *)model.adc.regs + common_ccr;
+}
+
+
+/* Internal channels read 0 while switched off */
+static unsigned short model_sample(int chan)
+{
+	if (chan == adc_chVref)
+		return (*model_ccr() & VREFEN) ? model.vref : 0;
+
+	if (chan == adc_chTemp)
+		return (*model_ccr() & TSEN) ? model.temp : 0;
+
+	return model.value;
+}
+
+
+/* Channel at position 1..16 of the regular sequence */
+static int model_seq(volatile uint32_t *r, unsigned int pos)
+{
+	return (r[sqr1 + pos / 5] >> (6 * (pos % 5))) & 0x1f;
+}
+
+
+static void model_calibrate(volatile uint32_t *r)
+{
+	r[cr] &= ~ADCAL;
+	r[calfact] = 0x40;
+	sim_us += MODEL_CAL_US;
+	++model.calibrations;
+}
+
+
+static void model_adcWrite(mmio_t *m, unsigned int offs, uint32_t old)
+{
+	volatile uint32_t *r;
+	unsigned int reg = (offs / 4) % 64;
+
+	if (offs / 4 == common_ccr) {
+		if ((*model_ccr() & TSEN) && !(old & TSEN))
+			sim_us += MODEL_TS_US;
+		return;
+	}
+
+	if (offs / 4 >= common_offs)
+		return;
+
+	r = (volatile uint32_t *)m->regs + offs / 4 - reg;
+
+	if (reg == isr) {
+		r[isr] = old & ~r[isr];
+	}
+	else if (reg == cr) {
+		if (r[cr] & DEEPPWD)
+			r[cr] &= ~ADVREGEN;
+
+		if ((r[cr] & ADVREGEN) && !(old & ADVREGEN))
+			sim_us += MODEL_VREG_US;
+
+		if ((r[cr] & ADSTART) && !(old & ADSTART) && (r[cfgr] & CONT))
+			++model.starts;
+
+		/* Driver waits for these with a delay loop, they take their time here */
+		if (r[cr] & ADCAL)
+			model_calibrate(r);
+
+		if (r[cr] & ADSTP) {
+			r[cr] &= ~(ADSTP | ADSTART);
+			sim_us += MODEL_STOP_US;
+		}
+	}
+}
+
+
+static void model_dmaWrite(mmio_t *m, unsigned int offs, uint32_t old)
+{
+	volatile uint32_t *d = m->regs;
+
+	if (offs / 4 == dma_ifcr) {
+		d[dma_isr] &= ~d[dma_ifcr];
+		d[dma_ifcr] = 0;
+	}
+	else if (offs / 4 == dma_cndtr1) {
+		model.len = d[dma_cndtr1];
+		model.pos = 0;
+	}
+}
+
+
+/* Completes whatever the driver started, ADC flags are polled */
+static void model_step(void)
+{
+	volatile uint32_t *r;
+	unsigned int i, n;
+	int adc;
+
+	for (adc = adc1; adc <= adc3; ++adc) {
+		r = model_adc(adc);
+
+		if (r[cr] & ADDIS)
+			r[cr] &= ~(ADDIS | ADEN);
+
+		if (r[cr] & ADEN)
+			r[isr] |= ADRDY;
+		else
+			r[isr] &= ~ADRDY;
+
+		if ((r[cr] & (ADEN | ADSTART)) == (ADEN | ADSTART) && !(r[cfgr] & CONT)) {
+			n = (r[sqr1] & 0xf) + 1;
+
+			for (i = 1; i <= n; ++i)
+				r[dr] = model_sample(model_seq(r, i));
+
+			sim_us += n * MODEL_CONV_US;
+			r[isr] |= EOC | EOS | ((n > 1) ? OVR : 0);
+			r[cr] &= ~ADSTART;
+		}
+	}
+}
+
+
+/* Continuous scan fills the next half of the DMA buffer */
+static int model_scanHalf(void)
+{
+	volatile uint32_t *r = model_adc(adc1), *d = model_dma();
+	volatile uint16_t *buff = (void *)(uintptr_t)d[dma_cmar1];
+	unsigned int i, n = (r[sqr1] & 0xf) + 1;
+
+	if ((r[cr] & (ADEN | ADSTART)) != (ADEN | ADSTART) || (r[cfgr] & (CONT | DMACFG | DMAEN)) != (CONT | DMACFG | DMAEN))
+		return -1;
+
+	if (!(d[dma_ccr1] & 1) || !(d[dma_ccr1] & (1 << 5)) || model.len == 0 || model.len % (2 * n))
+		return -1;
+
+	for (i = 0; i < model.len / 2; ++i, ++model.pos)
+		buff[model.pos] = model_sample(model_seq(r, model.pos % n + 1));
+
+	sim_us += model.len / 2 * MODEL_CONV_US;
+
+	if (model.pos == model.len) {
+		model.pos = 0;
+		d[dma_isr] |= (1 << 1) | 1;
+	}
+	else {
+		d[dma_isr] |= (1 << 2) | 1;
+	}
+
+	d[dma_cndtr1] = model.len - model.pos;
+
+	return sim_irq(16 + 11);
+}
+
+
+int usleep(useconds_t us)
+{
+	sim_us += (us > 0) ? us : 1;
+	model_step();
+
+	return 0;
+}
+
+
+/* Only the sampler thread waits, it gets model.halves DMA events */
+int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	if (h != adc_common.scan.dmacond || model.halves == 0 || model_scanHalf() < 0)
+		longjmp(model.stop, 1);
+
+	--model.halves;
+
+	return EOK;
+}
+
+
+static void test_runSampler(unsigned int halves)
+{
+	model.halves = halves;
+
+	if (!setjmp(model.stop))
+		adc_scanThread(NULL);
+}
+
+
+static int test_single(void)
+{
+	unsigned short val = 0;
+	unsigned int calibrations = model.calibrations;
+	double start;
+	int adc, i;
+
+	for (adc = adc1; adc <= adc2; ++adc) {
+		start = sim_us;
+
+		for (i = 0; i < 1000; ++i)
+			TEST_CHECK(adc_conversion(adc, 5, &val) == EOK);
+
+		/* 3000 mV * vrefint / vref * 2048 / 4095 */
+		TEST_CHECK(val == 1655);
+		printf("adc%d single read: %.1f us, %.0f reads/s\n", adc + 1, (sim_us - start) / 1000, 1000 * 1e6 / (sim_us - start));
+	}
+
+	TEST_CHECK(model.calibrations == calibrations);
+	TEST_CHECK(!(model_adc(adc1)[cr] & ADVREGEN) && !(model_adc(adc2)[cr] & ADVREGEN));
+	TEST_CHECK(!(*model_ccr() & (VREFEN | TSEN)));
+
+	return EOK;
+}
+
+
+static int test_drift(void)
+{
+	unsigned int calibrations = model.calibrations;
+	unsigned short val;
+
+	/* VDDA dropped, the drift is noticed after this conversion */
+	model.vref = 1600;
+	TEST_CHECK(adc_conversion(adc1, 5, &val) == EOK);
+	TEST_CHECK(model.calibrations == calibrations);
+
+	/* Each ADC is calibrated again before its next use, once */
+	TEST_CHECK(adc_conversion(adc1, 5, &val) == EOK && val == 1551);
+	TEST_CHECK(model.calibrations == calibrations + 1);
+	TEST_CHECK(adc_conversion(adc2, 5, &val) == EOK && val == 1551);
+	TEST_CHECK(model.calibrations == calibrations + 2);
+	TEST_CHECK(adc_conversion(adc1, 5, &val) == EOK && adc_conversion(adc2, 5, &val) == EOK);
+	TEST_CHECK(model.calibrations == calibrations + 2);
+
+	return EOK;
+}
+
+
+
+
+/* Temperature is read with the sensor on every ADC_TEMP_CHECK conversions */
+static int test_tempDrift(void)
+{
+	unsigned int calibrations = model.calibrations;
+	unsigned short val;
+	int i;
+
+	for (i = 0; i < ADC_TEMP_CHECK; ++i)
+		TEST_CHECK(adc_conversion(adc1, 5, &val) == EOK);
+
+	TEST_CHECK(adc_common.tempCal == model.temp && model.calibrations == calibrations);
+
+	/* Drift is noticed on the next check, ADC1 is calibrated before the conversion after it */
+	model.temp += 2 * ADC_TEMP_DRIFT;
+
+	for (i = 0; i <= ADC_TEMP_CHECK; ++i)
+		TEST_CHECK(adc_conversion(adc1, 5, &val) == EOK);
+
+	TEST_CHECK(model.calibrations == calibrations + 1);
+	TEST_CHECK(!(*model_ccr() & (VREFEN | TSEN)));
+
+	return EOK;
+}
+
+
+static int test_scan(void)
+{
+	volatile uint32_t *r = model_adc(adc1);
+	unsigned int seq = 0, lost, chanmask, i;
+	adcsample_t samples[10];
+	unsigned short val;
+
+	TEST_CHECK(adc_scanConfigure(adc1, (1 << 1) | (1 << 5) | (1 << 16)) == EOK);
+	TEST_CHECK(model.starts == 1);
+
+	/* vref, temperature, then scanned channels in ascending order */
+	TEST_CHECK((r[sqr1] & 0xf) == 4 && model_seq(r, 1) == adc_chVref && model_seq(r, 2) == adc_chTemp);
+	TEST_CHECK(model_seq(r, 3) == 1 && model_seq(r, 4) == 5 && model_seq(r, 5) == 16);
+
+	test_runSampler(4);
+	TEST_CHECK(adc_common.scan.head == 2 * ADC_SCAN_DEPTH);
+	TEST_CHECK((*model_ccr() & (VREFEN | TSEN)) == (VREFEN | TSEN));
+
+	TEST_CHECK(adc_conversion(adc1, 5, &val) == EOK && val == 1551);
+	TEST_CHECK(adc_conversion(adc1, 7, &val) == -EBUSY);
+	TEST_CHECK(adc_conversion(adc2, 7, &val) == EOK && val == 1551);
+
+	TEST_CHECK(adc_streamRead(&seq, samples, sizeof(samples), &lost, &chanmask) == 10);
+	TEST_CHECK(seq == 10 && lost == 0 && chanmask == ((1 << 1) | (1 << 5) | (1 << 16)));
+
+	for (i = 0; i < 10; ++i) {
+		TEST_CHECK(samples[i].seq == i && samples[i].valmv[1] == 1551);
+		TEST_CHECK(i == 0 || samples[i].timestamp > samples[i - 1].timestamp);
+	}
+
+	printf("scan period: %u us\n", (unsigned int)(samples[9].timestamp - samples[0].timestamp) / 9);
+
+	/* Overrun readers lose the oldest samples */
+	test_runSampler(4);
+	TEST_CHECK(adc_streamRead(&seq, samples, sizeof(samples), &lost, &chanmask) == 10);
+	TEST_CHECK(lost == 4 * ADC_SCAN_DEPTH - ADC_STREAM_LEN - 10 && samples[0].seq == 4 * ADC_SCAN_DEPTH - ADC_STREAM_LEN);
+
+	return EOK;
+}
+
+
+static int test_scanDrift(void)
+{
+	unsigned int calibrations = model.calibrations, starts = model.starts;
+	unsigned short val;
+
+	/* The scan is restarted once to calibrate ADC1, other ADCs wait for their next use */
+	model.vref = 1700;
+	test_runSampler(8);
+	TEST_CHECK(model.starts == starts + 1 && model.calibrations == calibrations + 1);
+	TEST_CHECK(adc_common.scan.active);
+
+	TEST_CHECK(adc_conversion(adc2, 7, &val) == EOK && model.calibrations == calibrations + 2);
+
+	TEST_CHECK(adc_scanConfigure(adc1, 0) == EOK);
+	TEST_CHECK(!adc_common.scan.active && !(model_dma()[dma_ccr1] & 1));
+	TEST_CHECK((model_adc(adc1)[cr] & (ADEN | ADSTART | DEEPPWD)) == DEEPPWD);
+	TEST_CHECK(!(*model_ccr() & (VREFEN | TSEN)));
+
+	return EOK;
+}
+
+
+int main(void)
+{
+	model.adc.addr = 0x50040000;
+	model.adc.size = 0x400;
+	model.adc.write = model_adcWrite;
+	mmio_map(&model.adc);
+
+	model.dma1.addr = 0x40020000;
+	model.dma1.size = 0x400;
+	model.dma1.write = model_dmaWrite;
+	mmio_map(&model.dma1);
+
+	model.cal.addr = (uintptr_t)vrefint;
+	model.cal.size = sizeof(*vrefint);
+	mmio_map(&model.cal);
+	*(volatile uint16_t *)model.cal.regs = MODEL_VREFINT;
+
+	model.vref = 1500;
+	model.temp = 1000;
+	model.value = 2048;
+
+	dma_init();
+	adc_init();
+
+	TEST_CASE(test_single());
+	TEST_CASE(test_drift());
+	TEST_CASE(test_tempDrift());
+	TEST_CASE(test_scan());
+	TEST_CASE(test_scanDrift());
+
+	return sim_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
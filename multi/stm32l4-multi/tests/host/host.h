@@ -0,0 +1,58 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - common.h replacement
+ *
+ * Included before every driver source, it takes the include guard
+ * of common.h, which uses ARM instructions.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _COMMON_H_
+#define _COMMON_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <phoenix/arch/stm32l4.h>
+
+#include "../../config.h"
+
+/* Optional peripherals exercised by the tests */
+#undef I2C2
+#define I2C2 1
+
+
+#define max(a, b) ({ \
+	__typeof__ (a) _a = (a); \
+	__typeof__ (b) _b = (b); \
+	_a > _b ? _a : _b; \
+})
+
+
+#define min(a, b) ({ \
+	__typeof__ (a) _a = (a); \
+	__typeof__ (b) _b = (b); \
+	_a > _b ? _b : _a; \
+})
+
+
+#define DEBUG(format, ...)
+
+
+static inline void dataBarier(void)
+{
+	__sync_synchronize();
+}
+
+
+static inline uint32_t getPC(void)
+{
+	return (uint32_t)(uintptr_t)__builtin_return_address(0);
+}
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - platform definitions stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_PHOENIX_ARCH_STM32L4_H_
+#define _HOST_PHOENIX_ARCH_STM32L4_H_
+
+enum { pctl_adc = 0, pctl_dma1, pctl_dma2, pctl_syscfg, pctl_gpioa, pctl_gpiob, pctl_gpioc, pctl_gpiod, pctl_gpioe,
+	pctl_gpiof, pctl_gpiog, pctl_gpioh, pctl_gpioi, pctl_i2c2, pctl_rtc, pctl_spi1, pctl_spi2, pctl_spi3, pctl_usart1,
+	pctl_usart2, pctl_usart3, pctl_uart4, pctl_uart5 };
+
+
+enum { spi1_irq = 16 + 35, spi2_irq = 16 + 36, spi3_irq = 16 + 51 };
+
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - interrupts stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_INTERRUPT_H_
+#define _HOST_SYS_INTERRUPT_H_
+
+#include <sys/threads.h>
+
+
+/* Handlers are recorded, models call them through sim_irq() */
+extern int interrupt(unsigned int n, int (*f)(unsigned int, void *), void *arg, handle_t cond, handle_t *handle);
+
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - messages stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MSG_H_
+#define _HOST_SYS_MSG_H_
+
+#include <sys/threads.h>
+
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - platformctl stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_PLATFORM_H_
+#define _HOST_SYS_PLATFORM_H_
+
+#include <phoenix/arch/stm32l4.h>
+
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - power management stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_PWMAN_H_
+#define _HOST_SYS_PWMAN_H_
+
+extern void keepidle(int idle);
+
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - threads stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_THREADS_H_
+#define _HOST_SYS_THREADS_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#define EOK 0
+
+
+typedef unsigned int handle_t;
+
+
+extern int mutexCreate(handle_t *h);
+
+
+extern int mutexLock(handle_t h);
+
+
+extern int mutexUnlock(handle_t h);
+
+
+extern int condCreate(handle_t *h);
+
+
+/* Provided by each model, it runs the emulated hardware until the waiter would be woken */
+extern int condWait(handle_t h, handle_t m, time_t timeout);
+
+
+extern int condSignal(handle_t h);
+
+
+extern int condBroadcast(handle_t h);
+
+
+extern int beginthread(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg);
+
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - time stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_TIME_H_
+#define _HOST_SYS_TIME_H_
+
+#include_next <sys/time.h>
+
+
+/* Simulated time in us */
+extern int gettime(time_t *raw, time_t *offs);
+
+
+#endif
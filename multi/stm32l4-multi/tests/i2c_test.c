@@ -0,0 +1,439 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 I2C driver host tests
+ *
+ * Runs i2c.c against a model of I2C2 at 100 kHz with two slaves,
+ * an EEPROM with 16-bit address pointer at 0x50 and a sensor with
+ * 8-bit register pointer at 0x48, and DMA1 channels 4 (TX) and 5 (RX).
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../i2c.c"
+#include "sim.h"
+
+
+#define MODEL_BYTE_US 90.0      /* 9 bits at 100 kHz */
+#define MODEL_STOP_US 10.0
+#define MODEL_IRQ_US  1.0       /* Interrupt entry and exit */
+#define MODEL_WAKE_US 5.0       /* Waking the waiting thread */
+
+#define MODEL_EEPROM 0x50
+#define MODEL_SENSOR 0x48
+
+
+/* I2C_CR1 */
+#define TXDMAEN (1 << 14)
+#define RXDMAEN (1 << 15)
+
+/* I2C_CR2 */
+#define RD_WRN (1 << 10)
+#define START  (1 << 13)
+#define STOP   (1 << 14)
+#define RELOAD (1 << 24)
+
+
+enum { dma_isr = 0, dma_ifcr, dma_ccr1, dma_cndtr1, dma_cpar1, dma_cmar1, dma_cselr = 42 };
+
+
+#define DMA_CHAN(reg, chan) ((reg) + 5 * ((chan) - 1))
+
+/* DMA1 request mapping (RM0394), I2C2 requests at CxS = 3 */
+#define DMA_I2C2_REQ 3
+#define DMA_I2C2_TX  4
+#define DMA_I2C2_RX  5
+
+
+struct {
+	mmio_t i2c;
+	mmio_t dma1;
+
+	unsigned char eeprom[4096];
+	unsigned char sensor[256];
+	unsigned int eptr;
+	unsigned int sptr;
+
+	/* Transfer on the bus */
+	int active;
+	int slave;
+	int rd;
+	unsigned int nbytes;
+	unsigned int written;
+
+	unsigned int bytes;
+	int nack;
+	int stall;
+
+	unsigned long irqs;
+	unsigned long wakeups;
+} model;
+
+
+static volatile uint32_t *model_i2c(void)
+{
+	return model.i2c.regs;
+}
+
+
+static void model_i2cWrite(mmio_t *m, unsigned int offs, uint32_t old)
+{
+	volatile uint32_t *r = m->regs;
+	unsigned int v;
+
+	if (offs / 4 == icr) {
+		r[isr] &= ~r[icr];
+		r[icr] = 0;
+		return;
+	}
+
+	if (offs / 4 != cr2)
+		return;
+
+	v = r[cr2];
+	r[cr2] = v & ~(START | STOP);
+	r[isr] &= ~(I2C_TC | I2C_TCR);
+
+	if (v & STOP) {
+		r[isr] |= I2C_STOPF;
+		model.active = 0;
+		sim_us += MODEL_STOP_US;
+		return;
+	}
+
+	model.nbytes = (v >> 16) & 0xff;
+
+	if (v & START) {
+		sim_us += MODEL_BYTE_US;
+		model.slave = (v >> 1) & 0x7f;
+		model.rd = !!(v & RD_WRN);
+		model.written = 0;
+
+		/* Address NACK, master sends STOP by itself */
+		if (model.slave != MODEL_EEPROM && model.slave != MODEL_SENSOR) {
+			r[isr] |= I2C_NACKF | I2C_STOPF;
+			model.active = 0;
+			return;
+		}
+
+		model.active = 1;
+	}
+
+	if (model.active && model.nbytes == 0)
+		r[isr] |= (v & RELOAD) ? I2C_TCR : I2C_TC;
+}
+
+
+static void model_dmaWrite(mmio_t *m, unsigned int offs, uint32_t old)
+{
+	volatile uint32_t *d = m->regs;
+
+	if (offs / 4 == dma_ifcr) {
+		d[dma_isr] &= ~d[dma_ifcr];
+		d[dma_ifcr] = 0;
+	}
+}
+
+
+static void model_slaveWrite(unsigned char c)
+{
+	if (model.slave == MODEL_EEPROM) {
+		if (model.written == 0)
+			model.eptr = (c << 8) & 0xfff;
+		else if (model.written == 1)
+			model.eptr |= c;
+		else
+			model.eeprom[model.eptr++ % sizeof(model.eeprom)] = c;
+	}
+	else {
+		if (model.written == 0)
+			model.sptr = c;
+		else
+			model.sensor[model.sptr++ % sizeof(model.sensor)] = c;
+	}
+
+	++model.written;
+}
+
+
+static unsigned char model_slaveRead(void)
+{
+	if (model.slave == MODEL_EEPROM)
+		return model.eeprom[model.eptr++ % sizeof(model.eeprom)];
+
+	return model.sensor[model.sptr++ % sizeof(model.sensor)];
+}
+
+
+static int model_irq(unsigned int n)
+{
+	++model.irqs;
+	cpu_us += MODEL_IRQ_US;
+	sim_us += MODEL_IRQ_US;
+
+	return sim_irq(n);
+}
+
+
+/* Moves one byte through the channel serving I2C2 request, returns 1 on the last one */
+static int model_dma(int rd, volatile uint32_t *data)
+{
+	const int chan = rd ? DMA_I2C2_RX : DMA_I2C2_TX;
+	volatile uint32_t *d = model.dma1.regs;
+	volatile uint8_t *p = (void *)(uintptr_t)d[DMA_CHAN(dma_cmar1, chan)];
+
+	/* Channel is enabled, mapped to I2C2, and reads memory (DIR) only for TX */
+	if (!(d[DMA_CHAN(dma_ccr1, chan)] & 1) || d[DMA_CHAN(dma_cndtr1, chan)] == 0 ||
+			((d[dma_cselr] >> (4 * (chan - 1))) & 0xf) != DMA_I2C2_REQ ||
+			((d[DMA_CHAN(dma_ccr1, chan)] >> 4) & 1) == (uint32_t)rd ||
+			d[DMA_CHAN(dma_cpar1, chan)] != (uint32_t)(uintptr_t)((volatile uint32_t *)model.i2c.addr + (rd ? rxdr : txdr))) {
+		printf("i2c_test: DMA channel %d not ready\n", chan);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Stalled channel doesn't take the last byte */
+	if (rd && model.stall && d[DMA_CHAN(dma_cndtr1, chan)] == 1)
+		return 0;
+
+	if (rd)
+		*p = *data;
+	else
+		*data = *p;
+
+	d[DMA_CHAN(dma_cmar1, chan)] += 1;
+
+	if (--d[DMA_CHAN(dma_cndtr1, chan)] != 0)
+		return 0;
+
+	d[dma_isr] |= 0x2 << (4 * (chan - 1));
+	model_irq(16 + 10 + chan);
+
+	return 1;
+}
+
+
+/* Runs the bus until something wakes the waiting thread */
+int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	volatile uint32_t *r = model_i2c();
+	unsigned int ie;
+
+	for (;;) {
+		ie = r[cr1];
+
+		if ((r[isr] & (I2C_TC | I2C_TCR | I2C_STOPF | I2C_ERRORS)) && (ie & I2C_EVENTS)) {
+			if (model_irq(16 + 33) >= 0)
+				break;
+			continue;
+		}
+
+		if (!model.active || model.nbytes == 0)
+			return -ETIME;
+
+		if (!model.rd) {
+			if (ie & TXDMAEN) {
+				/* TX completion wakes the thread, it goes back to wait for TC */
+				if (model_dma(0, &r[txdr])) {
+					++model.wakeups;
+					cpu_us += MODEL_WAKE_US;
+					sim_us += MODEL_WAKE_US;
+				}
+			}
+			else {
+				r[isr] |= I2C_TXIS;
+				if (!(ie & I2C_TXIE))
+					return -ETIME;
+				model_irq(16 + 33);
+			}
+
+			r[isr] &= ~I2C_TXIS;
+
+			if (model.nack == model.bytes) {
+				r[isr] |= I2C_NACKF | I2C_STOPF;
+				model.active = 0;
+				model.nack = -1;
+				continue;
+			}
+
+			model_slaveWrite(r[txdr]);
+		}
+		else {
+			r[rxdr] = model_slaveRead();
+			r[isr] |= I2C_RXNE;
+
+			if (ie & RXDMAEN) {
+				model_dma(1, &r[rxdr]);
+			}
+			else {
+				if (!(ie & I2C_RXIE))
+					return -ETIME;
+				model_irq(16 + 33);
+			}
+
+			r[isr] &= ~I2C_RXNE;
+		}
+
+		sim_us += MODEL_BYTE_US;
+		++model.bytes;
+
+		if (--model.nbytes == 0)
+			r[isr] |= (r[cr2] & RELOAD) ? I2C_TCR : I2C_TC;
+	}
+
+	++model.wakeups;
+	cpu_us += MODEL_WAKE_US;
+	sim_us += MODEL_WAKE_US;
+
+	return EOK;
+}
+
+
+static void test_reset(void)
+{
+	sim_us = 0;
+	cpu_us = 0;
+	model.irqs = 0;
+	model.wakeups = 0;
+}
+
+
+static void test_report(const char *name)
+{
+	printf("%-32s %8.0f us  irqs %4lu  wakeups %2lu  cpu %5.2f%%\n", name, sim_us, model.irqs, model.wakeups, 100 * cpu_us / sim_us);
+}
+
+
+static int test_transfers(void)
+{
+	static const i2cseg_t rseg[] = { { 2, 0 }, { 64, i2cseg_read } };
+	static const i2cseg_t wseg[] = { { 2, 0 }, { 64, i2cseg_nostart } };
+	static const i2cseg_t lseg[] = { { 2, 0 }, { 1000, i2cseg_read } };
+	static unsigned char in[2048], out[2048];
+	signed char status[I2C_XFER_SEGMENTS];
+	int i;
+
+	/* Sensor block, 8-bit register */
+	test_reset();
+	TEST_CHECK(i2c_transaction(_i2c_read, MODEL_SENSOR, 0x10, in, 6) == 6);
+	for (i = 0; i < 6; ++i)
+		TEST_CHECK(in[i] == ((0x10 + i) ^ 0xa5));
+	test_report("sensor 6 B read");
+
+	/* EEPROM page read, 16-bit address */
+	out[0] = 0x01;
+	out[1] = 0x40;
+	test_reset();
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, rseg, 2, in, sizeof(in), out, 2, status) == 66 && status[0] == EOK && status[1] == EOK);
+	for (i = 0; i < 64; ++i)
+		TEST_CHECK(in[i] == (unsigned char)((0x140 + i) * 7));
+	test_report("eeprom 64 B read, 16-bit addr");
+
+	/* EEPROM page write, address and data glued without start */
+	out[0] = 0x02;
+	out[1] = 0x00;
+	for (i = 0; i < 64; ++i)
+		out[2 + i] = 0xc0 + i;
+	test_reset();
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, wseg, 2, in, 0, out, 66, status) == 66 && status[0] == EOK && status[1] == EOK);
+	for (i = 0; i < 64; ++i)
+		TEST_CHECK(model.eeprom[0x200 + i] == 0xc0 + i);
+	test_report("eeprom 64 B write, 16-bit addr");
+
+	/* Long read split with RELOAD */
+	out[0] = 0;
+	out[1] = 0;
+	test_reset();
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, lseg, 2, in, sizeof(in), out, 2, status) == 1002);
+	for (i = 0; i < 1000; ++i)
+		TEST_CHECK(in[i] == model.eeprom[i]);
+	test_report("eeprom 1000 B read (RELOAD)");
+
+	/* No device */
+	TEST_CHECK(i2c_xferList(0x33, rseg, 2, in, sizeof(in), out, 2, status) == -ENXIO && status[0] == -ENXIO && status[1] == -EAGAIN);
+
+	/* Data NACK in the second segment */
+	model.nack = model.bytes + 2 + 10;
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, wseg, 2, in, 0, out, 66, status) == -EIO && status[0] == EOK && status[1] == -EIO);
+
+	/* Bus is usable after errors */
+	TEST_CHECK(i2c_transaction(_i2c_read, MODEL_SENSOR, 0x10, in, 6) == 6 && in[0] == (0x10 ^ 0xa5));
+
+	/* Invalid segment lists */
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, wseg + 1, 1, in, 0, out, 66, status) == -EINVAL);
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, rseg, 2, in, 63, out, 2, status) == -EINVAL);
+
+	return EOK;
+}
+
+
+static int test_interrupt(void)
+{
+	int dma = i2c_common.dma, err;
+
+	printf("data phase: interrupt handler\n");
+	i2c_common.dma = 0;
+	err = test_transfers();
+	i2c_common.dma = dma;
+
+	return err;
+}
+
+
+static int test_dma(void)
+{
+	static const i2cseg_t rseg[] = { { 2, 0 }, { 64, i2cseg_read } };
+	static unsigned char in[64], out[2];
+	signed char status[2];
+
+	TEST_CHECK(i2c_common.dma);
+	printf("data phase: DMA\n");
+	TEST_CHECK(test_transfers() == EOK);
+
+	/* Bus finished the chunk but DMA didn't, it fails instead of hanging */
+	model.stall = 1;
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, rseg, 2, in, sizeof(in), out, 2, status) == -EIO && status[1] == -EIO);
+	model.stall = 0;
+
+	TEST_CHECK(i2c_xferList(MODEL_EEPROM, rseg, 2, in, sizeof(in), out, 2, status) == 66);
+
+	return EOK;
+}
+
+
+int main(void)
+{
+	int i;
+
+	model.i2c.addr = 0x40005800;
+	model.i2c.size = 0x400;
+	model.i2c.write = model_i2cWrite;
+	mmio_map(&model.i2c);
+
+	model.dma1.addr = 0x40020000;
+	model.dma1.size = 0x400;
+	model.dma1.write = model_dmaWrite;
+	mmio_map(&model.dma1);
+
+	for (i = 0; i < sizeof(model.sensor); ++i)
+		model.sensor[i] = i ^ 0xa5;
+
+	for (i = 0; i < sizeof(model.eeprom); ++i)
+		model.eeprom[i] = i * 7;
+
+	model.nack = -1;
+
+	dma_init();
+	i2c_init();
+
+	TEST_CASE(test_interrupt());
+	TEST_CASE(test_dma());
+
+	return sim_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
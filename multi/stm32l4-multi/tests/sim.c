@@ -0,0 +1,271 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - emulated peripherals
+ *
+ * Register pages are mapped read-only at their hardware addresses.
+ * A write faults, the page is opened for one instruction executed
+ * with the trap flag set and the model is told about the new value.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/threads.h>
+#include <sys/time.h>
+
+#include "sim.h"
+
+
+#define SIM_PAGE    0x1000
+#define SIM_PAGES   8
+#define SIM_REGIONS 8
+#define SIM_IRQS    128
+
+#define EFLAGS_TF 0x100
+
+
+struct {
+	struct {
+		uintptr_t addr;
+		volatile char *alias;
+	} pages[SIM_PAGES];
+	int npages;
+
+	mmio_t *regions[SIM_REGIONS];
+	int nregions;
+
+	struct {
+		int (*f)(unsigned int, void *);
+		void *arg;
+	} irqs[SIM_IRQS];
+
+	/* Write in progress */
+	uintptr_t page;
+	mmio_t *region;
+	unsigned int offs;
+	uint32_t old;
+} sim_common;
+
+
+double sim_us, cpu_us;
+int sim_failed;
+
+
+static void sim_fatal(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+
+static void sim_segv(int sig, siginfo_t *info, void *arg)
+{
+	ucontext_t *ctx = arg;
+	uintptr_t addr = (uintptr_t)info->si_addr, page = addr & ~(uintptr_t)(SIM_PAGE - 1);
+	int i;
+
+	for (i = 0; i < sim_common.npages && sim_common.pages[i].addr != page; ++i)
+		;
+
+	/* Not ours, fault again with the default action */
+	if (i == sim_common.npages) {
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+
+	sim_common.page = page;
+	sim_common.region = NULL;
+
+	for (i = 0; i < sim_common.nregions; ++i) {
+		if (addr >= sim_common.regions[i]->addr && addr < sim_common.regions[i]->addr + sim_common.regions[i]->size) {
+			sim_common.region = sim_common.regions[i];
+			sim_common.offs = (addr - sim_common.region->addr) & ~3u;
+			sim_common.old = MMIO_REG(sim_common.region, sim_common.offs);
+			break;
+		}
+	}
+
+	mprotect((void *)page, SIM_PAGE, PROT_READ | PROT_WRITE);
+	ctx->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+
+static void sim_step(int sig, siginfo_t *info, void *arg)
+{
+	ucontext_t *ctx = arg;
+	mmio_t *m = sim_common.region;
+
+	ctx->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+	mprotect((void *)sim_common.page, SIM_PAGE, PROT_READ);
+
+	if (m != NULL && m->write != NULL)
+		m->write(m, sim_common.offs, sim_common.old);
+}
+
+
+void mmio_map(mmio_t *m)
+{
+	uintptr_t page = m->addr & ~(uintptr_t)(SIM_PAGE - 1);
+	struct sigaction sa;
+	void *p;
+	int i, fd;
+
+	if (m->addr + m->size > page + SIM_PAGE || sim_common.nregions == SIM_REGIONS)
+		sim_fatal("mmio_map: region");
+
+	for (i = 0; i < sim_common.npages && sim_common.pages[i].addr != page; ++i)
+		;
+
+	if (i == sim_common.npages) {
+		if (i == SIM_PAGES)
+			sim_fatal("mmio_map: pages");
+
+		if ((fd = memfd_create("mmio", 0)) < 0 || ftruncate(fd, SIM_PAGE) < 0)
+			sim_fatal("mmio_map: memfd");
+
+		if ((p = mmap((void *)page, SIM_PAGE, PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0)) != (void *)page)
+			sim_fatal("mmio_map: mmap");
+
+		if ((p = mmap(NULL, SIM_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+			sim_fatal("mmio_map: alias");
+
+		close(fd);
+
+		sim_common.pages[i].addr = page;
+		sim_common.pages[i].alias = p;
+		++sim_common.npages;
+
+		if (i == 0) {
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_flags = SA_SIGINFO;
+			sa.sa_sigaction = sim_segv;
+			sigaction(SIGSEGV, &sa, NULL);
+			sa.sa_sigaction = sim_step;
+			sigaction(SIGTRAP, &sa, NULL);
+		}
+	}
+
+	m->regs = sim_common.pages[i].alias + (m->addr - page);
+	sim_common.regions[sim_common.nregions++] = m;
+}
+
+
+/* Phoenix API, single threaded */
+
+
+int mutexCreate(handle_t *h)
+{
+	*h = 0;
+	return EOK;
+}
+
+
+int mutexLock(handle_t h)
+{
+	return EOK;
+}
+
+
+int mutexUnlock(handle_t h)
+{
+	return EOK;
+}
+
+
+/* Conditionals get distinct handles, models tell waiters apart by them */
+int condCreate(handle_t *h)
+{
+	static handle_t last;
+
+	*h = ++last;
+	return EOK;
+}
+
+
+int condSignal(handle_t h)
+{
+	return EOK;
+}
+
+
+int condBroadcast(handle_t h)
+{
+	return EOK;
+}
+
+
+/* Threads of the drivers aren't started, tests run them */
+int beginthread(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg)
+{
+	return EOK;
+}
+
+
+int interrupt(unsigned int n, int (*f)(unsigned int, void *), void *arg, handle_t cond, handle_t *handle)
+{
+	if (n >= SIM_IRQS)
+		sim_fatal("interrupt");
+
+	sim_common.irqs[n].f = f;
+	sim_common.irqs[n].arg = arg;
+	*handle = n;
+
+	return EOK;
+}
+
+
+int sim_irq(unsigned int n)
+{
+	if (n >= SIM_IRQS || sim_common.irqs[n].f == NULL)
+		return -1;
+
+	return sim_common.irqs[n].f(n, sim_common.irqs[n].arg);
+}
+
+
+void keepidle(int idle)
+{
+}
+
+
+int gettime(time_t *raw, time_t *offs)
+{
+	*raw = (time_t)sim_us;
+
+	if (offs != NULL)
+		*offs = 0;
+
+	return EOK;
+}
+
+
+/* Drivers' neighbours */
+
+
+int rcc_devClk(int dev, int state)
+{
+	return EOK;
+}
+
+
+int rcc_getCpufreq(void)
+{
+	return 80000000;
+}
+
+
+int gpio_configPin(int port, char pin, char mode, char af, char otype, char ospeed, char pupd)
+{
+	return EOK;
+}
@@ -0,0 +1,69 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 multi-driver host tests - emulated peripherals
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+
+typedef struct _mmio_t mmio_t;
+
+
+struct _mmio_t {
+	uintptr_t addr;            /* address used by the driver */
+	size_t size;
+	volatile void *regs;       /* model's view of the same registers, its accesses aren't trapped */
+
+	/* Called after the driver wrote to the word at offs, old holds its previous value */
+	void (*write)(mmio_t *m, unsigned int offs, uint32_t old);
+};
+
+
+#define MMIO_REG(m, offs) (*(volatile uint32_t *)((volatile char *)(m)->regs + (offs)))
+
+
+/* Maps registers at m->addr, driver writes to them call m->write (x86-64 Linux, -no-pie) */
+extern void mmio_map(mmio_t *m);
+
+
+/* Calls the handler registered for interrupt n, returns its result or -1 */
+extern int sim_irq(unsigned int n);
+
+
+/* Simulated time and the part of it spent on the CPU in us */
+extern double sim_us, cpu_us;
+
+
+extern int sim_failed;
+
+
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			return -1; \
+		} \
+	} while (0)
+
+
+#define TEST_CASE(test) \
+	do { \
+		int _err = (test); \
+		printf("%-32s -- %s\n", #test, (_err == 0) ? "PASSED" : "FAILED"); \
+		sim_failed += (_err != 0); \
+	} while (0)
+
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * Phoenix-RTOS
+ *
+ * STM32L4 SPI driver host tests
+ *
+ * Runs spi.c against a model of SPI1 at 10 MHz looped back through
+ * a slave answering each byte with the byte XOR 0x5a, and DMA1
+ * channels 2 (RX) and 3 (TX). Reports time and CPU load per transfer.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../spi.c"
+#include "sim.h"
+
+
+#define MODEL_BYTE_US  0.8      /* 10 MHz */
+#define MODEL_IRQ_US   1.0      /* Interrupt entry and exit */
+#define MODEL_WAKE_US  5.0      /* Waking the waiting thread */
+#define MODEL_POLL_US  0.5      /* Driver work around a polled byte */
+#define MODEL_SETUP_US 2.0      /* Driver work around a DMA transfer */
+
+#define MODEL_XOR 0x5a
+
+
+/* SPI_CR2 */
+#define RXDMAEN (1 << 0)
+#define TXDMAEN (1 << 1)
+#define TXEIE   (1 << 7)
+
+
+enum { dma_isr = 0, dma_ifcr, dma_ccr1, dma_cndtr1, dma_cpar1, dma_cmar1, dma_cselr = 42 };
+
+
+#define DMA_CHAN(reg, chan) ((reg) + 5 * ((chan) - 1))
+
+
+struct {
+	mmio_t spi;
+	mmio_t dma1;
+
+	/* Bytes seen by the slave */
+	unsigned char slave[0x20000];
+	unsigned int pos;
+
+	unsigned long wakeups;
+	unsigned int errors;
+} model;
+
+
+static struct {
+	unsigned char ibuff[0x10000];
+	unsigned char obuff[0x10000];
+} test_common;
+
+
+static unsigned char model_exchange(unsigned char txd)
+{
+	model.slave[model.pos++ % sizeof(model.slave)] = txd;
+
+	return txd ^ MODEL_XOR;
+}
+
+
+static void model_spiWrite(mmio_t *m, unsigned int offs, uint32_t old)
+{
+	volatile uint16_t *r = m->regs;
+
+	if (offs == 2 * dr) {
+		/* Received byte is ready by the time TXE interrupt comes */
+		*(volatile uint8_t *)(r + dr) = model_exchange(*(volatile uint8_t *)(r + dr));
+	}
+	else if (offs == 2 * cr2) {
+		/* RX DMA request has to be enabled first */
+		if ((r[cr2] & TXDMAEN) && !(old & TXDMAEN) && !(r[cr2] & RXDMAEN))
+			++model.errors;
+	}
+}
+
+
+static void model_dmaWrite(mmio_t *m, unsigned int offs, uint32_t old)
+{
+	volatile uint32_t *d = m->regs;
+
+	if (offs / 4 == dma_ifcr) {
+		d[dma_isr] &= ~d[dma_ifcr];
+		d[dma_ifcr] = 0;
+	}
+}
+
+
+static int model_dmaReady(volatile uint32_t *d, int chan)
+{
+	/* Byte transfers with SPI1 data register as the peripheral, request 1 */
+	return (d[DMA_CHAN(dma_ccr1, chan)] & 1) && ((d[dma_cselr] >> (4 * (chan - 1))) & 0xf) == 1 &&
+		d[DMA_CHAN(dma_cpar1, chan)] == model.spi.addr + 2 * dr && !(d[DMA_CHAN(dma_ccr1, chan)] & (0xf << 8));
+}
+
+
+static void model_dmaTransfer(void)
+{
+	volatile uint32_t *d = model.dma1.regs;
+	volatile uint8_t *rx = (void *)(uintptr_t)d[DMA_CHAN(dma_cmar1, 2)];
+	volatile uint8_t *tx = (void *)(uintptr_t)d[DMA_CHAN(dma_cmar1, 3)];
+	int rxinc = d[DMA_CHAN(dma_ccr1, 2)] & (1 << 7), txinc = d[DMA_CHAN(dma_ccr1, 3)] & (1 << 7);
+	unsigned int i, n = d[DMA_CHAN(dma_cndtr1, 2)];
+
+	if (n != d[DMA_CHAN(dma_cndtr1, 3)] || !(d[DMA_CHAN(dma_ccr1, 3)] & (1 << 4)) || (d[DMA_CHAN(dma_ccr1, 2)] & (1 << 4)))
+		++model.errors;
+
+	for (i = 0; i < n; ++i)
+		rx[rxinc ? i : 0] = model_exchange(tx[txinc ? i : 0]);
+
+	d[DMA_CHAN(dma_cndtr1, 2)] = 0;
+	d[DMA_CHAN(dma_cndtr1, 3)] = 0;
+	d[dma_isr] |= (0x3 << 4) | (0x3 << 8);
+
+	sim_us += MODEL_SETUP_US + n * MODEL_BYTE_US + 2 * MODEL_IRQ_US;
+	cpu_us += MODEL_SETUP_US + 2 * MODEL_IRQ_US;
+
+	sim_irq(16 + 13);
+	sim_irq(16 + 12);
+}
+
+
+/* Runs the bus until the waiting thread would be woken */
+int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	volatile uint16_t *r = model.spi.regs;
+	volatile uint32_t *d = model.dma1.regs;
+
+	if ((r[cr2] & (RXDMAEN | TXDMAEN)) == (RXDMAEN | TXDMAEN) && model_dmaReady(d, 2) && model_dmaReady(d, 3)) {
+		model_dmaTransfer();
+	}
+	else if (r[cr2] & TXEIE) {
+		sim_us += MODEL_BYTE_US + MODEL_IRQ_US;
+		cpu_us += MODEL_POLL_US + MODEL_IRQ_US;
+		sim_irq(spi1_irq);
+	}
+	else {
+		printf("spi_test: waiting with nothing started\n");
+		exit(EXIT_FAILURE);
+	}
+
+	sim_us += MODEL_WAKE_US;
+	cpu_us += MODEL_WAKE_US;
+	++model.wakeups;
+
+	return EOK;
+}
+
+
+static void test_reset(void)
+{
+	sim_us = 0;
+	cpu_us = 0;
+	model.wakeups = 0;
+	model.pos = 0;
+}
+
+
+static int test_transaction(int dir, const char *name, size_t len)
+{
+	const int reps = 20;
+	size_t i;
+	int k;
+
+	for (i = 0; i < len; ++i)
+		test_common.obuff[i] = rand();
+
+	test_reset();
+
+	for (k = 0; k < reps; ++k) {
+		memset(test_common.ibuff, 0, len);
+		TEST_CHECK(spi_transaction(spi1, dir, 0x0b, 0x123456, spi_cmd | spi_address, test_common.ibuff, test_common.obuff, len) == len);
+	}
+
+	/* Slave got command, address and data */
+	TEST_CHECK(model.pos == reps * (len + 4) && !model.errors);
+	TEST_CHECK(model.slave[0] == 0x0b && model.slave[1] == 0x12 && model.slave[2] == 0x34 && model.slave[3] == 0x56);
+
+	for (i = 0; i < len; ++i) {
+		TEST_CHECK(model.slave[(reps - 1) * (len + 4) + 4 + i] == ((dir == spi_read) ? 0 : test_common.obuff[i]));
+
+		if (dir != spi_write)
+			TEST_CHECK(test_common.ibuff[i] == (((dir == spi_read) ? 0 : test_common.obuff[i]) ^ MODEL_XOR));
+		else
+			TEST_CHECK(test_common.ibuff[i] == 0);
+	}
+
+	printf("%-10s %5zu B: %8.1f us %8.1f KiB/s  cpu %5.1f%%  wakeups %lu\n", name, len, sim_us / reps,
+		len * reps / sim_us * 1e6 / 1024, 100 * cpu_us / sim_us, model.wakeups / reps);
+
+	return EOK;
+}
+
+
+static int test_transactions(void)
+{
+	static const size_t sizes[] = { 4, 16, 256, 4096 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		TEST_CHECK(test_transaction(spi_read, "read", sizes[i]) == EOK);
+		TEST_CHECK(test_transaction(spi_write, "write", sizes[i]) == EOK);
+		TEST_CHECK(test_transaction(spi_readwrite, "readwrite", sizes[i]) == EOK);
+	}
+
+	return EOK;
+}
+
+
+static int test_xferList(void)
+{
+	static const spiseg_t seg[] = { { 4, spixfer_out }, { 2048, spixfer_in }, { 2048, spixfer_in | spixfer_out }, { 100, 0 } };
+	unsigned int i;
+
+	for (i = 0; i < 4 + 2048; ++i)
+		test_common.obuff[i] = i;
+
+	test_reset();
+	TEST_CHECK(spi_xferList(spi1, seg, 4, test_common.ibuff, 4096, test_common.obuff, 4 + 2048) == 4 + 2048 + 2048 + 100);
+	TEST_CHECK(model.pos == 4 + 2048 + 2048 + 100 && !model.errors);
+	printf("xfer list 4 + 2048 + 2048 + 100: %.1f us, wakeups %lu\n", sim_us, model.wakeups);
+
+	/* Outputs are packed, inputs too */
+	for (i = 0; i < 4; ++i)
+		TEST_CHECK(model.slave[i] == i);
+
+	for (i = 0; i < 2048; ++i) {
+		TEST_CHECK(model.slave[4 + i] == 0 && test_common.ibuff[i] == MODEL_XOR);
+		TEST_CHECK(model.slave[4 + 2048 + i] == (unsigned char)(4 + i) && test_common.ibuff[2048 + i] == (unsigned char)((4 + i) ^ MODEL_XOR));
+	}
+
+	for (i = 0; i < 100; ++i)
+		TEST_CHECK(model.slave[4 + 4096 + i] == 0);
+
+	/* Buffers too short for the segments */
+	TEST_CHECK(spi_xferList(spi1, seg, 4, test_common.ibuff, 4095, test_common.obuff, 4 + 2048) == -EINVAL);
+	TEST_CHECK(spi_xferList(spi1, seg, 4, test_common.ibuff, 4096, test_common.obuff, 4 + 2047) == -EINVAL);
+	TEST_CHECK(spi_xferList(spi2, seg, 4, test_common.ibuff, 4096, test_common.obuff, 4 + 2048) == -EINVAL);
+
+	return EOK;
+}
+
+
+int main(void)
+{
+	model.spi.addr = 0x40013000;
+	model.spi.size = 0x400;
+	model.spi.write = model_spiWrite;
+	mmio_map(&model.spi);
+
+	model.dma1.addr = 0x40020000;
+	model.dma1.size = 0x400;
+	model.dma1.write = model_dmaWrite;
+	mmio_map(&model.dma1);
+
+	dma_init();
+	spi_init();
+
+	TEST_CASE(test_transactions());
+	TEST_CASE(test_xferList());
+
+	return sim_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,770 @@
+/*
+ * Phoenix-RTOS
+ *
+ * IMX6ULL NAND flash block translation layer.
+ *
+ * Logical erase blocks are mapped onto physical blocks of the partition.
+ * Every programmed page carries a header in its metadata (logical block,
+ * erase count, sequence number and length of the relocation which created
+ * the copy), which is used to rebuild the mapping on mount. A copy counts
+ * only once the last page of its relocation is programmed.
+ *
+ * Pages of a block are programmed strictly in order, skipped pages are
+ * padded, so the write pointer is found again on mount. A write below the
+ * write pointer relocates the logical block into a fresh physical one.
+ * Replaced blocks stay stale with their headers, and so with their erase
+ * counts, until they are needed - the garbage collector thread only keeps
+ * a few of them erased in advance.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/msg.h>
+#include <sys/minmax.h>
+#include <sys/mman.h>
+#include <sys/threads.h>
+
+#include "flashbtl.h"
+#include "flashdrv.h"
+#include "flashsrv.h"
+
+#define LOG_ERROR(str, ...) do { fprintf(stderr, __FILE__  ":%d error: " str "\n", __LINE__, ##__VA_ARGS__); } while (0)
+#define TRACE(str, ...) do { if (0) fprintf(stderr, __FILE__  ":%d trace: " str "\n", __LINE__, ##__VA_ARGS__); } while (0)
+
+#define BTL_MAGIC 0x324c5442 /* "BTL2" */
+#define BTL_NONE ((uint32_t)-1)
+
+/* blocks reserved for bad block replacement and relocations: 1/32 of partition, at least 4 */
+#define BTL_SPARE_MIN 4
+#define BTL_SPARE_DIV 32
+
+/* erase count spread between used and free blocks which triggers static wear leveling */
+#define BTL_WL_THRESHOLD 64
+
+/* erased blocks kept ready by the garbage collector, their erase counts are estimated after power loss */
+#define BTL_ERASED_RESERVE 2
+
+/* blocks with nothing readable taken for interrupted erases or first programs - more and mount is refused */
+#define BTL_UNREADABLE_MAX 2
+
+
+typedef struct {
+	uint32_t magic;
+	uint32_t lblock : 24;
+	uint32_t npages : 8;
+	uint32_t erasecnt;
+	uint32_t seq;
+} flashbtl_oob_t;
+
+
+enum { btl_free = 0, btl_used, btl_stale, btl_bad, btl_foreign, btl_unreadable };
+
+
+typedef struct {
+	uint32_t erasecnt;
+	uint32_t lblock;
+	uint32_t seq;
+	uint16_t wp;	/* next page to be programmed */
+	uint8_t npages;	/* pages programmed by the relocation which created the copy */
+	uint8_t state;
+} flashbtl_block_t;
+
+
+struct _flashbtl_t {
+	size_t start;
+	size_t nblocks;
+	size_t nlogical;
+
+	uint32_t seq;
+	unsigned nfree;
+	unsigned nstale;
+	int wlpending;
+	int format;
+
+	flashbtl_block_t *blocks;
+	uint32_t *l2p;
+	const uint32_t *badblocks;
+	flashbtl_eccreport_t eccreport;
+
+	flashdrv_dma_t *dma;
+	char *databuf;
+	char *metabuf;
+
+	handle_t lock, cond;
+	char stack[2048] __attribute__((aligned(8)));
+};
+
+
+static uint32_t btl_paddr(flashbtl_t *btl, uint32_t b, unsigned page)
+{
+	return (btl->start + b) * PAGES_PER_BLOCK + page;
+}
+
+
+/* takes the block out of use for good, the factory marker keeps it out after restart as well */
+static void btl_retire(flashbtl_t *btl, uint32_t b)
+{
+	LOG_ERROR("retiring block %u", (unsigned)(btl->start + b));
+
+	btl->blocks[b].state = btl_bad;
+
+	memset(btl->databuf, 0, RAW_FLASH_PAGE_SIZE);
+	flashdrv_writeraw(btl->dma, btl_paddr(btl, b, 0), btl->databuf, RAW_FLASH_PAGE_SIZE);
+}
+
+
+static int btl_erase(flashbtl_t *btl, uint32_t b)
+{
+	flashbtl_block_t *blk = &btl->blocks[b];
+
+	if (flashdrv_erase(btl->dma, btl_paddr(btl, b, 0)) != EOK) {
+		LOG_ERROR("block %u erase failed", (unsigned)(btl->start + b));
+		btl_retire(btl, b);
+		return -EIO;
+	}
+
+	blk->erasecnt++;
+	blk->lblock = BTL_NONE;
+	blk->wp = 0;
+	blk->state = btl_free;
+	btl->nfree++;
+
+	return EOK;
+}
+
+
+/* returns stale block with the lowest erase count */
+static int btl_coldest(flashbtl_t *btl, int state)
+{
+	uint32_t b;
+	int best = -1;
+
+	for (b = 0; b < btl->nblocks; ++b) {
+		if (btl->blocks[b].state == state && (best < 0 || btl->blocks[b].erasecnt < btl->blocks[best].erasecnt))
+			best = b;
+	}
+
+	return best;
+}
+
+
+/*
+ * returns erased block with the lowest erase count, erasing the coldest stale one if there is none,
+ * or (worn != 0) the erased or stale block with the highest erase count
+ */
+static int btl_alloc(flashbtl_t *btl, int worn)
+{
+	uint32_t b;
+	int best;
+
+	for (;;) {
+		if (!worn) {
+			if ((best = btl_coldest(btl, btl_free)) < 0)
+				best = btl_coldest(btl, btl_stale);
+		}
+		else {
+			for (b = 0, best = -1; b < btl->nblocks; ++b) {
+				if ((btl->blocks[b].state == btl_free || btl->blocks[b].state == btl_stale) &&
+						(best < 0 || btl->blocks[b].erasecnt > btl->blocks[best].erasecnt))
+					best = b;
+			}
+		}
+
+		if (best < 0)
+			return -ENOSPC;
+
+		if (btl->blocks[best].state == btl_stale) {
+			btl->nstale--;
+			if (btl_erase(btl, best) != EOK)
+				continue;
+		}
+
+		btl->nfree--;
+
+		return best;
+	}
+}
+
+
+static void btl_release(flashbtl_t *btl, uint32_t b)
+{
+	btl->blocks[b].state = btl_stale;
+	btl->nstale++;
+	condSignal(btl->cond);
+}
+
+
+/* programs databuf into the page, tagging it with the block header */
+static int btl_program(flashbtl_t *btl, uint32_t b, unsigned page)
+{
+	flashbtl_block_t *blk = &btl->blocks[b];
+	flashbtl_oob_t oob = { BTL_MAGIC, blk->lblock, blk->npages, blk->erasecnt, blk->seq };
+
+	memset(btl->metabuf, 0xff, sizeof(flashdrv_meta_t));
+	memcpy(btl->metabuf, &oob, sizeof(oob));
+
+	return flashdrv_write(btl->dma, btl_paddr(btl, b, page), btl->databuf, btl->metabuf);
+}
+
+
+static int btl_readpage(flashbtl_t *btl, uint32_t b, unsigned page)
+{
+	int err;
+
+	err = flashdrv_read(btl->dma, btl_paddr(btl, b, page), btl->databuf, (flashdrv_meta_t *)btl->metabuf);
+
+	if (btl->eccreport != NULL)
+		btl->eccreport(btl_paddr(btl, b, page), 1, btl->metabuf);
+
+	if (err == flash_uncorrectable) {
+		LOG_ERROR("uncorrectable read of block %u page %u", (unsigned)(btl->start + b), page);
+		return -EIO;
+	}
+
+	return EOK;
+}
+
+
+/* copies logical block into a new physical block replacing pages [page, page + n) with data */
+static int btl_rewrite(flashbtl_t *btl, uint32_t lblock, unsigned page, unsigned n, const char *data, int worn)
+{
+	uint32_t old = btl->l2p[lblock];
+	unsigned i, last = page + n;
+	int b, err;
+
+	if (old != BTL_NONE && btl->blocks[old].wp > last)
+		last = btl->blocks[old].wp;
+
+	for (;;) {
+		if ((b = btl_alloc(btl, worn)) < 0)
+			return b;
+
+		/* newer seq wins on mount only when page npages - 1 made it to flash */
+		btl->blocks[b].lblock = lblock;
+		btl->blocks[b].seq = ++btl->seq;
+		btl->blocks[b].npages = last;
+		btl->blocks[b].state = btl_used;
+
+		for (i = 0, err = EOK; i < last && err == EOK; ++i) {
+			if (i >= page && i < page + n) {
+				memcpy(btl->databuf, data + (i - page) * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+			}
+			else if (old != BTL_NONE && i < btl->blocks[old].wp) {
+				if ((err = btl_readpage(btl, old, i)) < 0) {
+					btl_release(btl, b);
+					return err;
+				}
+			}
+			else {
+				memset(btl->databuf, 0xff, FLASH_PAGE_SIZE);
+			}
+
+			err = btl_program(btl, b, i);
+		}
+
+		if (err == EOK)
+			break;
+
+		LOG_ERROR("block %u program failed", (unsigned)(btl->start + b));
+		btl_retire(btl, b);
+	}
+
+	btl->blocks[b].wp = last;
+	btl->l2p[lblock] = b;
+
+	if (old != BTL_NONE)
+		btl_release(btl, old);
+
+	return EOK;
+}
+
+
+static int btl_write(flashbtl_t *btl, size_t offs, const char *data, size_t size)
+{
+	flashbtl_block_t *blk;
+	uint32_t lblock, b;
+	unsigned page, n, i;
+	size_t done = 0;
+	int err = EOK;
+
+	if ((offs & (FLASH_PAGE_SIZE - 1)) || (size & (FLASH_PAGE_SIZE - 1)))
+		return -EINVAL;
+
+	if (offs + size > btl->nlogical * ERASE_BLOCK_SIZE)
+		return -EINVAL;
+
+	while (done < size) {
+		lblock = (offs + done) / ERASE_BLOCK_SIZE;
+		page = ((offs + done) % ERASE_BLOCK_SIZE) / FLASH_PAGE_SIZE;
+		n = min((size - done) / FLASH_PAGE_SIZE, PAGES_PER_BLOCK - page);
+
+		b = btl->l2p[lblock];
+		blk = (b != BTL_NONE) ? &btl->blocks[b] : NULL;
+
+		if (blk != NULL && page >= blk->wp) {
+			/* pages above the write pointer are still erased - program them in place, skipped ones padded */
+			for (i = blk->wp; i < page + n; ++i) {
+				if (i < page)
+					memset(btl->databuf, 0xff, FLASH_PAGE_SIZE);
+				else
+					memcpy(btl->databuf, data + done + (i - page) * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+
+				if ((err = btl_program(btl, b, i)) != EOK)
+					break;
+				blk->wp = i + 1;
+			}
+
+			/* move what is left into a new block, the failing one will be retired on erase */
+			if (i < page + n) {
+				i = max(i, page);
+				err = btl_rewrite(btl, lblock, i, page + n - i, data + done + (i - page) * FLASH_PAGE_SIZE, 0);
+			}
+		}
+		else {
+			err = btl_rewrite(btl, lblock, page, n, data + done, 0);
+			btl->wlpending = 1;
+		}
+
+		if (err < 0)
+			break;
+
+		done += n * FLASH_PAGE_SIZE;
+	}
+
+	return done ? (int)done : err;
+}
+
+
+static int btl_read(flashbtl_t *btl, size_t offs, char *data, size_t size)
+{
+	flashbtl_block_t *blk;
+	uint32_t lblock, b;
+	unsigned page, pageoffs, len;
+	size_t done = 0;
+	int err;
+
+	if (offs >= btl->nlogical * ERASE_BLOCK_SIZE)
+		return 0;
+
+	size = min(size, btl->nlogical * ERASE_BLOCK_SIZE - offs);
+
+	while (done < size) {
+		lblock = (offs + done) / ERASE_BLOCK_SIZE;
+		page = ((offs + done) % ERASE_BLOCK_SIZE) / FLASH_PAGE_SIZE;
+		pageoffs = (offs + done) & (FLASH_PAGE_SIZE - 1);
+		len = min(size - done, FLASH_PAGE_SIZE - pageoffs);
+
+		b = btl->l2p[lblock];
+		blk = (b != BTL_NONE) ? &btl->blocks[b] : NULL;
+
+		if (blk == NULL || page >= blk->wp) {
+			memset(data + done, 0xff, len);
+		}
+		else {
+			if ((err = btl_readpage(btl, b, page)) < 0)
+				return done ? (int)done : err;
+
+			memcpy(data + done, btl->databuf + pageoffs, len);
+		}
+
+		done += len;
+	}
+
+	return done;
+}
+
+
+/* moves the coldest data onto the most worn free block if erase counts drifted apart */
+static int btl_wearlevel(flashbtl_t *btl)
+{
+	uint32_t b, cold = BTL_NONE, worn = BTL_NONE;
+
+	for (b = 0; b < btl->nblocks; ++b) {
+		if (btl->blocks[b].state == btl_used && (cold == BTL_NONE || btl->blocks[b].erasecnt < btl->blocks[cold].erasecnt))
+			cold = b;
+		else if ((btl->blocks[b].state == btl_free || btl->blocks[b].state == btl_stale) &&
+				(worn == BTL_NONE || btl->blocks[b].erasecnt > btl->blocks[worn].erasecnt))
+			worn = b;
+	}
+
+	if (cold == BTL_NONE || worn == BTL_NONE)
+		return 0;
+
+	if (btl->blocks[worn].erasecnt - btl->blocks[cold].erasecnt <= BTL_WL_THRESHOLD)
+		return 0;
+
+	TRACE("wear leveling: moving logical block %u", btl->blocks[cold].lblock);
+
+	return btl_rewrite(btl, btl->blocks[cold].lblock, 0, 0, NULL, 1);
+}
+
+
+static void flashbtl_gcThread(void *arg)
+{
+	flashbtl_t *btl = arg;
+	int b;
+
+	mutexLock(btl->lock);
+	for (;;) {
+		while ((btl->nfree >= BTL_ERASED_RESERVE || !btl->nstale) && !btl->wlpending)
+			condWait(btl->cond, btl->lock, 0);
+
+		if (btl->nfree < BTL_ERASED_RESERVE && btl->nstale) {
+			/* the coldest stale blocks are the next ones allocated */
+			if ((b = btl_coldest(btl, btl_stale)) >= 0) {
+				btl->nstale--;
+				btl_erase(btl, b);
+			}
+		}
+		else {
+			/* at most one wear leveling move per host triggered relocation */
+			btl->wlpending = 0;
+			btl_wearlevel(btl);
+		}
+
+		/* let pending I/O in between steps */
+		mutexUnlock(btl->lock);
+		mutexLock(btl->lock);
+	}
+}
+
+
+/*
+ * factory bad block marker, only meaningful while page 0 is erased - it shares the raw offset with the metadata,
+ * or page 0 zeroed by btl_retire()
+ */
+static int btl_marked(flashbtl_t *btl, uint32_t b, int erased)
+{
+	unsigned i;
+
+	if (flashdrv_readraw(btl->dma, btl_paddr(btl, b, 0), btl->databuf, RAW_FLASH_PAGE_SIZE) != EOK)
+		return 1;
+
+	if ((uint8_t)btl->databuf[FLASH_PAGE_SIZE] == 0xff)
+		return 0;
+
+	if (erased)
+		return 1;
+
+	for (i = 0; i < FLASH_PAGE_SIZE + sizeof(flashbtl_oob_t); ++i) {
+		if (btl->databuf[i] != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/* copy is complete if the last page of its relocation carries the same header */
+static int btl_complete(flashbtl_t *btl, uint32_t b, const flashbtl_oob_t *hdr)
+{
+	flashbtl_oob_t *oob = (flashbtl_oob_t *)btl->metabuf;
+	uint32_t seq = hdr->seq, lblock = hdr->lblock;
+
+	if (hdr->npages <= 1)
+		return 1;
+
+	if (flashdrv_read(btl->dma, btl_paddr(btl, b, hdr->npages - 1), NULL, (flashdrv_meta_t *)btl->metabuf) == flash_uncorrectable)
+		return 0;
+
+	return oob->magic == BTL_MAGIC && oob->seq == seq && oob->lblock == lblock;
+}
+
+
+/* reads metadata of the page, returns 1 if it is erased, 0 if programmed, -EIO if unreadable */
+static int btl_readmeta(flashbtl_t *btl, uint32_t b, unsigned page)
+{
+	const uint8_t *meta = (const uint8_t *)btl->metabuf;
+	unsigned i;
+
+	if (flashdrv_read(btl->dma, btl_paddr(btl, b, page), NULL, (flashdrv_meta_t *)btl->metabuf) == flash_uncorrectable)
+		return -EIO;
+
+	for (i = 0; i < sizeof(flashbtl_oob_t); ++i) {
+		if (meta[i] != 0xff)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/* finds block header, page 0 first and any other page if that one is unreadable, returns new block state */
+static int btl_scan(flashbtl_t *btl, uint32_t b, flashbtl_oob_t *hdr)
+{
+	flashbtl_oob_t *oob = (flashbtl_oob_t *)btl->metabuf;
+	unsigned page;
+	int err;
+
+	for (page = 0; page < PAGES_PER_BLOCK; ++page) {
+		if ((err = btl_readmeta(btl, b, page)) < 0)
+			continue;
+
+		if (err > 0) {
+			if (page == 0)
+				return btl_free;
+			continue;
+		}
+
+		if (oob->magic != BTL_MAGIC || oob->lblock >= btl->nlogical)
+			return btl_foreign;
+
+		*hdr = *oob;
+		return btl_used;
+	}
+
+	return btl_unreadable;
+}
+
+
+/* pages are programmed in order, the write pointer is the first erased page past the relocated ones */
+static unsigned btl_wp(flashbtl_t *btl, uint32_t b)
+{
+	unsigned lo = btl->blocks[b].npages, hi = PAGES_PER_BLOCK, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		/* an unreadable page was programmed, if only partially */
+		if (btl_readmeta(btl, b, mid) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+
+int flashbtl_mount(void *arg)
+{
+	flashbtl_t *btl = arg;
+	flashbtl_oob_t hdr = { 0 };
+	flashbtl_block_t *blk;
+	uint64_t erasesum = 0;
+	unsigned known = 0, nforeign = 0, nunreadable = 0;
+	uint32_t b, other;
+
+	for (b = 0; b < btl->nblocks; ++b) {
+		blk = &btl->blocks[b];
+		blk->lblock = BTL_NONE;
+
+		/* DBBT lists factory bad blocks and the ones nandtool found */
+		if (btl->badblocks[(btl->start + b) / 32] & (1u << ((btl->start + b) % 32))) {
+			blk->state = btl_bad;
+			continue;
+		}
+
+		blk->state = btl_scan(btl, b, &hdr);
+
+		if (blk->state == btl_free && !btl_marked(btl, b, 1)) {
+			btl->nfree++;
+			continue;
+		}
+
+		if (blk->state != btl_used) {
+			/* never erase a block carrying the factory marker or retired before */
+			if (blk->state == btl_free || btl_marked(btl, b, 0)) {
+				TRACE("block %u is marked bad", (unsigned)(btl->start + b));
+				blk->state = btl_bad;
+			}
+			else if (blk->state == btl_foreign) {
+				nforeign++;
+			}
+			else {
+				nunreadable++;
+			}
+			continue;
+		}
+
+		blk->erasecnt = hdr.erasecnt;
+		erasesum += blk->erasecnt;
+		known++;
+
+		if (hdr.seq > btl->seq)
+			btl->seq = hdr.seq;
+
+		/* relocation interrupted by power loss, the old copy is still valid */
+		if (!btl_complete(btl, b, &hdr)) {
+			TRACE("block %u holds incomplete copy of %u", (unsigned)(btl->start + b), hdr.lblock);
+			blk->state = btl_stale;
+			btl->nstale++;
+			continue;
+		}
+
+		blk->lblock = hdr.lblock;
+		blk->npages = hdr.npages;
+		blk->seq = hdr.seq;
+
+		/* block rewritten more than once - newer copy wins */
+		if ((other = btl->l2p[blk->lblock]) != BTL_NONE) {
+			if (btl->blocks[other].seq > blk->seq) {
+				blk->state = btl_stale;
+				btl->nstale++;
+				continue;
+			}
+
+			btl->blocks[other].state = btl_stale;
+			btl->nstale++;
+		}
+
+		btl->l2p[blk->lblock] = b;
+	}
+
+	/* other data or failing reads, don't destroy anything unless asked to */
+	if (!btl->format && (nforeign || nunreadable > BTL_UNREADABLE_MAX)) {
+		LOG_ERROR("%u blocks of other content, %u unreadable blocks at %u, mount with format mode to erase them",
+			nforeign, nunreadable, (unsigned)btl->start);
+		return -EINVAL;
+	}
+
+	for (b = 0; b < btl->nblocks; ++b) {
+		blk = &btl->blocks[b];
+
+		if (blk->state == btl_used) {
+			blk->wp = btl_wp(btl, b);
+			continue;
+		}
+
+		/* erased blocks don't keep erase counts, assume average wear */
+		if (blk->state == btl_free || blk->state == btl_foreign || blk->state == btl_unreadable)
+			blk->erasecnt = known ? erasesum / known : 0;
+
+		/* format mode erases other content, nothing readable is left of an interrupted erase or first program */
+		if (blk->state == btl_foreign || blk->state == btl_unreadable)
+			btl_erase(btl, b);
+	}
+
+	/* only the last page can be left unstable by power loss - move the block without it, it was never acknowledged */
+	for (b = 0; b < btl->nblocks; ++b) {
+		blk = &btl->blocks[b];
+
+		if (blk->state == btl_used && blk->wp > blk->npages && btl_readmeta(btl, b, blk->wp - 1) < 0) {
+			TRACE("block %u page %u was interrupted", (unsigned)(btl->start + b), blk->wp - 1);
+			blk->wp--;
+			btl_rewrite(btl, blk->lblock, 0, 0, NULL, 0);
+		}
+	}
+
+	if (beginthread(flashbtl_gcThread, 6, btl->stack, sizeof(btl->stack), btl) < 0) {
+		LOG_ERROR("beginthread");
+		return -ENOMEM;
+	}
+
+	return EOK;
+}
+
+
+int flashbtl_handler(void *arg, msg_t *msg)
+{
+	flashbtl_t *btl = arg;
+
+	mutexLock(btl->lock);
+
+	switch (msg->type) {
+	case mtRead:
+		msg->o.io.err = btl_read(btl, msg->i.io.offs, msg->o.data, msg->o.size);
+		break;
+
+	case mtWrite:
+		msg->o.io.err = btl_write(btl, msg->i.io.offs, msg->i.data, msg->i.size);
+		break;
+
+	case mtGetAttr:
+		if (msg->i.attr.type == atSize)
+			msg->o.attr.val = btl->nlogical * ERASE_BLOCK_SIZE;
+		else
+			msg->o.attr.val = -EINVAL;
+		break;
+
+	case mtOpen:
+	case mtClose:
+	case mtSync:
+		msg->o.io.err = EOK;
+		break;
+
+	default:
+		msg->o.io.err = -EINVAL;
+		break;
+	}
+
+	mutexUnlock(btl->lock);
+
+	return EOK;
+}
+
+
+int flashbtl_scrub(void *arg, unsigned block)
+{
+	flashbtl_t *btl = arg;
+	uint32_t b = block - btl->start;
+	int err = EOK;
+
+	if (block < btl->start || b >= btl->nblocks)
+		return -EINVAL;
+
+	mutexLock(btl->lock);
+
+	/* stale copies are erased before reuse, only the current one is moved */
+	if (btl->blocks[b].state == btl_used) {
+		TRACE("scrub: moving logical block %u", btl->blocks[b].lblock);
+		err = btl_rewrite(btl, btl->blocks[b].lblock, 0, 0, NULL, 0);
+	}
+
+	mutexUnlock(btl->lock);
+
+	return err;
+}
+
+
+flashbtl_t *flashbtl_create(size_t start, size_t size, const uint32_t *badblocks, flashbtl_eccreport_t eccreport, int format, long *root)
+{
+	flashbtl_t *btl;
+	size_t spare = max(BTL_SPARE_MIN, size / BTL_SPARE_DIV);
+	uint32_t l;
+
+	if (size <= spare)
+		return NULL;
+
+	if ((btl = calloc(1, sizeof(*btl))) == NULL)
+		return NULL;
+
+	btl->start = start;
+	btl->nblocks = size;
+	btl->nlogical = size - spare;
+	btl->badblocks = badblocks;
+	btl->eccreport = eccreport;
+	btl->format = format;
+
+	btl->blocks = calloc(btl->nblocks, sizeof(*btl->blocks));
+	btl->l2p = malloc(btl->nlogical * sizeof(*btl->l2p));
+	btl->dma = flashdrv_dmanew();
+	btl->databuf = mmap(NULL, 2 * FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+	btl->metabuf = mmap(NULL, FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+
+	if (btl->blocks == NULL || btl->l2p == NULL || btl->databuf == MAP_FAILED || btl->metabuf == MAP_FAILED) {
+		LOG_ERROR("out of memory");
+		/* TODO: cleanup */
+		return NULL;
+	}
+
+	for (l = 0; l < btl->nlogical; ++l)
+		btl->l2p[l] = BTL_NONE;
+
+	mutexCreate(&btl->lock);
+	condCreate(&btl->cond);
+
+	*root = 0;
+
+	return btl;
+}
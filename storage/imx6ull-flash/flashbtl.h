@@ -0,0 +1,43 @@
+/*
+ * Phoenix-RTOS
+ *
+ * IMX6ULL NAND flash block translation layer.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _IMX6ULL_FLASHBTL_H_
+#define _IMX6ULL_FLASHBTL_H_
+
+#include <sys/msg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+typedef struct _flashbtl_t flashbtl_t;
+
+
+/* receives ECC status of every page read, aux is the page metadata as filled by flashdrv_read */
+typedef void (*flashbtl_eccreport_t)(size_t paddr, int npages, void *aux);
+
+
+/* creates translation layer over blocks [start, start + size), badblocks is the chip bad block bitmap consulted on mount,
+ * eccreport may be NULL, format allows mount to erase blocks of other content */
+extern flashbtl_t *flashbtl_create(size_t start, size_t size, const uint32_t *badblocks, flashbtl_eccreport_t eccreport, int format, long *root);
+
+
+/* scans partition metadata and starts garbage collector, fails if the partition holds other data and format isn't set */
+extern int flashbtl_mount(void *arg);
+
+
+extern int flashbtl_handler(void *arg, msg_t *msg);
+
+
+/* moves data of the physical block into a fresh one, the mapping is switched once the copy is complete */
+extern int flashbtl_scrub(void *arg, unsigned block);
+
+#endif
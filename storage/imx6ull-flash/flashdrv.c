@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <sys/msg.h>
@@ -43,6 +44,19 @@ enum {
 };
 
 
+/* Sequential read chain of 16 pages takes ~2 ms, wait 100 times that before giving up (us) */
+#define FLASHDRV_SEQ_TIMEOUT 200000
+
+/* Erases chained under one controller hold, ~3 ms each (up to 10 ms worst case) */
+#define FLASHDRV_ERASE_CHAIN 2
+
+/* Programs chained under one controller hold, ~300 us each (up to 600 us), close to a sequential read chain */
+#define FLASHDRV_WRITE_CHAIN 4
+
+/* Not a BCH status value, marks status bytes the BCH hasn't written back yet */
+#define BCH_STATUS_PENDING 0xfd
+
+
 enum {
 	dma_noxfer = 0,	dma_write = 1, dma_read = 2, dma_sense = 3,
 
@@ -204,6 +218,8 @@ struct {
 	unsigned pagesz, metasz;
 
 	int result, bch_status, bch_done;
+
+	flashdrv_stats_t stats;
 } flashdrv_common;
 
 
@@ -257,6 +273,16 @@ static void dma_run(dma_t *dma, int channel)
 }
 
 
+/* Stops the channel abandoning the chain it was running */
+static void dma_reset(int channel)
+{
+	*(flashdrv_common.dma + apbh_channel_ctrl_set) = 1 << (16 + channel);
+
+	while (*(flashdrv_common.dma + apbh_channel_ctrl) & (1 << (16 + channel)))
+		;
+}
+
+
 static int dma_irqHandler(unsigned int n, void *data)
 {
 	/* TODO: report errors, etc? */
@@ -273,7 +299,7 @@ static int bch_irqHandler(unsigned int n, void *data)
 {
 	/* Clear interrupt flags */
 	flashdrv_common.bch_status = *(flashdrv_common.bch + bch_status0);
-	flashdrv_common.bch_done = 1;
+	flashdrv_common.bch_done++;
 	*(flashdrv_common.bch + bch_ctrl_clr) = 1;
 	return 1;
 }
@@ -621,25 +647,38 @@ int flashdrv_readcompare(flashdrv_dma_t *dma, int chip, uint16_t mask, uint16_t
 }
 
 
-int flashdrv_reset(flashdrv_dma_t *dma)
+/* Issues RESET (FFh), flashdrv_common.mutex has to be held */
+static int _flashdrv_reset(flashdrv_dma_t *dma)
 {
-	int chip = 0, channel = 0, err;
+	int chip = 0, channel = 0;
 	dma->first = NULL;
 	dma->last = NULL;
 
 	flashdrv_issue(dma, flash_reset, chip, NULL, 0, NULL, NULL);
 	flashdrv_finish(dma);
 
-	mutexLock(flashdrv_common.mutex);
 	flashdrv_common.result = 1;
 	dma_run((dma_t *)dma->first, channel);
 
 	mutexLock(flashdrv_common.wait_mutex);
-	while (flashdrv_common.result > 0)
-		condWait(flashdrv_common.dma_cond, flashdrv_common.wait_mutex, 0);
+	while (flashdrv_common.result > 0) {
+		if (condWait(flashdrv_common.dma_cond, flashdrv_common.wait_mutex, FLASHDRV_SEQ_TIMEOUT) < 0 && flashdrv_common.result > 0) {
+			dma_reset(channel);
+			flashdrv_common.result = -ETIME;
+		}
+	}
 	mutexUnlock(flashdrv_common.wait_mutex);
 
-	err = flashdrv_common.result;
+	return flashdrv_common.result;
+}
+
+
+int flashdrv_reset(flashdrv_dma_t *dma)
+{
+	int err;
+
+	mutexLock(flashdrv_common.mutex);
+	err = _flashdrv_reset(dma);
 	mutexUnlock(flashdrv_common.mutex);
 
 	return err;
@@ -687,6 +726,7 @@ int flashdrv_write(flashdrv_dma_t *dma, uint32_t paddr, void *data, char *aux)
 	mutexUnlock(flashdrv_common.wait_mutex);
 
 	err = flashdrv_common.result;
+	flashdrv_common.stats.pages_written++;
 
 	if (data == NULL) {
 		*(flashdrv_common.bch + bch_flash0layout0) |= 8 << 24;
@@ -701,6 +741,72 @@ int flashdrv_write(flashdrv_dma_t *dma, uint32_t paddr, void *data, char *aux)
 }
 
 
+int flashdrv_writeseq(flashdrv_dma_t *dma, uint32_t paddr, int npages, void *data, char *aux)
+{
+	int chip = 0, channel = 0, i, done, chain, result;
+	char addr[5] = { 0 };
+	uint32_t page;
+
+	if (npages <= 0 || npages > FLASHDRV_MAX_SEQ_PAGES || data == NULL)
+		return -EINVAL;
+
+	for (done = 0; done < npages; done += chain) {
+		chain = (npages - done < FLASHDRV_WRITE_CHAIN) ? npages - done : FLASHDRV_WRITE_CHAIN;
+
+		dma->first = NULL;
+		dma->last = NULL;
+
+		/* status check of i-th page terminates the chain with -(i + 1) */
+		for (i = 0; i < chain; ++i) {
+			page = paddr + done + i;
+			memcpy(addr + 2, &page, 3);
+
+			flashdrv_wait4ready(dma, chip, EOK);
+			flashdrv_issue(dma, flash_program_page, chip, addr, flashdrv_common.pagesz, (char *)data + (done + i) * FLASHDRV_DATA_SIZE, aux);
+			flashdrv_wait4ready(dma, chip, EOK);
+			flashdrv_issue(dma, flash_read_status, chip, NULL, 0, NULL, NULL);
+			flashdrv_readcompare(dma, chip, 0x3, 0, -(i + 1));
+		}
+		flashdrv_finish(dma);
+
+		mutexLock(flashdrv_common.mutex);
+		flashdrv_common.result = 1;
+		dma_run((dma_t *)dma->first, channel);
+
+		mutexLock(flashdrv_common.wait_mutex);
+		while (flashdrv_common.result > 0) {
+			if (condWait(flashdrv_common.dma_cond, flashdrv_common.wait_mutex, FLASHDRV_SEQ_TIMEOUT) < 0 && flashdrv_common.result > 0) {
+				dma_reset(channel);
+				flashdrv_common.result = -ETIME;
+			}
+		}
+		mutexUnlock(flashdrv_common.wait_mutex);
+
+		result = flashdrv_common.result;
+
+		/* Program may be left running, the chip has to be idle for the next operation */
+		if (result == -ETIME)
+			_flashdrv_reset(dma);
+
+		if (result == EOK)
+			result = chain;
+		else if (result < 0 && result >= -chain)
+			result = -result - 1;
+
+		flashdrv_common.stats.pages_written += (result >= 0 && result < chain) ? result + 1 : chain;
+		mutexUnlock(flashdrv_common.mutex);
+
+		if (result < 0)
+			return result;
+
+		if (result < chain)
+			return done + result;
+	}
+
+	return npages;
+}
+
+
 int flashdrv_read(flashdrv_dma_t *dma, uint32_t paddr, void *data, flashdrv_meta_t *aux)
 {
 	int chip = 0, channel = 0, sz = 0, result;
@@ -736,8 +842,90 @@ int flashdrv_read(flashdrv_dma_t *dma, uint32_t paddr, void *data, flashdrv_meta
 	mutexUnlock(flashdrv_common.wait_mutex);
 
 	result = flashdrv_common.bch_status;
+	flashdrv_common.stats.pages_read++;
+	flashdrv_common.stats.read_chains++;
+	mutexUnlock(flashdrv_common.mutex);
+
+	return result;
+}
+
+
+int flashdrv_readseq(flashdrv_dma_t *dma, uint32_t paddr, int npages, void *data, void *aux)
+{
+	int chip = 0, channel = 0, i, b, result = flash_no_errors;
+	char addr[5] = { 0 };
+	volatile char *last;
+	flashdrv_meta_t *meta;
+
+	if (npages <= 0 || npages > FLASHDRV_MAX_SEQ_PAGES || data == NULL || aux == NULL)
+		return -EINVAL;
+
+	memcpy(addr + 2, &paddr, 3);
+
+	dma->first = NULL;
+	dma->last = NULL;
+
+	/* first page goes to the data register */
+	flashdrv_wait4ready(dma, chip, EOK);
+	flashdrv_issue(dma, flash_read_page, chip, addr, 0, NULL, NULL);
+
+	for (i = 0; i < npages; ++i) {
+		/* move page to the cache register, array starts loading the next one while this one is read out */
+		flashdrv_wait4ready(dma, chip, EOK);
+		flashdrv_issue(dma, (i == npages - 1) ? flash_read_page_cache_last : flash_read_page_cache_sequential, chip, NULL, 0, NULL, NULL);
+		flashdrv_wait4ready(dma, chip, EOK);
+		flashdrv_readback(dma, chip, flashdrv_common.pagesz, (char *)data + i * FLASHDRV_DATA_SIZE, (char *)aux + i * FLASHDRV_META_STRIDE);
+		flashdrv_disablebch(dma, chip);
+
+		meta = (flashdrv_meta_t *)((char *)aux + i * FLASHDRV_META_STRIDE);
+		memset(meta->errors, BCH_STATUS_PENDING, sizeof(meta->errors));
+	}
+	flashdrv_finish(dma);
+
+	/* BCH writes status bytes of a page back after decoding it, the last page is done once its last byte is there.
+	 * BCH interrupts can coalesce so they aren't counted. */
+	last = (char *)aux + (npages - 1) * FLASHDRV_META_STRIDE + offsetof(flashdrv_meta_t, errors) + sizeof(meta->errors) - 1;
+
+	mutexLock(flashdrv_common.mutex);
+	flashdrv_common.result = 1;
+	dma_run((dma_t *)dma->first, channel);
+
+	mutexLock(flashdrv_common.wait_mutex);
+	while (flashdrv_common.result > 0) {
+		if (condWait(flashdrv_common.dma_cond, flashdrv_common.wait_mutex, FLASHDRV_SEQ_TIMEOUT) < 0 && flashdrv_common.result > 0) {
+			dma_reset(channel);
+			flashdrv_common.result = -ETIME;
+		}
+	}
+
+	while (flashdrv_common.result == EOK && (unsigned char)*last == BCH_STATUS_PENDING) {
+		if (condWait(flashdrv_common.bch_cond, flashdrv_common.wait_mutex, FLASHDRV_SEQ_TIMEOUT) < 0 && (unsigned char)*last == BCH_STATUS_PENDING)
+			flashdrv_common.result = -ETIME;
+	}
+	mutexUnlock(flashdrv_common.wait_mutex);
+
+	if (flashdrv_common.result < 0) {
+		result = flashdrv_common.result;
+
+		/* The chip may be left in a cache read, take it back to idle for the next operation */
+		if (result == -ETIME)
+			_flashdrv_reset(dma);
+	}
+	flashdrv_common.stats.pages_read += npages;
+	flashdrv_common.stats.read_chains++;
 	mutexUnlock(flashdrv_common.mutex);
 
+	if (result < 0)
+		return result;
+
+	for (i = 0; i < npages; ++i) {
+		meta = (flashdrv_meta_t *)((char *)aux + i * FLASHDRV_META_STRIDE);
+		for (b = 0; b < sizeof(meta->errors); ++b) {
+			if ((unsigned char)meta->errors[b] == flash_uncorrectable)
+				return flash_uncorrectable;
+		}
+	}
+
 	return result;
 }
 
@@ -764,12 +952,65 @@ int flashdrv_erase(flashdrv_dma_t *dma, uint32_t paddr)
 	mutexUnlock(flashdrv_common.wait_mutex);
 
 	result = flashdrv_common.result;
+	flashdrv_common.stats.blocks_erased++;
 	mutexUnlock(flashdrv_common.mutex);
 
 	return result;
 }
 
 
+int flashdrv_eraseseq(flashdrv_dma_t *dma, const uint32_t *paddrs, int n)
+{
+	int chip = 0, channel = 0, i, done, chain, result;
+
+	if (n <= 0 || n > FLASHDRV_MAX_ERASE_BLOCKS)
+		return -EINVAL;
+
+	/* Blocks are chained FLASHDRV_ERASE_CHAIN at a time, reads get the controller in between */
+	for (done = 0; done < n; done += chain) {
+		chain = (n - done < FLASHDRV_ERASE_CHAIN) ? n - done : FLASHDRV_ERASE_CHAIN;
+
+		dma->first = NULL;
+		dma->last = NULL;
+
+		/* status check of i-th block terminates the chain with -(i + 1) */
+		for (i = 0; i < chain; ++i) {
+			flashdrv_wait4ready(dma, chip, EOK);
+			flashdrv_issue(dma, flash_erase_block, chip, (void *)&paddrs[done + i], 0, NULL, NULL);
+			flashdrv_wait4ready(dma, chip, EOK);
+			flashdrv_readcompare(dma, chip, 0x3, 0, -(i + 1));
+		}
+		flashdrv_finish(dma);
+
+		mutexLock(flashdrv_common.mutex);
+		flashdrv_common.result = 1;
+		dma_run((dma_t *)dma->first, channel);
+
+		mutexLock(flashdrv_common.wait_mutex);
+		while (flashdrv_common.result > 0)
+			condWait(flashdrv_common.dma_cond, flashdrv_common.wait_mutex, 0);
+		mutexUnlock(flashdrv_common.wait_mutex);
+
+		result = flashdrv_common.result;
+		if (result == EOK)
+			result = chain;
+		else if (result < 0 && result >= -chain)
+			result = -result - 1;
+
+		flashdrv_common.stats.blocks_erased += (result >= 0 && result < chain) ? result + 1 : chain;
+		mutexUnlock(flashdrv_common.mutex);
+
+		if (result < 0)
+			return result;
+
+		if (result < chain)
+			return done + result;
+	}
+
+	return n;
+}
+
+
 int flashdrv_writeraw(flashdrv_dma_t *dma, uint32_t paddr, void *data, int sz)
 {
 	int chip = 0, channel = 0, err;
@@ -845,6 +1086,14 @@ void flashdrv_rundma(flashdrv_dma_t *dma)
 }
 
 
+void flashdrv_getstats(flashdrv_stats_t *stats)
+{
+	mutexLock(flashdrv_common.mutex);
+	*stats = flashdrv_common.stats;
+	mutexUnlock(flashdrv_common.mutex);
+}
+
+
 void flashdrv_init(void)
 {
 	flashdrv_common.dma  = mmap(NULL, 2 * SIZE_PAGE, PROT_READ | PROT_WRITE, MAP_DEVICE, OID_PHYSMEM, 0x1804000);
@@ -46,6 +46,27 @@ typedef struct _flashdrv_meta_t {
 } flashdrv_meta_t;
 
 
+typedef struct _flashdrv_stats_t {
+	uint32_t pages_read;
+	uint32_t pages_written;
+	uint32_t blocks_erased;
+	uint32_t read_chains;	/* DMA chains run to read pages */
+} flashdrv_stats_t;
+
+
+/* maximum number of pages read in a single flashdrv_readseq call */
+#define FLASHDRV_MAX_SEQ_PAGES 16
+
+/* distance between consecutive pages' metadata in flashdrv_readseq aux buffer */
+#define FLASHDRV_META_STRIDE 32
+
+/* maximum number of blocks erased in a single flashdrv_eraseseq call */
+#define FLASHDRV_MAX_ERASE_BLOCKS 16
+
+/* size of ECC-protected data in a page */
+#define FLASHDRV_DATA_SIZE 4096
+
+
 extern flashdrv_dma_t *flashdrv_dmanew(void);
 
 
@@ -58,18 +79,40 @@ extern int flashdrv_reset(flashdrv_dma_t *dma);
 extern int flashdrv_write(flashdrv_dma_t *dma, uint32_t paddr, void *data, char *metadata);
 
 
+/* Programs npages consecutive pages (not crossing erase block boundary) with data of npages * FLASHDRV_DATA_SIZE
+ * bytes, every page gets the same metadata. Pages are chained a few at a time, so that reads get the controller
+ * in between. Returns number of pages programmed before the first failure (npages on success, failed page is
+ * paddr + ret) or a negative error. */
+extern int flashdrv_writeseq(flashdrv_dma_t *dma, uint32_t paddr, int npages, void *data, char *metadata);
+
+
 extern int flashdrv_read(flashdrv_dma_t *dma, uint32_t paddr, void *data, flashdrv_meta_t *meta);
 
 
+/* Reads npages consecutive pages (not crossing erase block boundary) in a single DMA chain
+ * using read page cache sequential command. data has to hold npages * FLASHDRV_DATA_SIZE bytes,
+ * aux npages * FLASHDRV_META_STRIDE bytes and stay uncached, per page BCH status is left there.
+ * Returns flash_uncorrectable if any page failed, -ETIME if the chain or BCH didn't complete. */
+extern int flashdrv_readseq(flashdrv_dma_t *dma, uint32_t paddr, int npages, void *data, void *aux);
+
+
 extern int flashdrv_erase(flashdrv_dma_t *dma, uint32_t paddr);
 
 
+/* erases n blocks given by their first page address in a single DMA chain, returns number of blocks
+ * erased before the first failure (n on success, failed block is paddrs[ret]) or a negative error */
+extern int flashdrv_eraseseq(flashdrv_dma_t *dma, const uint32_t *paddrs, int n);
+
+
 extern int flashdrv_writeraw(flashdrv_dma_t *dma, uint32_t paddr, void *data, int sz);
 
 
 extern int flashdrv_readraw(flashdrv_dma_t *dma, uint32_t paddr, void *data, int sz);
 
 
+extern void flashdrv_getstats(flashdrv_stats_t *stats);
+
+
 extern void flashdrv_init(void);
 
 #endif
@@ -0,0 +1,546 @@
+/*
+ * Phoenix-RTOS
+ *
+ * IMX6ULL NAND flash driver simulator.
+ *
+ * Implements flashdrv interface over a file so that flash server and
+ * nandtool code can be run and profiled on a host. Link it instead of
+ * flashdrv.o. Configuration is taken from the environment:
+ *
+ *   FLASHSIM_FILE       backing file (default flash.img)
+ *   FLASHSIM_BLOCKS     number of erase blocks (default 4096)
+ *   FLASHSIM_BITFLIPS   max bit flips injected per ECC chunk on read (default 0)
+ *   FLASHSIM_SEED       bit flip generator seed
+ *   FLASHSIM_BADBLOCKS  comma separated list of bad blocks
+ *   FLASHSIM_TR, FLASHSIM_TPROG, FLASHSIM_TBERS
+ *                       page read, page program and block erase times in us (default 0)
+ *   FLASHSIM_POWERCUT   n-th page program or block erase is interrupted and the
+ *                       process killed, as if power was cut (default 0 - never)
+ *
+ * Raw page is 4320 bytes: 4096 bytes of data, 16 bytes of metadata and
+ * unused ECC area - GPMI bit packing and BCH parity are not modelled.
+ * Bytes are stored inverted, so a sparse file reads as erased flash. The
+ * file ends with a byte per page marking the ones left unstable by an
+ * interrupted program or erase, they read as uncorrectable unless erased.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "flashdrv.h"
+
+#ifndef EOK
+#define EOK 0
+#endif
+
+#define LOG_ERROR(str, ...) do { fprintf(stderr, __FILE__  ":%d error: " str "\n", __LINE__, ##__VA_ARGS__); } while (0)
+
+#define SIM_PAGES_PER_BLOCK 64
+#define SIM_RAW_SIZE (4096 + 224)
+#define SIM_META_SIZE 16
+#define SIM_META_OFFS FLASHDRV_DATA_SIZE
+#define SIM_CHUNK_SIZE 512
+#define SIM_CHUNKS (FLASHDRV_DATA_SIZE / SIM_CHUNK_SIZE)
+
+/* BCH strength of metadata and data chunks, as configured in flashdrv_init() */
+#define SIM_ECC0 16
+#define SIM_ECCN 14
+
+/* pages programmed under one hold by flashdrv_writeseq, FLASHDRV_WRITE_CHAIN of the driver */
+#define SIM_WRITE_CHAIN 4
+
+
+struct _flashdrv_dma_t {
+	int dummy;
+};
+
+
+struct {
+	pthread_mutex_t mutex;
+
+	uint8_t *mem;
+	uint8_t *unstable;
+	size_t nblocks;
+	uint8_t *bad;
+	unsigned powercut;
+
+	unsigned bitflips;
+	uint32_t seed;
+	unsigned tr, tprog, tbers;
+
+	flashdrv_stats_t stats;
+} flashsim_common;
+
+
+static unsigned sim_env(const char *name, unsigned dflt)
+{
+	const char *s = getenv(name);
+
+	return (s != NULL) ? strtoul(s, NULL, 0) : dflt;
+}
+
+
+static void sim_delay(unsigned us)
+{
+	struct timespec ts;
+
+	if (!us)
+		return;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+
+static uint32_t sim_rand(void)
+{
+	uint32_t x = flashsim_common.seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return flashsim_common.seed = x;
+}
+
+
+static uint8_t *sim_page(uint32_t paddr)
+{
+	if (paddr >= flashsim_common.nblocks * SIM_PAGES_PER_BLOCK)
+		return NULL;
+
+	return flashsim_common.mem + (size_t)paddr * SIM_RAW_SIZE;
+}
+
+
+/* called with flashsim_common.mutex held before a program or erase, returns 1 if power is cut during it */
+static int sim_cut(void)
+{
+	return flashsim_common.powercut && --flashsim_common.powercut == 0;
+}
+
+
+/* leaves pages of the interrupted operation unstable and cuts the power */
+static void sim_halt(uint32_t paddr, unsigned npages)
+{
+	memset(flashsim_common.unstable + paddr, 1, npages);
+	kill(getpid(), SIGKILL);
+}
+
+
+/* stored bytes are inverted - programming can only clear bits of the flash content */
+static void sim_program(uint8_t *dst, const uint8_t *src, size_t sz)
+{
+	size_t i;
+
+	for (i = 0; i < sz; ++i)
+		dst[i] |= (uint8_t)~src[i];
+}
+
+
+static void sim_load(uint8_t *dst, const uint8_t *src, size_t sz)
+{
+	size_t i;
+
+	for (i = 0; i < sz; ++i)
+		dst[i] = ~src[i];
+}
+
+
+static int sim_erased(const uint8_t *src, size_t sz)
+{
+	size_t i;
+
+	for (i = 0; i < sz; ++i) {
+		if (src[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/* loads one ECC chunk, injecting random bit flips, returns BCH status of the chunk */
+static unsigned char sim_chunk(uint8_t *dst, const uint8_t *src, size_t sz, unsigned strength, int unstable)
+{
+	unsigned i, n = 0;
+
+	if (sim_erased(src, sz)) {
+		if (dst != NULL)
+			memset(dst, 0xff, sz);
+		return flash_erased;
+	}
+
+	if (unstable)
+		n = strength + 1 + sim_rand() % sz;
+	else if (flashsim_common.bitflips)
+		n = sim_rand() % (flashsim_common.bitflips + 1);
+
+	if (dst == NULL)
+		return (n > strength) ? flash_uncorrectable : n;
+
+	sim_load(dst, src, sz);
+
+	if (n <= strength)
+		return n;
+
+	/* uncorrectable - BCH hands the data over as it was read */
+	for (i = 0; i < n; ++i)
+		dst[sim_rand() % sz] ^= 1 << (sim_rand() % 8);
+
+	return flash_uncorrectable;
+}
+
+
+static int sim_read(uint32_t paddr, void *data, flashdrv_meta_t *meta)
+{
+	uint8_t *page;
+	int i, unstable, result = flash_no_errors;
+
+	if ((page = sim_page(paddr)) == NULL)
+		return -EINVAL;
+
+	sim_delay(flashsim_common.tr);
+	unstable = flashsim_common.unstable[paddr];
+
+	meta->errors[0] = sim_chunk((uint8_t *)meta->metadata, page + SIM_META_OFFS, SIM_META_SIZE, SIM_ECC0, unstable);
+	if ((unsigned char)meta->errors[0] == flash_uncorrectable)
+		result = flash_uncorrectable;
+
+	for (i = 0; i < SIM_CHUNKS; ++i) {
+		if (data == NULL) {
+			meta->errors[i + 1] = meta->errors[0];
+			continue;
+		}
+
+		meta->errors[i + 1] = sim_chunk((uint8_t *)data + i * SIM_CHUNK_SIZE, page + i * SIM_CHUNK_SIZE, SIM_CHUNK_SIZE, SIM_ECCN, unstable);
+		if ((unsigned char)meta->errors[i + 1] == flash_uncorrectable)
+			result = flash_uncorrectable;
+	}
+
+	flashsim_common.stats.pages_read++;
+
+	return result;
+}
+
+
+flashdrv_dma_t *flashdrv_dmanew(void)
+{
+	return calloc(1, sizeof(flashdrv_dma_t));
+}
+
+
+void flashdrv_dmadestroy(flashdrv_dma_t *dma)
+{
+	free(dma);
+}
+
+
+int flashdrv_reset(flashdrv_dma_t *dma)
+{
+	return EOK;
+}
+
+
+/* called with flashsim_common.mutex held */
+static int sim_write(uint32_t paddr, const void *data, const char *aux)
+{
+	uint8_t *page;
+
+	if ((page = sim_page(paddr)) == NULL)
+		return -EINVAL;
+
+	sim_delay(flashsim_common.tprog);
+
+	if (flashsim_common.bad[paddr / SIM_PAGES_PER_BLOCK])
+		return -1;
+
+	if (data != NULL)
+		sim_program(page, data, FLASHDRV_DATA_SIZE);
+	sim_program(page + SIM_META_OFFS, (const uint8_t *)aux, SIM_META_SIZE);
+
+	if (sim_cut())
+		sim_halt(paddr, 1);
+
+	flashsim_common.stats.pages_written++;
+
+	return EOK;
+}
+
+
+int flashdrv_write(flashdrv_dma_t *dma, uint32_t paddr, void *data, char *aux)
+{
+	int err;
+
+	if (sim_page(paddr) == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&flashsim_common.mutex);
+	err = sim_write(paddr, data, aux);
+	pthread_mutex_unlock(&flashsim_common.mutex);
+
+	return err;
+}
+
+
+int flashdrv_writeseq(flashdrv_dma_t *dma, uint32_t paddr, int npages, void *data, char *aux)
+{
+	int i;
+
+	if (npages <= 0 || npages > FLASHDRV_MAX_SEQ_PAGES || data == NULL || sim_page(paddr + npages - 1) == NULL)
+		return -EINVAL;
+
+	/* Same hold pattern as the driver */
+	for (i = 0; i < npages; ++i) {
+		if ((i % SIM_WRITE_CHAIN) == 0)
+			pthread_mutex_lock(&flashsim_common.mutex);
+
+		if (sim_write(paddr + i, (char *)data + i * FLASHDRV_DATA_SIZE, aux) != EOK) {
+			pthread_mutex_unlock(&flashsim_common.mutex);
+			break;
+		}
+
+		if ((i % SIM_WRITE_CHAIN) == SIM_WRITE_CHAIN - 1 || i == npages - 1)
+			pthread_mutex_unlock(&flashsim_common.mutex);
+	}
+
+	return i;
+}
+
+
+int flashdrv_read(flashdrv_dma_t *dma, uint32_t paddr, void *data, flashdrv_meta_t *aux)
+{
+	int result;
+
+	pthread_mutex_lock(&flashsim_common.mutex);
+	result = sim_read(paddr, data, aux);
+	flashsim_common.stats.read_chains++;
+	pthread_mutex_unlock(&flashsim_common.mutex);
+
+	return result;
+}
+
+
+int flashdrv_readseq(flashdrv_dma_t *dma, uint32_t paddr, int npages, void *data, void *aux)
+{
+	int i, err, result = flash_no_errors;
+
+	if (npages <= 0 || npages > FLASHDRV_MAX_SEQ_PAGES || data == NULL || aux == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&flashsim_common.mutex);
+
+	for (i = 0; i < npages; ++i) {
+		err = sim_read(paddr + i, (char *)data + i * FLASHDRV_DATA_SIZE, (flashdrv_meta_t *)((char *)aux + i * FLASHDRV_META_STRIDE));
+		if (err != flash_no_errors)
+			result = err;
+	}
+
+	flashsim_common.stats.read_chains++;
+	pthread_mutex_unlock(&flashsim_common.mutex);
+
+	return result;
+}
+
+
+/* called with flashsim_common.mutex held */
+static int sim_erase(uint32_t paddr)
+{
+	uint32_t block = paddr / SIM_PAGES_PER_BLOCK;
+	uint8_t *page;
+
+	if ((page = sim_page(block * SIM_PAGES_PER_BLOCK)) == NULL)
+		return -EINVAL;
+
+	sim_delay(flashsim_common.tbers);
+	flashsim_common.stats.blocks_erased++;
+
+	if (flashsim_common.bad[block])
+		return -1;
+
+	if (sim_cut())
+		sim_halt(block * SIM_PAGES_PER_BLOCK, SIM_PAGES_PER_BLOCK);
+
+	memset(page, 0, SIM_PAGES_PER_BLOCK * SIM_RAW_SIZE);
+	memset(flashsim_common.unstable + block * SIM_PAGES_PER_BLOCK, 0, SIM_PAGES_PER_BLOCK);
+
+	return EOK;
+}
+
+
+int flashdrv_erase(flashdrv_dma_t *dma, uint32_t paddr)
+{
+	int err;
+
+	if (sim_page(paddr) == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&flashsim_common.mutex);
+	err = sim_erase(paddr);
+	pthread_mutex_unlock(&flashsim_common.mutex);
+
+	return err;
+}
+
+
+int flashdrv_eraseseq(flashdrv_dma_t *dma, const uint32_t *paddrs, int n)
+{
+	int i, err;
+
+	if (n <= 0 || n > FLASHDRV_MAX_ERASE_BLOCKS)
+		return -EINVAL;
+
+	/* Same hold pattern as the driver, FLASHDRV_ERASE_CHAIN (2) blocks at a time */
+	for (i = 0; i < n; ++i) {
+		if ((i & 1) == 0)
+			pthread_mutex_lock(&flashsim_common.mutex);
+
+		if ((err = sim_erase(paddrs[i])) != EOK) {
+			pthread_mutex_unlock(&flashsim_common.mutex);
+			/* status failure of a bad block, anything else is an error of the call */
+			if (err != -1)
+				return err;
+			break;
+		}
+
+		if ((i & 1) == 1 || i == n - 1)
+			pthread_mutex_unlock(&flashsim_common.mutex);
+	}
+
+	return i;
+}
+
+
+int flashdrv_writeraw(flashdrv_dma_t *dma, uint32_t paddr, void *data, int sz)
+{
+	uint8_t *page;
+
+	if ((page = sim_page(paddr)) == NULL || sz < 0 || sz > SIM_RAW_SIZE)
+		return -EINVAL;
+
+	pthread_mutex_lock(&flashsim_common.mutex);
+
+	sim_delay(flashsim_common.tprog);
+
+	if (flashsim_common.bad[paddr / SIM_PAGES_PER_BLOCK]) {
+		pthread_mutex_unlock(&flashsim_common.mutex);
+		return -1;
+	}
+
+	sim_program(page, data, sz);
+
+	if (sim_cut())
+		sim_halt(paddr, 1);
+
+	flashsim_common.stats.pages_written++;
+	pthread_mutex_unlock(&flashsim_common.mutex);
+
+	return EOK;
+}
+
+
+int flashdrv_readraw(flashdrv_dma_t *dma, uint32_t paddr, void *data, int sz)
+{
+	uint8_t *page;
+
+	if ((page = sim_page(paddr)) == NULL || sz < 0 || sz > SIM_RAW_SIZE)
+		return -EINVAL;
+
+	pthread_mutex_lock(&flashsim_common.mutex);
+
+	sim_delay(flashsim_common.tr);
+	sim_load(data, page, sz);
+
+	/* factory bad block marker */
+	if (flashsim_common.bad[paddr / SIM_PAGES_PER_BLOCK] && sz > FLASHDRV_DATA_SIZE)
+		((uint8_t *)data)[FLASHDRV_DATA_SIZE] = 0;
+
+	flashsim_common.stats.pages_read++;
+	flashsim_common.stats.read_chains++;
+	pthread_mutex_unlock(&flashsim_common.mutex);
+
+	return EOK;
+}
+
+
+void flashdrv_getstats(flashdrv_stats_t *stats)
+{
+	pthread_mutex_lock(&flashsim_common.mutex);
+	*stats = flashsim_common.stats;
+	pthread_mutex_unlock(&flashsim_common.mutex);
+}
+
+
+/* exit waits for the operation in progress, the simulator doesn't leave half erased blocks or half programmed pages */
+static void sim_exit(void)
+{
+	pthread_mutex_lock(&flashsim_common.mutex);
+}
+
+
+void flashdrv_init(void)
+{
+	const char *path, *s;
+	char *end;
+	size_t size, block;
+	int fd;
+
+	pthread_mutex_init(&flashsim_common.mutex, NULL);
+
+	if ((path = getenv("FLASHSIM_FILE")) == NULL)
+		path = "flash.img";
+
+	flashsim_common.nblocks = sim_env("FLASHSIM_BLOCKS", 4096);
+	flashsim_common.bitflips = sim_env("FLASHSIM_BITFLIPS", 0);
+	flashsim_common.seed = sim_env("FLASHSIM_SEED", 0x2545f491);
+	flashsim_common.tr = sim_env("FLASHSIM_TR", 0);
+	flashsim_common.tprog = sim_env("FLASHSIM_TPROG", 0);
+	flashsim_common.tbers = sim_env("FLASHSIM_TBERS", 0);
+	flashsim_common.powercut = sim_env("FLASHSIM_POWERCUT", 0);
+
+	if (!flashsim_common.seed)
+		flashsim_common.seed = 1;
+
+	size = flashsim_common.nblocks * SIM_PAGES_PER_BLOCK * (SIM_RAW_SIZE + 1);
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || ftruncate(fd, size) < 0) {
+		LOG_ERROR("can't open %s", path);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((flashsim_common.mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		LOG_ERROR("can't map %s", path);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	flashsim_common.unstable = flashsim_common.mem + flashsim_common.nblocks * SIM_PAGES_PER_BLOCK * SIM_RAW_SIZE;
+	flashsim_common.bad = calloc(flashsim_common.nblocks, 1);
+
+	for (s = getenv("FLASHSIM_BADBLOCKS"); s != NULL && *s != '\0'; s = (*end == ',') ? end + 1 : end) {
+		block = strtoul(s, &end, 0);
+		if (end == s)
+			break;
+		if (block < flashsim_common.nblocks)
+			flashsim_common.bad[block] = 1;
+	}
+
+	atexit(sim_exit);
+}
@@ -6,21 +6,36 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/file.h>
+#include <sys/platform.h>
 #include <string.h>
 #include <errno.h>
 #include <getopt.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <phoenix/arch/imx6ull.h>
 
 #include "posix/utils.h"
 #include "posix/idtree.h"
 #include "flashsrv.h"
 #include "flashdrv.h"
+#include "flashbtl.h"
 
 #include "../../../phoenix-rtos-filesystems/jffs2/libjffs2.h"
 
 #define LOG_ERROR(str, ...) do { fprintf(stderr, __FILE__  ":%d error: " str "\n", __LINE__, ##__VA_ARGS__); } while (0)
 #define TRACE(str, ...) do { if (0) fprintf(stderr, __FILE__  ":%d trace: " str "\n", __LINE__, ##__VA_ARGS__); } while (0)
 
+/* default number of corrected bits in a single ECC chunk that triggers block relocation, 3/4 of the BCH16 strength */
+#define SCRUB_THRESHOLD 12
+
+/* dev port worker threads, each one owns a DMA context and bounce buffers */
+#define DEV_WORKERS 3
+
+/* discovered bad block table written by nandtool, one copy in each of the first blocks after FCB */
+#define DBBT_START 0x100
+#define DBBT_COPIES 4
+#define DBBT_FINGERPRINT 0x54424244
+
 typedef struct {
 	void *next, *prev;
 
@@ -39,7 +54,9 @@ typedef struct {
 	long root;
 	int (*handler)(void *, msg_t *);
 	int (*mount)(void *);
+	int (*scrub)(void *, unsigned);
 	void *data;
+	int ready;
 	unsigned tid;
 	char stack[4 * 4096] __attribute__((aligned(8)));
 	char name[16];
@@ -50,21 +67,78 @@ typedef struct {
 	idnode_t node;
 	size_t start;
 	size_t size;
+	int mounted;
+	flashsrv_filesystem_t *fs;
 } flashsrv_partition_t;
 
 
-struct {
-	char poolStacks[4][4 * 4096] __attribute__((aligned(8)));
+typedef struct {
+	flashsrv_request_t *reqs;
+	handle_t cond;
+} flashsrv_queue_t;
 
-	rbtree_t filesystems;
-	idtree_t partitions;
-	flashsrv_request_t *queue;
-	handle_t lock, cond;
 
+typedef struct {
 	flashdrv_dma_t *dma;
 	void *databuf;
 	void *rawdatabuf;
 	void *metabuf;
+
+	uint32_t zerocopyReqs;
+	uint32_t bounceReqs;
+	char stack[4 * 4096] __attribute__((aligned(8)));
+} flashsrv_ctx_t;
+
+
+struct {
+	char poolStacks[4][4 * 4096] __attribute__((aligned(8)));
+
+	rbtree_t filesystems;
+	idtree_t partitions;
+	handle_t lock;
+
+	/* filesystem and dev port requests are served by separate threads */
+	flashsrv_queue_t fsqueue;
+	flashsrv_queue_t devqueue;
+	flashsrv_ctx_t devctx[DEV_WORKERS];
+
+	int zerocopy;
+
+	/* bad blocks from DBBT and retire marks, erase counts since start, protected by lock */
+	uint32_t badblocks[BLOCKS_CNT / 32];
+	uint32_t erasecnt[BLOCKS_CNT];
+
+	struct {
+		handle_t cond;
+		int running;
+		int err;
+		uint32_t start;
+		uint32_t end;
+		uint32_t next;
+		uint32_t erased;
+		uint32_t skipped;
+		uint32_t failed;
+
+		flashdrv_dma_t *dma;
+		char *rawbuf;
+		char stack[2 * 4096] __attribute__((aligned(8)));
+	} erase;
+
+	struct {
+		/* lock protects counters and histograms, per-block ones saturate */
+		handle_t lock, cond;
+		unsigned threshold;
+
+		uint16_t blockhist[BLOCKS_CNT][FLASHSRV_BITFLIP_BUCKETS];
+		uint32_t pending[BLOCKS_CNT / 32];
+		uint32_t npending;
+		uint32_t histogram[FLASHSRV_BITFLIP_BUCKETS];
+		uint32_t refreshed;
+		uint32_t skipped;
+		uint32_t failed;
+
+		char stack[4096] __attribute__((aligned(8)));
+	} scrub;
 } flashsrv_common;
 
 
@@ -102,18 +176,25 @@ static void flashsrv_freeRequest(flashsrv_request_t *req)
 }
 
 
-static void flashsrv_queueRequest(flashsrv_request_t *req)
+static void flashsrv_queueRequest(flashsrv_queue_t *queue, flashsrv_request_t *req)
 {
-	LIST_ADD(&flashsrv_common.queue, req);
+	mutexLock(flashsrv_common.lock);
+	LIST_ADD(&queue->reqs, req);
+	mutexUnlock(flashsrv_common.lock);
+
+	condSignal(queue->cond);
 }
 
 
-static flashsrv_request_t *flashsrv_getRequest(void)
+static flashsrv_request_t *flashsrv_getRequest(flashsrv_queue_t *queue)
 {
 	flashsrv_request_t *req;
 
-	if ((req = flashsrv_common.queue) != NULL)
-		LIST_REMOVE(&flashsrv_common.queue, req);
+	mutexLock(flashsrv_common.lock);
+	while ((req = queue->reqs) == NULL)
+		condWait(queue->cond, flashsrv_common.lock, 0);
+	LIST_REMOVE(&queue->reqs, req);
+	mutexUnlock(flashsrv_common.lock);
 
 	return req;
 }
@@ -124,10 +205,7 @@ static void flashsrv_poolThread(void *arg)
 	flashsrv_request_t *req;
 
 	for (;;) {
-		mutexLock(flashsrv_common.lock);
-		while ((req = flashsrv_getRequest()) == NULL)
-			condWait(flashsrv_common.cond, flashsrv_common.lock, 0);
-		mutexUnlock(flashsrv_common.lock);
+		req = flashsrv_getRequest(&flashsrv_common.fsqueue);
 
 		req->handler(req->data, &req->msg);
 
@@ -137,6 +215,49 @@ static void flashsrv_poolThread(void *arg)
 }
 
 
+/* accounts corrected bitflips reported for pages [rp, rp + npages) of a single erase block */
+static void flashsrv_bitflips(size_t rp, int npages, void *aux)
+{
+	flashdrv_meta_t *meta;
+	unsigned block = rp / PAGES_PER_BLOCK, maxflips = 0, n;
+	uint32_t hist[FLASHSRV_BITFLIP_BUCKETS] = { 0 };
+	uint16_t *blockhist;
+	int i, b;
+
+	for (i = 0; i < npages; ++i) {
+		meta = (flashdrv_meta_t *)((char *)aux + i * FLASHDRV_META_STRIDE);
+
+		for (b = 0; b < sizeof(meta->errors); ++b) {
+			n = (unsigned char)meta->errors[b];
+			if (n == flash_uncorrectable || n == flash_erased)
+				continue;
+
+			hist[min((n + 1) / 2, FLASHSRV_BITFLIP_BUCKETS - 1)]++;
+			maxflips = max(maxflips, n);
+		}
+	}
+
+	if (block >= BLOCKS_CNT)
+		return;
+
+	blockhist = flashsrv_common.scrub.blockhist[block];
+
+	mutexLock(flashsrv_common.scrub.lock);
+	for (b = 0; b < FLASHSRV_BITFLIP_BUCKETS; ++b) {
+		flashsrv_common.scrub.histogram[b] += hist[b];
+		blockhist[b] = min(blockhist[b] + hist[b], UINT16_MAX);
+	}
+
+	if (flashsrv_common.scrub.threshold && maxflips >= flashsrv_common.scrub.threshold &&
+			!(flashsrv_common.scrub.pending[block / 32] & (1u << (block % 32)))) {
+		flashsrv_common.scrub.pending[block / 32] |= 1u << (block % 32);
+		flashsrv_common.scrub.npending++;
+		condSignal(flashsrv_common.scrub.cond);
+	}
+	mutexUnlock(flashsrv_common.scrub.lock);
+}
+
+
 static void flashsrv_fsThread(void *arg)
 {
 	flashsrv_filesystem_t *fs = arg;
@@ -154,6 +275,10 @@ static void flashsrv_fsThread(void *arg)
 	}
 	setlogmask(logmask ? logmask : 0xffffffff);
 
+	mutexLock(flashsrv_common.lock);
+	fs->ready = 1;
+	mutexUnlock(flashsrv_common.lock);
+
 	for (;;) {
 		req = flashsrv_newRequest(fs->port, fs->handler, fs->data);
 
@@ -165,11 +290,7 @@ static void flashsrv_fsThread(void *arg)
 
 		}
 
-		mutexLock(flashsrv_common.lock);
-		flashsrv_queueRequest(req);
-		mutexUnlock(flashsrv_common.lock);
-
-		condSignal(flashsrv_common.cond);
+		flashsrv_queueRequest(&flashsrv_common.fsqueue, req);
 	}
 }
 
@@ -194,29 +315,143 @@ static flashsrv_filesystem_t *flashsrv_mountFs(flashsrv_partition_t *partition,
 		TRACE("creating jffs2 partition at port %d", fs->port);
 		fs->data = jffs2lib_create_partition(partition->start, partition->start + partition->size, mode, fs->port, &fs->root);
 		fs->mount = jffs2lib_mount_partition;
+	}
+	else if (!strcmp(fs->name, "btl")) {
+		fs->handler = flashbtl_handler;
+		portCreate(&fs->port);
+		TRACE("creating btl partition at port %d", fs->port);
+		fs->data = flashbtl_create(partition->start, partition->size, flashsrv_common.badblocks, flashsrv_bitflips, mode, &fs->root);
+		fs->mount = flashbtl_mount;
+		fs->scrub = flashbtl_scrub;
+	}
+	else {
+		LOG_ERROR("bad fs type");
+		free(fs);
+		return NULL;
+	}
+
+	if (fs->data == NULL) {
+		LOG_ERROR("create %s partition", fs->name);
+		/* TODO: cleanup */
+		return NULL;
+	}
+
+	if (beginthreadex(flashsrv_fsThread, 4, fs->stack, sizeof(fs->stack), fs, &fs->tid) < 0) {
+		LOG_ERROR("beginthread");
+		/* TODO: cleanup */
+		return NULL;
+	}
+
+	mutexLock(flashsrv_common.lock);
+	lib_rbInsert(&flashsrv_common.filesystems, &fs->node);
+	partition->mounted = 1;
+	partition->fs = fs;
+	mutexUnlock(flashsrv_common.lock);
+
+	return fs;
+}
+
 
-		if (beginthreadex(flashsrv_fsThread, 4, fs->stack, sizeof(fs->stack), fs, &fs->tid) < 0) {
-			LOG_ERROR("beginthread");
-			/* TODO: cleanup */
-			return NULL;
+static int flashsrv_isBad(uint32_t block)
+{
+	return (flashsrv_common.badblocks[block / 32] & (1u << (block % 32))) != 0;
+}
+
+
+/* factory bad blocks carry the marker in otherwise erased page 0 (and are listed in DBBT), blocks retired at run time have raw page 0 zeroed */
+static int flashsrv_marked(flashdrv_dma_t *dma, char *rawbuf, uint32_t block)
+{
+	int i;
+
+	if (flashdrv_readraw(dma, block * PAGES_PER_BLOCK, rawbuf, RAW_FLASH_PAGE_SIZE) != EOK)
+		return 0;
+
+	if ((uint8_t)rawbuf[FLASH_PAGE_SIZE] == 0xff)
+		return 0;
+
+	for (i = 0; i < RAW_FLASH_PAGE_SIZE; ++i) {
+		if (i != FLASH_PAGE_SIZE && rawbuf[i] != rawbuf[0])
+			return 0;
+	}
+
+	return (uint8_t)rawbuf[0] == 0xff || rawbuf[0] == 0;
+}
+
+
+static void flashsrv_retire(flashdrv_dma_t *dma, char *rawbuf, uint32_t block)
+{
+	memset(rawbuf, 0, RAW_FLASH_PAGE_SIZE);
+	if (flashdrv_writeraw(dma, block * PAGES_PER_BLOCK, rawbuf, RAW_FLASH_PAGE_SIZE) != EOK)
+		LOG_ERROR("failed to mark block %u bad", (unsigned)block);
+
+	mutexLock(flashsrv_common.lock);
+	flashsrv_common.badblocks[block / 32] |= 1u << (block % 32);
+	mutexUnlock(flashsrv_common.lock);
+}
+
+
+/* erases good blocks starting at *block with a single DMA chain, advances *block past the last processed one,
+ * rawbuf is an uncached buffer of RAW_FLASH_PAGE_SIZE bytes */
+static int flashsrv_eraseBatch(flashdrv_dma_t *dma, char *rawbuf, uint32_t *block, uint32_t end, uint32_t *erased, uint32_t *skipped)
+{
+	uint32_t paddrs[FLASHDRV_MAX_ERASE_BLOCKS], b = 0;
+	int n = 0, i, k, done;
+
+	mutexLock(flashsrv_common.lock);
+	for (; *block < end && n < FLASHDRV_MAX_ERASE_BLOCKS; ++*block) {
+		if (flashsrv_isBad(*block))
+			(*skipped)++;
+		else
+			paddrs[n++] = *block * PAGES_PER_BLOCK;
+	}
+	mutexUnlock(flashsrv_common.lock);
+
+	/* blocks retired before restart are only known by their marks */
+	for (i = 0, k = 0; i < n; ++i) {
+		b = paddrs[i] / PAGES_PER_BLOCK;
+
+		if (flashsrv_marked(dma, rawbuf, b)) {
+			mutexLock(flashsrv_common.lock);
+			flashsrv_common.badblocks[b / 32] |= 1u << (b % 32);
+			mutexUnlock(flashsrv_common.lock);
+			(*skipped)++;
+		}
+		else {
+			paddrs[k++] = paddrs[i];
 		}
+	}
+	n = k;
 
-		mutexLock(flashsrv_common.lock);
-		lib_rbInsert(&flashsrv_common.filesystems, &fs->node);
-		mutexUnlock(flashsrv_common.lock);
+	if (!n)
+		return EOK;
+
+	if ((done = flashdrv_eraseseq(dma, paddrs, n)) < 0)
+		return done;
+
+	mutexLock(flashsrv_common.lock);
+	for (i = 0; i < min(done + 1, n); ++i)
+		flashsrv_common.erasecnt[paddrs[i] / PAGES_PER_BLOCK]++;
+	mutexUnlock(flashsrv_common.lock);
+
+	*erased += done;
+	if (done < n) {
+		/* retire the block and continue with the next one */
+		b = paddrs[done] / PAGES_PER_BLOCK;
+		LOG_ERROR("erase error, block %u", (unsigned)b);
+		flashsrv_retire(dma, rawbuf, b);
+		*block = b + 1;
 
-		return fs;
+		return -EIO;
 	}
 
-	LOG_ERROR("bad fs type");
-	return NULL;
+	return EOK;
 }
 
 
-static int flashsrv_erase(size_t start, size_t end)
+static int flashsrv_erase(flashsrv_ctx_t *ctx, size_t start, size_t end)
 {
-	flashdrv_dma_t *dma;
-	int i, err;
+	uint32_t block, erased = 0, skipped = 0;
+	int err, ret = EOK;
 
 	TRACE("Erase %d %d", start, end);
 
@@ -226,24 +461,48 @@ static int flashsrv_erase(size_t start, size_t end)
 	if (end % (FLASH_PAGE_SIZE * PAGES_PER_BLOCK))
 		return -EINVAL;
 
-	if (end < start)
+	if (end < start || end > (size_t)BLOCKS_CNT * ERASE_BLOCK_SIZE)
 		return -EINVAL;
 
-	start /= FLASH_PAGE_SIZE * PAGES_PER_BLOCK;
-	end /= FLASH_PAGE_SIZE * PAGES_PER_BLOCK;
+	block = start / ERASE_BLOCK_SIZE;
+	end /= ERASE_BLOCK_SIZE;
 
-	dma = flashsrv_common.dma;
+	while (block < end) {
+		if ((err = flashsrv_eraseBatch(ctx->dma, ctx->rawdatabuf, &block, end, &erased, &skipped)) < 0 && ret == EOK)
+			ret = err;
+	}
 
-	for (i = start; i < end; i++) {
-		err = flashdrv_erase(dma, i * PAGES_PER_BLOCK);
+	return ret;
+}
 
-		if (err) {
-			LOG_ERROR("erase error %d", err);
-			break;
+
+/* reads bad block list from the first valid DBBT copy */
+static void flashsrv_loadDbbt(flashsrv_ctx_t *ctx)
+{
+	uint32_t *page = ctx->databuf;
+	uint32_t i, n, page0;
+	int copy;
+
+	for (copy = 0; copy < DBBT_COPIES; ++copy) {
+		page0 = DBBT_START + copy * PAGES_PER_BLOCK;
+
+		if (flashdrv_read(ctx->dma, page0, page, ctx->metabuf) == flash_uncorrectable || page[1] != DBBT_FINGERPRINT)
+			continue;
+
+		/* table starts 4 pages after the header: reserved word, number of entries, entries */
+		if (flashdrv_read(ctx->dma, page0 + 4, page, ctx->metabuf) == flash_uncorrectable)
+			continue;
+
+		n = min(page[1], FLASH_PAGE_SIZE / sizeof(uint32_t) - 2);
+		for (i = 0; i < n; ++i) {
+			if (page[2 + i] < BLOCKS_CNT)
+				flashsrv_common.badblocks[page[2 + i] / 32] |= 1u << (page[2 + i] % 32);
 		}
+
+		return;
 	}
 
-	return err;
+	LOG_ERROR("no valid DBBT found");
 }
 
 
@@ -274,13 +533,54 @@ static int flashsrv_partoff(id_t id, size_t start, size_t size, size_t *partoff)
 }
 
 
-static int flashsrv_write(id_t id, size_t start, char *data, size_t size)
+/* message buffer can be used for DMA directly if every flash page maps to physically contiguous memory */
+static int flashsrv_zerocopy(const void *data, size_t offset, size_t size)
+{
+	const char *p = data;
+	addr_t pa;
+	size_t i, j;
+
+	if (!flashsrv_common.zerocopy)
+		return 0;
+
+	if (((uintptr_t)data & (SIZE_PAGE - 1)) || (offset & (FLASH_PAGE_SIZE - 1)) || (size & (FLASH_PAGE_SIZE - 1)))
+		return 0;
+
+	for (i = 0; i < size; i += FLASH_PAGE_SIZE) {
+		if ((pa = va2pa((void *)(p + i))) == 0)
+			return 0;
+
+		for (j = SIZE_PAGE; j < FLASH_PAGE_SIZE; j += SIZE_PAGE) {
+			if (va2pa((void *)(p + i + j)) != pa + j)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/* message buffers are cacheable, DMA goes around the D-cache */
+static void flashsrv_cacheSync(void *data, size_t size)
+{
+	platformctl_t pctl;
+
+	pctl.action = pctl_set;
+	pctl.type = pctl_cleanInvalDCache;
+	pctl.cleanInvalDCache.addr = data;
+	pctl.cleanInvalDCache.sz = size;
+
+	platformctl(&pctl);
+}
+
+
+static int flashsrv_write(flashsrv_ctx_t *ctx, id_t id, size_t start, char *data, size_t size)
 {
 	flashdrv_dma_t *dma;
-	int i, err;
+	int npages, err;
 	char *databuf;
 	void *metabuf;
-	size_t partoff = 0;
+	size_t wp, partoff = 0;
 	size_t writesz = size;
 
 	if (flashsrv_partoff(id, start, size, &partoff) < 0)
@@ -297,23 +597,46 @@ static int flashsrv_write(id_t id, size_t start, char *data, size_t size)
 		return -EINVAL;
 
 	if (data == NULL)
-		return flashsrv_erase(start, start + size);
+		return flashsrv_erase(ctx, start, start + size);
 
-	dma = flashsrv_common.dma;
-	databuf = flashsrv_common.databuf;
-	metabuf = flashsrv_common.metabuf;
+	dma = ctx->dma;
+	databuf = ctx->databuf;
+	metabuf = ctx->metabuf;
 
 	memset(metabuf, 0xff, sizeof(flashdrv_meta_t));
 
-	for (i = 0; size; i++) {
-		memcpy(databuf, data + FLASH_PAGE_SIZE * i, FLASH_PAGE_SIZE);
-		err = flashdrv_write(dma, start / FLASH_PAGE_SIZE + i, databuf, metabuf);
+	if (flashsrv_zerocopy(data, start, size)) {
+		ctx->zerocopyReqs++;
+		databuf = NULL;
+		flashsrv_cacheSync(data, size);
+	}
+	else {
+		ctx->bounceReqs++;
+	}
 
-		if (err) {
+	for (wp = start / FLASH_PAGE_SIZE; size; wp += npages) {
+		/* a few pages are programmed per controller hold, the sequence can't cross erase block boundary */
+		npages = min(size / FLASH_PAGE_SIZE, FLASHDRV_MAX_SEQ_PAGES);
+		npages = min(npages, PAGES_PER_BLOCK - (wp % PAGES_PER_BLOCK));
+
+		if (databuf != NULL) {
+			memcpy(databuf, data, npages * FLASH_PAGE_SIZE);
+			err = flashdrv_writeseq(dma, wp, npages, databuf, metabuf);
+		}
+		else {
+			err = flashdrv_writeseq(dma, wp, npages, data, metabuf);
+		}
+
+		if (err != npages) {
 			LOG_ERROR("write error %d", err);
+			if (err > 0) {
+				size -= err * FLASH_PAGE_SIZE;
+			}
 			break;
 		}
-		size -= FLASH_PAGE_SIZE;
+
+		data += npages * FLASH_PAGE_SIZE;
+		size -= npages * FLASH_PAGE_SIZE;
 	}
 
 	writesz -= size;
@@ -322,16 +645,16 @@ static int flashsrv_write(id_t id, size_t start, char *data, size_t size)
 }
 
 
-static int flashsrv_read(id_t id, size_t offset, char *data, size_t size)
+static int flashsrv_read(flashsrv_ctx_t *ctx, id_t id, size_t offset, char *data, size_t size)
 {
 	flashdrv_dma_t *dma;
 	char *databuf;
 	size_t rp, totalBytes = 0;
 	size_t partoff = 0;
-	int pageoffs, writesz, err = EOK;
+	int pageoffs, writesz, npages, zerocopy, err = EOK;
 
-	dma = flashsrv_common.dma;
-	databuf = flashsrv_common.databuf;
+	dma = ctx->dma;
+	databuf = ctx->databuf;
 
 	if (flashsrv_partoff(id, offset, size, &partoff) < 0)
 		return -EINVAL;
@@ -342,8 +665,25 @@ static int flashsrv_read(id_t id, size_t offset, char *data, size_t size)
 
 	TRACE("Read off: %d, size: %d.", offset, size);
 
+	if ((zerocopy = flashsrv_zerocopy(data, offset, size)))
+		ctx->zerocopyReqs++;
+	else
+		ctx->bounceReqs++;
+
 	while (size) {
-		err = flashdrv_read(dma, rp, databuf, flashsrv_common.metabuf);
+		/* read ahead as many pages as needed, sequential cache read can't cross erase block boundary */
+		npages = (pageoffs + size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+		npages = min(npages, FLASHDRV_MAX_SEQ_PAGES);
+		npages = min(npages, PAGES_PER_BLOCK - (rp % PAGES_PER_BLOCK));
+
+		/* dirty lines can't be evicted over the DMA data, lines fetched during the transfer are dropped after it */
+		if (zerocopy)
+			flashsrv_cacheSync(data + totalBytes, npages * FLASH_PAGE_SIZE);
+
+		err = flashdrv_readseq(dma, rp, npages, zerocopy ? data + totalBytes : databuf, ctx->metabuf);
+
+		if (zerocopy)
+			flashsrv_cacheSync(data + totalBytes, npages * FLASH_PAGE_SIZE);
 
 		if (err == flash_uncorrectable) {
 			LOG_ERROR("uncorrectable read");
@@ -351,12 +691,15 @@ static int flashsrv_read(id_t id, size_t offset, char *data, size_t size)
 			break;
 		}
 
-		writesz = min(size, FLASH_PAGE_SIZE - pageoffs);
-		memcpy(data + totalBytes, databuf, writesz);
+		flashsrv_bitflips(rp, npages, ctx->metabuf);
+
+		writesz = min(size, npages * FLASH_PAGE_SIZE - pageoffs);
+		if (!zerocopy)
+			memcpy(data + totalBytes, databuf + pageoffs, writesz);
 
 		size -= writesz;
 		totalBytes += writesz;
-		rp++;
+		rp += npages;
 
 		pageoffs = 0;
 	}
@@ -365,6 +708,117 @@ static int flashsrv_read(id_t id, size_t offset, char *data, size_t size)
 }
 
 
+/* returns the mounted filesystem the block belongs to */
+static flashsrv_filesystem_t *flashsrv_blockFs(unsigned block)
+{
+	flashsrv_partition_t *p;
+	flashsrv_filesystem_t *fs = NULL;
+	rbnode_t *n;
+
+	mutexLock(flashsrv_common.lock);
+	for (n = lib_rbMinimum(flashsrv_common.partitions.root); n; n = lib_rbNext(n)) {
+		p = lib_treeof(flashsrv_partition_t, node, n);
+
+		if (p->mounted && block >= p->start && block < p->start + p->size) {
+			if (p->fs != NULL && p->fs->ready)
+				fs = p->fs;
+			break;
+		}
+	}
+	mutexUnlock(flashsrv_common.lock);
+
+	return fs;
+}
+
+
+static void flashsrv_eraseThread(void *arg)
+{
+	uint32_t block, end, erased, skipped;
+	int err;
+
+	mutexLock(flashsrv_common.lock);
+	for (;;) {
+		while (!flashsrv_common.erase.running)
+			condWait(flashsrv_common.erase.cond, flashsrv_common.lock, 0);
+
+		block = flashsrv_common.erase.next;
+		end = flashsrv_common.erase.end;
+		mutexUnlock(flashsrv_common.lock);
+
+		erased = skipped = 0;
+		err = flashsrv_eraseBatch(flashsrv_common.erase.dma, flashsrv_common.erase.rawbuf, &block, end, &erased, &skipped);
+
+		mutexLock(flashsrv_common.lock);
+		flashsrv_common.erase.next = block;
+		flashsrv_common.erase.erased += erased;
+		flashsrv_common.erase.skipped += skipped;
+
+		if (err < 0) {
+			flashsrv_common.erase.failed++;
+			if (flashsrv_common.erase.err == EOK)
+				flashsrv_common.erase.err = err;
+		}
+
+		if (block >= end)
+			flashsrv_common.erase.running = 0;
+	}
+}
+
+
+static void flashsrv_scrubThread(void *arg)
+{
+	flashsrv_filesystem_t *fs;
+	unsigned block = 0;
+	int err;
+
+	mutexLock(flashsrv_common.scrub.lock);
+	for (;;) {
+		while (!flashsrv_common.scrub.npending)
+			condWait(flashsrv_common.scrub.cond, flashsrv_common.scrub.lock, 0);
+
+		while (!(flashsrv_common.scrub.pending[block / 32] & (1u << (block % 32))))
+			block = (block + 1) % BLOCKS_CNT;
+		mutexUnlock(flashsrv_common.scrub.lock);
+
+		/*
+		 * Only a filesystem with its own mapping can move data to a fresh block and switch
+		 * over once the copy is complete, raw partitions and jffs2 (relocating on its own
+		 * garbage collection) are left to their users, the per-block histograms tell which
+		 */
+		fs = flashsrv_blockFs(block);
+		if (fs == NULL || fs->scrub == NULL || flashsrv_isBad(block))
+			err = -EBUSY;
+		else
+			err = fs->scrub(fs->data, block);
+
+		/* reports of the copy itself are dropped, the old block is erased before reuse */
+		mutexLock(flashsrv_common.scrub.lock);
+		flashsrv_common.scrub.pending[block / 32] &= ~(1u << (block % 32));
+		flashsrv_common.scrub.npending--;
+
+		if (err == -EBUSY) {
+			flashsrv_common.scrub.skipped++;
+		}
+		else if (err != EOK) {
+			LOG_ERROR("block %u relocation failed %d", block, err);
+			flashsrv_common.scrub.failed++;
+		}
+		else {
+			flashsrv_common.scrub.refreshed++;
+		}
+	}
+}
+
+
+static int flashsrv_scrubInit(void)
+{
+	if (!flashsrv_common.scrub.threshold)
+		return EOK;
+
+	return beginthread(flashsrv_scrubThread, 6, flashsrv_common.scrub.stack, sizeof(flashsrv_common.scrub.stack), NULL);
+}
+
+
 static int flashsrv_mount(mount_msg_t *mnt, oid_t *oid)
 {
 	flashsrv_filesystem_t *fs;
@@ -411,7 +865,7 @@ static void flashsrv_syncAll(void)
 }
 
 
-static int flashsrv_devErase(flash_i_devctl_t *idevctl, int type)
+static int flashsrv_devErase(flashsrv_ctx_t *ctx, flash_i_devctl_t *idevctl, int type)
 {
 	size_t partoff = 0;
 	size_t start = 0;
@@ -428,11 +882,11 @@ static int flashsrv_devErase(flash_i_devctl_t *idevctl, int type)
 	if (end % ERASE_BLOCK_SIZE || start % ERASE_BLOCK_SIZE)
 		return -EINVAL;
 
-	return flashsrv_erase(start, end);
+	return flashsrv_erase(ctx, start, end);
 }
 
 
-static int flashsrv_devWriteRaw(flash_i_devctl_t *idevctl, char *data)
+static int flashsrv_devWriteRaw(flashsrv_ctx_t *ctx, flash_i_devctl_t *idevctl, char *data)
 {
 	flashdrv_dma_t *dma;
 	int i, err;
@@ -448,8 +902,8 @@ static int flashsrv_devWriteRaw(flash_i_devctl_t *idevctl, char *data)
 	if (idevctl->write.address % RAW_FLASH_PAGE_SIZE)
 		return -EINVAL;
 
-	dma = flashsrv_common.dma;
-	databuf = flashsrv_common.databuf;
+	dma = ctx->dma;
+	databuf = ctx->databuf;
 
 	for (i = 0; size; i++) {
 		memcpy(databuf, data + RAW_FLASH_PAGE_SIZE * i, RAW_FLASH_PAGE_SIZE);
@@ -467,7 +921,7 @@ static int flashsrv_devWriteRaw(flash_i_devctl_t *idevctl, char *data)
 }
 
 
-static int flashsrv_devWriteMeta(flash_i_devctl_t *idevctl, char* data)
+static int flashsrv_devWriteMeta(flashsrv_ctx_t *ctx, flash_i_devctl_t *idevctl, char* data)
 {
 	flashdrv_dma_t *dma;
 	int i, err;
@@ -481,8 +935,8 @@ static int flashsrv_devWriteMeta(flash_i_devctl_t *idevctl, char* data)
 	if (idevctl->write.address & (FLASH_PAGE_SIZE - 1))
 		return -EINVAL;
 
-	dma = flashsrv_common.dma;
-	databuf = flashsrv_common.databuf;
+	dma = ctx->dma;
+	databuf = ctx->databuf;
 
 	memcpy(databuf, data, FLASH_PAGE_SIZE);
 	for (i = 0; size; i++) {
@@ -501,7 +955,7 @@ static int flashsrv_devWriteMeta(flash_i_devctl_t *idevctl, char* data)
 }
 
 
-static int flashsrv_devReadRaw(flash_i_devctl_t *idevctl, char *data)
+static int flashsrv_devReadRaw(flashsrv_ctx_t *ctx, flash_i_devctl_t *idevctl, char *data)
 {
 	flashdrv_dma_t *dma;
 	char *databuf;
@@ -513,8 +967,8 @@ static int flashsrv_devReadRaw(flash_i_devctl_t *idevctl, char *data)
 	if ( (size % RAW_FLASH_PAGE_SIZE) || (offset % RAW_FLASH_PAGE_SIZE) )
 		return -EINVAL;
 
-	dma = flashsrv_common.dma;
-	databuf = flashsrv_common.rawdatabuf;
+	dma = ctx->dma;
+	databuf = ctx->rawdatabuf;
 	rp = offset / RAW_FLASH_PAGE_SIZE;
 
 	while (size) {
@@ -536,30 +990,142 @@ static int flashsrv_devReadRaw(flash_i_devctl_t *idevctl, char *data)
 }
 
 
-static void flashsrv_devCtrl(msg_t *msg)
+static void flashsrv_devStats(flash_o_devctl_t *odevctl)
+{
+	flashdrv_stats_t stats;
+	int i;
+
+	flashdrv_getstats(&stats);
+
+	odevctl->stats.pagesRead = stats.pages_read;
+	odevctl->stats.pagesWritten = stats.pages_written;
+	odevctl->stats.blocksErased = stats.blocks_erased;
+	odevctl->stats.readChains = stats.read_chains;
+	odevctl->stats.zerocopyReqs = 0;
+	odevctl->stats.bounceReqs = 0;
+
+	for (i = 0; i < DEV_WORKERS; ++i) {
+		odevctl->stats.zerocopyReqs += flashsrv_common.devctx[i].zerocopyReqs;
+		odevctl->stats.bounceReqs += flashsrv_common.devctx[i].bounceReqs;
+	}
+	odevctl->err = EOK;
+}
+
+
+static int flashsrv_devEraseStart(flash_i_devctl_t *idevctl)
+{
+	size_t partoff = 0, start, end;
+
+	if (flashsrv_common.erase.dma == NULL)
+		return -ENOSYS;
+
+	if (flashsrv_partoff(idevctl->erase.oid.id, idevctl->erase.offset, idevctl->erase.size, &partoff) < 0)
+		return -EINVAL;
+
+	start = idevctl->erase.offset + partoff;
+	end = start + idevctl->erase.size;
+
+	if (end % ERASE_BLOCK_SIZE || start % ERASE_BLOCK_SIZE || end > (size_t)BLOCKS_CNT * ERASE_BLOCK_SIZE)
+		return -EINVAL;
+
+	mutexLock(flashsrv_common.lock);
+	if (flashsrv_common.erase.running) {
+		mutexUnlock(flashsrv_common.lock);
+		return -EBUSY;
+	}
+
+	flashsrv_common.erase.start = start / ERASE_BLOCK_SIZE;
+	flashsrv_common.erase.end = end / ERASE_BLOCK_SIZE;
+	flashsrv_common.erase.next = flashsrv_common.erase.start;
+	flashsrv_common.erase.erased = 0;
+	flashsrv_common.erase.skipped = 0;
+	flashsrv_common.erase.failed = 0;
+	flashsrv_common.erase.err = EOK;
+	flashsrv_common.erase.running = (start < end);
+	mutexUnlock(flashsrv_common.lock);
+
+	condSignal(flashsrv_common.erase.cond);
+
+	return EOK;
+}
+
+
+static void flashsrv_devEraseStatus(flash_o_devctl_t *odevctl, void *data, size_t size)
+{
+	mutexLock(flashsrv_common.lock);
+	odevctl->erase.running = flashsrv_common.erase.running;
+	odevctl->erase.start = flashsrv_common.erase.start;
+	odevctl->erase.end = flashsrv_common.erase.end;
+	odevctl->erase.next = flashsrv_common.erase.next;
+	odevctl->erase.erased = flashsrv_common.erase.erased;
+	odevctl->erase.skipped = flashsrv_common.erase.skipped;
+	odevctl->erase.failed = flashsrv_common.erase.failed;
+	odevctl->erase.err = flashsrv_common.erase.err;
+
+	if (data != NULL)
+		memcpy(data, flashsrv_common.erasecnt, min(size, sizeof(flashsrv_common.erasecnt)));
+	mutexUnlock(flashsrv_common.lock);
+
+	odevctl->err = EOK;
+}
+
+
+static void flashsrv_devScrubStats(flash_o_devctl_t *odevctl, void *data, size_t size)
+{
+	memcpy(odevctl->scrub.histogram, flashsrv_common.scrub.histogram, sizeof(odevctl->scrub.histogram));
+	odevctl->scrub.threshold = flashsrv_common.scrub.threshold;
+	odevctl->scrub.pending = flashsrv_common.scrub.npending;
+	odevctl->scrub.refreshed = flashsrv_common.scrub.refreshed;
+	odevctl->scrub.skipped = flashsrv_common.scrub.skipped;
+	odevctl->scrub.failed = flashsrv_common.scrub.failed;
+
+	if (data != NULL)
+		memcpy(data, flashsrv_common.scrub.blockhist, min(size, sizeof(flashsrv_common.scrub.blockhist)));
+
+	odevctl->err = EOK;
+}
+
+
+static void flashsrv_devCtrl(flashsrv_ctx_t *ctx, msg_t *msg)
 {
 	flash_i_devctl_t *idevctl = (flash_i_devctl_t *)msg->i.raw;
 	flash_o_devctl_t *odevctl = (flash_o_devctl_t *)msg->o.raw;
 
 	switch (idevctl->type) {
 	case flashsrv_devctl_erase :
-		odevctl->err = flashsrv_devErase(idevctl, flashsrv_devctl_erase);
+		odevctl->err = flashsrv_devErase(ctx, idevctl, flashsrv_devctl_erase);
 		break;
 
 	case flashsrv_devctl_chiperase :
-		odevctl->err = flashsrv_devErase(idevctl, flashsrv_devctl_chiperase);
+		odevctl->err = flashsrv_devErase(ctx, idevctl, flashsrv_devctl_chiperase);
 		break;
 
 	case flashsrv_devctl_writeraw :
-		odevctl->err = flashsrv_devWriteRaw(idevctl, msg->i.data);
+		odevctl->err = flashsrv_devWriteRaw(ctx, idevctl, msg->i.data);
 		break;
 
 	case flashsrv_devctl_writemeta :
-		odevctl->err = flashsrv_devWriteMeta(idevctl, msg->i.data);
+		odevctl->err = flashsrv_devWriteMeta(ctx, idevctl, msg->i.data);
 		break;
 
 	case flashsrv_devctl_readraw :
-		odevctl->err = flashsrv_devReadRaw(idevctl, msg->o.data);
+		odevctl->err = flashsrv_devReadRaw(ctx, idevctl, msg->o.data);
+		break;
+
+	case flashsrv_devctl_stats :
+		flashsrv_devStats(odevctl);
+		break;
+
+	case flashsrv_devctl_scrubstats :
+		flashsrv_devScrubStats(odevctl, msg->o.data, msg->o.size);
+		break;
+
+	case flashsrv_devctl_erasestart :
+		odevctl->err = flashsrv_devEraseStart(idevctl);
+		break;
+
+	case flashsrv_devctl_erasestatus :
+		flashsrv_devEraseStatus(odevctl, msg->o.data, msg->o.size);
 		break;
 
 	default:
@@ -593,28 +1159,29 @@ static int flashsrv_fileAttr(int type, id_t id)
 }
 
 
-static void flashsrv_devThread(void *arg)
+static void flashsrv_devWorker(void *arg)
 {
-	msg_t msg;
-	unsigned rid, port = (unsigned)arg;
+	flashsrv_ctx_t *ctx = arg;
+	flashsrv_request_t *req;
+	msg_t *msg;
 
 	for (;;) {
-		if (msgRecv(port, &msg, &rid) < 0)
-			continue;
+		req = flashsrv_getRequest(&flashsrv_common.devqueue);
+		msg = &req->msg;
 
-		switch (msg.type) {
+		switch (msg->type) {
 		case mtRead:
-			TRACE("DEV read - id: %llu, size: %d, off: %llu ", msg.i.io.oid.id, msg.o.size, msg.i.io.offs);
-			msg.o.io.err = flashsrv_read(msg.i.io.oid.id, msg.i.io.offs, msg.o.data, msg.o.size);
+			TRACE("DEV read - id: %llu, size: %d, off: %llu ", msg->i.io.oid.id, msg->o.size, msg->i.io.offs);
+			msg->o.io.err = flashsrv_read(ctx, msg->i.io.oid.id, msg->i.io.offs, msg->o.data, msg->o.size);
 			break;
 
 		case mtWrite:
-			TRACE("DEV write - id: %llu, size: %d, off: %llu", msg.i.io.oid.id, msg.i.size, msg.i.io.offs);
-			msg.o.io.err = flashsrv_write(msg.i.io.oid.id, msg.i.io.offs, msg.i.data, msg.i.size ? msg.i.size : msg.i.io.len);
+			TRACE("DEV write - id: %llu, size: %d, off: %llu", msg->i.io.oid.id, msg->i.size, msg->i.io.offs);
+			msg->o.io.err = flashsrv_write(ctx, msg->i.io.oid.id, msg->i.io.offs, msg->i.data, msg->i.size ? msg->i.size : msg->i.io.len);
 			break;
 
 		case mtMount:
-			flashsrv_mount((mount_msg_t *)msg.i.raw, (oid_t *)msg.o.raw);
+			flashsrv_mount((mount_msg_t *)msg->i.raw, (oid_t *)msg->o.raw);
 			break;
 
 		case mtSync:
@@ -622,27 +1189,48 @@ static void flashsrv_devThread(void *arg)
 			break;
 
 		case mtDevCtl:
-			flashsrv_devCtrl(&msg);
+			flashsrv_devCtrl(ctx, msg);
 			break;
 
 		case mtGetAttr:
 			TRACE("DEV mtgetAttr");
-			msg.o.attr.val = flashsrv_fileAttr(msg.i.attr.type, msg.i.attr.oid.id);
+			msg->o.attr.val = flashsrv_fileAttr(msg->i.attr.type, msg->i.attr.oid.id);
 			break;
 
 		case mtOpen:
 			TRACE("DEV mtOpen");
 		case mtClose:
-			msg.o.io.err = EOK;
+			msg->o.io.err = EOK;
 			break;
 
 		default:
 			TRACE("DEV error");
-			msg.o.io.err = -EINVAL;
+			msg->o.io.err = -EINVAL;
 			break;
 		}
 
-		msgRespond(port, &msg, rid);
+		msgRespond(req->port, msg, req->rid);
+		flashsrv_freeRequest(req);
+	}
+}
+
+
+static void flashsrv_devThread(void *arg)
+{
+	flashsrv_request_t *req;
+	unsigned port = (unsigned)arg;
+
+	for (;;) {
+		if ((req = flashsrv_newRequest(port, NULL, NULL)) == NULL) {
+			LOG_ERROR("out of memory");
+			usleep(100000);
+			continue;
+		}
+
+		while (msgRecv(port, &req->msg, &req->rid) < 0)
+			;
+
+		flashsrv_queueRequest(&flashsrv_common.devqueue, req);
 	}
 }
 
@@ -655,6 +1243,8 @@ static int flashsrv_partition(size_t start, size_t size)
 
 	p->start = start;
 	p->size = size;
+	p->mounted = 0;
+	p->fs = NULL;
 
 	mutexLock(flashsrv_common.lock);
 	idtree_alloc(&flashsrv_common.partitions, &p->node);
@@ -677,6 +1267,7 @@ int main(int argc, char **argv)
 	oid_t oid = {0, 0}, rootoid;
 	flashsrv_filesystem_t *rootfs = NULL;
 	flashsrv_partition_t *p;
+	flashsrv_ctx_t *ctx;
 	rbnode_t *n;
 	unsigned port;
 	char path[32];
@@ -685,24 +1276,60 @@ int main(int argc, char **argv)
 
 	TRACE("got port %d", port);
 
-	condCreate(&flashsrv_common.cond);
 	mutexCreate(&flashsrv_common.lock);
+	condCreate(&flashsrv_common.fsqueue.cond);
+	condCreate(&flashsrv_common.devqueue.cond);
+	mutexCreate(&flashsrv_common.scrub.lock);
+	condCreate(&flashsrv_common.scrub.cond);
+	condCreate(&flashsrv_common.erase.cond);
 	lib_rbInit(&flashsrv_common.filesystems, flashsrv_fscmp, NULL);
 	idtree_init(&flashsrv_common.partitions);
 
-	flashsrv_common.queue = NULL;
+	flashsrv_common.fsqueue.reqs = NULL;
+	flashsrv_common.devqueue.reqs = NULL;
+	flashsrv_common.scrub.threshold = SCRUB_THRESHOLD;
+	flashsrv_common.zerocopy = 1;
 
 	flashdrv_init();
-	flashsrv_common.dma = flashdrv_dmanew();
-	flashsrv_common.databuf = mmap(NULL, FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
-	flashsrv_common.rawdatabuf = mmap(NULL, 2 * FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
-	flashsrv_common.metabuf = mmap(NULL, FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+
+	for (i = 0; i < DEV_WORKERS; ++i) {
+		ctx = &flashsrv_common.devctx[i];
+		ctx->dma = flashdrv_dmanew();
+		ctx->databuf = mmap(NULL, FLASHDRV_MAX_SEQ_PAGES * FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+		ctx->rawdatabuf = mmap(NULL, 2 * FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+		ctx->metabuf = mmap(NULL, FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+
+		if (ctx->dma == NULL || ctx->databuf == MAP_FAILED || ctx->rawdatabuf == MAP_FAILED || ctx->metabuf == MAP_FAILED) {
+			LOG_ERROR("out of memory");
+			return -1;
+		}
+	}
+
+	flashsrv_loadDbbt(&flashsrv_common.devctx[0]);
+
+	flashsrv_common.erase.rawbuf = mmap(NULL, 2 * FLASH_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, NULL, -1);
+
+	if (flashsrv_common.erase.rawbuf == MAP_FAILED || (flashsrv_common.erase.dma = flashdrv_dmanew()) == NULL ||
+			beginthread(flashsrv_eraseThread, 5, flashsrv_common.erase.stack, sizeof(flashsrv_common.erase.stack), NULL) < 0) {
+		LOG_ERROR("failed to start erase thread");
+		flashsrv_common.erase.dma = NULL;
+	}
 
 	for (i = 0; i < sizeof(flashsrv_common.poolStacks) / sizeof(flashsrv_common.poolStacks[0]); ++i)
 		beginthread(flashsrv_poolThread, 4, flashsrv_common.poolStacks[i], sizeof(flashsrv_common.poolStacks[i]), NULL);
 
-	while ((c = getopt(argc, argv, "r:p:")) != -1) {
+	while ((c = getopt(argc, argv, "r:p:Zb:")) != -1) {
 		switch (c) {
+		case 'Z':
+			/* always go through the bounce buffers */
+			flashsrv_common.zerocopy = 0;
+			break;
+
+		case 'b':
+			/* corrected bits per ECC chunk which trigger block relocation, 0 disables scrubbing */
+			flashsrv_common.scrub.threshold = atoi(optarg);
+			break;
+
 		case 'r':
 			if (argv[optind] == NULL) {
 				LOG_ERROR("invalid number of arguments");
@@ -741,6 +1368,12 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (flashsrv_scrubInit() < 0)
+		LOG_ERROR("failed to start scrubber");
+
+	for (i = 0; i < DEV_WORKERS; ++i)
+		beginthread(flashsrv_devWorker, 4, flashsrv_common.devctx[i].stack, sizeof(flashsrv_common.devctx[i].stack), &flashsrv_common.devctx[i]);
+
 	for (n = lib_rbMinimum(flashsrv_common.partitions.root); n; n = lib_rbNext(n)) {
 		p = lib_treeof(flashsrv_partition_t, node, n);
 		oid.id = idtree_id(&p->node);
@@ -26,8 +26,12 @@
 #define ERASE_BLOCK_SIZE (FLASH_PAGE_SIZE * PAGES_PER_BLOCK)
 #define ROOT_ID -1
 
+/* corrected bitflips histogram, bucket i counts ECC chunks with 2i - 1 or 2i corrected bits, last one also more */
+#define FLASHSRV_BITFLIP_BUCKETS 8
+
 enum { flashsrv_devctl_erase = 0, flashsrv_devctl_chiperase, flashsrv_devctl_writeraw, flashsrv_devctl_writemeta,
-	 flashsrv_devctl_readraw };
+	 flashsrv_devctl_readraw, flashsrv_devctl_stats, flashsrv_devctl_scrubstats, flashsrv_devctl_erasestart,
+	 flashsrv_devctl_erasestatus };
 
 typedef struct {
 	int type;
@@ -61,6 +65,40 @@ typedef struct {
 
 typedef struct {
 	int err;
+
+	union {
+		struct {
+			uint32_t pagesRead;
+			uint32_t pagesWritten;
+			uint32_t blocksErased;
+			uint32_t readChains;
+			uint32_t zerocopyReqs;
+			uint32_t bounceReqs;
+		} stats;
+
+		/* optional output data receives BLOCKS_CNT per-block histograms of FLASHSRV_BITFLIP_BUCKETS saturating uint16_t counters */
+		struct {
+			uint32_t histogram[FLASHSRV_BITFLIP_BUCKETS];
+			uint32_t threshold;
+			uint32_t pending;
+			uint32_t refreshed;
+			uint32_t skipped;
+			uint32_t failed;
+		} scrub;
+
+		/* background erase started with erasestart, blocks [start, end) skipping bad ones,
+		 * optional output data receives BLOCKS_CNT erase counts (uint32_t) */
+		struct {
+			uint32_t running;
+			uint32_t start;
+			uint32_t end;
+			uint32_t next;
+			uint32_t erased;
+			uint32_t skipped;
+			uint32_t failed;
+			int32_t err;
+		} erase;
+	};
 } __attribute__((packed)) flash_o_devctl_t;
 
 #endif
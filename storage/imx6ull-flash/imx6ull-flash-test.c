@@ -132,6 +132,50 @@ int test_erase(const char *path, size_t offset, size_t size)
 }
 
 
+int test_stats(const char *path)
+{
+	msg_t msg;
+	oid_t oid;
+	flash_i_devctl_t *idevctl = NULL;
+	flash_o_devctl_t *odevctl = NULL;
+
+	msg.type = mtDevCtl;
+	msg.i.data = NULL;
+	msg.i.size = 0;
+	msg.o.data = NULL;
+	msg.o.size = 0;
+
+	idevctl = (flash_i_devctl_t *)msg.i.raw;
+
+	if (lookup(path, NULL, &oid) < 0) {
+		printf("Lookup error.");
+		return -1;
+	}
+
+	idevctl->type = flashsrv_devctl_stats;
+
+	if (msgSend(oid.port, &msg) < 0) {
+		printf("\nSending error to port: %u.", oid.port);
+		return -1;
+	}
+
+	odevctl = (flash_o_devctl_t *)msg.o.raw;
+
+	if (odevctl->err < 0) {
+		printf("Err: %d.\n", odevctl->err);
+		return -1;
+	}
+
+	printf("pages read: %u (%u DMA chains, %u pages/chain) written: %u, blocks erased: %u\n",
+		odevctl->stats.pagesRead, odevctl->stats.readChains,
+		odevctl->stats.readChains ? odevctl->stats.pagesRead / odevctl->stats.readChains : 0,
+		odevctl->stats.pagesWritten, odevctl->stats.blocksErased);
+	printf("zero-copy requests: %u, bounce buffer requests: %u\n", odevctl->stats.zerocopyReqs, odevctl->stats.bounceReqs);
+
+	return 0;
+}
+
+
 void test_readwrite(const char *path, char content, const size_t SIZE)
 {
 	char data[SIZE];
@@ -183,6 +227,7 @@ void test_2(const char *path)
 		return;
 
 	test_readwrite(path, 0x55, DATA_SIZE);
+	test_stats(path);
 	printf("\nEND\n");
 }
 
@@ -0,0 +1,625 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash block translation layer host test
+ *
+ * Runs flashbtl.c over the flashsim.c NAND simulator against a RAM model
+ * of the logical contents. Every mount runs in a child process, the way
+ * the server starts after a reset - writers report the writes they issue
+ * and complete through a pipe, a verifier mounts the partition again and
+ * dumps all of it back. Covers remapping around failing blocks, static
+ * wear leveling, power cuts at every kind of program and erase
+ * (FLASHSIM_POWERCUT), partitions holding other data and scrubbing of
+ * blocks reported with corrected bitflips (FLASHSIM_BITFLIPS).
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/msg.h>
+#include <sys/wait.h>
+
+#include "../flashsrv.h"
+#include "../flashdrv.h"
+#include "../flashbtl.h"
+#include "host.h"
+#include "test.h"
+
+
+#define TEST_FILE   "btl_test.img"
+#define TEST_BLOCKS 72
+#define TEST_BAD    "3,17"      /* in the remapping partition, not in the DBBT */
+
+#define TEST_WL_THRESHOLD 64    /* BTL_WL_THRESHOLD of flashbtl.c */
+#define TEST_BTL_MAGIC 0x324c5442
+
+#define TEST_POWERCUTS 150
+
+
+int test_failed;
+
+
+/* page header of flashbtl.c */
+typedef struct {
+	uint32_t magic;
+	uint32_t lblock : 24;
+	uint32_t npages : 8;
+	uint32_t erasecnt;
+	uint32_t seq;
+} test_oob_t;
+
+
+/* write reported by the writer, once when issued and once when done */
+typedef struct {
+	uint32_t offs;
+	uint32_t size;
+	uint32_t seed;
+	uint32_t done;
+} test_op_t;
+
+
+enum { test_random = 0, test_hot };
+
+
+static struct {
+	size_t start, size, nlogical;
+	uint8_t *ref;           /* acknowledged logical contents */
+	test_op_t pending;      /* write interrupted by the power cut */
+
+	uint32_t badblocks[(TEST_BLOCKS + 31) / 32];
+	unsigned reports;       /* pages reported by the ECC callback */
+	unsigned flips;
+	unsigned stray;         /* reports outside the partition */
+	uint32_t page[FLASH_PAGE_SIZE / sizeof(uint32_t)];
+	char buf[ERASE_BLOCK_SIZE];
+} test_common;
+
+
+static void test_partition(size_t start, size_t size, size_t nlogical)
+{
+	test_common.start = start;
+	test_common.size = size;
+	test_common.nlogical = nlogical;
+	test_common.pending.size = 0;
+
+	free(test_common.ref);
+	test_common.ref = malloc(nlogical * ERASE_BLOCK_SIZE);
+	memset(test_common.ref, 0xff, nlogical * ERASE_BLOCK_SIZE);
+}
+
+
+/* i-th page written by the operation */
+static const void *test_pattern(uint32_t seed, unsigned i)
+{
+	uint32_t x = (seed ^ (i * 0x9e3779b9u)) | 1;
+	unsigned k;
+
+	for (k = 0; k < FLASH_PAGE_SIZE / sizeof(uint32_t); ++k) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		test_common.page[k] = x;
+	}
+
+	return test_common.page;
+}
+
+
+static void test_apply(const test_op_t *op)
+{
+	unsigned i;
+
+	for (i = 0; i < op->size / FLASH_PAGE_SIZE; ++i)
+		memcpy(test_common.ref + op->offs + i * FLASH_PAGE_SIZE, test_pattern(op->seed, i), FLASH_PAGE_SIZE);
+}
+
+
+/* child side: the simulator is opened anew by every "boot" */
+static void test_boot(const char *powercut)
+{
+	setenv("FLASHSIM_POWERCUT", powercut, 1);
+	flashdrv_init();
+}
+
+
+static void test_eccreport(size_t paddr, int npages, void *aux)
+{
+	flashdrv_meta_t *meta = aux;
+	int i;
+
+	if (paddr < test_common.start * PAGES_PER_BLOCK || paddr + npages > (test_common.start + test_common.size) * PAGES_PER_BLOCK)
+		test_common.stray++;
+
+	for (i = 0; i < sizeof(meta->errors); ++i) {
+		if ((uint8_t)meta->errors[i] != flash_erased && (uint8_t)meta->errors[i] != flash_uncorrectable)
+			test_common.flips += (uint8_t)meta->errors[i];
+	}
+
+	test_common.reports += npages;
+}
+
+
+static flashbtl_t *test_mount(int format, int *err)
+{
+	flashbtl_t *btl;
+	long root;
+
+	if ((btl = flashbtl_create(test_common.start, test_common.size, test_common.badblocks, test_eccreport, format, &root)) == NULL) {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	*err = flashbtl_mount(btl);
+
+	return btl;
+}
+
+
+static int test_io(flashbtl_t *btl, int type, size_t offs, void *data, size_t size)
+{
+	msg_t msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = type;
+	msg.i.io.offs = offs;
+
+	if (type == mtWrite) {
+		msg.i.data = data;
+		msg.i.size = size;
+	}
+	else {
+		msg.o.data = data;
+		msg.o.size = size;
+	}
+
+	flashbtl_handler(btl, &msg);
+
+	return msg.o.io.err;
+}
+
+
+static int test_report(int fd, const test_op_t *op)
+{
+	return (write(fd, op, sizeof(*op)) == sizeof(*op)) ? 0 : -1;
+}
+
+
+/*
+ * writes of up to 8 pages, half of them appending to the previous ones (programmed in place) and half at random
+ * (relocating), or rewrites of the first pages of block 0 after all blocks are filled once
+ */
+static int test_writer(int fd, const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	static char data[8 * FLASH_PAGE_SIZE];
+	unsigned npages = test_common.nlogical * PAGES_PER_BLOCK, i, k, page, n, next = 0;
+	flashbtl_t *btl;
+	test_op_t op;
+	int err;
+
+	test_boot(powercut);
+	btl = test_mount(0, &err);
+	TEST_CHECK(err == EOK);
+
+	for (k = 0; k < nops; ++k) {
+		if (kind == test_hot) {
+			page = (k < test_common.nlogical * 8) ? k * 8 : 0;
+			n = (k < test_common.nlogical * 8) ? 8 : 4;
+		}
+		else {
+			page = (rand_r(&seed) & 1) ? next : rand_r(&seed) % npages;
+			n = 1 + rand_r(&seed) % 8;
+			n = (n < npages - page) ? n : npages - page;
+			next = (page + n) % npages;
+		}
+
+		op.offs = page * FLASH_PAGE_SIZE;
+		op.size = n * FLASH_PAGE_SIZE;
+		op.seed = rand_r(&seed);
+		op.done = 0;
+
+		for (i = 0; i < n; ++i)
+			memcpy(data + i * FLASH_PAGE_SIZE, test_pattern(op.seed, i), FLASH_PAGE_SIZE);
+
+		TEST_CHECK(test_report(fd, &op) == 0);
+		TEST_CHECK(test_io(btl, mtWrite, op.offs, data, op.size) == (int)op.size);
+
+		op.done = 1;
+		TEST_CHECK(test_report(fd, &op) == 0);
+	}
+
+	return 0;
+}
+
+
+static int test_dumper(int fd, const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	flashbtl_t *btl;
+	size_t l;
+	int err;
+
+	test_boot("0");
+	btl = test_mount(0, &err);
+	TEST_CHECK(err == EOK);
+
+	for (l = 0; l < test_common.nlogical; ++l) {
+		TEST_CHECK(test_io(btl, mtRead, l * ERASE_BLOCK_SIZE, test_common.buf, ERASE_BLOCK_SIZE) == ERASE_BLOCK_SIZE);
+		TEST_CHECK(write(fd, test_common.buf, ERASE_BLOCK_SIZE) == ERASE_BLOCK_SIZE);
+	}
+
+	return 0;
+}
+
+
+static pid_t test_fork(int *fd, int (*child)(int, const char *, int, unsigned, unsigned), const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	fflush(stdout);
+
+	if ((pid = fork()) == 0) {
+		close(fds[0]);
+		exit((child(fds[1], powercut, kind, nops, seed) == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+	*fd = fds[0];
+
+	return pid;
+}
+
+
+static int test_readall(int fd, void *buf, size_t size)
+{
+	ssize_t n;
+	size_t done = 0;
+
+	while (done < size) {
+		if ((n = read(fd, (char *)buf + done, size - done)) <= 0)
+			return done;
+		done += n;
+	}
+
+	return done;
+}
+
+
+/* writes, the ones completed before the child is done or killed are acknowledged */
+static int test_write(const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	test_op_t op;
+	int fd, status;
+	pid_t pid;
+
+	pid = test_fork(&fd, test_writer, powercut, kind, nops, seed);
+	TEST_CHECK(pid > 0);
+
+	while (test_readall(fd, &op, sizeof(op)) == sizeof(op)) {
+		if (!op.done) {
+			test_common.pending = op;
+		}
+		else {
+			test_apply(&op);
+			test_common.pending.size = 0;
+		}
+	}
+
+	close(fd);
+	TEST_CHECK(waitpid(pid, &status, 0) == pid);
+
+	if (strcmp(powercut, "0") != 0 && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+		return 0;
+
+	TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	TEST_CHECK(test_common.pending.size == 0);
+
+	return 0;
+}
+
+
+/* remount has to succeed and give back the model, pages of an interrupted write may hold either version */
+static int test_verify(void)
+{
+	test_op_t *op = &test_common.pending;
+	size_t l, p, offs;
+	int fd, status;
+	pid_t pid;
+
+	pid = test_fork(&fd, test_dumper, "0", 0, 0, 0);
+	TEST_CHECK(pid > 0);
+
+	for (l = 0; l < test_common.nlogical; ++l) {
+		TEST_CHECK(test_readall(fd, test_common.buf, ERASE_BLOCK_SIZE) == ERASE_BLOCK_SIZE);
+
+		for (p = 0; p < PAGES_PER_BLOCK; ++p) {
+			offs = l * ERASE_BLOCK_SIZE + p * FLASH_PAGE_SIZE;
+
+			if (memcmp(test_common.buf + p * FLASH_PAGE_SIZE, test_common.ref + offs, FLASH_PAGE_SIZE) == 0)
+				continue;
+
+			if (op->size != 0 && offs >= op->offs && offs < op->offs + op->size &&
+					memcmp(test_common.buf + p * FLASH_PAGE_SIZE, test_pattern(op->seed, (offs - op->offs) / FLASH_PAGE_SIZE), FLASH_PAGE_SIZE) == 0) {
+				memcpy(test_common.ref + offs, test_common.buf + p * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+				continue;
+			}
+
+			printf("logical block %zu page %zu differs from the model\n", l, p);
+			close(fd);
+			waitpid(pid, &status, 0);
+			return -1;
+		}
+	}
+
+	close(fd);
+	TEST_CHECK(waitpid(pid, &status, 0) == pid);
+	TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	op->size = 0;
+
+	return 0;
+}
+
+
+/* remapping: blocks 3 and 17 fail every program and erase, the DBBT doesn't list them */
+static int test_remap(void)
+{
+	unsigned k;
+
+	test_partition(0, 24, 20);
+
+	for (k = 0; k < 4; ++k) {
+		TEST_CHECK(test_write("0", test_random, 1000, k) == 0);
+		TEST_CHECK(test_verify() == 0);
+	}
+
+	return 0;
+}
+
+
+static int test_headers(int fd, const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	flashdrv_meta_t meta;
+	test_oob_t *oob = (test_oob_t *)meta.metadata;
+	flashdrv_dma_t *dma;
+	uint32_t counts[2] = { 0xffffffff, 0 };
+	size_t b;
+
+	test_boot("0");
+	dma = flashdrv_dmanew();
+
+	for (b = test_common.start; b < test_common.start + test_common.size; ++b) {
+		if (flashdrv_read(dma, b * PAGES_PER_BLOCK, NULL, &meta) == flash_uncorrectable || oob->magic != TEST_BTL_MAGIC)
+			continue;
+
+		counts[0] = (oob->erasecnt < counts[0]) ? oob->erasecnt : counts[0];
+		counts[1] = (oob->erasecnt > counts[1]) ? oob->erasecnt : counts[1];
+	}
+
+	TEST_CHECK(write(fd, counts, sizeof(counts)) == sizeof(counts));
+
+	return 0;
+}
+
+
+/* static wear leveling: the cold blocks are moved onto worn ones, erase counts stay close */
+static int test_wearlevel(void)
+{
+	uint32_t counts[2];
+	int fd, status;
+	pid_t pid;
+
+	test_partition(24, 16, 12);
+
+	TEST_CHECK(test_write("0", test_hot, 12 * 8 + 3000, 1) == 0);
+	TEST_CHECK(test_verify() == 0);
+
+	pid = test_fork(&fd, test_headers, "0", 0, 0, 0);
+	TEST_CHECK(pid > 0);
+	TEST_CHECK(test_readall(fd, counts, sizeof(counts)) == sizeof(counts));
+	close(fd);
+	TEST_CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	printf("erase counts %u..%u\n", counts[0], counts[1]);
+
+	/* without the moves the cold blocks stay at their first erase */
+	TEST_CHECK(counts[0] > TEST_WL_THRESHOLD);
+	TEST_CHECK(counts[1] - counts[0] <= 2 * TEST_WL_THRESHOLD);
+
+	return 0;
+}
+
+
+/* power is cut at a random program or erase, mount included, the next mount has to find every acknowledged write */
+static int test_powercut(void)
+{
+	unsigned k, seed = 1;
+	char powercut[16];
+
+	test_partition(40, 16, 12);
+
+	for (k = 0; k < TEST_POWERCUTS; ++k) {
+		sprintf(powercut, "%u", 1 + rand_r(&seed) % 1000);
+		TEST_CHECK(test_write(powercut, test_random, 200, rand_r(&seed)) == 0);
+
+		if (test_verify() != 0) {
+			printf("power cut %u at operation %s\n", k, powercut);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int test_foreignChild(int fd, const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	static char meta[FLASH_PAGE_SIZE];
+	flashdrv_meta_t rmeta;
+	flashdrv_dma_t *dma;
+	uint32_t paddr = (test_common.start + 2) * PAGES_PER_BLOCK;
+	int err, i;
+
+	test_boot("0");
+	dma = flashdrv_dmanew();
+
+	/* e.g. jffs2 cleanmarker left by an older layout */
+	memset(meta, 0xff, sizeof(meta));
+	memcpy(meta, "\x85\x19\x03\x20", 4);
+	memset(test_common.buf, 0x5a, FLASH_PAGE_SIZE);
+	TEST_CHECK(flashdrv_write(dma, paddr, test_common.buf, meta) == EOK);
+
+	test_mount(0, &err);
+	TEST_CHECK(err == -EINVAL);
+
+	/* refused mount leaves the data alone */
+	TEST_CHECK(flashdrv_read(dma, paddr, test_common.buf, &rmeta) != flash_uncorrectable);
+	TEST_CHECK(memcmp(rmeta.metadata, meta, 4) == 0 && (uint8_t)test_common.buf[0] == 0x5a);
+
+	test_mount(1, &err);
+	TEST_CHECK(err == EOK);
+
+	TEST_CHECK(flashdrv_read(dma, paddr, NULL, &rmeta) != flash_uncorrectable);
+	for (i = 0; i < 4; ++i)
+		TEST_CHECK((uint8_t)rmeta.metadata[i] == 0xff);
+
+	return 0;
+}
+
+
+/* other data in the partition: mount is refused, format mode erases it */
+static int test_foreign(void)
+{
+	int fd, status;
+	pid_t pid;
+
+	test_partition(56, 8, 4);
+
+	pid = test_fork(&fd, test_foreignChild, "0", 0, 0, 0);
+	TEST_CHECK(pid > 0);
+	close(fd);
+	TEST_CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	/* the formatted partition is an empty one */
+	TEST_CHECK(test_verify() == 0);
+	TEST_CHECK(test_write("0", test_random, 100, 1) == 0);
+	TEST_CHECK(test_verify() == 0);
+
+	return 0;
+}
+
+
+/* physical block holding the newest copy of the logical block */
+static size_t test_current(flashdrv_dma_t *dma, uint32_t lblock)
+{
+	flashdrv_meta_t meta;
+	test_oob_t *oob = (test_oob_t *)meta.metadata;
+	size_t b, cur = 0;
+	uint32_t seq = 0;
+
+	for (b = test_common.start; b < test_common.start + test_common.size; ++b) {
+		if (flashdrv_read(dma, b * PAGES_PER_BLOCK, NULL, &meta) == flash_uncorrectable || oob->magic != TEST_BTL_MAGIC)
+			continue;
+
+		if (oob->lblock == lblock && oob->seq > seq) {
+			seq = oob->seq;
+			cur = b;
+		}
+	}
+
+	return cur;
+}
+
+
+static int test_scrubChild(int fd, const char *powercut, int kind, unsigned nops, unsigned seed)
+{
+	flashdrv_dma_t *dma;
+	flashbtl_t *btl;
+	size_t l, b, old;
+	int err;
+
+	setenv("FLASHSIM_BITFLIPS", "4", 1);
+	test_boot("0");
+	dma = flashdrv_dmanew();
+	btl = test_mount(0, &err);
+	TEST_CHECK(err == EOK);
+
+	/* reads of the data pages go through the callback */
+	test_common.reports = test_common.flips = test_common.stray = 0;
+	for (l = 0; l < test_common.nlogical; ++l)
+		TEST_CHECK(test_io(btl, mtRead, l * ERASE_BLOCK_SIZE, test_common.buf, ERASE_BLOCK_SIZE) == ERASE_BLOCK_SIZE);
+
+	TEST_CHECK(test_common.stray == 0 && test_common.reports >= test_common.nlogical * 8 && test_common.flips > 0);
+
+	/* the copy goes to another block, mount picks it by sequence number */
+	old = test_current(dma, 0);
+	TEST_CHECK(old != 0);
+	TEST_CHECK(flashbtl_scrub(btl, old) == EOK);
+	TEST_CHECK(test_current(dma, 0) != old);
+
+	/* free, stale and used blocks alike */
+	for (b = test_common.start; b < test_common.start + test_common.size; ++b)
+		TEST_CHECK(flashbtl_scrub(btl, b) == EOK);
+
+	TEST_CHECK(flashbtl_scrub(btl, test_common.start - 1) == -EINVAL);
+	TEST_CHECK(flashbtl_scrub(btl, test_common.start + test_common.size) == -EINVAL);
+
+	return 0;
+}
+
+
+/* scrubbing: blocks with corrected bitflips are moved to fresh ones, the data stays */
+static int test_scrub(void)
+{
+	int fd, status;
+	pid_t pid;
+
+	test_partition(64, 8, 4);
+
+	TEST_CHECK(test_write("0", test_hot, 4 * 8 + 8, 1) == 0);
+
+	pid = test_fork(&fd, test_scrubChild, "0", 0, 0, 0);
+	TEST_CHECK(pid > 0);
+	close(fd);
+	TEST_CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	TEST_CHECK(test_verify() == 0);
+
+	return 0;
+}
+
+
+int main(void)
+{
+	char blocks[16];
+
+	sprintf(blocks, "%u", TEST_BLOCKS);
+	setenv("FLASHSIM_FILE", TEST_FILE, 1);
+	setenv("FLASHSIM_BLOCKS", blocks, 1);
+	setenv("FLASHSIM_BADBLOCKS", TEST_BAD, 1);
+	unlink(TEST_FILE);
+
+	host_init();
+
+	TEST_CASE(test_remap());
+	TEST_CASE(test_wearlevel());
+	TEST_CASE(test_powercut());
+	TEST_CASE(test_foreign());
+	TEST_CASE(test_scrub());
+
+	unlink(TEST_FILE);
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
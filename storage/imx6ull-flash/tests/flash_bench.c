@@ -0,0 +1,188 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host benchmark
+ *
+ * Runs flashsrv.c over the flashsim.c NAND simulator and reports the
+ * latency of reads, writes and erases issued concurrently to the device
+ * port, e.g. with datasheet timings:
+ *
+ *   FLASHSIM_FILE=/tmp/flash.img FLASHSIM_TR=25 FLASHSIM_TPROG=300 FLASHSIM_TBERS=3000 ./flash_bench
+ *
+ * Arguments are passed to the server.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/msg.h>
+
+#include "../flashsrv.h"
+#include "host.h"
+
+
+#define BENCH_REQS  200
+#define BENCH_SIZE  (16 * FLASH_PAGE_SIZE)
+
+#define BENCH_PORT  0           /* First port created by the server */
+
+
+enum { bench_read = 0, bench_write, bench_erase, bench_clients };
+
+
+typedef struct {
+	int kind;
+	int n;
+	double sum;
+	double max;
+	int errors;
+	char buff[BENCH_SIZE] __attribute__((aligned(FLASH_PAGE_SIZE)));
+} bench_client_t;
+
+
+static struct {
+	bench_client_t client[bench_clients];
+	int argc;
+	char **argv;
+} bench_common;
+
+
+static const char *const bench_names[] = { "read 64K", "write 64K", "erase 8 blk" };
+
+
+static double bench_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static void *bench_server(void *arg)
+{
+	flashsrv_main(bench_common.argc, bench_common.argv);
+
+	return NULL;
+}
+
+
+/* Requests of one kind back to back, reads and writes in distinct areas, erases elsewhere */
+static void *bench_client(void *arg)
+{
+	bench_client_t *c = arg;
+	flash_i_devctl_t *idevctl;
+	msg_t msg;
+	double t;
+	int i, n = (c->kind == bench_erase) ? BENCH_REQS / 4 : BENCH_REQS;
+
+	for (i = 0; i < n; ++i) {
+		memset(&msg, 0, sizeof(msg));
+		msg.i.io.oid.id = ROOT_ID;
+
+		switch (c->kind) {
+			case bench_read:
+				msg.type = mtRead;
+				msg.i.io.offs = (64 + i % 32) * ERASE_BLOCK_SIZE;
+				msg.o.data = c->buff;
+				msg.o.size = sizeof(c->buff);
+				break;
+
+			case bench_write:
+				msg.type = mtWrite;
+				msg.i.io.offs = (64 * 64 + i * 16) * FLASH_PAGE_SIZE;
+				msg.i.data = c->buff;
+				msg.i.size = sizeof(c->buff);
+				break;
+
+			default:
+				msg.type = mtDevCtl;
+				idevctl = (flash_i_devctl_t *)msg.i.raw;
+				idevctl->type = flashsrv_devctl_chiperase;
+				idevctl->chiperase.offset = (512 + (i % 64) * 8) * ERASE_BLOCK_SIZE;
+				idevctl->chiperase.size = 8 * ERASE_BLOCK_SIZE;
+				break;
+		}
+
+		t = bench_now();
+		host_call(BENCH_PORT, &msg);
+		t = bench_now() - t;
+
+		if ((c->kind == bench_erase) ? ((flash_o_devctl_t *)msg.o.raw)->err < 0 : msg.o.io.err != BENCH_SIZE)
+			c->errors++;
+
+		c->sum += t;
+		c->max = (t > c->max) ? t : c->max;
+		c->n++;
+	}
+
+	return NULL;
+}
+
+
+static void bench_stats(void)
+{
+	flash_i_devctl_t *idevctl;
+	flash_o_devctl_t *odevctl;
+	msg_t msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = mtDevCtl;
+	idevctl = (flash_i_devctl_t *)msg.i.raw;
+	odevctl = (flash_o_devctl_t *)msg.o.raw;
+	idevctl->type = flashsrv_devctl_stats;
+	host_call(BENCH_PORT, &msg);
+
+	printf("pages read %u written %u, blocks erased %u, read chains %u, zero-copy requests %u, bounced %u\n",
+		odevctl->stats.pagesRead, odevctl->stats.pagesWritten, odevctl->stats.blocksErased,
+		odevctl->stats.readChains, odevctl->stats.zerocopyReqs, odevctl->stats.bounceReqs);
+}
+
+
+int main(int argc, char **argv)
+{
+	pthread_t server, tid[bench_clients];
+	double t;
+	int i, errors = 0;
+
+	/* Server gets our arguments, argv[0] included */
+	bench_common.argc = argc;
+	bench_common.argv = argv;
+
+	host_init();
+	pthread_create(&server, NULL, bench_server, NULL);
+
+	/* Server has initialized once it answers */
+	bench_stats();
+
+	t = bench_now();
+
+	for (i = 0; i < bench_clients; ++i) {
+		bench_common.client[i].kind = i;
+		pthread_create(&tid[i], NULL, bench_client, &bench_common.client[i]);
+	}
+
+	for (i = 0; i < bench_clients; ++i)
+		pthread_join(tid[i], NULL);
+
+	printf("total %.3f s\n", bench_now() - t);
+
+	for (i = 0; i < bench_clients; ++i) {
+		printf("%-12s n %3d avg %7.2f ms max %7.2f ms errors %d\n", bench_names[i], bench_common.client[i].n,
+			bench_common.client[i].sum / bench_common.client[i].n * 1e3, bench_common.client[i].max * 1e3, bench_common.client[i].errors);
+		errors += bench_common.client[i].errors;
+	}
+
+	bench_stats();
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - Phoenix API over pthreads
+ *
+ * Threads, mutexes and condition variables map to pthreads. Ports are
+ * queues of messages sent by host_call(), which blocks until the server
+ * responds.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/msg.h>
+#include <sys/threads.h>
+#include <posix/utils.h>
+
+#include "host.h"
+
+
+#define HOST_HANDLES 256
+#define HOST_PORTS   8
+#define HOST_SLOTS   64
+
+
+typedef struct {
+	void (*start)(void *);
+	void *arg;
+} host_thread_t;
+
+
+struct {
+	pthread_mutex_t mutex[HOST_HANDLES];
+	pthread_cond_t cond[HOST_HANDLES];
+	unsigned int handles;
+
+	/* Requests in flight, rid is the slot */
+	msg_t *slot[HOST_SLOTS];
+	sem_t done[HOST_SLOTS];
+	pthread_mutex_t slotlock;
+	pthread_cond_t slotcond;
+
+	struct {
+		unsigned int fifo[HOST_SLOTS];
+		unsigned int head, tail;
+		pthread_cond_t cond;
+	} port[HOST_PORTS];
+	pthread_mutex_t portlock;
+	unsigned int ports;
+} host_common = {
+	.slotlock = PTHREAD_MUTEX_INITIALIZER,
+	.slotcond = PTHREAD_COND_INITIALIZER,
+	.portlock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+static void *host_threadStart(void *arg)
+{
+	host_thread_t t = *(host_thread_t *)arg;
+
+	free(arg);
+	t.start(t.arg);
+
+	return NULL;
+}
+
+
+int beginthreadex(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg, unsigned int *id)
+{
+	host_thread_t *t;
+	pthread_t tid;
+
+	if ((t = malloc(sizeof(*t))) == NULL)
+		return -ENOMEM;
+
+	t->start = start;
+	t->arg = arg;
+
+	if (pthread_create(&tid, NULL, host_threadStart, t) != 0) {
+		free(t);
+		return -ENOMEM;
+	}
+
+	pthread_detach(tid);
+
+	if (id != NULL)
+		*id = (unsigned int)tid;
+
+	return 0;
+}
+
+
+int beginthread(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg)
+{
+	return beginthreadex(start, priority, stack, stacksz, arg, NULL);
+}
+
+
+void endthread(void)
+{
+	pthread_exit(NULL);
+}
+
+
+int mutexCreate(handle_t *h)
+{
+	if ((*h = __sync_add_and_fetch(&host_common.handles, 1)) >= HOST_HANDLES)
+		return -ENOMEM;
+
+	return pthread_mutex_init(&host_common.mutex[*h], NULL);
+}
+
+
+int mutexLock(handle_t h)
+{
+	return pthread_mutex_lock(&host_common.mutex[h]);
+}
+
+
+int mutexUnlock(handle_t h)
+{
+	return pthread_mutex_unlock(&host_common.mutex[h]);
+}
+
+
+int condCreate(handle_t *h)
+{
+	pthread_condattr_t attr;
+
+	if ((*h = __sync_add_and_fetch(&host_common.handles, 1)) >= HOST_HANDLES)
+		return -ENOMEM;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	return pthread_cond_init(&host_common.cond[*h], &attr);
+}
+
+
+int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	struct timespec ts;
+
+	if (!timeout)
+		return pthread_cond_wait(&host_common.cond[h], &host_common.mutex[m]);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout / 1000000;
+	ts.tv_nsec += (timeout % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	return (pthread_cond_timedwait(&host_common.cond[h], &host_common.mutex[m], &ts) == ETIMEDOUT) ? -ETIME : 0;
+}
+
+
+int condSignal(handle_t h)
+{
+	return pthread_cond_signal(&host_common.cond[h]);
+}
+
+
+int condBroadcast(handle_t h)
+{
+	return pthread_cond_broadcast(&host_common.cond[h]);
+}
+
+
+int portCreate(uint32_t *port)
+{
+	pthread_mutex_lock(&host_common.portlock);
+
+	if (host_common.ports == HOST_PORTS) {
+		pthread_mutex_unlock(&host_common.portlock);
+		return -ENOMEM;
+	}
+
+	*port = host_common.ports++;
+
+	pthread_mutex_unlock(&host_common.portlock);
+
+	return 0;
+}
+
+
+int portRegister(uint32_t port, const char *name, oid_t *oid)
+{
+	return 0;
+}
+
+
+int create_dev(oid_t *oid, const char *path)
+{
+	return 0;
+}
+
+
+int msgSend(uint32_t port, msg_t *m)
+{
+	return host_call(port, m);
+}
+
+
+int msgRecv(uint32_t port, msg_t *m, unsigned int *rid)
+{
+	pthread_mutex_lock(&host_common.portlock);
+
+	while (host_common.port[port].head == host_common.port[port].tail)
+		pthread_cond_wait(&host_common.port[port].cond, &host_common.portlock);
+
+	*rid = host_common.port[port].fifo[host_common.port[port].head++ % HOST_SLOTS];
+
+	pthread_mutex_unlock(&host_common.portlock);
+
+	*m = *host_common.slot[*rid];
+
+	return 0;
+}
+
+
+int msgRespond(uint32_t port, msg_t *m, unsigned int rid)
+{
+	host_common.slot[rid]->o = m->o;
+	sem_post(&host_common.done[rid]);
+
+	return 0;
+}
+
+
+int host_call(uint32_t port, msg_t *m)
+{
+	unsigned int rid;
+
+	/* Take a free slot */
+	pthread_mutex_lock(&host_common.slotlock);
+	for (;;) {
+		for (rid = 0; rid < HOST_SLOTS && host_common.slot[rid] != NULL; ++rid)
+			;
+
+		if (rid < HOST_SLOTS)
+			break;
+
+		pthread_cond_wait(&host_common.slotcond, &host_common.slotlock);
+	}
+	host_common.slot[rid] = m;
+	pthread_mutex_unlock(&host_common.slotlock);
+
+	pthread_mutex_lock(&host_common.portlock);
+	host_common.port[port].fifo[host_common.port[port].tail++ % HOST_SLOTS] = rid;
+	pthread_cond_signal(&host_common.port[port].cond);
+	pthread_mutex_unlock(&host_common.portlock);
+
+	sem_wait(&host_common.done[rid]);
+
+	pthread_mutex_lock(&host_common.slotlock);
+	host_common.slot[rid] = NULL;
+	pthread_cond_signal(&host_common.slotcond);
+	pthread_mutex_unlock(&host_common.slotlock);
+
+	return 0;
+}
+
+
+void host_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < HOST_SLOTS; ++i)
+		sem_init(&host_common.done[i], 0, 0);
+
+	for (i = 0; i < HOST_PORTS; ++i)
+		pthread_cond_init(&host_common.port[i].cond, NULL);
+}
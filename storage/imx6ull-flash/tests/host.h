@@ -0,0 +1,30 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <sys/msg.h>
+
+
+/* Sends message to the port and waits for the response */
+extern int host_call(uint32_t port, msg_t *m);
+
+
+extern void host_init(void);
+
+
+/* main() of flashsrv.c */
+extern int flashsrv_main(int argc, char **argv);
+
+
+#endif
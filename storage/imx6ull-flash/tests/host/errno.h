@@ -0,0 +1,21 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - errno stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_ERRNO_H_
+#define _HOST_ERRNO_H_
+
+#include_next <errno.h>
+
+#define EOK 0
+
+
+#endif
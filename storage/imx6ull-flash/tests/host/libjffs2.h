@@ -0,0 +1,39 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - jffs2 library stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_LIBJFFS2_H_
+#define _HOST_LIBJFFS2_H_
+
+#include <stddef.h>
+#include <sys/msg.h>
+
+
+/* jffs2 isn't built for the host, its partitions fail to mount */
+static inline int jffs2lib_message_handler(void *partition, msg_t *msg)
+{
+	return -1;
+}
+
+
+static inline void *jffs2lib_create_partition(size_t start, size_t end, unsigned int mode, uint32_t port, long *root)
+{
+	return NULL;
+}
+
+
+static inline int jffs2lib_mount_partition(void *partition)
+{
+	return -1;
+}
+
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - id tree stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_POSIX_IDTREE_H_
+#define _HOST_POSIX_IDTREE_H_
+
+#include <sys/msg.h>
+#include <sys/rb.h>
+
+
+typedef struct {
+	rbnode_t linkage;
+	id_t id;
+} idnode_t;
+
+
+typedef rbtree_t idtree_t;
+
+
+static inline void idtree_init(idtree_t *tree)
+{
+	lib_rbInit(tree, NULL, NULL);
+}
+
+
+/* Lowest free id, nodes are kept sorted by id */
+static inline int idtree_alloc(idtree_t *tree, idnode_t *node)
+{
+	rbnode_t **n;
+
+	node->id = 0;
+
+	for (n = &tree->root; *n != NULL && ((idnode_t *)*n)->id == node->id; n = &(*n)->next)
+		++node->id;
+
+	node->linkage.next = *n;
+	*n = &node->linkage;
+
+	return node->id;
+}
+
+
+static inline id_t idtree_id(idnode_t *node)
+{
+	return node->id;
+}
+
+
+static inline rbnode_t *idtree_find(idtree_t *tree, id_t id)
+{
+	rbnode_t *n;
+
+	for (n = tree->root; n != NULL && ((idnode_t *)n)->id != id; n = n->next)
+		;
+
+	return n;
+}
+
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - posix utilities stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_POSIX_UTILS_H_
+#define _HOST_POSIX_UTILS_H_
+
+/* stdio and syslog come in through this header in libphoenix, flashsrv.c relies on it */
+#include <stdio.h>
+#include <syslog.h>
+#include <sys/msg.h>
+
+
+extern int create_dev(oid_t *oid, const char *path);
+
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - lists stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_LIST_H_
+#define _HOST_SYS_LIST_H_
+
+#include <stddef.h>
+
+
+/* Circular doubly linked list with next and prev at given offsets, same as libphoenix */
+static inline void lib_listAdd(void **list, void *t, size_t noff, size_t poff)
+{
+	if (*list == NULL) {
+		*(void **)((char *)t + noff) = t;
+		*(void **)((char *)t + poff) = t;
+		*list = t;
+	}
+	else {
+		*(void **)((char *)t + poff) = *(void **)((char *)*list + poff);
+		*(void **)((char *)*(void **)((char *)*list + poff) + noff) = t;
+		*(void **)((char *)t + noff) = *list;
+		*(void **)((char *)*list + poff) = t;
+	}
+}
+
+
+static inline void lib_listRemove(void **list, void *t, size_t noff, size_t poff)
+{
+	void *next = *(void **)((char *)t + noff), *prev = *(void **)((char *)t + poff);
+
+	if (next == t)
+		*list = NULL;
+	else {
+		*(void **)((char *)prev + noff) = next;
+		*(void **)((char *)next + poff) = prev;
+		if (t == *list)
+			*list = next;
+	}
+
+	*(void **)((char *)t + noff) = NULL;
+	*(void **)((char *)t + poff) = NULL;
+}
+
+
+#define LIST_ADD(list, t) lib_listAdd((void **)(list), (void *)(t), 0, sizeof(void *))
+
+
+#define LIST_REMOVE(list, t) lib_listRemove((void **)(list), (void *)(t), 0, sizeof(void *))
+
+
+#endif
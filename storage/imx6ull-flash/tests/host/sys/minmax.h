@@ -0,0 +1,20 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - min/max stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MINMAX_H_
+#define _HOST_SYS_MINMAX_H_
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - memory management stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MMAN_H_
+#define _HOST_SYS_MMAN_H_
+
+#include_next <sys/mman.h>
+#include <stdint.h>
+
+
+#define SIZE_PAGE 4096
+
+#define MAP_UNCACHED 0
+
+
+typedef uintptr_t addr_t;
+
+
+/* Anonymous memory only, Phoenix passes an oid instead of a descriptor */
+#define mmap(vaddr, size, prot, flags, oid, offs) mmap((vaddr), (size), (prot), (flags) | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+
+
+/* Identity mapping, the simulator takes data by virtual address so zero-copy works too */
+static inline addr_t va2pa(void *va)
+{
+	return (addr_t)va;
+}
+
+
+#endif
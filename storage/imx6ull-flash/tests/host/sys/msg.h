@@ -0,0 +1,96 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - messages stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MSG_H_
+#define _HOST_SYS_MSG_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Phoenix ids are 64-bit, glibc id_t is not */
+typedef unsigned long long host_id_t;
+#define id_t host_id_t
+
+
+typedef struct {
+	uint32_t port;
+	id_t id;
+} oid_t;
+
+
+enum { mtRead, mtWrite, mtGetAttr, mtOpen, mtClose, mtSync, mtDevCtl, mtMount, mtUmount };
+
+
+enum { atSize, atDev };
+
+
+typedef struct {
+	int type;
+
+	struct {
+		struct {
+			off_t offs;
+			oid_t oid;
+			size_t len;
+		} io;
+
+		struct {
+			int type;
+			oid_t oid;
+		} attr;
+
+		void *data;
+		size_t size;
+		unsigned char raw[64];
+	} i;
+
+	struct {
+		struct {
+			int err;
+		} io;
+
+		struct {
+			long long val;
+		} attr;
+
+		void *data;
+		size_t size;
+		unsigned char raw[64];
+	} o;
+} msg_t;
+
+
+typedef struct {
+	id_t id;
+	unsigned mode;
+	char fstype[16];
+} mount_msg_t;
+
+
+extern int portCreate(uint32_t *port);
+
+
+extern int portRegister(uint32_t port, const char *name, oid_t *oid);
+
+
+extern int msgSend(uint32_t port, msg_t *m);
+
+
+extern int msgRecv(uint32_t port, msg_t *m, unsigned int *rid);
+
+
+extern int msgRespond(uint32_t port, msg_t *m, unsigned int rid);
+
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - platform control stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_PLATFORM_H_
+#define _HOST_SYS_PLATFORM_H_
+
+#include <phoenix/arch/imx6ull.h>
+
+
+static inline int platformctl(void *ctl)
+{
+	return 0;
+}
+
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - red-black tree stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_RB_H_
+#define _HOST_SYS_RB_H_
+
+#include <stddef.h>
+
+
+/* Sorted singly linked list with the rb tree interface, fine for a few nodes */
+typedef struct _rbnode_t {
+	struct _rbnode_t *next;
+} rbnode_t;
+
+
+typedef int (*rbcomp_t)(rbnode_t *n1, rbnode_t *n2);
+
+
+typedef struct {
+	rbnode_t *root;
+	rbcomp_t compare;
+} rbtree_t;
+
+
+#define lib_treeof(type, node_field, node) \
+	({ \
+		rbnode_t *_n = (node); \
+		(type *)((_n == NULL) ? NULL : (void *)((char *)_n - offsetof(type, node_field))); \
+	})
+
+
+static inline void lib_rbInit(rbtree_t *tree, rbcomp_t compare, void *augment)
+{
+	tree->root = NULL;
+	tree->compare = compare;
+}
+
+
+static inline int lib_rbInsert(rbtree_t *tree, rbnode_t *node)
+{
+	rbnode_t **n;
+
+	for (n = &tree->root; *n != NULL && (tree->compare == NULL || tree->compare(*n, node) <= 0); n = &(*n)->next)
+		;
+
+	node->next = *n;
+	*n = node;
+
+	return 0;
+}
+
+
+static inline rbnode_t *lib_rbMinimum(rbnode_t *node)
+{
+	return node;
+}
+
+
+static inline rbnode_t *lib_rbNext(rbnode_t *node)
+{
+	return node->next;
+}
+
+
+#endif
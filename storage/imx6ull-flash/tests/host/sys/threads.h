@@ -0,0 +1,54 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL flash server host build - threads stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_THREADS_H_
+#define _HOST_SYS_THREADS_H_
+
+#include <time.h>
+#include <unistd.h>
+
+
+typedef unsigned int handle_t;
+
+
+extern int beginthreadex(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg, unsigned int *id);
+
+
+extern int beginthread(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg);
+
+
+extern void endthread(void) __attribute__((noreturn));
+
+
+extern int mutexCreate(handle_t *h);
+
+
+extern int mutexLock(handle_t h);
+
+
+extern int mutexUnlock(handle_t h);
+
+
+extern int condCreate(handle_t *h);
+
+
+/* Timeout in us, 0 waits forever */
+extern int condWait(handle_t h, handle_t m, time_t timeout);
+
+
+extern int condSignal(handle_t h);
+
+
+extern int condBroadcast(handle_t h);
+
+
+#endif
@@ -93,6 +93,39 @@ int dbbt_flash(flashdrv_dma_t *dma, dbbt_t *dbbt)
 }
 
 
+dbbt_t *dbbt_read(flashdrv_dma_t *dma)
+{
+	int i;
+	uint32_t page_num = DBBT_START;
+	dbbt_t *dbbt = NULL;
+	uint32_t *data = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, OID_NULL, 0);
+	void *meta = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, OID_NULL, 0);
+
+	if (data == MAP_FAILED || meta == MAP_FAILED)
+		return NULL;
+
+	for (i = 0; i < BCB_CNT; i++, page_num += PAGES_PER_BLOCK) {
+		if (flashdrv_read(dma, page_num, data, meta) == flash_uncorrectable || data[1] != 0x54424244)
+			continue;
+
+		/* table starts 4 pages after the header: reserved word, number of entries, entries
+		 * (erased if there were no bad blocks, 0xffffffff entries match no block) */
+		if (flashdrv_read(dma, page_num + 4, data, meta) == flash_uncorrectable)
+			continue;
+
+		if ((dbbt = calloc(1, sizeof(dbbt_t) + sizeof(uint32_t) * BB_MAX)) != NULL) {
+			dbbt->entries_num = (data[1] < BB_MAX) ? data[1] : BB_MAX;
+			memcpy(dbbt->bad_block, data + 2, sizeof(uint32_t) * dbbt->entries_num);
+		}
+		break;
+	}
+
+	munmap(data, PAGE_SIZE);
+	munmap(meta, PAGE_SIZE);
+	return dbbt;
+}
+
+
 void fcb_init(fcb_t *fcb)
 {
 	fcb->fingerprint			= 0x20424346;
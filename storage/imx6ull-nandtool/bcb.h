@@ -104,6 +104,9 @@ int fcb_flash(flashdrv_dma_t *dma, fcb_t *fcb_ret);
 
 int dbbt_flash(flashdrv_dma_t *dma, dbbt_t *dbbt);
 
+/* returns bad block table read back from flash (free() it) or NULL if there is no valid one */
+dbbt_t *dbbt_read(flashdrv_dma_t *dma);
+
 int dbbt_block_is_bad(dbbt_t *dbbt, uint32_t block_num);
 
 #endif /* _BCB_H_ */
@@ -185,35 +185,37 @@ static void store_ecc8(struct bch_control *bch, uint8_t *dst,
 }
 
 /*
- * reverse bit for byte
+ * bit reversal lookup table
  */
-static uint8_t reverse_bit(uint8_t in_byte)
-{
-	int i;
-	uint8_t out_byte = 0;
+#define R2(n) (n), (n) + 2*64, (n) + 1*64, (n) + 3*64
+#define R4(n) R2(n), R2((n) + 2*16), R2((n) + 1*16), R2((n) + 3*16)
+#define R6(n) R4(n), R4((n) + 2*4), R4((n) + 1*4), R4((n) + 3*4)
 
-	for (i = 0; i < 8; i++) {
-		if (in_byte & ((0x80) >> i)) {
-			out_byte |= 1 << i;
-		}
-	}
+static const uint8_t rev8_tab[256] = {
+	R6(0), R6(2), R6(1), R6(3)
+};
 
-	return out_byte;
+#undef R2
+#undef R4
+#undef R6
+
+/*
+ * reverse bit for byte
+ */
+static inline uint8_t reverse_bit(uint8_t in_byte)
+{
+	return rev8_tab[in_byte];
 }
 
  /*
   * swap 32-bit data, including bit reverse and swap to big endian
   */
-static uint32_t swap_data(uint32_t data)
+static inline uint32_t swap_data(uint32_t data)
 {
-	uint32_t r = 0;
-
-	r = reverse_bit(data & 0xFF) << 24;
-	r |= reverse_bit((data >> 8) & 0xFF) << 16;
-	r |= reverse_bit((data >> 16) & 0xFF) << 8;
-	r |= reverse_bit((data >> 24) & 0xFF);
-
-	return r;
+	return ((uint32_t)rev8_tab[data & 0xff] << 24) |
+		((uint32_t)rev8_tab[(data >> 8) & 0xff] << 16) |
+		((uint32_t)rev8_tab[(data >> 16) & 0xff] << 8) |
+		(uint32_t)rev8_tab[(data >> 24) & 0xff];
 }
 
 /**
@@ -243,18 +245,19 @@ void encode_bch(struct bch_control *bch, const uint8_t *data,
 	const uint32_t * const tab3 = tab2 + 256*(l+1);
 	const uint32_t *pdata, *p0, *p1, *p2, *p3;
 
+	/* parity is kept on the stack, bch is only read unless ecc is NULL */
 	if (ecc) {
 		/* load ecc parity bytes into internal 32-bit buffer */
-		load_ecc8(bch, bch->ecc_buf, ecc);
+		load_ecc8(bch, r, ecc);
 	} else {
-		memset(bch->ecc_buf, 0, sizeof(r));
+		memset(r, 0, sizeof(r));
 	}
 
 	/* process first unaligned data bytes */
 	m = ((unsigned long)data) & 3;
 	if (m) {
 		mlen = (len < (4-m)) ? len : 4-m;
-		encode_bch_unaligned(bch, data, mlen, bch->ecc_buf);
+		encode_bch_unaligned(bch, data, mlen, r);
 		data += mlen;
 		len  -= mlen;
 	}
@@ -264,7 +267,6 @@ void encode_bch(struct bch_control *bch, const uint8_t *data,
 	mlen  = len/4;
 	data += 4*mlen;
 	len  -= 4*mlen;
-	memcpy(r, bch->ecc_buf, sizeof(r));
 
 	/*
 	 * split each 32-bit word into 4 polynomials of weight 8 as follows:
@@ -293,15 +295,16 @@ void encode_bch(struct bch_control *bch, const uint8_t *data,
 
 		r[l] = p0[l]^p1[l]^p2[l]^p3[l];
 	}
-	memcpy(bch->ecc_buf, r, sizeof(r));
 
 	/* process last unaligned bytes */
 	if (len)
-		encode_bch_unaligned(bch, data, len, bch->ecc_buf);
+		encode_bch_unaligned(bch, data, len, r);
 
-	/* store ecc parity bytes into original parity buffer */
+	/* store ecc parity bytes into original parity buffer, or the internal one for decode_bch() */
 	if (ecc)
-		store_ecc8(bch, ecc, bch->ecc_buf);
+		store_ecc8(bch, ecc, r);
+	else
+		memcpy(bch->ecc_buf, r, sizeof(r));
 }
 
 static inline int modulo(struct bch_control *bch, unsigned int v)
@@ -1441,18 +1444,83 @@ void free_bch(struct bch_control *bch)
 	}
 }
 
+/*
+ * returns BCH control structure for given parameters, tables are built once and reused
+ *
+ * A slot is published once and never freed, so concurrent callers share it -
+ * encode_bch() with an ecc buffer only reads the tables. Threads racing for
+ * an empty slot build their own tables and the losers free theirs.
+ */
+static struct bch_control *get_bch(int m, int t)
+{
+	static struct bch_control *cache[4];	/* one per supported (m, t) */
+	struct bch_control *bch, *prev;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache); i++) {
+		bch = __atomic_load_n(&cache[i], __ATOMIC_ACQUIRE);
+
+		if (bch == NULL) {
+			bch = init_bch(m, t, 0);
+			if (!bch)
+				return NULL;
+
+			prev = NULL;
+			if (__atomic_compare_exchange_n(&cache[i], &prev, bch, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return bch;
+
+			free_bch(bch);
+			bch = prev;
+		}
+
+		if (bch->m == m && bch->t == t)
+			return bch;
+	}
+
+	return NULL;
+}
+
+/*
+ * dst[i] = (src[i] >> shift) | (src[i+1] << (8 - shift)), 4 bytes at a time
+ */
+static void shift_merge(uint8_t *dst, const uint8_t *src, unsigned int len,
+			unsigned int shift)
+{
+	unsigned int i;
+	uint64_t w;
+
+	if (!shift) {
+		memcpy(dst, src, len);
+		return;
+	}
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		w = src[i] | (src[i+1] << 8) | (src[i+2] << 16) |
+			((uint64_t)src[i+3] << 24) | ((uint64_t)src[i+4] << 32);
+		w >>= shift;
+
+		dst[i]   = w;
+		dst[i+1] = w >> 8;
+		dst[i+2] = w >> 16;
+		dst[i+3] = w >> 24;
+	}
+
+	for (; i < len; i++)
+		dst[i] = (src[i] >> shift) | (src[i+1] << (8 - shift));
+}
+
 int encode_bch_ecc(void *source_block, size_t source_size,
 				   void *target_block, size_t target_size,
 				   int version)
 {
 
 	struct bch_control *bch;
-	uint8_t *ecc_buf;
+	uint8_t ecc_buf[(13 * 62 + 7) / 8];	/* largest ecc of supported versions */
 	int ecc_buf_size;
 	uint8_t *tmp_buf;
 	int tmp_buf_size;
 	int real_buf_size;
-	int i, j;
+	int i, j, blk, end;
 	int ecc_bit_off;
 	int data_ecc_blk_size;
 	int low_byte_off, low_bit_off;
@@ -1505,15 +1573,11 @@ int encode_bch_ecc(void *source_block, size_t source_size,
 		return -EINVAL;
 
 	/* init bch, using default polynomial */
-	bch = init_bch(gf, en, 0);
+	bch = get_bch(gf, en);
 	if(!bch)
 		return -EINVAL;
 
-	/* buffer for ecc */
 	ecc_buf_size = (gf * en + 7)/8;
-	ecc_buf = malloc(ecc_buf_size);
-	if(!ecc_buf)
-		return -EINVAL;
 
 	/* temp buffer to store data and ecc */
 	tmp_buf_size = b0 + (e0 * gf + 7)/8 + (bn + (en * gf + 7)/8) * 7;
@@ -1554,20 +1618,233 @@ int encode_bch_ecc(void *source_block, size_t source_size,
 		/* size of a data block plus ecc block */
 		data_ecc_blk_size = bn +(gf*en+7)/8;
 
-		for (i = 0; i < real_buf_size; i++) {
-			low_bit_off = ((i/data_ecc_blk_size) * ecc_bit_off)%8;
-			low_byte_off = ((i/data_ecc_blk_size) * ecc_bit_off)/8;
-			high_bit_off = (((i+1)/data_ecc_blk_size) * ecc_bit_off)%8;
-			high_byte_off = (((i+1)/data_ecc_blk_size) * ecc_bit_off)/8;
+		for (i = 0; i < real_buf_size; i = end + 1) {
+			/* bytes i .. end - 1 are shifted by the same offset as the next one */
+			blk = i / data_ecc_blk_size;
+			end = (blk + 1) * data_ecc_blk_size - 1;
+			if (end > real_buf_size)
+				end = real_buf_size;
 
-			byte_low = tmp_buf[i+low_byte_off] >> low_bit_off;
-			byte_high = tmp_buf[i+1+high_byte_off] << (8 - high_bit_off);
+			low_bit_off = (blk * ecc_bit_off)%8;
+			low_byte_off = (blk * ecc_bit_off)/8;
+			shift_merge(target_block + m + i, tmp_buf + i + low_byte_off, end - i, low_bit_off);
 
-			*(uint8_t *)(target_block + i + m) = (byte_low | byte_high);
+			if (end == real_buf_size)
+				break;
+
+			/* block boundary byte */
+			high_bit_off = ((blk + 1) * ecc_bit_off)%8;
+			high_byte_off = ((blk + 1) * ecc_bit_off)/8;
+
+			byte_low = tmp_buf[end+low_byte_off] >> low_bit_off;
+			byte_high = tmp_buf[end+1+high_byte_off] << (8 - high_bit_off);
+
+			*(uint8_t *)(target_block + end + m) = (byte_low | byte_high);
 		}
 	}
 
-	free(ecc_buf);
 	free(tmp_buf);
 	return 0;
 }
+
+/*
+ * struct bch_decoder - raw page decoding context
+ * @m:      metadata bytes in front of the first block, not covered by ecc
+ * @b0:     block 0 data bytes
+ * @e0:     block 0 ecc strength
+ * @bn:     block N data bytes
+ * @en:     block N ecc strength
+ * @n:      number of N blocks
+ * @gf:     Galois field order
+ * @bch0:   block 0 BCH control structure
+ * @bchn:   block N BCH control structure, same as @bch0 if @e0 == @en
+ * @buf:    padded copy of the raw page
+ * @recv:   received ecc
+ * @calc:   calculated ecc
+ * @errloc: error locations
+ */
+struct bch_decoder {
+	int m, b0, e0, bn, en, n, gf;
+	struct bch_control *bch0;
+	struct bch_control *bchn;
+	uint8_t *buf;
+	uint8_t *recv;
+	uint8_t *calc;
+	unsigned int *errloc;
+};
+
+/*
+ * number of bits set in nbits of bytes
+ */
+static unsigned int count_ones(const uint8_t *p, unsigned int nbits)
+{
+	unsigned int i, cnt = 0;
+
+	for (i = 0; i < nbits / 8; i++)
+		cnt += __builtin_popcount(p[i]);
+
+	if (nbits % 8)
+		cnt += __builtin_popcount(p[i] & ((1 << (nbits % 8)) - 1));
+
+	return cnt;
+}
+
+struct bch_decoder *init_bch_decoder(int version)
+{
+	struct bch_decoder *dec;
+	int err = 0, t;
+
+	dec = calloc(1, sizeof(*dec));
+	if (dec == NULL)
+		return NULL;
+
+	switch (version) {
+		/* regular pages, see BCH setup in flashdrv_init() */
+		case BCH_VERSION_PAGE:
+			dec->m  = 0;
+			dec->b0 = 16;
+			dec->e0 = 16;
+			dec->bn = 512;
+			dec->en = 14;
+			dec->n  = 8;
+			dec->gf = 13;
+			break;
+		/* 40 bit BCH FCB, same as encode_bch_ecc() */
+		case 3:
+			dec->m  = 32;
+			dec->b0 = 128;
+			dec->e0 = 40;
+			dec->bn = 128;
+			dec->en = 40;
+			dec->n  = 7;
+			dec->gf = 13;
+			break;
+		default:
+			free(dec);
+			return NULL;
+	}
+
+	t = (dec->e0 > dec->en) ? dec->e0 : dec->en;
+
+	dec->bch0 = init_bch(dec->gf, dec->e0, 0);
+	dec->bchn = (dec->en == dec->e0) ? dec->bch0 : init_bch(dec->gf, dec->en, 0);
+	dec->buf = bch_alloc(dec->m + dec->b0 + dec->n * dec->bn + (dec->n + 1) * (dec->gf * t + 7) / 8 + 8, &err);
+	dec->recv = bch_alloc((dec->gf * t + 7) / 8, &err);
+	dec->calc = bch_alloc((dec->gf * t + 7) / 8, &err);
+	dec->errloc = bch_alloc(t * sizeof(*dec->errloc), &err);
+
+	if (err || dec->bch0 == NULL || dec->bchn == NULL) {
+		free_bch_decoder(dec);
+		return NULL;
+	}
+
+	return dec;
+}
+
+void free_bch_decoder(struct bch_decoder *dec)
+{
+	if (dec) {
+		if (dec->bchn != dec->bch0)
+			free_bch(dec->bchn);
+		free_bch(dec->bch0);
+		free(dec->buf);
+		free(dec->recv);
+		free(dec->calc);
+		free(dec->errloc);
+		free(dec);
+	}
+}
+
+int bch_decoder_blocks(struct bch_decoder *dec)
+{
+	return dec->n + 1;
+}
+
+/**
+ * decode_bch_ecc - decode raw page written by the BCH engine
+ * @dec:          decoding context
+ * @source_block: raw page
+ * @source_size:  raw page size
+ * @target_block: corrected data of all blocks, back to back
+ * @target_size:  size of @target_block
+ * @status:       per block status, bch_decoder_blocks() entries: number of
+ *                corrected bits, BCH_BLK_UNCORRECTABLE or BCH_BLK_ERASED
+ *
+ * Blocks without errors are detected by comparing received and calculated ecc,
+ * the full decoder is run only on blocks that differ.
+ *
+ * Returns number of corrected bits or -EBADMSG if any of the blocks is
+ * uncorrectable.
+ */
+int decode_bch_ecc(struct bch_decoder *dec, const void *source_block,
+		   size_t source_size, void *target_block, size_t target_size,
+		   uint8_t *status)
+{
+	struct bch_control *bch;
+	uint8_t *data = target_block;
+	unsigned int pos, eccbits, eccbytes, zeros;
+	int i, j, len, t, cnt, total = 0, ret = 0;
+
+	if (target_size < dec->b0 + dec->n * dec->bn)
+		return -EINVAL;
+
+	/* total size rounded down, like in encode_bch_ecc() */
+	if (source_size < dec->m + (dec->b0*8 + dec->e0*dec->gf + (dec->bn*8 + dec->en*dec->gf)*dec->n)/8)
+		return -EINVAL;
+
+	source_size = dec->m + (dec->b0*8 + dec->e0*dec->gf + (dec->bn*8 + dec->en*dec->gf)*dec->n + 7)/8;
+	memcpy(dec->buf, source_block, source_size);
+	memset(dec->buf + source_size, 0, 8);
+
+	pos = dec->m * 8;
+
+	for (i = 0; i < dec->n + 1; i++) {
+		len = i ? dec->bn : dec->b0;
+		t = i ? dec->en : dec->e0;
+		bch = i ? dec->bchn : dec->bch0;
+		eccbits = dec->gf * t;
+		eccbytes = (eccbits + 7) / 8;
+
+		shift_merge(data, dec->buf + pos / 8, len, pos % 8);
+		pos += len * 8;
+
+		shift_merge(dec->recv, dec->buf + pos / 8, eccbytes, pos % 8);
+		pos += eccbits;
+
+		if (eccbits % 8)
+			dec->recv[eccbytes-1] &= (1 << (eccbits % 8)) - 1;
+
+		zeros = len * 8 + eccbits - count_ones(data, len * 8) - count_ones(dec->recv, eccbits);
+
+		for (j = 0; j < eccbytes; j++)
+			dec->recv[j] = reverse_bit(dec->recv[j]);
+
+		memset(dec->calc, 0, eccbytes);
+		encode_bch(bch, data, len, dec->calc);
+
+		cnt = decode_bch(bch, NULL, len, dec->recv, dec->calc, NULL, dec->errloc);
+
+		if (cnt >= 0 && zeros > t) {
+			/* data bytes are encoded lsb first (see swap_data()), so bit order in errloc is mirrored */
+			for (j = 0; j < cnt; j++) {
+				if (dec->errloc[j] < 8 * len)
+					data[dec->errloc[j] / 8] ^= 0x80 >> (dec->errloc[j] % 8);
+			}
+			status[i] = cnt;
+			total += cnt;
+		}
+		else if (zeros <= t) {
+			/* erased block with a few bit flips at most, like the BCH engine reports */
+			memset(data, 0xff, len);
+			status[i] = BCH_BLK_ERASED;
+		}
+		else {
+			status[i] = BCH_BLK_UNCORRECTABLE;
+			ret = -EBADMSG;
+		}
+
+		data += len;
+	}
+
+	return ret ? ret : total;
+}
@@ -97,4 +97,23 @@ int decode_bch(struct bch_control *bch, const uint8_t *data, unsigned int len,
 
 int encode_bch_ecc(void *source_block, size_t source_size,
 				   void *target_block, size_t target_size, int version);
+
+/* raw layout of regular pages, accepted by init_bch_decoder() besides FCB version 3 */
+#define BCH_VERSION_PAGE 0
+
+/* decode_bch_ecc() block status, same as reported by the BCH engine */
+#define BCH_BLK_UNCORRECTABLE 0xfe
+#define BCH_BLK_ERASED        0xff
+
+struct bch_decoder;
+
+struct bch_decoder *init_bch_decoder(int version);
+
+void free_bch_decoder(struct bch_decoder *dec);
+
+int bch_decoder_blocks(struct bch_decoder *dec);
+
+int decode_bch_ecc(struct bch_decoder *dec, const void *source_block,
+		   size_t source_size, void *target_block, size_t target_size,
+		   uint8_t *status);
 #endif /* _BCH_H */
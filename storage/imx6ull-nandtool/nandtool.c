@@ -23,11 +23,13 @@
 
 #include <sys/msg.h>
 #include <sys/mman.h>
+#include <sys/threads.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
 
 #include "bcb.h"
+#include "bch.h"
 #include "test.h"
 
 #include "../../storage/imx6ull-flash/flashsrv.h"
@@ -54,6 +56,25 @@ static const struct cleanmarker oob_cleanmarker =
 test_func_t test_func[16];
 int test_cnt;
 
+/* verify: metadata + data of a decoded page, number of ecc blocks */
+#define VERIFY_DATA_SIZE (16 + PAGE_SIZE)
+#define VERIFY_BLOCKS 9
+#define VERIFY_MAX_THREADS 8
+/* histogram of corrected bits per chunk: 0-1, 2-3, ..., 16+ */
+#define VERIFY_HIST 9
+
+typedef struct {
+	handle_t lock, cond, done;
+
+	uint8_t *raw;
+	uint8_t *data;
+	uint8_t *status;
+	int *result;
+
+	unsigned int npages, next, pending;
+	int nthreads, quit;
+} verify_t;
+
 
 #define nand_msg(silent, fmt, ...)		\
 	do {								\
@@ -228,6 +249,243 @@ int flash_check_range(void *arg, int start, int end, int silent, dbbt_t **dbbt)
 }
 
 
+static void verify_thread(void *arg)
+{
+	verify_t *v = arg;
+	struct bch_decoder *dec = init_bch_decoder(BCH_VERSION_PAGE);
+	unsigned int page;
+
+	mutexLock(v->lock);
+	for (;;) {
+		while (!v->quit && v->next >= v->npages)
+			condWait(v->cond, v->lock, 0);
+
+		if (v->quit)
+			break;
+
+		page = v->next++;
+		mutexUnlock(v->lock);
+
+		if (dec == NULL)
+			v->result[page] = -ENOMEM;
+		else
+			v->result[page] = decode_bch_ecc(dec, v->raw + page * RAW_PAGE_SIZE, RAW_PAGE_SIZE,
+				v->data + page * VERIFY_DATA_SIZE, VERIFY_DATA_SIZE, v->status + page * VERIFY_BLOCKS);
+
+		mutexLock(v->lock);
+		if (--v->pending == 0)
+			condSignal(v->done);
+	}
+
+	v->nthreads--;
+	condSignal(v->done);
+	mutexUnlock(v->lock);
+
+	free_bch_decoder(dec);
+	endthread();
+}
+
+
+/* decodes raw pages from file (path != NULL) or flash blocks start..end, optionally saving corrected data */
+int flash_verify(void *arg, char *path, int start, int end, char *outpath, int nthreads)
+{
+	verify_t v = { 0 };
+	flashdrv_dma_t *dma = NULL;
+	void *raw_page = NULL, *stacks[VERIFY_MAX_THREADS];
+	int imgfd = -1, outfd = -1, i, j, n, err = 0;
+	unsigned int page = 0, blkbits, blkmax, blkfail, st;
+	unsigned int decoded = 0, total = 0, failed = 0, erased = 0, hist[VERIFY_HIST] = { 0 };
+
+	printf("\n------ VERIFY ------\n");
+
+	if (nthreads < 1)
+		nthreads = 1;
+	else if (nthreads > VERIFY_MAX_THREADS)
+		nthreads = VERIFY_MAX_THREADS;
+
+	if (path != NULL) {
+		if ((imgfd = open(path, O_RDONLY)) < 0) {
+			printf("Can't open %s\n", path);
+			return -1;
+		}
+	}
+	else {
+		page = start * PAGES_PER_BLOCK;
+
+		if ((raw_page = mmap(NULL, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_UNCACHED, OID_PHYSMEM, 0x900000)) == MAP_FAILED) {
+			printf("Failed to map pages from OC RAM\n");
+			return -1;
+		}
+
+		if (arg == NULL) {
+			flashdrv_init();
+			dma = flashdrv_dmanew();
+			flashdrv_reset(dma);
+		}
+		else
+			dma = (flashdrv_dma_t *)arg;
+	}
+
+	if (outpath != NULL && (outfd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		printf("Can't open %s, corrected data won't be saved\n", outpath);
+
+	v.raw = malloc(PAGES_PER_BLOCK * RAW_PAGE_SIZE);
+	v.data = malloc(PAGES_PER_BLOCK * VERIFY_DATA_SIZE);
+	v.status = malloc(PAGES_PER_BLOCK * VERIFY_BLOCKS);
+	v.result = malloc(PAGES_PER_BLOCK * sizeof(int));
+
+	/* no threads are started, the cleanup below releases what was allocated */
+	if (v.raw == NULL || v.data == NULL || v.status == NULL || v.result == NULL) {
+		printf("Out of memory\n");
+		err = -1;
+	}
+
+	mutexCreate(&v.lock);
+	condCreate(&v.cond);
+	condCreate(&v.done);
+
+	for (i = 0; i < nthreads && !err; i++) {
+		if ((stacks[i] = malloc(2 * PAGE_SIZE)) == NULL)
+			break;
+
+		if (beginthread(verify_thread, 4, stacks[i], 2 * PAGE_SIZE, &v) < 0) {
+			free(stacks[i]);
+			break;
+		}
+		v.nthreads++;
+	}
+	nthreads = v.nthreads;
+
+	if (!nthreads && !err) {
+		printf("Can't start decoding threads\n");
+		err = -1;
+	}
+
+	/* decode one erase block worth of pages at a time */
+	while (!err) {
+		n = 0;
+		if (path != NULL) {
+			while (n < PAGES_PER_BLOCK && read(imgfd, v.raw + n * RAW_PAGE_SIZE, RAW_PAGE_SIZE) == RAW_PAGE_SIZE)
+				n++;
+		}
+		else if (start < end) {
+			for (; n < PAGES_PER_BLOCK; n++) {
+				if (flashdrv_readraw(dma, start * PAGES_PER_BLOCK + n, raw_page, RAW_PAGE_SIZE) != EOK)
+					printf("Reading page %d returned an error\n", start * PAGES_PER_BLOCK + n);
+				memcpy(v.raw + n * RAW_PAGE_SIZE, raw_page, RAW_PAGE_SIZE);
+			}
+			start++;
+		}
+
+		if (!n)
+			break;
+
+		decoded += n;
+
+		mutexLock(v.lock);
+		v.npages = n;
+		v.pending = n;
+		v.next = 0;
+		condBroadcast(v.cond);
+		while (v.pending)
+			condWait(v.done, v.lock, 0);
+		mutexUnlock(v.lock);
+
+		blkbits = blkmax = blkfail = 0;
+
+		for (i = 0; i < n; i++, page++) {
+			if (v.result[i] == -ENOMEM) {
+				printf("Out of memory\n");
+				err = -1;
+				break;
+			}
+
+			if (v.result[i] < 0) {
+				blkfail++;
+				failed++;
+			}
+			else {
+				blkbits += v.result[i];
+			}
+
+			for (j = 0; j < VERIFY_BLOCKS; j++) {
+				st = v.status[i * VERIFY_BLOCKS + j];
+				if (st == BCH_BLK_ERASED) {
+					if (j == 0)
+						erased++;
+				}
+				else if (st != BCH_BLK_UNCORRECTABLE) {
+					hist[(st / 2 < VERIFY_HIST - 1) ? st / 2 : VERIFY_HIST - 1]++;
+					if (st > blkmax)
+						blkmax = st;
+				}
+			}
+
+			if (v.result[i] != 0) {
+				printf("Page %u:", page);
+				for (j = 0; j < VERIFY_BLOCKS; j++) {
+					st = v.status[i * VERIFY_BLOCKS + j];
+					if (st == BCH_BLK_UNCORRECTABLE)
+						printf(" X");
+					else if (st == BCH_BLK_ERASED)
+						printf(" -");
+					else
+						printf(" %u", st);
+				}
+				printf("\n");
+			}
+
+			if (outfd >= 0)
+				write(outfd, v.data + i * VERIFY_DATA_SIZE + 16, PAGE_SIZE);
+		}
+
+		if (err)
+			break;
+
+		if (blkbits || blkfail)
+			printf("Block %u: %u bits corrected, max %u per chunk, %u uncorrectable pages\n",
+				(page - 1) / PAGES_PER_BLOCK, blkbits, blkmax, blkfail);
+
+		total += blkbits;
+	}
+
+	mutexLock(v.lock);
+	v.quit = 1;
+	condBroadcast(v.cond);
+	while (v.nthreads)
+		condWait(v.done, v.lock, 0);
+	mutexUnlock(v.lock);
+
+	printf("\nPages decoded: %u (%u erased)\n", decoded, erased);
+	printf("Bits corrected: %u\n", total);
+	printf("Uncorrectable pages: %u\n", failed);
+	printf("Corrected bits per chunk:");
+	for (j = 0; j < VERIFY_HIST; j++)
+		printf(" %u", hist[j]);
+	printf(" (0-1, 2-3, ..., 16+)\n");
+	printf("------------------\n");
+
+	for (i = 0; i < nthreads; i++)
+		free(stacks[i]);
+
+	if (imgfd >= 0)
+		close(imgfd);
+	if (outfd >= 0)
+		close(outfd);
+	if (raw_page != NULL)
+		munmap(raw_page, 2 * PAGE_SIZE);
+	if (dma != NULL && arg == NULL)
+		flashdrv_dmadestroy(dma);
+
+	free(v.raw);
+	free(v.data);
+	free(v.status);
+	free(v.result);
+
+	return (err || failed) ? -1 : 0;
+}
+
+
 int flash_check(void *arg, int silent, dbbt_t **dbbt)
 {
 	return flash_check_range(arg, 0, BLOCKS_CNT, silent, dbbt);
@@ -265,7 +523,9 @@ void flash_test(int test_no, void * arg)
 void flash_erase(void *arg, int start, int end, int silent)
 {
 	flashdrv_dma_t *dma;
-	int i;
+	dbbt_t *dbbt;
+	uint32_t paddrs[FLASHDRV_MAX_ERASE_BLOCKS];
+	int i, n;
 	int err;
 
 	nand_msg(silent, "\n------ ERASE ------\n");
@@ -282,11 +542,31 @@ void flash_erase(void *arg, int start, int end, int silent)
 	} else
 		dma = (flashdrv_dma_t *)arg;
 
-	for (i = start; i < end; i++) {
-		err = flashdrv_erase(dma, PAGES_PER_BLOCK * i);
-		if (err)
-			printf("Erasing block %d returned error %d\n", i, err);
+	/* blocks listed in DBBT keep their factory marks */
+	dbbt = dbbt_read(dma);
+
+	/* erase in chained batches, restart after a failed block */
+	for (i = start; i < end;) {
+		for (n = 0; n < FLASHDRV_MAX_ERASE_BLOCKS && i < end; i++) {
+			if (dbbt_block_is_bad(dbbt, i))
+				nand_msg(silent, "Skipping bad block %d\n", i);
+			else
+				paddrs[n++] = PAGES_PER_BLOCK * i;
+		}
+
+		if (n == 0)
+			continue;
+
+		if ((err = flashdrv_eraseseq(dma, paddrs, n)) < 0) {
+			printf("Erasing blocks %u-%u returned error %d\n", paddrs[0] / PAGES_PER_BLOCK, paddrs[n - 1] / PAGES_PER_BLOCK, err);
+		}
+		else if (err < n) {
+			printf("Erasing block %u returned error\n", paddrs[err] / PAGES_PER_BLOCK);
+			i = paddrs[err] / PAGES_PER_BLOCK + 1;
+		}
 	}
+
+	free(dbbt);
 	if (arg == NULL)
 		flashdrv_dmadestroy(dma);
 	nand_msg(silent, "------------------\n");
@@ -405,7 +685,11 @@ void print_help(void)
 			"\t-h - print this message\n" \
 			"\t-t (number) - run test #no\n" \
 			"\t-e (start:end) - erase blocks form start to end\n" \
-			"\t-f (fw1) (fw2) (rootfs) - set flash for internal booting\n");
+			"\t-f (fw1) (fw2) (rootfs) - set flash for internal booting\n" \
+			"\t-v (path) - decode raw page dump and report corrected bits\n" \
+			"\t-V (start:end) - same as -v for raw pages read from blocks start to end\n" \
+			"\t-o (path) - save corrected data (with -v or -V option)\n" \
+			"\t-j (number) - number of decoding threads (with -v or -V option)\n");
 }
 
 
@@ -437,6 +721,84 @@ static int send_nandErase(unsigned port, unsigned start, unsigned end)
 }
 
 
+static int send_nandEraseStart(unsigned port, unsigned start, unsigned end)
+{
+	msg_t msg = { 0 };
+	flash_i_devctl_t *devctl;
+	int err;
+
+	devctl = (flash_i_devctl_t *)&msg.i.raw;
+
+	msg.type = mtDevCtl;
+	devctl->type = flashsrv_devctl_erasestart;
+	devctl->erase.offset = start * PAGES_PER_BLOCK * SIZE_PAGE;
+	devctl->erase.size = (end - start) * PAGES_PER_BLOCK * SIZE_PAGE;
+	devctl->erase.oid.id = -1;
+	devctl->erase.oid.port = port;
+
+	err = msgSend(port, &msg);
+
+	if (err)
+		return err;
+
+	return ((flash_o_devctl_t *)msg.o.raw)->err;
+}
+
+
+static int send_nandEraseStatus(unsigned port, flash_o_devctl_t *status)
+{
+	msg_t msg = { 0 };
+	flash_i_devctl_t *devctl;
+	int err;
+
+	devctl = (flash_i_devctl_t *)&msg.i.raw;
+
+	msg.type = mtDevCtl;
+	devctl->type = flashsrv_devctl_erasestatus;
+
+	err = msgSend(port, &msg);
+
+	if (err)
+		return err;
+
+	memcpy(status, msg.o.raw, sizeof(*status));
+
+	return status->err;
+}
+
+
+/* erases in the server's background thread, falls back to a single blocking request on older servers */
+static int flash_update_erase(unsigned port, unsigned start, unsigned end)
+{
+	flash_o_devctl_t status;
+	int result;
+
+	if ((result = send_nandEraseStart(port, start, end)) == -ENOSYS)
+		return send_nandErase(port, start, end);
+
+	if (result < 0)
+		return result;
+
+	do {
+		usleep(100 * 1000);
+
+		if ((result = send_nandEraseStatus(port, &status)) < 0)
+			return result;
+
+		printf("\rflash: erased %u/%u blocks (%u bad skipped, %u failed)", status.erase.next - status.erase.start,
+			status.erase.end - status.erase.start, status.erase.skipped, status.erase.failed);
+		fflush(stdout);
+	} while (status.erase.running);
+
+	printf("\n");
+
+	if (status.erase.err < 0)
+		return status.erase.err;
+
+	return status.erase.failed ? -EIO : EOK;
+}
+
+
 static int send_nandFlash(unsigned port, unsigned offset, unsigned end, void *data, size_t size)
 {
 	msg_t msg = { 0 };
@@ -492,7 +854,7 @@ static int flash_update_tool(char **args)
 			return -EINVAL;
 		}
 
-		result = send_nandErase(port, start, end);
+		result = flash_update_erase(port, start, end);
 
 		if (result < 0)
 			fprintf(stderr, "flash: error while erasing\n");
@@ -566,8 +928,10 @@ int main(int argc, char **argv)
 	char *tok, *primary, *secondary, *rootfs;
 	int len, i, raw = 0;
 	size_t rootfssz = 64, erase_data = 0;
+	char *verify_path = NULL, *verify_out = NULL;
+	int verify = 0, verify_start = 0, verify_end = 0, verify_threads = 4;
 
-	while ((c = getopt(argc, argv, "i:r:s:hct:e:f:U")) != -1) {
+	while ((c = getopt(argc, argv, "i:r:s:hct:e:f:Uv:V:o:j:")) != -1) {
 		switch (c) {
 
 			case 'i':
@@ -653,6 +1017,27 @@ int main(int argc, char **argv)
 			case 'U':
 				return flash_update_tool(argv + optind) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 
+			case 'v':
+				verify_path = optarg;
+				verify = 1;
+				break;
+
+			case 'V':
+				tok = strtok(optarg, ":");
+				verify_start = atoi(tok);
+				tok = strtok(NULL, ":");
+				verify_end = (tok != NULL) ? atoi(tok) : verify_start + 1;
+				verify = 1;
+				break;
+
+			case 'o':
+				verify_out = optarg;
+				break;
+
+			case 'j':
+				verify_threads = atoi(optarg);
+				break;
+
 			case 'h':
 			default:
 				print_help();
@@ -660,6 +1045,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (verify)
+		return flash_verify(NULL, verify_path, verify_start, verify_end, verify_out, verify_threads) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
 	if (path == NULL || start < 0) {
 		print_help();
 		return 0;
@@ -0,0 +1,173 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL nandtool BCH host tests
+ *
+ * encode_bch_ecc() as it was before the table driven rework: init_bch()
+ * on every call, per bit reverse_bit() and a divide for every output
+ * byte of the data/ecc shift. Kept verbatim, apart from the renames and
+ * freeing the control structure, as the reference of the equivalence
+ * test in bch_test.c.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../bch.h"
+#include "bch_old.h"
+
+
+static uint8_t old_reverse_bit(uint8_t in_byte)
+{
+	int i;
+	uint8_t out_byte = 0;
+
+	for (i = 0; i < 8; i++) {
+		if (in_byte & ((0x80) >> i)) {
+			out_byte |= 1 << i;
+		}
+	}
+
+	return out_byte;
+}
+
+int old_encode_bch_ecc(void *source_block, size_t source_size,
+				   void *target_block, size_t target_size,
+				   int version)
+{
+
+	struct bch_control *bch;
+	uint8_t *ecc_buf;
+	int ecc_buf_size;
+	uint8_t *tmp_buf;
+	int tmp_buf_size;
+	int real_buf_size;
+	int i, j;
+	int ecc_bit_off;
+	int data_ecc_blk_size;
+	int low_byte_off, low_bit_off;
+	int high_byte_off, high_bit_off;
+	uint8_t byte_low, byte_high;
+
+	/* define the variables for bch algorithm*/
+	/* m:  METADATABYTE */
+	/* b0: BLOCK0BYTE */
+	/* e0: BLOCK0ECC */
+	/* bn: BLOCKNBYTE */
+	/* en: BLOCKNECC */
+	/* n : NUMOFBLOCKN */
+	/* gf: FCB_GF */
+	int m, b0, e0, bn, en, n, gf;
+
+	switch (version) {
+		/* 62 bit BCH, for i.MX6SX and i.MX7D */
+		case 2:
+			m  = 32;
+			b0 = 128;
+			e0 = 62;
+			bn = 128;
+			en = 62;
+			n  = 7;
+			gf = 13;
+			break;
+		/* 40 bit BCH, for i.MX6UL */
+		case 3:
+			m  = 32;
+			b0 = 128;
+			e0 = 40;
+			bn = 128;
+			en = 40;
+			n  = 7;
+			gf = 13;
+			break;
+		default:
+			printf("!!!!ERROR, bch version not defined\n");
+			return -EINVAL;
+			break;
+	}
+
+	/* sanity check */
+	/* nand data block must be large enough for FCB structure */
+	if (source_size > b0 + n * bn)
+		return -EINVAL;
+	/* nand page need to be large enough to contain Meta, FCB and ECC */
+	if (target_size < m + b0 + e0*gf/8 + n*bn + n*en*gf/8)
+		return -EINVAL;
+
+	/* init bch, using default polynomial */
+	bch = init_bch(gf, en, 0);
+	if(!bch)
+		return -EINVAL;
+
+	/* buffer for ecc */
+	ecc_buf_size = (gf * en + 7)/8;
+	ecc_buf = malloc(ecc_buf_size);
+	if(!ecc_buf)
+		return -EINVAL;
+
+	/* temp buffer to store data and ecc */
+	tmp_buf_size = b0 + (e0 * gf + 7)/8 + (bn + (en * gf + 7)/8) * 7;
+	tmp_buf = malloc(tmp_buf_size);
+	if(!tmp_buf)
+		return -EINVAL;
+	memset(tmp_buf, 0, tmp_buf_size);
+
+	/* generate ecc code for each data block and store in temp buffer */
+
+	for (i = 0; i < n+1; i++) {
+		memset(ecc_buf, 0, ecc_buf_size);
+		encode_bch(bch, source_block + i * bn, bn, ecc_buf);
+
+		memcpy(tmp_buf + i * (bn + ecc_buf_size), source_block + i * bn, bn);
+
+		/* reverse ecc bit */
+		for (j = 0; j < ecc_buf_size; j++) {
+			ecc_buf[j] = old_reverse_bit(ecc_buf[j]);
+		}
+
+		memcpy(tmp_buf + (i+1)*bn + i*ecc_buf_size, ecc_buf, ecc_buf_size);
+	}
+
+	/* store Metadata for taget block with randomizer*/
+	/*memcpy(target_block, RandData, m);*/
+	memset(target_block, 0, m);
+
+	/* shift the bit to combine the source data and ecc */
+	real_buf_size = (b0*8 + gf*e0 + (bn*8 + gf*en)*n)/8;
+
+	if (!((gf * en)%8)) {
+		/* ecc data is byte aligned, just copy it. */
+		memcpy(target_block + m, tmp_buf, real_buf_size);
+	} else {
+		/* bit offset for each ecc block */
+		ecc_bit_off = 8 - (gf * en)%8;
+		/* size of a data block plus ecc block */
+		data_ecc_blk_size = bn +(gf*en+7)/8;
+
+		for (i = 0; i < real_buf_size; i++) {
+			low_bit_off = ((i/data_ecc_blk_size) * ecc_bit_off)%8;
+			low_byte_off = ((i/data_ecc_blk_size) * ecc_bit_off)/8;
+			high_bit_off = (((i+1)/data_ecc_blk_size) * ecc_bit_off)%8;
+			high_byte_off = (((i+1)/data_ecc_blk_size) * ecc_bit_off)/8;
+
+			byte_low = tmp_buf[i+low_byte_off] >> low_bit_off;
+			byte_high = tmp_buf[i+1+high_byte_off] << (8 - high_bit_off);
+
+			*(uint8_t *)(target_block + i + m) = (byte_low | byte_high);
+		}
+	}
+
+	free_bch(bch);
+	free(ecc_buf);
+	free(tmp_buf);
+	return 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL nandtool BCH host tests
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _BCH_OLD_H_
+#define _BCH_OLD_H_
+
+#include <stddef.h>
+
+
+/* encode_bch_ecc() before the table driven rework */
+extern int old_encode_bch_ecc(void *source_block, size_t source_size,
+	void *target_block, size_t target_size, int version);
+
+
+#endif
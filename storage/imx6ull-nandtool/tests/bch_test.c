@@ -0,0 +1,475 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL nandtool BCH host tests
+ *
+ * Raw pages are built by a bit-serial reference encoder, independent of
+ * the table driven encode_bch(): generator polynomial from the roots in
+ * GF(2^13), data fed lsb first, parity msb first, everything packed lsb
+ * first into one bit stream like the GPMI does. The reference is checked
+ * against encode_bch_ecc() on the FCB layout, then used for the regular
+ * page layout (16 B metadata with BCH16, 8 x 512 B with BCH14) to test
+ * decode_bch_ecc() with injected bit flips and erased pages.
+ *
+ * encode_bch_ecc() is also compared with its implementation before the
+ * table driven rework (bch_old.c) on both FCB versions, v2 (BCH-62, bit
+ * shifted blocks) and v3 (BCH-40), and run from several threads at once.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../bch.h"
+#include "bch_old.h"
+#include "test.h"
+
+
+#define GF_M    13
+#define GF_N    ((1 << GF_M) - 1)
+#define GF_POLY 0x201b          /* Default of init_bch() for m = 13 */
+
+#define MAX_T   40
+
+#define PAGE_RAW  4320
+#define PAGE_DATA (16 + 8 * 512)
+#define PAGE_BLKS 9
+
+#define FCB_RAW  (32 + 8 * (128 + 65))
+#define FCB_DATA (8 * 128)
+
+#define ENC_INPUTS  64
+#define ENC_PAGE    2048        /* Version 2 takes 32 + 8 * 128 + 8 * 100.75 bytes */
+#define ENC_THREADS 4
+
+
+/* Chunk layout of a raw page */
+typedef struct {
+	int m, b0, e0, bn, en, n;
+} ref_layout_t;
+
+
+static const ref_layout_t ref_page = { 0, 16, 16, 512, 14, 8 };
+static const ref_layout_t ref_fcb = { 32, 128, 40, 128, 40, 7 };
+
+
+static struct {
+	uint16_t pow[GF_N + 1];
+	uint16_t log[GF_N + 1];
+
+	/* Generator polynomials over GF(2), index t, coefficient of x^i at gen[t][i] */
+	uint8_t gen[MAX_T + 1][GF_M * MAX_T + 1];
+	int deg[MAX_T + 1];
+} ref_common;
+
+
+int test_failed;
+
+
+static struct {
+	uint8_t data[PAGE_DATA];
+	uint8_t raw[PAGE_RAW];
+	uint8_t bad[PAGE_RAW];
+	uint8_t out[PAGE_DATA];
+	uint8_t status[PAGE_BLKS];
+	struct bch_decoder *dec;
+} test_common;
+
+
+/* encode_bch_ecc() of the old implementation, [version - 2][input] */
+static struct {
+	uint8_t in[ENC_INPUTS][FCB_DATA];
+	uint8_t out[2][ENC_INPUTS][ENC_PAGE];
+	int errors;
+} enc_common;
+
+
+static unsigned int ref_mul(unsigned int a, unsigned int b)
+{
+	if (!a || !b)
+		return 0;
+
+	return ref_common.pow[(ref_common.log[a] + ref_common.log[b]) % GF_N];
+}
+
+
+/* Product of (x + a^j) over the cyclotomic cosets of a^1 .. a^2t */
+static int ref_generator(int t)
+{
+	static unsigned int g[GF_M * MAX_T + 1];
+	static uint8_t root[GF_N];
+	unsigned int r;
+	int i, j, d = 0;
+
+	memset(root, 0, sizeof(root));
+
+	for (i = 1; i <= 2 * t; ++i) {
+		for (j = i; !root[j]; j = (2 * j) % GF_N)
+			root[j] = 1;
+	}
+
+	g[0] = 1;
+
+	for (r = 1; r < GF_N; ++r) {
+		if (!root[r])
+			continue;
+
+		g[++d] = 0;
+		for (i = d; i > 0; --i)
+			g[i] = g[i - 1] ^ ref_mul(g[i], ref_common.pow[r]);
+		g[0] = ref_mul(g[0], ref_common.pow[r]);
+	}
+
+	/* Minimal polynomials have binary coefficients */
+	for (i = 0; i <= d; ++i) {
+		if (g[i] > 1)
+			return -1;
+
+		ref_common.gen[t][i] = g[i];
+	}
+
+	ref_common.deg[t] = d;
+
+	return 0;
+}
+
+
+static int ref_init(void)
+{
+	unsigned int x = 1;
+	int i;
+
+	for (i = 0; i < GF_N; ++i) {
+		ref_common.pow[i] = x;
+		ref_common.log[x] = i;
+		x <<= 1;
+		if (x & (1 << GF_M))
+			x ^= GF_POLY;
+	}
+
+	TEST_CHECK(x == 1);
+
+	TEST_CHECK(ref_generator(14) == 0 && ref_common.deg[14] == GF_M * 14);
+	TEST_CHECK(ref_generator(16) == 0 && ref_common.deg[16] == GF_M * 16);
+	TEST_CHECK(ref_generator(40) == 0 && ref_common.deg[40] == GF_M * 40);
+
+	return 0;
+}
+
+
+static inline int ref_getBit(const uint8_t *buff, unsigned int pos)
+{
+	return (buff[pos / 8] >> (pos % 8)) & 1;
+}
+
+
+static inline void ref_putBit(uint8_t *buff, unsigned int pos, int bit)
+{
+	buff[pos / 8] |= bit << (pos % 8);
+}
+
+
+/* Systematic encoding of one chunk by LFSR division, returns stream position after its parity */
+static unsigned int ref_chunk(uint8_t *raw, unsigned int pos, const uint8_t *data, int len, int t)
+{
+	static uint8_t reg[GF_M * MAX_T];
+	const uint8_t *g = ref_common.gen[t];
+	int i, k, r = ref_common.deg[t], fb;
+
+	memset(reg, 0, r);
+
+	for (i = 0; i < 8 * len; ++i) {
+		fb = ((data[i / 8] >> (i % 8)) & 1) ^ reg[r - 1];
+		ref_putBit(raw, pos++, (data[i / 8] >> (i % 8)) & 1);
+
+		for (k = r - 1; k > 0; --k)
+			reg[k] = reg[k - 1] ^ (fb & g[k]);
+		reg[0] = fb & g[0];
+	}
+
+	for (k = r - 1; k >= 0; --k)
+		ref_putBit(raw, pos++, reg[k]);
+
+	return pos;
+}
+
+
+static void ref_encode(const ref_layout_t *l, const uint8_t *data, uint8_t *raw, size_t size)
+{
+	unsigned int pos = 8 * l->m;
+	int i;
+
+	memset(raw, 0, size);
+
+	pos = ref_chunk(raw, pos, data, l->b0, l->e0);
+	data += l->b0;
+
+	for (i = 0; i < l->n; ++i, data += l->bn)
+		pos = ref_chunk(raw, pos, data, l->bn, l->en);
+}
+
+
+static void test_fill(uint8_t *buff, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		buff[i] = rand();
+}
+
+
+/* Flips n distinct bits within [start, start + len) of the stream */
+static void test_flip(uint8_t *raw, unsigned int start, unsigned int len, int n)
+{
+	unsigned int pos;
+
+	while (n) {
+		pos = start + rand() % len;
+		if (ref_getBit(raw, pos) == ref_getBit(test_common.raw, pos)) {
+			raw[pos / 8] ^= 1 << (pos % 8);
+			--n;
+		}
+	}
+}
+
+
+static unsigned int test_chunkStart(int blk)
+{
+	return blk ? 8 * 16 + GF_M * 16 + (blk - 1) * (8 * 512 + GF_M * 14) : 0;
+}
+
+
+static unsigned int test_chunkBits(int blk)
+{
+	return blk ? 8 * 512 + GF_M * 14 : 8 * 16 + GF_M * 16;
+}
+
+
+static int test_reference(void)
+{
+	static uint8_t fcb[FCB_DATA], ref[FCB_RAW], lib[FCB_RAW];
+	int k;
+
+	/* Reference matches kobs-ng encoder on the byte aligned FCB layout */
+	for (k = 0; k < 4; ++k) {
+		test_fill(fcb, sizeof(fcb));
+
+		ref_encode(&ref_fcb, fcb, ref, sizeof(ref));
+		TEST_CHECK(encode_bch_ecc(fcb, sizeof(fcb), lib, sizeof(lib), 3) == 0);
+		TEST_CHECK(memcmp(ref, lib, sizeof(ref)) == 0);
+	}
+
+	/* Regular page fills 4320 bytes exactly */
+	TEST_CHECK(test_chunkStart(PAGE_BLKS - 1) + test_chunkBits(PAGE_BLKS - 1) == 8 * PAGE_RAW);
+
+	return 0;
+}
+
+
+/* Whole page, metadata and the bytes past the layout included, matches the old encoder */
+static int test_encoders(void)
+{
+	static uint8_t out[ENC_PAGE];
+	int k, v;
+
+	for (k = 0; k < ENC_INPUTS; ++k)
+		test_fill(enc_common.in[k], FCB_DATA);
+
+	for (v = 0; v < 2; ++v) {
+		for (k = 0; k < ENC_INPUTS; ++k) {
+			memset(enc_common.out[v][k], 0x5a, ENC_PAGE);
+			memset(out, 0x5a, ENC_PAGE);
+
+			TEST_CHECK(old_encode_bch_ecc(enc_common.in[k], FCB_DATA, enc_common.out[v][k], ENC_PAGE, v + 2) == 0);
+			TEST_CHECK(encode_bch_ecc(enc_common.in[k], FCB_DATA, out, ENC_PAGE, v + 2) == 0);
+
+			if (memcmp(out, enc_common.out[v][k], ENC_PAGE) != 0) {
+				printf("version %d input %d differs\n", v + 2, k);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+static void *test_encodeThread(void *arg)
+{
+	unsigned int seed = (uintptr_t)arg;
+	uint8_t out[ENC_PAGE];
+	int i, k, v;
+
+	for (i = 0; i < 2000; ++i) {
+		k = rand_r(&seed) % ENC_INPUTS;
+		v = rand_r(&seed) % 2;
+
+		memset(out, 0x5a, ENC_PAGE);
+		if (encode_bch_ecc(enc_common.in[k], FCB_DATA, out, ENC_PAGE, v + 2) != 0 || memcmp(out, enc_common.out[v][k], ENC_PAGE) != 0)
+			__atomic_add_fetch(&enc_common.errors, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+
+/* nandtool -j: both versions encoded concurrently share the cached BCH tables */
+static int test_encodeThreads(void)
+{
+	pthread_t tids[ENC_THREADS];
+	uintptr_t i;
+
+	for (i = 0; i < ENC_THREADS; ++i)
+		TEST_CHECK(pthread_create(&tids[i], NULL, test_encodeThread, (void *)(i + 1)) == 0);
+
+	for (i = 0; i < ENC_THREADS; ++i)
+		pthread_join(tids[i], NULL);
+
+	TEST_CHECK(enc_common.errors == 0);
+
+	return 0;
+}
+
+
+static int test_clean(void)
+{
+	int k, i;
+
+	for (k = 0; k < 8; ++k) {
+		test_fill(test_common.data, sizeof(test_common.data));
+		ref_encode(&ref_page, test_common.data, test_common.raw, sizeof(test_common.raw));
+
+		memset(test_common.out, 0, sizeof(test_common.out));
+		TEST_CHECK(decode_bch_ecc(test_common.dec, test_common.raw, PAGE_RAW, test_common.out, sizeof(test_common.out), test_common.status) == 0);
+		TEST_CHECK(memcmp(test_common.out, test_common.data, sizeof(test_common.data)) == 0);
+
+		for (i = 0; i < PAGE_BLKS; ++i)
+			TEST_CHECK(test_common.status[i] == 0);
+	}
+
+	return 0;
+}
+
+
+/* Up to t flips per chunk, in data and parity, are corrected exactly */
+static int test_correctable(void)
+{
+	int k, i, t, flips[PAGE_BLKS], total;
+
+	for (k = 0; k < 200; ++k) {
+		test_fill(test_common.data, sizeof(test_common.data));
+		ref_encode(&ref_page, test_common.data, test_common.raw, sizeof(test_common.raw));
+		memcpy(test_common.bad, test_common.raw, PAGE_RAW);
+
+		for (i = 0, total = 0; i < PAGE_BLKS; ++i) {
+			t = i ? 14 : 16;
+			flips[i] = (k < 2) ? k * t : rand() % (t + 1);
+			test_flip(test_common.bad, test_chunkStart(i), test_chunkBits(i), flips[i]);
+			total += flips[i];
+		}
+
+		memset(test_common.out, 0, sizeof(test_common.out));
+		TEST_CHECK(decode_bch_ecc(test_common.dec, test_common.bad, PAGE_RAW, test_common.out, sizeof(test_common.out), test_common.status) == total);
+		TEST_CHECK(memcmp(test_common.out, test_common.data, sizeof(test_common.data)) == 0);
+
+		for (i = 0; i < PAGE_BLKS; ++i)
+			TEST_CHECK(test_common.status[i] == flips[i]);
+	}
+
+	return 0;
+}
+
+
+/* Damage past t is reported, other chunks of the page are still corrected */
+static int test_uncorrectable(void)
+{
+	int k, i, t, bad, misses = 0;
+
+	for (k = 0; k < 100; ++k) {
+		test_fill(test_common.data, sizeof(test_common.data));
+		ref_encode(&ref_page, test_common.data, test_common.raw, sizeof(test_common.raw));
+		memcpy(test_common.bad, test_common.raw, PAGE_RAW);
+
+		bad = k % PAGE_BLKS;
+
+		for (i = 0; i < PAGE_BLKS; ++i) {
+			t = i ? 14 : 16;
+			test_flip(test_common.bad, test_chunkStart(i), test_chunkBits(i), (i == bad) ? t + 1 + rand() % (2 * t) : rand() % (t + 1));
+		}
+
+		TEST_CHECK(decode_bch_ecc(test_common.dec, test_common.bad, PAGE_RAW, test_common.out, sizeof(test_common.out), test_common.status) == -EBADMSG);
+
+		for (i = 0; i < PAGE_BLKS; ++i) {
+			if (i == bad) {
+				/* Miscorrection past t is possible, but it must be rare */
+				misses += (test_common.status[i] != BCH_BLK_UNCORRECTABLE);
+				continue;
+			}
+
+			TEST_CHECK(test_common.status[i] <= (i ? 14 : 16));
+			TEST_CHECK(memcmp(test_common.out + (i ? 16 + (i - 1) * 512 : 0), test_common.data + (i ? 16 + (i - 1) * 512 : 0), i ? 512 : 16) == 0);
+		}
+	}
+
+	/* Only the damaged chunk makes the page fail, so each page has it reported */
+	TEST_CHECK(misses == 0);
+
+	return 0;
+}
+
+
+static int test_erased(void)
+{
+	int k, i;
+
+	for (k = 0; k <= 14; ++k) {
+		memset(test_common.raw, 0xff, PAGE_RAW);
+		memcpy(test_common.bad, test_common.raw, PAGE_RAW);
+
+		for (i = 0; i < PAGE_BLKS; ++i)
+			test_flip(test_common.bad, test_chunkStart(i), test_chunkBits(i), k);
+
+		TEST_CHECK(decode_bch_ecc(test_common.dec, test_common.bad, PAGE_RAW, test_common.out, sizeof(test_common.out), test_common.status) == 0);
+
+		for (i = 0; i < PAGE_BLKS; ++i)
+			TEST_CHECK(test_common.status[i] == BCH_BLK_ERASED);
+
+		for (i = 0; i < PAGE_DATA; ++i)
+			TEST_CHECK(test_common.out[i] == 0xff);
+	}
+
+	return 0;
+}
+
+
+int main(void)
+{
+	srand(1);
+
+	TEST_CASE(ref_init());
+
+	if ((test_common.dec = init_bch_decoder(BCH_VERSION_PAGE)) == NULL || bch_decoder_blocks(test_common.dec) != PAGE_BLKS) {
+		printf("bch_test: init_bch_decoder failed\n");
+		return EXIT_FAILURE;
+	}
+
+	TEST_CASE(test_reference());
+	TEST_CASE(test_encoders());
+	TEST_CASE(test_encodeThreads());
+	TEST_CASE(test_clean());
+	TEST_CASE(test_correctable());
+	TEST_CASE(test_uncorrectable());
+	TEST_CASE(test_erased());
+
+	free_bch_decoder(test_common.dec);
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
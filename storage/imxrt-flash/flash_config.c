@@ -34,7 +34,7 @@ static int flash_getWindbondConfig(flash_context_t *context)
 			context->properties.size = 0x400000;
 			context->properties.page_size = 0x100;
 			context->properties.sector_size = 0x1000;
-			context->buff = malloc(context->properties.sector_size);
+			context->buff = malloc(FLASH_CACHE_SECTORS * context->properties.sector_size);
 
 			if (context->buff == NULL)
 				return -ENOMEM;
@@ -55,7 +55,7 @@ static int flash_getIssiConfig(flash_context_t *context)
 			context->properties.size = 0x800000;
 			context->properties.page_size = 0x100;
 			context->properties.sector_size = 0x1000;
-			context->buff = malloc(context->properties.sector_size);
+			context->buff = malloc(FLASH_CACHE_SECTORS * context->properties.sector_size);
 
 			if (context->buff == NULL)
 				return -ENOMEM;
@@ -76,7 +76,7 @@ static int flash_getMicronConfig(flash_context_t *context)
 			context->properties.size = 0x400000;
 			context->properties.page_size = 0x100;
 			context->properties.sector_size = 0x1000;
-			context->buff = malloc(context->properties.sector_size);
+			context->buff = malloc(FLASH_CACHE_SECTORS * context->properties.sector_size);
 
 			if (context->buff == NULL)
 				return -ENOMEM;
@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/platform.h>
 #include <phoenix/arch/imxrt.h>
 
 
@@ -96,23 +97,300 @@ static int flash_isValidAddress(flash_context_t *context, uint32_t addr, size_t
 }
 
 
+static int flash_isErased(const char *data, size_t size)
+{
+	const uint32_t *word = (const uint32_t *)data;
+	size_t i;
+
+	for (i = 0; i < size / sizeof(uint32_t); ++i) {
+		if (word[i] != 0xffffffff)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/* NOR program can only clear bits */
+static int flash_isProgrammable(const char *old, const char *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		if ((old[i] & data[i]) != data[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/* Mapped flash is cacheable, erase/program go around both the FlexSPI prefetch buffers and the D-cache */
+static void flash_invalidate(flash_context_t *context, uint32_t offset, size_t size)
+{
+	platformctl_t pctl;
+
+	flexspi_clearCache(context->instance);
+
+	pctl.action = pctl_set;
+	pctl.type = pctl_cleanInvalDCache;
+	pctl.cleanInvalDCache.addr = (void *)(context->address + offset);
+	pctl.cleanInvalDCache.sz = size;
+
+	platformctl(&pctl);
+}
+
+
+/* copies from the memory mapped flash, words are used when both buffers allow it */
+static void flash_readMapped(flash_context_t *context, uint32_t offset, char *buff, size_t size)
+{
+	const char *src = (const char *)(context->address + offset);
+	const uint32_t *wsrc;
+	uint32_t *wdst;
+
+	if ((((uintptr_t)src ^ (uintptr_t)buff) & (sizeof(uint32_t) - 1)) == 0) {
+		for (; size && ((uintptr_t)src & (sizeof(uint32_t) - 1)); --size)
+			*buff++ = *src++;
+
+		wsrc = (const uint32_t *)src;
+		wdst = (uint32_t *)buff;
+
+		for (; size >= 4 * sizeof(uint32_t); size -= 4 * sizeof(uint32_t)) {
+			wdst[0] = wsrc[0];
+			wdst[1] = wsrc[1];
+			wdst[2] = wsrc[2];
+			wdst[3] = wsrc[3];
+			wdst += 4;
+			wsrc += 4;
+		}
+
+		for (; size >= sizeof(uint32_t); size -= sizeof(uint32_t))
+			*wdst++ = *wsrc++;
+
+		src = (const char *)wsrc;
+		buff = (char *)wdst;
+	}
+
+	while (size--)
+		*buff++ = *src++;
+}
+
+
+static int flash_syncSector(flash_context_t *context, flash_cache_t *cache)
+{
+	int i, err = EOK;
+	uint32_t dstAddr, pages;
+	const char *src;
+	const uint32_t pagesNumber = context->properties.sector_size / context->properties.page_size;
+
+	cache->written = 0;
+
+	if (cache->sectorID < 0 || !cache->dirty)
+		return EOK;
+
+	dstAddr = cache->sectorID * context->properties.sector_size;
+
+	if (cache->erase) {
+		if (flexspi_norFlashErase(context->instance, &context->config, dstAddr, context->properties.sector_size) != 0) {
+			flash_invalidate(context, dstAddr, context->properties.sector_size);
+			cache->sectorID = -1;
+			return -EIO;
+		}
+
+		context->stats.erases++;
+		pages = (1u << (pagesNumber - 1) << 1) - 1;
+	}
+	else {
+		pages = cache->dirty;
+	}
+
+	for (i = 0; i < pagesNumber; ++i) {
+		if (!(pages & (1u << i)))
+			continue;
+
+		src = cache->buff + i * context->properties.page_size;
+
+		if (flash_isErased(src, context->properties.page_size)) {
+			context->stats.skipped++;
+			continue;
+		}
+
+		if (flexspi_norFlashPageProgram(context->instance, &context->config, dstAddr + i * context->properties.page_size, (const uint32_t *)src) != 0)
+			err = -EIO;
+		else
+			context->stats.programs++;
+	}
+
+	cache->dirty = 0;
+	cache->erase = 0;
+
+	/* memory mapped reads mustn't return prefetched or cached data */
+	flash_invalidate(context, dstAddr, context->properties.sector_size);
+
+	/* flash contents are unknown after failure */
+	if (err < 0)
+		cache->sectorID = -1;
+
+	return err;
+}
+
+
+static flash_cache_t *flash_getSector(flash_context_t *context, int sectorID)
+{
+	int i;
+	flash_cache_t *cache, *victim = NULL;
+
+	for (i = 0; i < FLASH_CACHE_SECTORS; ++i) {
+		cache = &context->cache[i];
+
+		if (cache->sectorID == sectorID) {
+			context->stats.hits++;
+			cache->lastUsed = ++context->tick;
+			return cache;
+		}
+
+		if (victim == NULL || cache->lastUsed < victim->lastUsed)
+			victim = cache;
+	}
+
+	context->stats.misses++;
+
+	if (flash_syncSector(context, victim) < 0)
+		return NULL;
+
+	flash_readMapped(context, context->properties.sector_size * sectorID, victim->buff, context->properties.sector_size);
+
+	victim->sectorID = sectorID;
+	victim->lastUsed = ++context->tick;
+	victim->dirty = 0;
+	victim->written = 0;
+	victim->erase = 0;
+
+	return victim;
+}
+
+
 size_t flash_readData(flash_context_t *context, uint32_t offset, char *buff, size_t size)
 {
+	int i;
+	uint32_t start, end;
+	flash_cache_t *cache;
+
 	if (flash_isValidAddress(context, offset, size))
 		return 0;
 
-	if (flexspi_norFlashRead(context->instance, &context->config, (uint32_t *)buff, offset, size) < 0)
-		return 0;
+	flash_readMapped(context, offset, buff, size);
+
+	/* cached sectors hold unsynced writes, clean ones are served from cache too */
+	for (i = 0; i < FLASH_CACHE_SECTORS; ++i) {
+		cache = &context->cache[i];
+
+		if (cache->sectorID < 0)
+			continue;
+
+		start = cache->sectorID * context->properties.sector_size;
+		end = start + context->properties.sector_size;
+
+		if (start < offset)
+			start = offset;
+
+		if (end > offset + size)
+			end = offset + size;
+
+		if (start < end)
+			memcpy(buff + start - offset, cache->buff + start % context->properties.sector_size, end - start);
+	}
 
 	return size;
 }
 
 
+/* returns how much of a write starting at addr can bypass the cache, whole blocks or sectors */
+static size_t flash_directSize(flash_context_t *context, uint32_t addr, const char *buff, size_t size)
+{
+	/* ROM programs pages from word buffers */
+	if ((uintptr_t)buff & (sizeof(uint32_t) - 1))
+		return 0;
+
+	if (!(addr % FLASH_BLOCK_SIZE) && size >= FLASH_BLOCK_SIZE)
+		return FLASH_BLOCK_SIZE;
+
+	if (!(addr % context->properties.sector_size) && size >= context->properties.sector_size)
+		return context->properties.sector_size;
+
+	return 0;
+}
+
+
+/* overwrites whole erase units with the caller's data, the old contents aren't read into the cache */
+static int flash_writeDirect(flash_context_t *context, uint32_t offset, const char *buff, size_t size)
+{
+	int i, erase = 0, err = EOK;
+	uint32_t pos, start;
+	flash_cache_t *cache;
+	const char *src, *old = (const char *)(context->address + offset);
+	const uint32_t pageSize = context->properties.page_size;
+
+	/* cached sectors of the range are superseded by the new data */
+	for (i = 0; i < FLASH_CACHE_SECTORS; ++i) {
+		cache = &context->cache[i];
+		start = cache->sectorID * context->properties.sector_size;
+
+		if (cache->sectorID >= 0 && start >= offset && start < offset + size) {
+			cache->sectorID = -1;
+			cache->dirty = 0;
+			cache->written = 0;
+			cache->erase = 0;
+		}
+	}
+
+	for (pos = 0; pos < size; pos += pageSize) {
+		if (!flash_isProgrammable(old + pos, buff + pos, pageSize)) {
+			erase = 1;
+			break;
+		}
+	}
+
+	/* single erase command, ROM uses block erase for aligned blocks */
+	if (erase) {
+		if (flexspi_norFlashErase(context->instance, &context->config, offset, size) != 0) {
+			flash_invalidate(context, offset, size);
+			return -EIO;
+		}
+
+		context->stats.erases++;
+	}
+
+	for (pos = 0; pos < size; pos += pageSize) {
+		src = buff + pos;
+
+		if (erase ? flash_isErased(src, pageSize) : !memcmp(old + pos, src, pageSize)) {
+			context->stats.skipped++;
+			continue;
+		}
+
+		if (flexspi_norFlashPageProgram(context->instance, &context->config, offset + pos, (const uint32_t *)src) != 0) {
+			err = -EIO;
+			break;
+		}
+
+		context->stats.programs++;
+	}
+
+	context->stats.direct += size / context->properties.sector_size;
+	flash_invalidate(context, offset, size);
+
+	return err;
+}
+
+
 size_t flash_writeDataPage(flash_context_t *context, uint32_t offset, const char *buff, size_t size)
 {
-	uint32_t pageAddr;
-	uint16_t sector_id;
-	size_t savedBytes = 0;
+	uint32_t pageAddr, page;
+	size_t len, savedBytes = 0;
+	flash_cache_t *cache;
+	char *dst;
+	const uint32_t pagesNumber = context->properties.sector_size / context->properties.page_size;
 
 	if (size % context->properties.page_size)
 		return 0;
@@ -122,30 +400,40 @@ size_t flash_writeDataPage(flash_context_t *context, uint32_t offset, const char
 
 	while (savedBytes < size) {
 		pageAddr = offset + savedBytes;
-		sector_id = pageAddr / context->properties.sector_size;
 
-		/* If sector_id has changed, data from previous sector have to be saved and new sector is read. */
-		if (sector_id != context->sectorID) {
-			flash_sync(context);
-
-			if (flash_readData(context, context->properties.sector_size * sector_id, context->buff, context->properties.sector_size) <= 0)
+		if ((len = flash_directSize(context, pageAddr, buff + savedBytes, size - savedBytes)) != 0) {
+			if (flash_writeDirect(context, pageAddr, buff + savedBytes, len) < 0)
 				return savedBytes;
 
-			if (flexspi_norFlashErase(context->instance, &context->config, context->properties.sector_size * sector_id, context->properties.sector_size) != 0)
-				return savedBytes;
-
-			context->sectorID = sector_id;
-			context->counter = offset - context->properties.sector_size * context->sectorID;
+			savedBytes += len;
+			continue;
 		}
 
-		memcpy(context->buff + context->counter, buff + savedBytes, context->properties.page_size);
+		if ((cache = flash_getSector(context, pageAddr / context->properties.sector_size)) == NULL)
+			return savedBytes;
+
+		page = (pageAddr % context->properties.sector_size) / context->properties.page_size;
+		dst = cache->buff + page * context->properties.page_size;
+
+		if (memcmp(dst, buff + savedBytes, context->properties.page_size)) {
+			if (!flash_isProgrammable(dst, buff + savedBytes, context->properties.page_size))
+				cache->erase = 1;
+
+			memcpy(dst, buff + savedBytes, context->properties.page_size);
+			cache->dirty |= 1u << page;
+		}
+		else {
+			context->stats.skipped++;
+		}
 
+		cache->written |= 1u << page;
 		savedBytes += context->properties.page_size;
-		context->counter += context->properties.page_size;
 
-		/* Save filled buffer */
-		if (context->counter >= context->properties.sector_size)
-			flash_sync(context);
+		/* Save filled sector */
+		if (cache->written == (1u << (pagesNumber - 1) << 1) - 1) {
+			if (flash_syncSector(context, cache) < 0)
+				return savedBytes - context->properties.page_size;
+		}
 	}
 
 	return size;
@@ -155,28 +443,15 @@ size_t flash_writeDataPage(flash_context_t *context, uint32_t offset, const char
 void flash_sync(flash_context_t *context)
 {
 	int i;
-	uint32_t dstAddr;
-	const uint32_t *src;
-	const uint32_t pagesNumber = context->properties.sector_size / context->properties.page_size;
 
-	if (context->counter == 0)
-		return;
-
-	for (i = 0; i < pagesNumber; ++i) {
-		dstAddr = context->sectorID * context->properties.sector_size + i * context->properties.page_size;
-		src = (const uint32_t *)(context->buff + i * context->properties.page_size);
-
-		flexspi_norFlashPageProgram(context->instance, &context->config, dstAddr, src);
-	}
-
-	context->counter = 0;
-	context->sectorID = -1;
+	for (i = 0; i < FLASH_CACHE_SECTORS; ++i)
+		flash_syncSector(context, &context->cache[i]);
 }
 
 
 int flash_init(flash_context_t *context)
 {
-	int res = EOK;
+	int i, res = EOK;
 
 	if ((res = flash_defineFlexSPI(context)) < 0)
 		return res;
@@ -190,14 +465,31 @@ int flash_init(flash_context_t *context)
 	/* Basic LUT table uses by ROM API. */
 	flash_setLutTable(context);
 
+	/* lets ROM erase aligned 64 KiB ranges with a single block erase */
+	context->config.blockSize = FLASH_BLOCK_SIZE;
+	context->config.isUniformBlockSize = 0;
+
 	if (flexspi_getVendorID(context->instance, &context->flashID) != 0)
 		return -ENXIO;
 
 	if (flash_getConfig(context) != 0)
 		return -ENXIO;
 
-	context->sectorID = -1;
-	context->counter = 0;
+	/* dirty and written bitmaps hold a bit per page */
+	if (context->properties.sector_size / context->properties.page_size > 32)
+		return -EINVAL;
+
+	for (i = 0; i < FLASH_CACHE_SECTORS; ++i) {
+		context->cache[i].sectorID = -1;
+		context->cache[i].lastUsed = 0;
+		context->cache[i].dirty = 0;
+		context->cache[i].written = 0;
+		context->cache[i].erase = 0;
+		context->cache[i].buff = context->buff + i * context->properties.sector_size;
+	}
+
+	context->tick = 0;
+	memset(&context->stats, 0, sizeof(context->stats));
 
 	return res;
 }
@@ -22,6 +22,12 @@
 #define FLEXSPI_DATA_ADDRESS 0x60000000
 #define FLEXSPI2_DATA_ADDRESS 0x70000000
 
+/* number of sectors kept in the write-back cache */
+#define FLASH_CACHE_SECTORS 4
+
+/* erase unit of the block erase LUT sequence */
+#define FLASH_BLOCK_SIZE 0x10000
+
 
 typedef struct _flash_properties_t {
 	uint32_t size;
@@ -30,9 +36,30 @@ typedef struct _flash_properties_t {
 } __attribute__((packed)) flash_properties_t;
 
 
-typedef struct _flash_context_t {
+typedef struct _flash_cache_t {
 	int sectorID;
-	int counter;
+	uint32_t lastUsed;
+	uint32_t dirty;         /* bitmap of pages which differ from flash */
+	uint32_t written;       /* bitmap of pages written since the sector was loaded */
+	int erase;              /* new data sets some bits, sector has to be erased before programming */
+	char *buff;
+} flash_cache_t;
+
+
+typedef struct _flash_stats_t {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t erases;
+	uint32_t programs;
+	uint32_t skipped;       /* page programs avoided, unchanged or erased pages */
+	uint32_t direct;        /* sectors written from the caller's buffer, bypassing the cache */
+} flash_stats_t;
+
+
+typedef struct _flash_context_t {
+	flash_cache_t cache[FLASH_CACHE_SECTORS];
+	uint32_t tick;
+	flash_stats_t stats;
 
 	char *buff;
 
@@ -87,6 +87,23 @@ static void flashsrv_devCtl(msg_t *msg)
 			odevctl->err = EOK;
 			break;
 
+		case flashsrv_devctl_stats:
+			TRACE("imxrt-flashsrv: flashsrv_devctl_stats, id: %d, port: %d.", idevctl->oid.id, idevctl->oid.port);
+			flash_memory = flashsrv_findFlash(idevctl->oid);
+			if (flash_memory == NULL) {
+				odevctl->err = -EINVAL;
+				break;
+			}
+
+			odevctl->stats.hits = flash_memory->context.stats.hits;
+			odevctl->stats.misses = flash_memory->context.stats.misses;
+			odevctl->stats.erases = flash_memory->context.stats.erases;
+			odevctl->stats.programs = flash_memory->context.stats.programs;
+			odevctl->stats.skipped = flash_memory->context.stats.skipped;
+			odevctl->stats.direct = flash_memory->context.stats.direct;
+			odevctl->err = EOK;
+			break;
+
 		default:
 			odevctl->err = -EINVAL;
 			break;
@@ -19,7 +19,7 @@
 #include <sys/msg.h>
 
 
-enum { flashsrv_devctl_properties = 0, flashsrv_devctl_sync };
+enum { flashsrv_devctl_properties = 0, flashsrv_devctl_sync, flashsrv_devctl_stats };
 
 
 typedef struct {
@@ -31,11 +31,23 @@ typedef struct {
 typedef struct {
 	int err;
 
-	struct {
-		uint32_t fsize;
-		uint32_t psize;
-		uint32_t ssize;
-	} properties;
+	union {
+		struct {
+			uint32_t fsize;
+			uint32_t psize;
+			uint32_t ssize;
+		} properties;
+
+		/* sector cache counters */
+		struct {
+			uint32_t hits;
+			uint32_t misses;
+			uint32_t erases;
+			uint32_t programs;
+			uint32_t skipped;
+			uint32_t direct;
+		} stats;
+	};
 
 } __attribute__((packed)) flash_o_devctl_t;
 
@@ -88,6 +88,12 @@ int flexspi_norFlashRead(uint32_t instance, flexspi_norConfig_t *config, uint32_
 }
 
 
+void flexspi_clearCache(uint32_t instance)
+{
+	flexspi_norApi->clear_cache(instance);
+}
+
+
 int flexspi_getVendorID(uint32_t instance, uint32_t *manID)
 {
 	int err = EOK;
@@ -0,0 +1,176 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX RT Flash driver read benchmark
+ *
+ * Compares ROM API reads with reads served from the memory mapped FlexSPI window,
+ * optionally checks that mapped reads see data rewritten through the driver.
+ *
+ * Copyright 2019 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../flashdrv.h"
+
+
+#define BENCH_MAX_SIZE 0x10000
+#define BENCH_BYTES (1 << 20)
+
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+
+
+struct {
+	flash_context_t context;
+	uint32_t buff[BENCH_MAX_SIZE / sizeof(uint32_t)];
+	uint32_t ref[BENCH_MAX_SIZE / sizeof(uint32_t)];
+} bench_common;
+
+
+static int bench_romRead(uint32_t offset, size_t size)
+{
+	flash_context_t *context = &bench_common.context;
+
+	return flexspi_norFlashRead(context->instance, &context->config, bench_common.buff, offset, size);
+}
+
+
+static int bench_mappedRead(uint32_t offset, size_t size)
+{
+	return (flash_readData(&bench_common.context, offset, (char *)bench_common.buff, size) == size) ? EOK : -EIO;
+}
+
+
+/* returns average time of a single read in ns, reads cover BENCH_BYTES of a 1 MiB area to defeat the D-cache */
+static long long bench_run(int (*read)(uint32_t, size_t), size_t size)
+{
+	time_t start, end;
+	uint32_t offset = 0, area = BENCH_BYTES;
+	unsigned int i, n = BENCH_BYTES / size;
+
+	if (area > bench_common.context.properties.size)
+		area = bench_common.context.properties.size;
+
+	gettime(&start, NULL);
+
+	for (i = 0; i < n; ++i) {
+		if (read(offset, size) < 0)
+			return -1;
+
+		if ((offset += size) + size > area)
+			offset = 0;
+	}
+
+	gettime(&end, NULL);
+
+	return (end - start) * 1000LL / n;
+}
+
+
+/* rewrites a sector with a pattern and its complement, mapped reads have to follow */
+static int bench_coherence(uint32_t offset)
+{
+	flash_context_t *context = &bench_common.context;
+	size_t size = context->properties.sector_size, i;
+	int pass;
+
+	if (size > sizeof(bench_common.buff) || offset % size)
+		return -EINVAL;
+
+	for (pass = 0; pass < 2; ++pass) {
+		/* pull the old contents into D-cache first */
+		if (bench_mappedRead(offset, size) < 0)
+			return -EIO;
+
+		for (i = 0; i < size / sizeof(uint32_t); ++i)
+			bench_common.ref[i] = (pass ? ~i : i) ^ 0x5a5a5a5a;
+
+		if (flash_writeDataPage(context, offset, (const char *)bench_common.ref, size) != size)
+			return -EIO;
+
+		flash_sync(context);
+
+		/* driver cache is flushed, reads come from the window */
+		if (bench_mappedRead(offset, size) < 0 || memcmp(bench_common.buff, bench_common.ref, size)) {
+			printf("flash_bench: stale mapped data at 0x%x, pass %d\n", offset, pass);
+			return -EIO;
+		}
+
+		if (bench_romRead(offset, size) < 0 || memcmp(bench_common.buff, bench_common.ref, size)) {
+			printf("flash_bench: ROM read mismatch at 0x%x, pass %d\n", offset, pass);
+			return -EIO;
+		}
+	}
+
+	return EOK;
+}
+
+
+int main(int argc, char **argv)
+{
+	flash_context_t *context = &bench_common.context;
+	long long rom, mapped;
+	uint32_t offset = 0;
+	int c, check = 0, err;
+	unsigned int i;
+
+	context->address = FLEXSPI_DATA_ADDRESS;
+
+	while ((c = getopt(argc, argv, "2w:h")) != -1) {
+		switch (c) {
+			case '2':
+				context->address = FLEXSPI2_DATA_ADDRESS;
+				break;
+
+			case 'w':
+				offset = strtoul(optarg, NULL, 0);
+				check = 1;
+				break;
+
+			default:
+				printf("usage: %s [-2] [-w offset]\n", argv[0]);
+				printf("\t-2 - use FlexSPI2 flash\n");
+				printf("\t-w - check coherence by rewriting the sector at offset (destroys its contents)\n");
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((err = flash_init(context)) < 0) {
+		printf("flash_bench: init failed (%d)\n", err);
+		return EXIT_FAILURE;
+	}
+
+	printf("%8s %12s %12s %12s %12s\n", "size", "ROM [ns]", "mapped [ns]", "ROM [KB/s]", "mapped [KB/s]");
+
+	for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); ++i) {
+		rom = bench_run(bench_romRead, bench_sizes[i]);
+		mapped = bench_run(bench_mappedRead, bench_sizes[i]);
+
+		if (rom <= 0 || mapped <= 0) {
+			printf("flash_bench: read failed\n");
+			break;
+		}
+
+		printf("%8zu %12lld %12lld %12lld %12lld\n", bench_sizes[i], rom, mapped,
+			bench_sizes[i] * 1000000LL / rom, bench_sizes[i] * 1000000LL / mapped);
+	}
+
+	if (check) {
+		err = bench_coherence(offset);
+		printf("flash_bench: coherence check %s\n", (err < 0) ? "FAILED" : "passed");
+	}
+
+	flash_contextDestroy(context);
+
+	return (err < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -89,6 +89,9 @@ uart_t uart = { 0 };
 
 #define BUFSIZE 4096
 
+#define UART_TXFIFO_SZ 32
+#define UART_RXFIFO_SZ 32
+
 void uart_thr(void *arg)
 {
 	uint32_t port = (uint32_t)arg;
@@ -150,6 +153,9 @@ static int uart_intr(unsigned int intr, void *data)
 
 static void uart_intrthr(void *arg)
 {
+	unsigned char txbuf[UART_TXFIFO_SZ], rxbuf[UART_RXFIFO_SZ];
+	unsigned int i, n;
+
 	for (;;) {
 		/* wait for character or transmit data */
 		mutexLock(uart.lock);
@@ -168,11 +174,21 @@ static void uart_intrthr(void *arg)
 		mutexUnlock(uart.lock);
 
 		/* RX */
-		while ((*(uart.base + usr2) & (1 << 0)))
-			libtty_putchar(&uart.tty_common, *(uart.base + urxd), NULL);
+		while ((*(uart.base + usr2) & (1 << 0))) {
+			/* drain HW FIFO and pass it to the line discipline at once */
+			for (n = 0; n < sizeof(rxbuf) && (*(uart.base + usr2) & (1 << 0)); ++n)
+				rxbuf[n] = *(uart.base + urxd);
+			libtty_putchars(&uart.tty_common, rxbuf, n, NULL);
+		}
 
 		/* TX */
 		while (libtty_txready(&uart.tty_common)) {
+			if (*(uart.base + uts) & (1 << 6)) { // TXEMPTY - whole HW FIFO can be filled at once
+				n = libtty_getchars(&uart.tty_common, txbuf, sizeof(txbuf), NULL);
+				for (i = 0; i < n; ++i)
+					*(uart.base + utxd) = txbuf[i];
+				continue;
+			}
 			if (*(uart.base + uts) & (1 << 4)) { // check TXFULL bit
 				break; /* wait in main loop for TX to be ready before resuming operation */
 			}
@@ -1,16 +1,44 @@
 #ifndef _LIBTTY_FIFO_H
 #define _LIBTTY_FIFO_H
 
+#include <stdint.h>
+#include <string.h>
+
 typedef struct fifo_s fifo_t;
 
 struct fifo_s {
-	unsigned int head;
-	unsigned int tail;
+	unsigned int head;	/* written only by the producer */
+	unsigned int tail;	/* written only by the consumer */
 	unsigned int size_mask;
 	uint8_t data[];
 };
 
 
+/* Indices are accessed with acquire/release semantics, so a single producer
+ * and a single consumer may use the fifo concurrently without locking.
+ * Functions which modify the index owned by the other side (fifo_pop_front,
+ * fifo_remove_all_but_one) still require external locking. */
+static inline unsigned int fifo_load_head(fifo_t *f)
+{
+	return __atomic_load_n(&f->head, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned int fifo_load_tail(fifo_t *f)
+{
+	return __atomic_load_n(&f->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline void fifo_store_head(fifo_t *f, unsigned int head)
+{
+	__atomic_store_n(&f->head, head, __ATOMIC_RELEASE);
+}
+
+static inline void fifo_store_tail(fifo_t *f, unsigned int tail)
+{
+	__atomic_store_n(&f->tail, tail, __ATOMIC_RELEASE);
+}
+
+
 /* NOTE: size must be a power of 2 ! */
 static inline void fifo_init(fifo_t *f, unsigned int size)
 {
@@ -19,9 +47,10 @@ static inline void fifo_init(fifo_t *f, unsigned int size)
 	f->size_mask = size - 1;
 }
 
+/* consumer side: drop all data available at the moment */
 static inline void fifo_remove_all(fifo_t *f)
 {
-	f->head = f->tail = 0;
+	fifo_store_tail(f, fifo_load_head(f));
 }
 
 static inline void fifo_remove_all_but_one(fifo_t *f)
@@ -32,37 +61,37 @@ static inline void fifo_remove_all_but_one(fifo_t *f)
 
 static inline unsigned int fifo_is_full(fifo_t *f)
 {
-	return ((f->head + 1) & f->size_mask) == f->tail;
+	return ((fifo_load_head(f) + 1) & f->size_mask) == fifo_load_tail(f);
 }
 
 
 static inline unsigned int fifo_is_empty(fifo_t *f)
 {
-	return (f->head == f->tail);
+	return (fifo_load_head(f) == fifo_load_tail(f));
 }
 
 static inline unsigned int fifo_count(fifo_t *f)
 {
-	return (f->head - f->tail) & f->size_mask;
+	return (fifo_load_head(f) - fifo_load_tail(f)) & f->size_mask;
 }
 
 static inline unsigned int fifo_freespace(fifo_t *f)
 {
-	return (f->tail - f->head - 1) & f->size_mask;
+	return (fifo_load_tail(f) - fifo_load_head(f) - 1) & f->size_mask;
 }
 
 
 static inline void fifo_push(fifo_t *f, uint8_t byte)
 {
 	f->data[f->head] = byte;
-	f->head = (f->head + 1) & f->size_mask;
+	fifo_store_head(f, (f->head + 1) & f->size_mask);
 }
 
 
 static inline uint8_t fifo_pop_back(fifo_t *f)
 {
 	uint8_t ret = f->data[f->tail];
-	f->tail = (f->tail + 1) & f->size_mask;
+	fifo_store_tail(f, (f->tail + 1) & f->size_mask);
 
 	return ret;
 }
@@ -84,6 +113,80 @@ static inline uint8_t fifo_peek_front(fifo_t *f)
 	return ret;
 }
 
+/* span interface: direct access to the largest linear region of the buffer.
+ * Wraparound is handled by the caller as at most two consecutive spans. */
+
+/* returns number of contiguous bytes ready to be read at *span */
+static inline unsigned int fifo_peek_span(fifo_t *f, uint8_t **span)
+{
+	unsigned int head = fifo_load_head(f);
+
+	*span = &f->data[f->tail];
+	if (head >= f->tail)
+		return head - f->tail;
+
+	return f->size_mask + 1 - f->tail;
+}
+
+static inline void fifo_consume(fifo_t *f, unsigned int n)
+{
+	fifo_store_tail(f, (f->tail + n) & f->size_mask);
+}
+
+/* returns number of contiguous bytes which can be written at *span */
+static inline unsigned int fifo_reserve_span(fifo_t *f, uint8_t **span)
+{
+	unsigned int tail = fifo_load_tail(f);
+
+	*span = &f->data[f->head];
+	if (tail > f->head)
+		return tail - f->head - 1;
+
+	/* one slot has to stay empty to distinguish full from empty fifo */
+	return f->size_mask + 1 - f->head - (tail == 0);
+}
+
+static inline void fifo_commit(fifo_t *f, unsigned int n)
+{
+	fifo_store_head(f, (f->head + n) & f->size_mask);
+}
+
+/* returns number of bytes actually pushed */
+static inline unsigned int fifo_push_buf(fifo_t *f, const uint8_t *data, unsigned int len)
+{
+	unsigned int n, done = 0;
+	uint8_t *span;
+
+	while (done < len && (n = fifo_reserve_span(f, &span)) != 0) {
+		if (n > len - done)
+			n = len - done;
+
+		memcpy(span, data + done, n);
+		fifo_commit(f, n);
+		done += n;
+	}
+
+	return done;
+}
+
+/* returns number of bytes actually popped */
+static inline unsigned int fifo_pop_buf(fifo_t *f, uint8_t *data, unsigned int len)
+{
+	unsigned int n, done = 0;
+	uint8_t *span;
+
+	while (done < len && (n = fifo_peek_span(f, &span)) != 0) {
+		if (n > len - done)
+			n = len - done;
+
+		memcpy(data + done, span, n);
+		fifo_consume(f, n);
+		done += n;
+	}
+
+	return done;
+}
+
 static inline int fifo_has_char(fifo_t *f, char byte)
 {
 	unsigned int tail = f->tail;
@@ -67,6 +67,7 @@
 #endif
 
 #define TX_FIFO_NOTFULL_WATERMARK	16  // amount of free space in fifo before we will wake up the writer
+#define TX_WAIT_TIMEOUT	10000  // us, bounds a wakeup lost between the waiter's check and condWait()
 
 static void termios_optimize(libtty_common_t* tty)
 {
@@ -82,10 +83,18 @@ static void termios_optimize(libtty_common_t* tty)
 
 	tty->breakchars[n] = '\0';
 
-	// check if we have break char in the RX FIFO
+	// no input processing needed - RX bytes can go straight into the FIFO without locking
+	if (!CMP_FLAG(i, ISTRIP | IGNCR | ICRNL | INLCR) && !CMP_FLAG(l, ICANON | ECHO | ECHONL | ISIG | IEXTEN))
+		tty->t_flags |= TF_BYPASS;
+	else
+		tty->t_flags &= ~TF_BYPASS;
+
+	// rebuild the count of break chars in the RX FIFO
 	tty->t_flags &= ~TF_HAVEBREAK;
+	tty->rx_breaks = 0;
 	if (CMP_FLAG(l, ICANON)) {
-		if (libttydisc_rx_have_breakchar(tty))
+		tty->rx_breaks = libttydisc_rx_count_breakchars(tty);
+		if (tty->rx_breaks > 0)
 			tty->t_flags |= TF_HAVEBREAK;
 	}
 }
@@ -170,17 +179,56 @@ ssize_t libtty_read_nonblock(libtty_common_t *tty, char *data, size_t size, unsi
 	return ret;
 }
 
+/* wake the writers only if some are actually waiting and enough space has been freed */
+static void libtty_wake_writer(libtty_common_t *tty, int *wake_writer)
+{
+	/* pairs with libtty_tx_wait(): either the waiter sees the freed space or we see the waiter,
+	 * tx_mutex can't be taken here (signal_txready callbacks pop chars with it held), so the
+	 * broadcast may still come just before the waiter sleeps - it rechecks after TX_WAIT_TIMEOUT */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&tty->tx_waiters, __ATOMIC_RELAXED))
+		return;
+
+	if (fifo_freespace(tty->tx_fifo) >= TX_FIFO_NOTFULL_WATERMARK) {
+		if (wake_writer)
+			*wake_writer = 1;
+		/* write and drain can wait at the same time */
+		condBroadcast(tty->tx_waitq);
+	}
+}
+
+/* waits on tx_waitq (tx_mutex held) unless free space already reached need, or the fifo is empty for need < 0 */
+static void libtty_tx_wait(libtty_common_t *tty, int need)
+{
+	__atomic_add_fetch(&tty->tx_waiters, 1, __ATOMIC_SEQ_CST);
+
+	if ((need < 0) ? !fifo_is_empty(tty->tx_fifo) : (fifo_freespace(tty->tx_fifo) < need))
+		condWait(tty->tx_waitq, tty->tx_mutex, TX_WAIT_TIMEOUT);
+
+	__atomic_sub_fetch(&tty->tx_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
 unsigned char libtty_getchar(libtty_common_t *tty, int *wake_writer)
 {
 	if (wake_writer)
 		*wake_writer = 0;
 
 	unsigned char ret = fifo_pop_back(tty->tx_fifo);
-	if (fifo_freespace(tty->rx_fifo) >= TX_FIFO_NOTFULL_WATERMARK) {
-		if (wake_writer)
-			*wake_writer = 1;
-		condSignal(tty->tx_waitq);
-	}
+	libtty_wake_writer(tty, wake_writer);
+
+	return ret;
+}
+
+unsigned int libtty_getchars(libtty_common_t *tty, unsigned char *buf, unsigned int len, int *wake_writer)
+{
+	unsigned int ret;
+
+	if (wake_writer)
+		*wake_writer = 0;
+
+	ret = fifo_pop_buf(tty->tx_fifo, buf, len);
+	if (ret > 0)
+		libtty_wake_writer(tty, wake_writer);
 
 	return ret;
 }
@@ -280,17 +328,17 @@ ssize_t libtty_write(libtty_common_t *tty, const char *data, size_t size, unsign
 				goto exit;
 
 			CALLBACK(signal_txready);
-			condWait(tty->tx_waitq, tty->tx_mutex, 0);
+			libtty_tx_wait(tty, fifo_freespace_for_single_char);
 		}
 
-		if (CMP_FLAG(o, OPOST) && (CTL_VALID(*data))) { // we need to process this char
-			libttydisc_write_oproc(tty, *data);
-		} else {
-			fifo_push(tty->tx_fifo, *data);
-		}
+		size_t n;
+		if (CMP_FLAG(o, OPOST))
+			n = libttydisc_write_oproc_block(tty, data, size - len);
+		else // no output processing - copy as much as fits at once
+			n = fifo_push_buf(tty->tx_fifo, (const uint8_t *)data, size - len);
 
-		len += 1;
-		data += 1;
+		len += n;
+		data += n;
 	}
 
 	//DEBUG_CHAR('W');
@@ -369,7 +417,7 @@ void libtty_drain(libtty_common_t* tty)
 {
 	mutexLock(tty->tx_mutex);
 	while (!fifo_is_empty(tty->tx_fifo))
-		condWait(tty->tx_waitq, tty->tx_mutex, 0);
+		libtty_tx_wait(tty, -1);
 
 	mutexUnlock(tty->tx_mutex);
 }
@@ -53,6 +53,9 @@ struct libtty_common_s {
 	// cached optimizations
 	char breakchars[4];	/* enough to hold \n, VEOF and VEOL. */
 	unsigned int t_flags;
+	unsigned int rx_breaks;	/* number of breakchars in RX fifo (ICANON only) */
+
+	unsigned int tx_waiters;	/* writers and drains blocked on tx_waitq */
 
 	// TODO: remove
 	volatile uint32_t* debug;
@@ -72,7 +75,7 @@ static inline void libtty_read_state_init(libtty_read_state_t *st) {
 // t_flags
 #define	TF_HAVEBREAK	0x00001	/* There is a breakchar present in RX fifo */
 #define	TF_LITERAL	0x00200	/* Accept the next character literally. */
-#define	TF_BYPASS	0x04000	/* Optimized input path. */
+#define	TF_BYPASS	0x04000	/* Optimized input path (no input processing, lock-free RX). */
 #define TF_CLOSING  0x08000 /* TTY is being closed */
 
 
@@ -99,7 +102,11 @@ ssize_t libtty_read_nonblock(libtty_common_t *tty, char *data, size_t size, unsi
 
 /* internal (HW) interface */
 int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader);
+/* runs the input discipline over the whole block under a single lock, the reader is signalled at most once */
+int libtty_putchars(libtty_common_t *tty, const unsigned char *buf, size_t len, int *wake_reader);
 unsigned char libtty_getchar(libtty_common_t *tty, int *wake_writer);
+/* pops up to len chars ready to be sent, returns the number of chars copied to buf */
+unsigned int libtty_getchars(libtty_common_t *tty, unsigned char *buf, unsigned int len, int *wake_writer);
 void libtty_signal_pgrp(libtty_common_t* tty, int signal);
 
 int libtty_txready(libtty_common_t *tty);	// at least 1 character ready to be sent
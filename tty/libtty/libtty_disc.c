@@ -54,6 +54,7 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 
 #include "ttydefaults.h"
 
@@ -95,13 +96,10 @@
 static int tx_write_ifspace(libtty_common_t* tty, const char* data, size_t len)
 {
 	// WARN: no locking
-	const char* data_end = data + len;
-
-	while ((data < data_end) && !fifo_is_full(tty->tx_fifo))
-		fifo_push(tty->tx_fifo, (uint8_t) *data++);
+	int ret = fifo_push_buf(tty->tx_fifo, (const uint8_t *)data, len);
 
 	CALLBACK(signal_txready);
-	return len - (data_end - data);
+	return ret;
 }
 
 static int libttydisc_echo(libtty_common_t *tty, char c)
@@ -183,11 +181,34 @@ static int libttydisc_rubchar(libtty_common_t* tty)
 	return 0;
 }
 
-int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
+/* lock-free RX path - the caller (IRQ/driver thread) is the only producer */
+static void libttydisc_putchars_bypass(libtty_common_t *tty, const unsigned char *buf, size_t len, int *wake_reader)
 {
-	if (wake_reader)
-		*wake_reader = 0;
+	size_t n = fifo_push_buf(tty->rx_fifo, buf, len);
+
+	if (n < len)
+		log_warn("RX OVERRUN!");
+
+	if (n == 0)
+		return;
+
+	/* order the head store before checking whether the reader drained the FIFO */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
+	/* reader sleeps only on an empty FIFO - wake it up only when it becomes non-empty */
+	if (fifo_count(tty->rx_fifo) <= n) {
+		if (wake_reader)
+			*wake_reader = 1;
+
+		mutexLock(tty->rx_mutex);
+		condSignal(tty->rx_waitq);
+		mutexUnlock(tty->rx_mutex);
+	}
+}
+
+/* input processing of a single char, rx_mutex has to be held; returns 1 if the reader should be woken up */
+static int libttydisc_input(libtty_common_t *tty, unsigned char c)
+{
 	/* ISTRIP: removing the top bit */
 	if (CMP_FLAG(i, ISTRIP))
 		c &= ~0x80;
@@ -269,9 +290,10 @@ int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
 
 
 processed:
-	mutexLock(tty->rx_mutex);
 	if (!fifo_is_full(tty->rx_fifo)) {
 		fifo_push(tty->rx_fifo, c);
+		if (CMP_FLAG(l, ICANON) && libttydisc_is_breakchar(tty, c))
+			tty->rx_breaks += 1;
 	} else {
 		log_warn("RX OVERRUN!");
 	}
@@ -280,14 +302,41 @@ processed:
 
 	if (CMP_FLAG(l, ICANON)) {
 		// signal only when the line ends
-		if (libttydisc_is_breakchar(tty, c)) {
+		if (tty->rx_breaks > 0 && libttydisc_is_breakchar(tty, c)) {
 			tty->t_flags |= TF_HAVEBREAK;
-
-			if (wake_reader)
-				*wake_reader = 1;
-			condSignal(tty->rx_waitq);
+			return 1;
 		}
-	} else {
+
+		return 0;
+	}
+
+	return 1;
+}
+
+int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
+{
+	return libtty_putchars(tty, &c, 1, wake_reader);
+}
+
+int libtty_putchars(libtty_common_t *tty, const unsigned char *buf, size_t len, int *wake_reader)
+{
+	int wake = 0;
+	size_t i;
+
+	if (wake_reader)
+		*wake_reader = 0;
+
+	if (tty->t_flags & TF_BYPASS) {
+		libttydisc_putchars_bypass(tty, buf, len, wake_reader);
+		return 0;
+	}
+
+	mutexLock(tty->rx_mutex);
+	for (i = 0; i < len; ++i)
+		wake |= libttydisc_input(tty, buf[i]);
+
+	/* signal the reader at most once per batch */
+	if (wake) {
 		if (wake_reader)
 			*wake_reader = 1;
 		condSignal(tty->rx_waitq);
@@ -353,6 +402,57 @@ int libttydisc_write_oproc(libtty_common_t *tty, char c)
 #undef PRINT_NORMAL
 }
 
+/* word-at-a-time test for any byte < 0x20 or == 0x7f (see CTL_VALID) */
+#define WORD_ONES	0x01010101u
+#define WORD_HIGHS	0x80808080u
+#define WORD_HAS_LESS(x, n)	(((x) - WORD_ONES * (n)) & ~(x) & WORD_HIGHS)
+#define WORD_HAS_ZERO(x)	(((x) - WORD_ONES) & ~(x) & WORD_HIGHS)
+#define WORD_HAS_CTL(x)	(WORD_HAS_LESS((x), 0x20) || WORD_HAS_ZERO((x) ^ (WORD_ONES * 0x7f)))
+
+/* returns length of the leading run of chars which need no output processing */
+static size_t libttydisc_plain_run(const char *data, size_t len)
+{
+	size_t pos = 0;
+	uint32_t word;
+
+	while (pos + sizeof(word) <= len) {
+		memcpy(&word, data + pos, sizeof(word));
+		if (WORD_HAS_CTL(word))
+			break;
+		pos += sizeof(word);
+	}
+
+	while (pos < len && !CTL_VALID(data[pos]))
+		++pos;
+
+	return pos;
+}
+
+size_t libttydisc_write_oproc_block(libtty_common_t *tty, const char *data, size_t len)
+{
+	size_t done = 0, run, space;
+
+	while (done < len) {
+		space = fifo_freespace(tty->tx_fifo);
+
+		/* plain text is copied into the TX FIFO directly */
+		run = libttydisc_plain_run(data + done, (len - done < space) ? len - done : space);
+		if (run > 0) {
+			done += fifo_push_buf(tty->tx_fifo, (const uint8_t *)data + done, run);
+			continue;
+		}
+
+		/* control char - needs space for the longest expansion */
+		if (space < LIBTTYDISC_WRITE_OPROC_MAXLEN)
+			break;
+
+		libttydisc_write_oproc(tty, data[done]);
+		done += 1;
+	}
+
+	return done;
+}
+
 ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size, unsigned mode, libtty_read_state_t* st)
 {
 	char byte = 0xff;
@@ -401,11 +501,11 @@ ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size,
 
 	if (libttydisc_is_breakchar(tty, byte)) { // loop ended due to breakchar
 		// check if we have another break char in the RX FIFO
-		tty->t_flags &= ~TF_HAVEBREAK;
-		if (CMP_FLAG(l, ICANON)) {
-			if (libttydisc_rx_have_breakchar(tty))
-				tty->t_flags |= TF_HAVEBREAK;
-		}
+		if (tty->rx_breaks > 0)
+			tty->rx_breaks -= 1;
+
+		if (tty->rx_breaks == 0)
+			tty->t_flags &= ~TF_HAVEBREAK;
 	}
 
 	mutexUnlock(tty->rx_mutex);
@@ -474,8 +574,9 @@ ssize_t libttydisc_read_raw(libtty_common_t *tty, char *data, size_t size, unsig
 			}
 		}
 
-		*data++ = fifo_pop_back(tty->rx_fifo);
-		len += 1;
+		unsigned int n = fifo_pop_buf(tty->rx_fifo, (uint8_t *)data, size - len);
+		data += n;
+		len += n;
 	}
 
 	return len;
@@ -37,6 +37,8 @@
 
 /* internal interface - line discipline */
 int libttydisc_write_oproc(libtty_common_t *tty, char c);
+/* output processing of the whole buffer (as far as TX FIFO space allows), returns number of consumed chars */
+size_t libttydisc_write_oproc_block(libtty_common_t *tty, const char *data, size_t len);
 
 ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size, unsigned mode, libtty_read_state_t *st);
 ssize_t libttydisc_read_raw(libtty_common_t *tty, char *data, size_t size, unsigned mode, libtty_read_state_t *st);
@@ -51,17 +53,18 @@ static inline int libttydisc_is_breakchar(libtty_common_t *tty, char c)
 	return 0;
 }
 
-static inline int libttydisc_rx_have_breakchar(libtty_common_t *tty)
+/* full RX fifo scan - use only when breakchars set changes, rx_breaks is kept up to date otherwise */
+static inline unsigned int libttydisc_rx_count_breakchars(libtty_common_t *tty)
 {
-	char* breakc = tty->breakchars;
-	while (*breakc) {
-		if (fifo_has_char(tty->rx_fifo, *breakc))
-			return 1;
+	fifo_t *f = tty->rx_fifo;
+	unsigned int pos, head = fifo_load_head(f), cnt = 0;
 
-		++breakc;
+	for (pos = f->tail; pos != head; pos = (pos + 1) & f->size_mask) {
+		if (libttydisc_is_breakchar(tty, f->data[pos]))
+			++cnt;
 	}
 
-	return 0;
+	return cnt;
 }
 
 
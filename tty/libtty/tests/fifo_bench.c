@@ -0,0 +1,207 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty FIFO span API host test and benchmark
+ *
+ * Checks the span interface against a reference queue, including the
+ * wraparound split and the empty slot, then compares moving data through
+ * the FIFO byte by byte (fifo_push/fifo_pop_back) with the span copies
+ * (fifo_push_buf/fifo_pop_buf) in ISR sized and write sized bursts.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fifo.h"
+#include "test.h"
+
+
+#define FIFO_SIZE  2048
+#define BENCH_SIZE (256 << 20)
+
+
+int test_failed;
+
+
+static struct {
+	union {
+		fifo_t fifo;
+		uint8_t raw[sizeof(fifo_t) + FIFO_SIZE];
+	} f;
+
+	uint8_t in[FIFO_SIZE];
+	uint8_t out[FIFO_SIZE];
+	uint8_t ref[FIFO_SIZE];
+	unsigned int refHead, refTail;
+} test_common;
+
+
+static unsigned int ref_count(unsigned int size)
+{
+	return (test_common.refHead - test_common.refTail) % size;
+}
+
+
+/* Every head/tail pair of a small fifo, both spans cover exactly the data and the free space */
+static int test_spans(void)
+{
+	fifo_t *f = &test_common.f.fifo;
+	unsigned int size = 16, head, tail, n1, n2, count, space;
+	uint8_t *span;
+
+	for (tail = 0; tail < size; ++tail) {
+		for (head = 0; head < size; ++head) {
+			fifo_init(f, size);
+			f->head = head;
+			f->tail = tail;
+			count = (head - tail) & (size - 1);
+			space = size - 1 - count;
+
+			TEST_CHECK(fifo_count(f) == count && fifo_freespace(f) == space);
+
+			/* Data: up to the end of the buffer, the rest from the start */
+			n1 = fifo_peek_span(f, &span);
+			TEST_CHECK(span == &f->data[tail]);
+			TEST_CHECK(n1 == ((head >= tail) ? count : size - tail));
+			fifo_consume(f, n1);
+			n2 = fifo_peek_span(f, &span);
+			TEST_CHECK(n1 + n2 == count && (n2 == 0 || span == &f->data[0]));
+
+			/* Free space, one slot always stays empty */
+			f->head = head;
+			f->tail = tail;
+			n1 = fifo_reserve_span(f, &span);
+			TEST_CHECK(span == &f->data[head]);
+			TEST_CHECK(n1 <= size - head && n1 <= space);
+			fifo_commit(f, n1);
+			n2 = fifo_reserve_span(f, &span);
+			TEST_CHECK(n1 + n2 == space && (n2 == 0 || span == &f->data[0]));
+			fifo_commit(f, n2);
+			TEST_CHECK(fifo_is_full(f));
+		}
+	}
+
+	return 0;
+}
+
+
+/* Random burst lengths against a reference queue */
+static int test_random(void)
+{
+	fifo_t *f = &test_common.f.fifo;
+	unsigned int size = 64, i, k, len, n;
+	uint8_t seq = 0;
+
+	fifo_init(f, size);
+	test_common.refHead = test_common.refTail = 0;
+
+	for (k = 0; k < 200000; ++k) {
+		len = rand() % size;
+
+		if (rand() & 1) {
+			for (i = 0; i < len; ++i)
+				test_common.in[i] = seq + i;
+
+			n = fifo_push_buf(f, test_common.in, len);
+			TEST_CHECK(n == ((len < size - 1 - ref_count(size)) ? len : size - 1 - ref_count(size)));
+
+			for (i = 0; i < n; ++i)
+				test_common.ref[test_common.refHead++ % size] = seq++;
+		}
+		else {
+			n = fifo_pop_buf(f, test_common.out, len);
+			TEST_CHECK(n == ((len < ref_count(size)) ? len : ref_count(size)));
+
+			for (i = 0; i < n; ++i)
+				TEST_CHECK(test_common.out[i] == test_common.ref[test_common.refTail++ % size]);
+		}
+
+		TEST_CHECK(fifo_count(f) == ref_count(size));
+	}
+
+	return 0;
+}
+
+
+static double bench_bytes(unsigned int burst)
+{
+	fifo_t *f = &test_common.f.fifo;
+	unsigned long done;
+	unsigned int i;
+	double t;
+
+	fifo_init(f, FIFO_SIZE);
+	t = test_now();
+
+	for (done = 0; done < BENCH_SIZE; done += burst) {
+		for (i = 0; i < burst && !fifo_is_full(f); ++i)
+			fifo_push(f, test_common.in[i]);
+
+		for (i = 0; i < burst && !fifo_is_empty(f); ++i)
+			test_common.out[i] = fifo_pop_back(f);
+	}
+
+	return BENCH_SIZE / (test_now() - t);
+}
+
+
+static double bench_spans(unsigned int burst)
+{
+	fifo_t *f = &test_common.f.fifo;
+	unsigned long done;
+	double t;
+
+	fifo_init(f, FIFO_SIZE);
+	t = test_now();
+
+	for (done = 0; done < BENCH_SIZE; done += burst) {
+		fifo_push_buf(f, test_common.in, burst);
+		fifo_pop_buf(f, test_common.out, burst);
+	}
+
+	return BENCH_SIZE / (test_now() - t);
+}
+
+
+static int test_throughput(void)
+{
+	static const unsigned int bursts[] = { 1, 16, 64, 1024 };
+	double bytes, spans;
+	unsigned int i;
+
+	printf("%6s | %14s | %14s\n", "burst", "per byte MB/s", "spans MB/s");
+
+	for (i = 0; i < sizeof(bursts) / sizeof(bursts[0]); ++i) {
+		bytes = bench_bytes(bursts[i]);
+		spans = bench_spans(bursts[i]);
+		printf("%6u | %14.1f | %14.1f\n", bursts[i], bytes / 1e6, spans / 1e6);
+
+		/* Data went through in order */
+		TEST_CHECK(memcmp(test_common.out, test_common.in, bursts[i]) == 0);
+	}
+
+	return 0;
+}
+
+
+int main(void)
+{
+	unsigned int i;
+
+	srand(1);
+
+	for (i = 0; i < sizeof(test_common.in); ++i)
+		test_common.in[i] = rand();
+
+	TEST_CASE(test_spans());
+	TEST_CASE(test_random());
+	TEST_CASE(test_throughput());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
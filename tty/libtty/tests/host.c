@@ -0,0 +1,116 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty host tests - Phoenix locks and conditions over pthreads
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+
+#define HOST_HANDLES 64
+
+
+static struct {
+	pthread_mutex_t mutex[HOST_HANDLES];
+	pthread_cond_t cond[HOST_HANDLES];
+	unsigned int signals[HOST_HANDLES];
+	unsigned int handles;
+} host_common;
+
+
+int mutexCreate(handle_t *h)
+{
+	if ((*h = __sync_add_and_fetch(&host_common.handles, 1)) >= HOST_HANDLES)
+		return -ENOMEM;
+
+	return pthread_mutex_init(&host_common.mutex[*h], NULL);
+}
+
+
+int mutexLock(handle_t h)
+{
+	return pthread_mutex_lock(&host_common.mutex[h]);
+}
+
+
+int mutexLock2(handle_t h1, handle_t h2)
+{
+	pthread_mutex_lock(&host_common.mutex[h1]);
+
+	return pthread_mutex_lock(&host_common.mutex[h2]);
+}
+
+
+int mutexUnlock(handle_t h)
+{
+	return pthread_mutex_unlock(&host_common.mutex[h]);
+}
+
+
+int condCreate(handle_t *h)
+{
+	pthread_condattr_t attr;
+
+	if ((*h = __sync_add_and_fetch(&host_common.handles, 1)) >= HOST_HANDLES)
+		return -ENOMEM;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	return pthread_cond_init(&host_common.cond[*h], &attr);
+}
+
+
+int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	struct timespec ts;
+
+	if (!timeout)
+		return pthread_cond_wait(&host_common.cond[h], &host_common.mutex[m]);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout / 1000000;
+	ts.tv_nsec += (timeout % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	return (pthread_cond_timedwait(&host_common.cond[h], &host_common.mutex[m], &ts) == ETIMEDOUT) ? -ETIME : EOK;
+}
+
+
+int condSignal(handle_t h)
+{
+	__sync_add_and_fetch(&host_common.signals[h], 1);
+
+	return pthread_cond_signal(&host_common.cond[h]);
+}
+
+
+int condBroadcast(handle_t h)
+{
+	__sync_add_and_fetch(&host_common.signals[h], 1);
+
+	return pthread_cond_broadcast(&host_common.cond[h]);
+}
+
+
+int resourceDestroy(handle_t h)
+{
+	return EOK;
+}
+
+
+unsigned int host_signals(handle_t h)
+{
+	return __sync_add_and_fetch(&host_common.signals[h], 0);
+}
@@ -0,0 +1,32 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty host tests - included before every source
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_HOST_H_
+#define _HOST_HOST_H_
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/threads.h>
+#include <termios.h>
+
+
+/* Not in Linux termios, a spare c_cc slot */
+#ifndef VERASE2
+#define VERASE2 17
+#endif
+
+
+/* Number of condSignal() and condBroadcast() calls on a condition */
+extern unsigned int host_signals(handle_t h);
+
+
+#endif
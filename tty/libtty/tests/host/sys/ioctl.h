@@ -0,0 +1,24 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty host tests - ioctl stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_IOCTL_H_
+#define _HOST_SYS_IOCTL_H_
+
+#include_next <sys/ioctl.h>
+
+/* Phoenix has a separate drain request, Linux uses TCSBRK */
+#ifndef TCDRAIN
+#define TCDRAIN 0x54ff
+#endif
+
+
+#endif
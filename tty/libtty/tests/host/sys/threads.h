@@ -0,0 +1,52 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty host tests - threads stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_THREADS_H_
+#define _HOST_SYS_THREADS_H_
+
+#include <time.h>
+
+#define EOK 0
+
+
+typedef unsigned int handle_t;
+
+
+extern int mutexCreate(handle_t *h);
+
+
+extern int mutexLock(handle_t h);
+
+
+extern int mutexLock2(handle_t h1, handle_t h2);
+
+
+extern int mutexUnlock(handle_t h);
+
+
+extern int condCreate(handle_t *h);
+
+
+/* timeout in microseconds, 0 waits forever */
+extern int condWait(handle_t h, handle_t m, time_t timeout);
+
+
+extern int condSignal(handle_t h);
+
+
+extern int condBroadcast(handle_t h);
+
+
+extern int resourceDestroy(handle_t h);
+
+
+#endif
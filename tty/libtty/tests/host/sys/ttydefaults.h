@@ -0,0 +1,16 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty host tests - hides the host's defaults, libtty brings its own
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_TTYDEFAULTS_H_
+#define _HOST_SYS_TTYDEFAULTS_H_
+
+#endif
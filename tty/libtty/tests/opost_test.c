@@ -0,0 +1,222 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty OPOST block output processing host test and benchmark
+ *
+ * Feeds random c_oflag settings and random text through the TX FIFO
+ * twice, with libttydisc_write_oproc_block() and with the per char loop
+ * libtty_write() used before it, draining the FIFO in random amounts in
+ * between. Both have to produce the same byte stream. Then compares
+ * their throughput on terminal-like text.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "../libtty.h"
+#include "../libtty_disc.h"
+#include "../fifo.h"
+#include "test.h"
+
+
+#define TTY_BUFSIZE  64
+#define BENCH_BUFSIZE 2048
+#define INPUT_SIZE   4096
+#define OUTPUT_SIZE  (INPUT_SIZE * LIBTTYDISC_WRITE_OPROC_MAXLEN)
+#define BENCH_SIZE   (64 << 20)
+
+
+int test_failed;
+
+
+typedef size_t (*test_write_t)(libtty_common_t *tty, const char *data, size_t len);
+
+
+static struct {
+	libtty_common_t tty;
+	libtty_callbacks_t cb;
+
+	char in[INPUT_SIZE];
+	uint8_t out[2][OUTPUT_SIZE];
+} test_common;
+
+
+static void test_txready(void *arg)
+{
+}
+
+
+/* libtty_write() OPOST loop before the block path, waits for LIBTTYDISC_WRITE_OPROC_MAXLEN before every char */
+static size_t test_writeChars(libtty_common_t *tty, const char *data, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len && fifo_freespace(tty->tx_fifo) >= LIBTTYDISC_WRITE_OPROC_MAXLEN) {
+		if (CTL_VALID(data[done]))
+			libttydisc_write_oproc(tty, data[done]);
+		else
+			fifo_push(tty->tx_fifo, data[done]);
+
+		done++;
+	}
+
+	return done;
+}
+
+
+static int test_open(unsigned int bufsize)
+{
+	test_common.cb.signal_txready = test_txready;
+	TEST_CHECK(libtty_init(&test_common.tty, &test_common.cb, bufsize) == 0);
+
+	return 0;
+}
+
+
+static int test_oflag(tcflag_t oflag)
+{
+	struct termios term;
+	const void *out;
+
+	term = test_common.tty.term;
+	term.c_oflag = oflag;
+	TEST_CHECK(libtty_ioctl(&test_common.tty, 0, TCSETS, &term, &out) == 0);
+
+	return 0;
+}
+
+
+/* Writes the whole input, the UART takes a random amount whenever the writer stops */
+static unsigned int test_run(test_write_t write, const char *data, size_t len, uint8_t *out, unsigned int seed)
+{
+	fifo_t *f = test_common.tty.tx_fifo;
+	unsigned int outlen = 0;
+	size_t done = 0;
+
+	while (done < len) {
+		done += write(&test_common.tty, data + done, len - done);
+		outlen += fifo_pop_buf(f, out + outlen, 1 + rand_r(&seed) % TTY_BUFSIZE);
+	}
+
+	while (!fifo_is_empty(f))
+		outlen += fifo_pop_buf(f, out + outlen, TTY_BUFSIZE);
+
+	return outlen;
+}
+
+
+/* Mostly text with every kind of control char, runs cross the word boundaries */
+static void test_input(char *data, size_t len)
+{
+	static const char ctl[] = { '\n', '\r', '\t', 0x04, 0x7f, 0x1b, 0x00, 0x1f };
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		switch (rand() % 8) {
+			case 0:
+				data[i] = ctl[rand() % sizeof(ctl)];
+				break;
+			case 1:
+				data[i] = rand();
+				break;
+			default:
+				data[i] = 0x20 + rand() % 0x5f;
+				break;
+		}
+	}
+}
+
+
+static int test_equivalence(void)
+{
+	static const tcflag_t oflags[] = { OPOST, ONLCR, OCRNL, TAB3, ONOCR, ONLRET };
+	unsigned int k, i, len[2];
+	tcflag_t oflag;
+	size_t n;
+
+	TEST_CHECK(test_open(TTY_BUFSIZE) == 0);
+
+	for (k = 0; k < 2000; ++k) {
+		oflag = 0;
+		for (i = 0; i < sizeof(oflags) / sizeof(oflags[0]); ++i) {
+			if (rand() & 1)
+				oflag |= oflags[i];
+		}
+
+		n = 1 + rand() % INPUT_SIZE;
+		test_input(test_common.in, n);
+
+		TEST_CHECK(test_oflag(oflag | OPOST) == 0);
+		len[0] = test_run(test_writeChars, test_common.in, n, test_common.out[0], k);
+		len[1] = test_run(libttydisc_write_oproc_block, test_common.in, n, test_common.out[1], k);
+
+		if (len[0] != len[1] || memcmp(test_common.out[0], test_common.out[1], len[0]) != 0) {
+			printf("c_oflag 0x%x, %zu bytes in: %u bytes out per char, %u bytes out in blocks\n", (unsigned int)oflag, n, len[0], len[1]);
+			return -1;
+		}
+	}
+
+	libtty_destroy(&test_common.tty);
+
+	return 0;
+}
+
+
+static double bench_write(test_write_t write, const char *data, size_t len)
+{
+	fifo_t *f;
+	unsigned long done;
+	size_t n;
+	double t;
+
+	f = test_common.tty.tx_fifo;
+	t = test_now();
+
+	for (done = 0; done < BENCH_SIZE; done += len) {
+		for (n = 0; n < len;) {
+			n += write(&test_common.tty, data + n, len - n);
+			fifo_pop_buf(f, test_common.out[0], BENCH_BUFSIZE);
+		}
+	}
+
+	return BENCH_SIZE / (test_now() - t);
+}
+
+
+/* 80 column lines of text, ONLCR on as after libtty_init() */
+static int test_throughput(void)
+{
+	double chars, block;
+	size_t i;
+
+	for (i = 0; i < INPUT_SIZE; ++i)
+		test_common.in[i] = ((i % 80) == 79) ? '\n' : 0x20 + rand() % 0x5f;
+
+	TEST_CHECK(test_open(BENCH_BUFSIZE) == 0);
+	TEST_CHECK(test_oflag(OPOST | ONLCR) == 0);
+	chars = bench_write(test_writeChars, test_common.in, INPUT_SIZE);
+	block = bench_write(libttydisc_write_oproc_block, test_common.in, INPUT_SIZE);
+	libtty_destroy(&test_common.tty);
+
+	printf("per char %.1f MB/s, block %.1f MB/s, speed-up %.1fx\n", chars / 1e6, block / 1e6, block / chars);
+
+	return 0;
+}
+
+
+int main(void)
+{
+	srand(1);
+
+	TEST_CASE(test_equivalence());
+	TEST_CASE(test_throughput());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty batched input host test
+ *
+ * Feeds the same random input to two TTYs with random termios settings,
+ * one byte per libtty_putchar() call and in random libtty_putchars()
+ * batches. After every batch both have to hold the same RX and TX FIFO
+ * contents (line editing, echo), t_flags and rx_breaks, and the batch
+ * may signal the reader at most once.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "../libtty.h"
+#include "../fifo.h"
+#include "test.h"
+
+
+#define TTY_BUFSIZE 2048
+#define INPUT_SIZE  512
+#define BATCH_SIZE  64
+
+
+int test_failed;
+
+
+static struct {
+	libtty_common_t tty[2];   /* per byte, batched */
+	libtty_callbacks_t cb;
+
+	unsigned char in[INPUT_SIZE];
+} test_common;
+
+
+static void test_txready(void *arg)
+{
+}
+
+
+static int test_fifoEqual(fifo_t *a, fifo_t *b)
+{
+	unsigned int i, n = fifo_count(a);
+
+	if (fifo_count(b) != n)
+		return 0;
+
+	for (i = 0; i < n; ++i) {
+		if (a->data[(a->tail + i) & a->size_mask] != b->data[(b->tail + i) & b->size_mask])
+			return 0;
+	}
+
+	return 1;
+}
+
+
+static int test_equal(void)
+{
+	libtty_common_t *a = &test_common.tty[0], *b = &test_common.tty[1];
+
+	TEST_CHECK(test_fifoEqual(a->rx_fifo, b->rx_fifo));
+	TEST_CHECK(test_fifoEqual(a->tx_fifo, b->tx_fifo));
+	TEST_CHECK(a->t_flags == b->t_flags);
+	TEST_CHECK(a->rx_breaks == b->rx_breaks);
+
+	return 0;
+}
+
+
+/* Random line discipline settings, both TTYs start empty */
+static int test_setup(void)
+{
+	static const tcflag_t iflags[] = { ICRNL, INLCR, IGNCR, ISTRIP };
+	static const tcflag_t oflags[] = { OPOST, ONLCR };
+	static const tcflag_t lflags[] = { ICANON, ECHO, ECHOE, ECHOK, ECHONL, ECHOCTL, ISIG, IEXTEN };
+	struct termios term;
+	const void *out;
+	unsigned int i;
+
+	term = test_common.tty[0].term;
+	term.c_iflag = term.c_oflag = term.c_lflag = 0;
+
+	for (i = 0; i < sizeof(iflags) / sizeof(iflags[0]); ++i)
+		term.c_iflag |= (rand() & 1) ? iflags[i] : 0;
+	for (i = 0; i < sizeof(oflags) / sizeof(oflags[0]); ++i)
+		term.c_oflag |= (rand() & 1) ? oflags[i] : 0;
+	for (i = 0; i < sizeof(lflags) / sizeof(lflags[0]); ++i)
+		term.c_lflag |= (rand() & 1) ? lflags[i] : 0;
+
+	for (i = 0; i < 2; ++i) {
+		TEST_CHECK(libtty_ioctl(&test_common.tty[i], 0, TCSETS, &term, &out) == 0);
+		fifo_remove_all(test_common.tty[i].rx_fifo);
+		fifo_remove_all(test_common.tty[i].tx_fifo);
+		test_common.tty[i].t_flags &= ~(TF_HAVEBREAK | TF_LITERAL);
+		test_common.tty[i].rx_breaks = 0;
+	}
+
+	return 0;
+}
+
+
+/* Text with the editing, signal and line end chars of the default c_cc */
+static void test_input(unsigned char *data, size_t len)
+{
+	const cc_t *cc = test_common.tty[0].term.c_cc;
+	const unsigned char special[] = {
+		'\r', '\n', '\t', 0x7f, 0x80 | 'x',
+		cc[VERASE], cc[VKILL], cc[VEOF], cc[VLNEXT], cc[VINTR], cc[VQUIT], cc[VSUSP]
+	};
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		if ((rand() % 4) == 0)
+			data[i] = special[rand() % sizeof(special)];
+		else
+			data[i] = 0x20 + rand() % 0x5f;
+	}
+}
+
+
+static int test_batches(void)
+{
+	unsigned int k, signals, prev, n, i, pos;
+	int wake, wakeBytes;
+
+	for (i = 0; i < 2; ++i) {
+		test_common.cb.signal_txready = test_txready;
+		TEST_CHECK(libtty_init(&test_common.tty[i], &test_common.cb, TTY_BUFSIZE) == 0);
+	}
+
+	for (k = 0; k < 5000; ++k) {
+		TEST_CHECK(test_setup() == 0);
+		test_input(test_common.in, INPUT_SIZE);
+
+		for (pos = 0; pos < INPUT_SIZE; pos += n) {
+			n = 1 + rand() % BATCH_SIZE;
+			if (n > INPUT_SIZE - pos)
+				n = INPUT_SIZE - pos;
+
+			wakeBytes = 0;
+			for (i = 0; i < n; ++i) {
+				TEST_CHECK(libtty_putchar(&test_common.tty[0], test_common.in[pos + i], &wake) == 0);
+				wakeBytes |= wake;
+			}
+
+			prev = host_signals(test_common.tty[1].rx_waitq);
+			TEST_CHECK(libtty_putchars(&test_common.tty[1], test_common.in + pos, n, &wake) == 0);
+			signals = host_signals(test_common.tty[1].rx_waitq) - prev;
+
+			/* One signal for the batch, and only if a byte alone would have woken the reader */
+			TEST_CHECK(signals <= 1 && signals == wake);
+			TEST_CHECK(wake == wakeBytes);
+
+			if (test_equal() != 0) {
+				printf("c_iflag 0x%x c_oflag 0x%x c_lflag 0x%x, batch of %u at %u\n", (unsigned int)test_common.tty[0].term.c_iflag,
+					(unsigned int)test_common.tty[0].term.c_oflag, (unsigned int)test_common.tty[0].term.c_lflag, n, pos);
+				return -1;
+			}
+		}
+	}
+
+	for (i = 0; i < 2; ++i)
+		libtty_destroy(&test_common.tty[i]);
+
+	return 0;
+}
+
+
+int main(void)
+{
+	srand(1);
+
+	TEST_CASE(test_batches());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
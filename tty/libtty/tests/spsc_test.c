@@ -0,0 +1,324 @@
+/*
+ * Phoenix-RTOS
+ *
+ * libtty SPSC and watermark wakeup host stress test
+ *
+ * A producer thread plays the UART interrupt thread and a consumer plays
+ * the reading or writing process, both on real pthreads. RX in raw mode
+ * goes through the lock-free bypass path, TX through the watermark
+ * wakeups of blocked writers and drains. Every byte is sequence checked,
+ * a lost wakeup hangs a thread and the alarm fails the test.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "../libtty.h"
+#include "../fifo.h"
+#include "test.h"
+
+
+#define TTY_BUFSIZE 2048
+#define STRESS_SIZE (32 << 20)
+#define TEST_TIMEOUT 60
+#define TX_WATERMARK 16     /* TX_FIFO_NOTFULL_WATERMARK of libtty.c */
+
+
+int test_failed;
+
+
+static struct {
+	libtty_common_t tty;
+	libtty_callbacks_t cb;
+
+	/* Bytes moved by each side, the reader checks the sequence */
+	unsigned long produced;
+	unsigned long consumed;
+	unsigned long getchars;
+	int drains;
+	int errors;
+} test_common;
+
+
+static void test_txready(void *arg)
+{
+}
+
+
+static int test_open(int raw)
+{
+	struct termios term;
+	const void *out;
+
+	test_common.cb.signal_txready = test_txready;
+	TEST_CHECK(libtty_init(&test_common.tty, &test_common.cb, TTY_BUFSIZE) == 0);
+
+	term = test_common.tty.term;
+	if (raw) {
+		term.c_iflag &= ~(IGNBRK | BRKINT | INLCR | IGNCR | ICRNL | ISTRIP);
+		term.c_oflag &= ~OPOST;
+		term.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+		term.c_cc[VMIN] = 1;
+		term.c_cc[VTIME] = 0;
+	}
+	TEST_CHECK(libtty_ioctl(&test_common.tty, 0, TCSETS, &term, &out) == 0);
+	TEST_CHECK(!!(test_common.tty.t_flags & TF_BYPASS) == raw);
+
+	test_common.produced = 0;
+	test_common.consumed = 0;
+	test_common.getchars = 0;
+	test_common.errors = 0;
+
+	return 0;
+}
+
+
+/* UART RX: bursts of up to 64 bytes, or single chars, only into free space */
+static void *test_rxProducer(void *arg)
+{
+	unsigned char buf[64];
+	unsigned int n, i;
+	int wake;
+
+	while (test_common.produced < STRESS_SIZE) {
+		n = 1 + rand() % sizeof(buf);
+		if (n > STRESS_SIZE - test_common.produced)
+			n = STRESS_SIZE - test_common.produced;
+
+		while (fifo_freespace(test_common.tty.rx_fifo) < n)
+			sched_yield();
+
+		for (i = 0; i < n; ++i)
+			buf[i] = test_common.produced + i;
+
+		if (n == 1)
+			libtty_putchar(&test_common.tty, buf[0], &wake);
+		else
+			libtty_putchars(&test_common.tty, buf, n, &wake);
+
+		test_common.produced += n;
+	}
+
+	return NULL;
+}
+
+
+static int test_rx(void)
+{
+	unsigned long wakeups = 0, reads = 0;
+	char buf[512];
+	pthread_t tid;
+	ssize_t n, i;
+	double t;
+
+	TEST_CHECK(test_open(1) == 0);
+
+	t = test_now();
+	pthread_create(&tid, NULL, test_rxProducer, NULL);
+
+	while (test_common.consumed < STRESS_SIZE) {
+		n = libtty_read(&test_common.tty, buf, 1 + rand() % sizeof(buf), 0);
+		TEST_CHECK(n > 0);
+
+		for (i = 0; i < n; ++i) {
+			if ((unsigned char)buf[i] != (unsigned char)(test_common.consumed + i))
+				test_common.errors++;
+		}
+
+		test_common.consumed += n;
+		reads++;
+	}
+
+	pthread_join(tid, NULL);
+	t = test_now() - t;
+	wakeups = host_signals(test_common.tty.rx_waitq);
+
+	printf("rx: %lu MiB in %.2f s, %lu reads, %lu reader signals\n", test_common.consumed >> 20, t, reads, wakeups);
+
+	TEST_CHECK(test_common.errors == 0);
+	TEST_CHECK(libtty_rxready(&test_common.tty) == 0);
+
+	/* Reader is signalled only when the FIFO turns non-empty, at most once per read */
+	TEST_CHECK(wakeups <= reads + 1);
+
+	libtty_destroy(&test_common.tty);
+
+	return 0;
+}
+
+
+/* UART TX: drains up to 16 bytes at a time and checks the sequence */
+static void *test_txConsumer(void *arg)
+{
+	unsigned char buf[16];
+	unsigned int n, i;
+	int wake;
+
+	for (;;) {
+		/* Writer is done once drains is set */
+		if (__atomic_load_n(&test_common.drains, __ATOMIC_ACQUIRE) && test_common.consumed == test_common.produced)
+			break;
+
+		n = libtty_getchars(&test_common.tty, buf, 1 + rand() % sizeof(buf), &wake);
+		test_common.getchars++;
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+
+		for (i = 0; i < n; ++i) {
+			if (buf[i] != (unsigned char)(test_common.consumed + i))
+				test_common.errors++;
+		}
+
+		test_common.consumed += n;
+	}
+
+	return NULL;
+}
+
+
+/* Drain waits next to the blocked writer, both have to be woken */
+static void *test_txDrain(void *arg)
+{
+	const void *out;
+	int i;
+
+	for (i = 0; i < 1000; ++i)
+		libtty_ioctl(&test_common.tty, 0, TCDRAIN, NULL, &out);
+
+	return NULL;
+}
+
+
+static int test_tx(void)
+{
+	char buf[4096];
+	pthread_t consumer, drain;
+	unsigned long wakeups;
+	ssize_t n, i;
+	double t;
+
+	TEST_CHECK(test_open(1) == 0);
+	test_common.drains = 0;
+
+	t = test_now();
+	pthread_create(&consumer, NULL, test_txConsumer, NULL);
+	pthread_create(&drain, NULL, test_txDrain, NULL);
+
+	while (test_common.produced < STRESS_SIZE) {
+		n = 1 + rand() % sizeof(buf);
+		for (i = 0; i < n; ++i)
+			buf[i] = test_common.produced + i;
+
+		TEST_CHECK(libtty_write(&test_common.tty, buf, n, 0) == n);
+		test_common.produced += n;
+	}
+
+	pthread_join(drain, NULL);
+	__atomic_store_n(&test_common.drains, 1, __ATOMIC_RELEASE);
+	pthread_join(consumer, NULL);
+	t = test_now() - t;
+	wakeups = host_signals(test_common.tty.tx_waitq);
+
+	printf("tx: %lu MiB in %.2f s, %lu getchars, %lu writer/drain wakeups\n", test_common.consumed >> 20, t, test_common.getchars, wakeups);
+
+	TEST_CHECK(test_common.errors == 0 && test_common.consumed == test_common.produced);
+
+	/*
+	 * The UART side can't take tx_mutex, so waiters are woken for as long
+	 * as they are registered, i.e. at most once per getchars
+	 */
+	TEST_CHECK(wakeups <= test_common.getchars);
+
+	libtty_destroy(&test_common.tty);
+
+	return 0;
+}
+
+
+/* No waiters, no wakeups */
+static int test_txIdle(void)
+{
+	unsigned char buf[64];
+	int wake = 1;
+
+	TEST_CHECK(test_open(1) == 0);
+
+	TEST_CHECK(libtty_write(&test_common.tty, "0123456789abcdef0123456789abcdef", 32, 0) == 32);
+	TEST_CHECK(libtty_getchars(&test_common.tty, buf, sizeof(buf), &wake) == 32);
+	TEST_CHECK(wake == 0 && host_signals(test_common.tty.tx_waitq) == 0);
+	TEST_CHECK(memcmp(buf, "0123456789abcdef0123456789abcdef", 32) == 0);
+
+	libtty_destroy(&test_common.tty);
+
+	return 0;
+}
+
+
+/* A registered waiter is woken only once the watermark of free space is reached */
+static int test_txWatermark(void)
+{
+	unsigned int n = 0, signals = 0;
+	unsigned char c;
+	int wake;
+
+	TEST_CHECK(test_open(1) == 0);
+
+	while (fifo_freespace(test_common.tty.tx_fifo) > 0) {
+		c = n++;
+		TEST_CHECK(libtty_write(&test_common.tty, (char *)&c, 1, 0) == 1);
+	}
+
+	/* Plays a writer blocked in libtty_tx_wait() */
+	test_common.tty.tx_waiters = 1;
+
+	/* Free space after the pop stays below the watermark */
+	while (fifo_freespace(test_common.tty.tx_fifo) + 1 < TX_WATERMARK) {
+		TEST_CHECK(libtty_getchar(&test_common.tty, &wake) == (unsigned char)test_common.consumed++);
+		TEST_CHECK(wake == 0 && host_signals(test_common.tty.tx_waitq) == 0);
+	}
+
+	while (!fifo_is_empty(test_common.tty.tx_fifo)) {
+		TEST_CHECK(libtty_getchar(&test_common.tty, &wake) == (unsigned char)test_common.consumed++);
+		TEST_CHECK(wake == 1 && host_signals(test_common.tty.tx_waitq) == ++signals);
+	}
+
+	test_common.tty.tx_waiters = 0;
+	libtty_destroy(&test_common.tty);
+
+	return 0;
+}
+
+
+static void test_timeout(int sig)
+{
+	printf("spsc_test: timed out, lost wakeup (%lu produced, %lu consumed)\n", test_common.produced, test_common.consumed);
+	fflush(stdout);
+	_exit(EXIT_FAILURE);
+}
+
+
+int main(void)
+{
+	srand(1);
+	signal(SIGALRM, test_timeout);
+	alarm(TEST_TIMEOUT);
+
+	TEST_CASE(test_rx());
+	TEST_CASE(test_txIdle());
+	TEST_CASE(test_txWatermark());
+	TEST_CASE(test_tx());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -18,11 +18,14 @@
 #include <sys/threads.h>
 #include <sys/list.h>
 #include <sys/interrupt.h>
+#include <sys/platform.h>
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <phoenix/arch/imx6ull.h>
 
 #include "ehci.h"
 #include "phy.h"
@@ -50,6 +53,15 @@
 #define USBCMD_ASE (1 << 5)
 #define USBCMD_IAA (1 << 6)
 
+#define EHCI_PERIODIC_SIZE 1024
+
+/* Bandwidth is accounted over the longest period, longer intervals are polled more often */
+#define EHCI_MAX_PERIOD 32
+
+/* Periodic transfers get at most 80% of a microframe and 90% of a full speed frame, in us */
+#define EHCI_UFRAME_BUDGET 100
+#define EHCI_FRAME_BUDGET  900
+
 #define PORTSC_PTS_1 (3 << 30)
 #define PORTSC_STS (1 << 29)
 #define PORTSC_PPTW (1 << 28)
@@ -247,6 +259,14 @@ struct qh {
 	/* non-hardware fields */
 	struct qtd *last;
 	struct qh *next, *prev;
+
+	/* periodic schedule placement, period in frames */
+	unsigned period : 6;
+	unsigned phase : 5;
+	unsigned uframe : 3;
+	unsigned usecs : 10;
+	unsigned periodic : 1;
+	unsigned unlink_frame : 7;
 };
 
 
@@ -254,9 +274,14 @@ struct {
 	volatile unsigned *base;
 	volatile unsigned *usb2;
 	link_pointer_t *periodic_list;
+	struct qh **periodic_shadow;
 	volatile struct qh *async_head;
 
-	handle_t irq_cond, irq_handle, irq_lock, aai_cond, async_lock;
+	/* us used by periodic transfers in each microframe (high speed) and frame (full/low speed) */
+	unsigned short uframe_load[EHCI_MAX_PERIOD][8];
+	unsigned short frame_load[EHCI_MAX_PERIOD];
+
+	handle_t irq_cond, irq_handle, irq_lock, aai_cond, async_lock, periodic_lock;
 	volatile unsigned status;
 	volatile unsigned port_change;
 	volatile unsigned portsc;
@@ -265,12 +290,214 @@ struct {
 } ehci_common;
 
 
-void ehci_insertPeriodic(struct qh *qh)
+/* Worst case bus time of one transaction in us, USB 2.0 5.11.3 */
+static unsigned ehci_busTime(struct qh *qh)
+{
+	unsigned bits = 3 + 7 * 8 * qh->max_packet_len / 6;
+	unsigned mult = qh->pipe_multiplier ? qh->pipe_multiplier : 1;
+
+	if (qh->endpoint_speed == high_speed)
+		return (mult * ((55 * 8 * 2083 + 2083 * bits) / 1000 + 5) + 999) / 1000;
+
+	if (qh->endpoint_speed == full_speed)
+		return (9107 + 84 * bits + 999) / 1000;
+
+	return (64060 + 677 * bits + 999) / 1000;
+}
+
+
+/* Returns the heaviest slot load after adding usecs, -1 if it doesn't fit */
+static int ehci_periodicLoad(int speed, unsigned usecs, unsigned period, unsigned phase, unsigned smask)
+{
+	unsigned f, u, load, max = 0;
+
+	for (f = phase; f < EHCI_MAX_PERIOD; f += period) {
+		if (speed != high_speed) {
+			if ((load = ehci_common.frame_load[f] + usecs) > EHCI_FRAME_BUDGET)
+				return -1;
+
+			max = (load > max) ? load : max;
+			continue;
+		}
+
+		for (u = 0; u < 8; ++u) {
+			if (!(smask & (1 << u)))
+				continue;
+
+			if ((load = ehci_common.uframe_load[f][u] + usecs) > EHCI_UFRAME_BUDGET)
+				return -1;
+
+			max = (load > max) ? load : max;
+		}
+	}
+
+	return max;
+}
+
+
+static void ehci_periodicCharge(struct qh *qh, int sign)
+{
+	unsigned f, u;
+
+	for (f = qh->phase; f < EHCI_MAX_PERIOD; f += qh->period) {
+		if (qh->endpoint_speed != high_speed) {
+			ehci_common.frame_load[f] += sign * (int)qh->usecs;
+			continue;
+		}
+
+		for (u = 0; u < 8; ++u) {
+			if (qh->interrupt_schedule_mask & (1 << u))
+				ehci_common.uframe_load[f][u] += sign * (int)qh->usecs;
+		}
+	}
+}
+
+
+/* Picks the least loaded frame phase and microframe for the interval */
+static int ehci_periodicPlace(struct qh *qh, int interval)
 {
-	link_pointer_t ptr = { 0 };
+	unsigned period, uperiod = 8, phase, uframe, smask, best_smask = 0, usecs = ehci_busTime(qh);
+	int load, best = -1;
+
+	if (qh->endpoint_speed == high_speed) {
+		/* bInterval selects 2^(bInterval - 1) microframes */
+		interval = (interval < 1) ? 1 : ((interval > 16) ? 16 : interval);
+		uperiod = 1 << (interval - 1);
+		period = (uperiod < 8) ? 1 : (uperiod >> 3);
+		uperiod = (uperiod < 8) ? uperiod : 8;
+	}
+	else {
+		/* bInterval in frames, rounded down to power of 2 */
+		for (period = 1; period * 2 <= interval; period *= 2)
+			;
+	}
+
+	if (period > EHCI_MAX_PERIOD)
+		period = EHCI_MAX_PERIOD;
+
+	for (phase = 0; phase < period; ++phase) {
+		for (uframe = 0; uframe < uperiod; ++uframe) {
+			/* Split transactions start in microframes 0-3 to complete in the same frame */
+			if (qh->endpoint_speed != high_speed && uframe != (phase & 3))
+				continue;
+
+			for (smask = 0, load = uframe; load < 8; load += uperiod)
+				smask |= 1 << load;
+
+			load = ehci_periodicLoad(qh->endpoint_speed, usecs, period, phase, smask);
+
+			if (load >= 0 && (best < 0 || load < best)) {
+				best = load;
+				best_smask = smask;
+				qh->phase = phase;
+				qh->uframe = uframe;
+			}
+		}
+	}
+
+	if (best < 0)
+		return -ENOSPC;
+
+	qh->period = period;
+	qh->usecs = usecs;
+
+	if (qh->endpoint_speed == high_speed) {
+		qh->interrupt_schedule_mask = best_smask;
+		qh->split_completion_mask = 0;
+	}
+	else {
+		/* Complete splits in microframes Y + 2 .. Y + 4 */
+		qh->interrupt_schedule_mask = 1 << qh->uframe;
+		qh->split_completion_mask = 0x1c << qh->uframe;
+	}
+
+	ehci_periodicCharge(qh, 1);
+
+	return EOK;
+}
+
+
+/* Frame chains are ordered by decreasing period, so all frames polling a QH agree on its successor */
+int ehci_linkPeriodic(struct qh *qh, int interval)
+{
+	link_pointer_t ptr = { 0 }, *link;
+	struct qh **prev;
+	unsigned f;
+	int err;
+
+	mutexLock(ehci_common.periodic_lock);
+
+	if ((err = ehci_periodicPlace(qh, interval)) < 0) {
+		mutexUnlock(ehci_common.periodic_lock);
+		return err;
+	}
+
 	ptr.pointer = va2pa(qh) >> 5;
 	ptr.type = framelist_qh;
-	ehci_common.periodic_list[0] = ptr;
+
+	for (f = qh->phase; f < EHCI_PERIODIC_SIZE; f += qh->period) {
+		prev = &ehci_common.periodic_shadow[f];
+		link = &ehci_common.periodic_list[f];
+
+		while (*prev != NULL && *prev != qh && (*prev)->period > qh->period) {
+			link = &(*prev)->horizontal;
+			prev = &(*prev)->next;
+		}
+
+		/* Already linked through a predecessor shared with previous frames */
+		if (*prev == qh)
+			continue;
+
+		qh->next = *prev;
+		qh->horizontal = *link;
+
+		asm volatile ("dmb" ::: "memory");
+
+		*link = ptr;
+		*prev = qh;
+	}
+
+	qh->periodic = 1;
+	mutexUnlock(ehci_common.periodic_lock);
+
+	return EOK;
+}
+
+
+/* QH may be freed two frames after the unlink, see ehci_freeQh */
+void ehci_unlinkPeriodic(struct qh *qh)
+{
+	link_pointer_t *link;
+	struct qh **prev;
+	unsigned f;
+
+	mutexLock(ehci_common.periodic_lock);
+
+	for (f = qh->phase; f < EHCI_PERIODIC_SIZE; f += qh->period) {
+		prev = &ehci_common.periodic_shadow[f];
+		link = &ehci_common.periodic_list[f];
+
+		while (*prev != NULL && *prev != qh) {
+			link = &(*prev)->horizontal;
+			prev = &(*prev)->next;
+		}
+
+		if (*prev == qh) {
+			*link = qh->horizontal;
+			*prev = qh->next;
+		}
+	}
+
+	ehci_periodicCharge(qh, -1);
+	qh->unlink_frame = *(ehci_common.usb2 + frindex) >> 3;
+
+	mutexUnlock(ehci_common.periodic_lock);
+}
+
+
+int ehci_insertPeriodic(struct qh *qh, int interval)
+{
+	return ehci_linkPeriodic(qh, interval);
 }
 
 
@@ -415,13 +642,53 @@ void ehci_enqueue(struct qh *qh, struct qtd *first, struct qtd *last)
 }
 
 
+/* qTDs come from 64-byte DMA slots, software state of a chain lives in the unused tail */
+struct qtd_chain {
+	struct qtd *next;
+
+	/* IN buffer, first qTD only, until the chain is seen finished */
+	char *buffer;
+	size_t size;
+};
+
+
+static inline struct qtd_chain *ehci_qtdChainState(struct qtd *qtd)
+{
+	return (struct qtd_chain *)(qtd + 1);
+}
+
+
+static inline struct qtd **ehci_qtdChain(struct qtd *qtd)
+{
+	return &ehci_qtdChainState(qtd)->next;
+}
+
+
+/* Chain buffers are cacheable, the controller goes around the D-cache */
+static void ehci_cacheSync(void *addr, size_t size)
+{
+	platformctl_t pctl;
+
+	pctl.action = pctl_set;
+	pctl.type = pctl_cleanInvalDCache;
+	pctl.cleanInvalDCache.addr = addr;
+	pctl.cleanInvalDCache.sz = size;
+
+	platformctl(&pctl);
+}
+
+
 void ehci_continue(struct qh *qh, struct qtd *last)
 {
 	if (qh->last == last) {
 		qh->last = &qh->transfer_overlay;
 		qh->last->next = last->next;
 	}
-	else if (qh->transfer_overlay.active == 0 && qh->current_qtd.pointer == va2pa(last) >> 5) {
+	else if (qh->transfer_overlay.active == 0 && (qh->current_qtd.pointer == va2pa(last) >> 5 ||
+			(!qh->transfer_overlay.next.terminate && qh->transfer_overlay.next.pointer == va2pa(last) >> 5) ||
+			(!qh->transfer_overlay.alt_next.terminate && qh->transfer_overlay.alt_next.pointer == va2pa(last) >> 5))) {
+		/* Queue stopped at or before the stop qTD of a chain */
+		qh->transfer_overlay.alt_next.terminate = 1;
 		qh->transfer_overlay.next = last->next;
 	}
 }
@@ -484,6 +751,147 @@ void ehci_freeQtd(struct qtd *qtd)
 }
 
 
+struct qtd *ehci_allocQtdChain(struct qh *qh, int token, char *buffer, size_t size, int datax, struct qtd **last)
+{
+	struct qtd *first = NULL, *prev = NULL, *qtd, *stop = NULL;
+	char *start = buffer;
+	size_t chunk, max, sz, total = size;
+	unsigned mps = qh->max_packet_len ? qh->max_packet_len : 1;
+
+	if (token == in_token) {
+		/* Short packet takes alt_next to an inactive qTD, queue stops there until ehci_continue */
+		if ((stop = dma_alloc64()) == NULL)
+			return NULL;
+
+		stop->next.terminate = 1;
+		stop->alt_next.terminate = 1;
+	}
+
+	do {
+		/* qTD spans 5 pages, all but the last one carry whole packets */
+		max = 5 * _PAGE_SIZE - ((uintptr_t)buffer & (_PAGE_SIZE - 1));
+		chunk = (size > max) ? max - max % mps : size;
+		sz = chunk;
+
+		if ((qtd = ehci_allocQtd(token, chunk ? buffer : NULL, &sz, datax)) == NULL) {
+			ehci_freeQtdChain(first);
+
+			if (stop != NULL)
+				dma_free64(stop);
+
+			return NULL;
+		}
+
+		if (stop != NULL) {
+			qtd->alt_next.pointer = va2pa(stop) >> 5;
+			qtd->alt_next.terminate = 0;
+		}
+
+		if (prev == NULL) {
+			first = qtd;
+		}
+		else {
+			ehci_linkQtd(prev, qtd);
+			*ehci_qtdChain(prev) = qtd;
+		}
+
+		prev = qtd;
+
+		/* DATA0/DATA1 alternate per packet, used only for control endpoints */
+		datax ^= ((chunk + mps - 1) / mps) & 1;
+		buffer += chunk;
+		size -= chunk;
+	} while (size);
+
+	prev->ioc = 1;
+
+	if (stop != NULL) {
+		ehci_linkQtd(prev, stop);
+		*ehci_qtdChain(prev) = stop;
+		prev = stop;
+
+		/* Lines fetched while the controller writes are dropped once the chain is finished */
+		ehci_qtdChainState(first)->buffer = start;
+		ehci_qtdChainState(first)->size = total;
+	}
+
+	/* OUT data is written back, dirty IN lines can't be evicted over the received data */
+	if (total)
+		ehci_cacheSync(start, total);
+
+	*last = prev;
+
+	return first;
+}
+
+
+static int ehci_qtdChainDone(struct qtd *first)
+{
+	for (; first != NULL; first = *ehci_qtdChain(first)) {
+		if (first->halted)
+			return 1;
+
+		if (first->active)
+			return 0;
+
+		/* Short packet, rest of the chain is skipped */
+		if (first->pid_code == in_token && first->bytes_to_transfer)
+			return 1;
+	}
+
+	return 1;
+}
+
+
+int ehci_qtdChainFinished(struct qtd *first)
+{
+	struct qtd_chain *state = ehci_qtdChainState(first);
+
+	if (!ehci_qtdChainDone(first))
+		return 0;
+
+	if (state->size) {
+		ehci_cacheSync(state->buffer, state->size);
+		state->size = 0;
+	}
+
+	return 1;
+}
+
+
+int ehci_qtdChainRemaining(struct qtd *first)
+{
+	int remaining = 0;
+
+	for (; first != NULL; first = *ehci_qtdChain(first))
+		remaining += first->bytes_to_transfer;
+
+	return remaining;
+}
+
+
+int ehci_qtdChainError(struct qtd *first)
+{
+	for (; first != NULL; first = *ehci_qtdChain(first)) {
+		if (first->halted || first->transaction_error || first->babble || first->buffer_error)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+void ehci_freeQtdChain(struct qtd *first)
+{
+	struct qtd *next;
+
+	for (; first != NULL; first = next) {
+		next = *ehci_qtdChain(first);
+		ehci_freeQtd(first);
+	}
+}
+
+
 struct qh *ehci_allocQh(int address, int endpoint, int transfer, int speed, int max_packet_len)
 {
 	struct qh *result = dma_alloc64();
@@ -550,6 +958,16 @@ void ehci_freeQh(struct qh *qh)
 {
 	FUN_TRACE;
 
+	if (qh->periodic) {
+		/* Periodic schedule is walked from the frame list every frame, no IAA needed.
+		 * The frame of the unlink may still be walked and the next one prefetched, halted controller walks nothing */
+		while ((((*(ehci_common.usb2 + frindex) >> 3) - qh->unlink_frame) & 0x7f) < 2 && !(*(ehci_common.usb2 + usbsts) & USBSTS_HCH))
+			usleep(125);
+
+		dma_free64(qh);
+		return;
+	}
+
 	mutexLock(ehci_common.async_lock);
 	if (ehci_common.async_head != NULL && /*hack*/!qh->interrupt_schedule_mask) {
 		*(ehci_common.usb2 + usbcmd) |= USBCMD_IAA;
@@ -659,7 +1077,7 @@ void ehci_init(void *event_callback, handle_t common_lock)
 {
 	int i;
 
-	if (sizeof(struct qh) > 64 || sizeof(struct qtd) > 64) {
+	if (sizeof(struct qh) > 64 || sizeof(struct qtd) + sizeof(struct qtd *) > 64) {
 		fprintf(stderr, "qh is %d bytes, qtd is %d bytes\n", sizeof(struct qh), sizeof(struct qtd));
 		exit(1);
 	}
@@ -672,10 +1090,12 @@ void ehci_init(void *event_callback, handle_t common_lock)
 	condCreate(&ehci_common.irq_cond);
 	mutexCreate(&ehci_common.irq_lock);
 	mutexCreate(&ehci_common.async_lock);
+	mutexCreate(&ehci_common.periodic_lock);
 
 	ehci_common.periodic_list = mmap(NULL, _PAGE_SIZE, PROT_WRITE | PROT_READ, MAP_ANONYMOUS | MAP_UNCACHED, OID_NULL, 0);
+	ehci_common.periodic_shadow = calloc(EHCI_PERIODIC_SIZE, sizeof(struct qh *));
 
-	for (i = 0; i < 1024; ++i)
+	for (i = 0; i < EHCI_PERIODIC_SIZE; ++i)
 		ehci_common.periodic_list[i] = (link_pointer_t) { .type = 0, .zero = 0, .pointer = 0, .terminate = 1 };
 
 	ehci_common.base = mmap(NULL, 4 * _PAGE_SIZE, PROT_WRITE | PROT_READ, MAP_DEVICE, OID_PHYSMEM, USB_ADDR);
@@ -810,6 +1230,23 @@ void ehci_dumpQueue(FILE *stream, struct qh *qh)
 }
 
 
+void ehci_dumpPeriodic(FILE *stream)
+{
+	unsigned f, u;
+
+	mutexLock(ehci_common.periodic_lock);
+	for (f = 0; f < EHCI_MAX_PERIOD; ++f) {
+		fprintf(stream, "%2u: fs %3u us, hs", f, ehci_common.frame_load[f]);
+
+		for (u = 0; u < 8; ++u)
+			fprintf(stream, " %3u", ehci_common.uframe_load[f][u]);
+
+		fprintf(stream, "\n");
+	}
+	mutexUnlock(ehci_common.periodic_lock);
+}
+
+
 void ehci_activate(struct qh *qh) {
 	qh->transfer_overlay.active = 1;
 }
@@ -28,6 +28,9 @@ enum { transfer_control, transfer_interrupt, transfer_bulk, transfer_isochronous
 enum { full_speed = 0, low_speed, high_speed };
 
 
+enum { out_token = 0, in_token, setup_token };
+
+
 struct itd;
 struct sitd;
 struct qtd;
@@ -58,6 +61,9 @@ extern void ehci_dumpRegisters(FILE *stream);
 extern void ehci_dumpQueue(FILE *stream, struct qh *qh);
 
 
+extern void ehci_dumpPeriodic(FILE *stream);
+
+
 extern void ehci_consQtd(struct qtd *qtd, struct qh *qh);
 
 
@@ -73,6 +79,17 @@ extern void ehci_linkQh(struct qh *qh);
 extern void ehci_unlinkQh(struct qh *unlink);
 
 
+/* Places interrupt QH by endpoint bInterval, returns -ENOSPC when periodic bandwidth is exhausted */
+extern int ehci_linkPeriodic(struct qh *qh, int interval);
+
+
+extern void ehci_unlinkPeriodic(struct qh *qh);
+
+
+/* Links interrupt QH polled at the endpoint's bInterval, -ENOSPC has to be reported to the class driver */
+extern int ehci_insertPeriodic(struct qh *qh, int interval);
+
+
 extern void ehci_linkQtd(struct qtd *prev, struct qtd *next);
 
 
@@ -97,6 +114,28 @@ extern int ehci_qtdFinished(struct qtd *qtd);
 extern struct qtd *ehci_allocQtd(int token, char *buffer, size_t *size, int datax);
 
 
+/* Splits size bytes at buffer into qTDs chained by ehci_linkQtd, each page is translated with va2pa, so buffer doesn't need
+ * to be physically contiguous. Buffer may be cached, it's cleaned and invalidated here and IN buffers again when
+ * ehci_qtdChainFinished first reports the chain finished, the caller doesn't touch it in between. Only the last data qTD
+ * interrupts. IN chains end with an inactive stop qTD, short packet jumps there through alt_next and ehci_continue(qh, last)
+ * restarts the queue after it. Returns first qTD, last in *last */
+extern struct qtd *ehci_allocQtdChain(struct qh *qh, int token, char *buffer, size_t size, int datax, struct qtd **last);
+
+
+/* IN data is valid in the caller's buffer once this returns 1 */
+extern int ehci_qtdChainFinished(struct qtd *first);
+
+
+/* Bytes not transferred, size minus this is the actual length also after a short packet */
+extern int ehci_qtdChainRemaining(struct qtd *first);
+
+
+extern int ehci_qtdChainError(struct qtd *first);
+
+
+extern void ehci_freeQtdChain(struct qtd *first);
+
+
 extern struct qh *ehci_allocQh(int address, int endpoint, int speed, int transfer, int max_packet_len);
 
 #endif
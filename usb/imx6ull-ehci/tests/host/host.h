@@ -0,0 +1,20 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - ARM specifics
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+/* Barriers of the driver assemble to nothing, tests run single threaded */
+__asm__ (".macro dmb\n.endm");
+
+
+#endif
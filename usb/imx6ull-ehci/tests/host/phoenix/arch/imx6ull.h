@@ -0,0 +1,43 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - platform control definitions stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_PHOENIX_ARCH_IMX6ULL_H_
+#define _HOST_PHOENIX_ARCH_IMX6ULL_H_
+
+#include <stddef.h>
+
+
+enum { pctl_set = 0, pctl_get };
+
+
+enum { pctl_devclock = 0, pctl_cleanInvalDCache };
+
+
+typedef struct {
+	int action;
+	int type;
+
+	union {
+		struct {
+			int dev;
+			unsigned int state;
+		} devclock;
+
+		struct {
+			void *addr;
+			size_t sz;
+		} cleanInvalDCache;
+	};
+} platformctl_t;
+
+
+#endif
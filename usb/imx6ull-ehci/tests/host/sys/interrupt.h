@@ -0,0 +1,25 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - interrupts stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_INTERRUPT_H_
+#define _HOST_SYS_INTERRUPT_H_
+
+#include <sys/threads.h>
+
+
+static inline int interrupt(unsigned int n, int (*f)(unsigned int, void *), void *arg, handle_t cond, handle_t *handle)
+{
+	return EOK;
+}
+
+
+#endif
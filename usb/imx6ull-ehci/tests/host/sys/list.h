@@ -0,0 +1,21 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - lists stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_LIST_H_
+#define _HOST_SYS_LIST_H_
+
+/* Async schedule isn't exercised */
+#define LIST_ADD(list, t) do { (void)(list); (void)(t); } while (0)
+#define LIST_REMOVE(list, t) do { (void)(list); (void)(t); } while (0)
+
+
+#endif
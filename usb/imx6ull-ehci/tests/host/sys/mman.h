@@ -0,0 +1,31 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - memory management stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_MMAN_H_
+#define _HOST_SYS_MMAN_H_
+
+#include_next <sys/mman.h>
+#include <stdint.h>
+
+#define _PAGE_SIZE 4096
+
+#define MAP_UNCACHED 0
+#define MAP_DEVICE   0
+#define OID_NULL     0
+#define OID_PHYSMEM  0
+
+
+/* Identity mapping, tests are built -no-pie so that static and heap addresses fit in 32 bits */
+#define va2pa(p) ((uint32_t)(uintptr_t)(p))
+
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - platform control stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_PLATFORM_H_
+#define _HOST_SYS_PLATFORM_H_
+
+#include <phoenix/arch/imx6ull.h>
+
+
+/* D-cache maintenance requested by the driver, last range and count */
+static struct {
+	unsigned long syncs;
+	void *addr;
+	size_t sz;
+} host_dcache;
+
+
+static inline int platformctl(void *ctl)
+{
+	platformctl_t *pctl = ctl;
+
+	if (pctl->action == pctl_set && pctl->type == pctl_cleanInvalDCache) {
+		++host_dcache.syncs;
+		host_dcache.addr = pctl->cleanInvalDCache.addr;
+		host_dcache.sz = pctl->cleanInvalDCache.sz;
+	}
+
+	return 0;
+}
+
+
+#endif
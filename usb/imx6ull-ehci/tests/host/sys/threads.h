@@ -0,0 +1,70 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI host tests - threads stand-in
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _HOST_SYS_THREADS_H_
+#define _HOST_SYS_THREADS_H_
+
+#include <errno.h>
+#include <stddef.h>
+
+#define EOK 0
+
+
+typedef unsigned int handle_t;
+
+
+static inline int mutexCreate(handle_t *h)
+{
+	*h = 0;
+	return EOK;
+}
+
+
+static inline int mutexLock(handle_t h)
+{
+	return EOK;
+}
+
+
+static inline int mutexUnlock(handle_t h)
+{
+	return EOK;
+}
+
+
+static inline int condCreate(handle_t *h)
+{
+	*h = 0;
+	return EOK;
+}
+
+
+static inline int condSignal(handle_t h)
+{
+	return EOK;
+}
+
+
+/* Nothing signals in a single thread */
+static inline int condWait(handle_t h, handle_t m, long long timeout)
+{
+	return -ETIME;
+}
+
+
+static inline int beginthread(void (*start)(void *), unsigned int priority, void *stack, unsigned int stacksz, void *arg)
+{
+	return EOK;
+}
+
+
+#endif
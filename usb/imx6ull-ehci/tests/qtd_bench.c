@@ -0,0 +1,343 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI qTD chain host benchmark
+ *
+ * Runs bulk transfers through a model of the controller's queue walker
+ * (EHCI 4.10: overlay, next and alternate next pointers) and compares
+ * one 5-page qTD per round trip through a bounce buffer against a qTD
+ * chain built over the caller's buffer. Time is estimated from HS bulk
+ * bandwidth and the interrupt to next enqueue latency.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ehci.c"
+#include "test.h"
+
+
+#define MODEL_FRAME_BYTES (13 * 512 * 8)  /* HS bulk, 13 packets per microframe */
+#define MODEL_IRQ_US      60              /* Interrupt to next enqueue, bus idle */
+
+
+#define QTD_PTR(p) ((struct qtd *)(uintptr_t)((p) << 5))
+
+
+struct {
+	unsigned int regs[0x200];
+
+	/* Device side of the endpoint, IN supplies len bytes then a short packet */
+	unsigned char dev[1 << 21];
+	size_t pos;
+	size_t len;
+	unsigned int sink;
+
+	unsigned long irqs;
+	unsigned long allocs;
+} model;
+
+
+static struct {
+	char buff[1 << 21] __attribute__((aligned(4096)));
+	char bounce[5 * 4096] __attribute__((aligned(4096)));
+	struct qh *qh;
+} test_common;
+
+
+int test_failed;
+
+
+void phy_init(void)
+{
+}
+
+
+void phy_disableClock(void)
+{
+}
+
+
+void *dma_alloc64(void)
+{
+	void *p = aligned_alloc(64, 64);
+
+	if (p != NULL)
+		memset(p, 0, 64);
+
+	++model.allocs;
+
+	return p;
+}
+
+
+void dma_free64(void *ptr)
+{
+	free(ptr);
+}
+
+
+/* Moves packets of the overlay until it completes or a short packet ends it */
+static int model_execute(struct qh *qh)
+{
+	struct qtd *ov = &qh->transfer_overlay;
+	unsigned int mps = qh->max_packet_len, n, k, shortpkt = 0;
+	size_t off = ov->offset + (ov->current_page << 12), o;
+	unsigned char *p;
+
+	while (ov->bytes_to_transfer && !shortpkt) {
+		n = (ov->bytes_to_transfer < mps) ? ov->bytes_to_transfer : mps;
+
+		if (ov->pid_code == in_token && model.len - model.pos < n) {
+			n = model.len - model.pos;
+			shortpkt = 1;
+		}
+
+		/* Packet may cross pages, 5 buffer pointers at most */
+		for (k = 0; k < n; ++k) {
+			o = off + k;
+			TEST_CHECK((o >> 12) < 5);
+			p = (unsigned char *)(uintptr_t)(ov->buffers[o >> 12].page << 12) + (o & 0xfff);
+
+			if (ov->pid_code == in_token)
+				*p = model.dev[model.pos + k];
+			else
+				model.sink += *p;
+		}
+
+		model.pos += n;
+		ov->bytes_to_transfer -= n;
+		off += n;
+		ov->current_page = off >> 12;
+		ov->offset = off & 0xfff;
+	}
+
+	/* Device takes whole OUT transfers */
+	TEST_CHECK(!ov->bytes_to_transfer || ov->pid_code == in_token);
+
+	return EOK;
+}
+
+
+/* Walks the QH until the queue stops */
+static int model_run(struct qh *qh)
+{
+	struct qtd *ov = &qh->transfer_overlay, *qtd;
+	link_pointer_t next;
+
+	for (;;) {
+		if (!ov->active) {
+			/* Short packet takes the alternate next pointer */
+			next = (ov->bytes_to_transfer && !ov->alt_next.terminate) ? ov->alt_next : ov->next;
+			if (next.terminate || !QTD_PTR(next.pointer)->active)
+				return EOK;
+
+			qh->current_qtd = next;
+			*ov = *QTD_PTR(next.pointer);
+		}
+
+		TEST_CHECK(model_execute(qh) == EOK);
+
+		/* Write back to the qTD */
+		ov->active = 0;
+		qtd = QTD_PTR(qh->current_qtd.pointer);
+		qtd->active = 0;
+		qtd->bytes_to_transfer = ov->bytes_to_transfer;
+
+		if (ov->ioc || (ov->pid_code == in_token && ov->bytes_to_transfer))
+			++model.irqs;
+	}
+}
+
+
+static void model_reset(size_t len)
+{
+	model.pos = 0;
+	model.len = len;
+	model.irqs = 0;
+	model.allocs = 0;
+}
+
+
+static double model_ms(size_t bytes, unsigned long rounds)
+{
+	return bytes * 1.0 / MODEL_FRAME_BYTES + rounds * MODEL_IRQ_US / 1000.0;
+}
+
+
+/* One 5-page qTD at a time through a bounce buffer, waiting for each */
+static int test_bounce(size_t size, unsigned long *rounds)
+{
+	struct qtd *qtd;
+	size_t left, chunk, n;
+	char *p;
+
+	model_reset(size);
+
+	for (left = size, p = test_common.buff + 8, *rounds = 0; left; ++*rounds) {
+		chunk = (left > sizeof(test_common.bounce)) ? sizeof(test_common.bounce) : left;
+		n = chunk;
+
+		qtd = ehci_allocQtd(in_token, test_common.bounce, &n, 0);
+		TEST_CHECK(qtd != NULL);
+		ehci_enqueue(test_common.qh, qtd, qtd);
+		TEST_CHECK(model_run(test_common.qh) == EOK);
+
+		memcpy(p, test_common.bounce, chunk);
+		ehci_continue(test_common.qh, qtd);
+		ehci_freeQtd(qtd);
+
+		p += chunk;
+		left -= chunk;
+	}
+
+	TEST_CHECK(memcmp(test_common.buff + 8, model.dev, size) == 0);
+
+	return EOK;
+}
+
+
+/* Whole transfer in one chain over an unaligned caller buffer */
+static int test_chain(size_t size, unsigned long *qtds)
+{
+	struct qtd *first, *last;
+	unsigned long syncs = host_dcache.syncs;
+
+	memset(test_common.buff, 0, size + 8);
+	model_reset(size);
+
+	first = ehci_allocQtdChain(test_common.qh, in_token, test_common.buff + 8, size, 0, &last);
+	TEST_CHECK(first != NULL);
+	*qtds = model.allocs - 1;
+
+	/* Whole buffer is cleaned before the controller writes it */
+	TEST_CHECK(host_dcache.syncs == syncs + 1 && host_dcache.addr == test_common.buff + 8 && host_dcache.sz == size);
+
+	ehci_enqueue(test_common.qh, first, last);
+	TEST_CHECK(!ehci_qtdChainFinished(first) && host_dcache.syncs == syncs + 1);
+	TEST_CHECK(model_run(test_common.qh) == EOK);
+
+	/* and invalidated once when it's seen finished */
+	TEST_CHECK(ehci_qtdChainFinished(first) && !ehci_qtdChainError(first) && ehci_qtdChainRemaining(first) == 0);
+	TEST_CHECK(host_dcache.syncs == syncs + 2 && host_dcache.addr == test_common.buff + 8 && host_dcache.sz == size);
+	TEST_CHECK(ehci_qtdChainFinished(first) && host_dcache.syncs == syncs + 2);
+	TEST_CHECK(memcmp(test_common.buff + 8, model.dev, size) == 0);
+
+	ehci_continue(test_common.qh, last);
+	ehci_freeQtdChain(first);
+
+	return EOK;
+}
+
+
+static int test_throughput(void)
+{
+	static const size_t sizes[] = { 512, 4096, 16384, 65536, 1 << 20 };
+	unsigned long rounds, irqs, qtds;
+	double ms;
+	unsigned int i;
+
+	printf("%8s | %28s | %28s\n", "size", "5-page qTD + bounce", "qTD chain");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		TEST_CHECK(test_bounce(sizes[i], &rounds) == EOK);
+		irqs = model.irqs;
+		ms = model_ms(sizes[i], rounds);
+		printf("%8zu | %3lu irq %6.3f ms %5.1f MB/s | ", sizes[i], irqs, ms, sizes[i] / ms / 1000);
+
+		TEST_CHECK(test_chain(sizes[i], &qtds) == EOK);
+		TEST_CHECK(model.irqs == 1);
+		ms = model_ms(sizes[i], model.irqs);
+		printf("%3lu irq %2lu qTD %6.3f ms %5.1f MB/s\n", model.irqs, qtds, ms, sizes[i] / ms / 1000);
+	}
+
+	return EOK;
+}
+
+
+static int test_shortPacket(void)
+{
+	struct qtd *first, *last, *first2, *last2;
+
+	/* Device ends a 1 MiB read after 50100 bytes */
+	model_reset(50100);
+
+	first = ehci_allocQtdChain(test_common.qh, in_token, test_common.buff + 8, 1 << 20, 0, &last);
+	TEST_CHECK(first != NULL);
+	ehci_enqueue(test_common.qh, first, last);
+
+	/* Transfer queued behind it must not get the rest of the first one */
+	first2 = ehci_allocQtdChain(test_common.qh, in_token, test_common.buff + (1 << 20) + 64, 4096, 0, &last2);
+	TEST_CHECK(first2 != NULL);
+	ehci_enqueue(test_common.qh, first2, last2);
+
+	TEST_CHECK(model_run(test_common.qh) == EOK);
+	TEST_CHECK(model.irqs == 1 && ehci_qtdChainFinished(first) && !ehci_qtdChainFinished(first2));
+	TEST_CHECK((1 << 20) - ehci_qtdChainRemaining(first) == 50100);
+
+	/* Restart after the stop qTD */
+	model.pos = 0;
+	model.len = 4096;
+	ehci_continue(test_common.qh, last);
+	TEST_CHECK(model_run(test_common.qh) == EOK);
+	TEST_CHECK(model.irqs == 2 && ehci_qtdChainFinished(first2) && ehci_qtdChainRemaining(first2) == 0);
+	TEST_CHECK(memcmp(test_common.buff + (1 << 20) + 64, model.dev, 4096) == 0);
+
+	ehci_continue(test_common.qh, last2);
+	ehci_freeQtdChain(first);
+	ehci_freeQtdChain(first2);
+
+	return EOK;
+}
+
+
+static int test_out(void)
+{
+	struct qtd *first, *last;
+	unsigned long syncs = host_dcache.syncs;
+
+	model_reset(0);
+
+	/* OUT data is written back before the controller reads it, nothing to drop after */
+	first = ehci_allocQtdChain(test_common.qh, out_token, test_common.buff + 100, 100000, 0, &last);
+	TEST_CHECK(first != NULL);
+	TEST_CHECK(host_dcache.syncs == syncs + 1 && host_dcache.addr == test_common.buff + 100 && host_dcache.sz == 100000);
+	ehci_enqueue(test_common.qh, first, last);
+
+	TEST_CHECK(model_run(test_common.qh) == EOK);
+	TEST_CHECK(model.irqs == 1 && model.pos == 100000);
+	TEST_CHECK(ehci_qtdChainFinished(first) && ehci_qtdChainRemaining(first) == 0);
+	TEST_CHECK(host_dcache.syncs == syncs + 1);
+
+	ehci_continue(test_common.qh, last);
+	ehci_freeQtdChain(first);
+
+	return EOK;
+}
+
+
+int main(void)
+{
+	size_t i;
+
+	ehci_common.usb2 = model.regs;
+
+	for (i = 0; i < sizeof(model.dev); ++i)
+		model.dev[i] = i * 7;
+
+	test_common.qh = ehci_allocQh(1, 1, transfer_bulk, high_speed, 512);
+	if (test_common.qh == NULL)
+		return EXIT_FAILURE;
+
+	TEST_CASE(test_throughput());
+	TEST_CASE(test_shortPacket());
+	TEST_CASE(test_out());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,400 @@
+/*
+ * Phoenix-RTOS
+ *
+ * i.MX 6ULL EHCI periodic schedule host tests
+ *
+ * Links a random mix of interrupt endpoints into the periodic
+ * schedule, checks the frame list against the bandwidth accounting
+ * and polling periods, and that unlinked QHs aren't freed while the
+ * controller can still walk them.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ehci.c"
+#include "test.h"
+
+
+#define TEST_QHS 400
+
+
+struct {
+	unsigned int regs[0x200];
+
+	/* Waits of the last free, QH freed while it could be walked */
+	unsigned long usleeps;
+	int early;
+} model;
+
+
+static struct {
+	link_pointer_t list[EHCI_PERIODIC_SIZE];
+	struct qh *qhs[TEST_QHS];
+	unsigned int want[TEST_QHS];
+	int linked[TEST_QHS];
+} test_common;
+
+
+int test_failed;
+
+
+/* Microframe passes while the controller runs */
+int usleep(useconds_t us)
+{
+	if (!(*(ehci_common.usb2 + usbsts) & USBSTS_HCH))
+		*(ehci_common.usb2 + frindex) = (*(ehci_common.usb2 + frindex) + 1) & 0x3fff;
+
+	++model.usleeps;
+
+	return 0;
+}
+
+
+void phy_init(void)
+{
+}
+
+
+void phy_disableClock(void)
+{
+}
+
+
+void *dma_alloc64(void)
+{
+	void *p = aligned_alloc(64, 64);
+
+	if (p != NULL)
+		memset(p, 0, 64);
+
+	return p;
+}
+
+
+/* Periodic QH may be walked during the frame of the unlink and prefetched in the next one */
+void dma_free64(void *ptr)
+{
+	struct qh *qh = ptr;
+	unsigned int frame = *(ehci_common.usb2 + frindex) >> 3;
+
+	if (qh->periodic && !(*(ehci_common.usb2 + usbsts) & USBSTS_HCH) && ((frame - qh->unlink_frame) & 0x7f) < 2)
+		model.early = 1;
+
+	free(ptr);
+}
+
+
+static struct qh *test_qh(link_pointer_t l)
+{
+	return (struct qh *)(uintptr_t)(l.pointer << 5);
+}
+
+
+/* Polling interval in microframes */
+static unsigned int test_uperiod(struct qh *qh)
+{
+	unsigned int n = 0, u;
+
+	if (qh->endpoint_speed != high_speed)
+		return qh->period * 8;
+
+	for (u = 0; u < 8; ++u)
+		n += (qh->interrupt_schedule_mask >> u) & 1;
+
+	return (qh->period > 1) ? qh->period * 8 : 8 / n;
+}
+
+
+static int test_verify(const char *name)
+{
+	static unsigned short uload[EHCI_MAX_PERIOD][8], fload[EHCI_MAX_PERIOD];
+	unsigned int u, maxu = 0, maxf = 0, sumu = 0;
+	int f, i, n, chain = 0;
+	link_pointer_t l;
+	struct qh *qh, *prev;
+
+	memset(uload, 0, sizeof(uload));
+	memset(fload, 0, sizeof(fload));
+
+	for (f = 0; f < EHCI_PERIODIC_SIZE; ++f) {
+		prev = NULL;
+
+		for (l = ehci_common.periodic_list[f], n = 0; !l.terminate; l = qh->horizontal, prev = qh) {
+			qh = test_qh(l);
+
+			/* QHs of the frame's phase only, longer periods first so that the tree is shared */
+			TEST_CHECK(l.type == framelist_qh && ++n < 1000);
+			TEST_CHECK(qh->periodic && f % qh->period == qh->phase);
+			TEST_CHECK(prev == NULL || prev->period >= qh->period);
+
+			if (f >= EHCI_MAX_PERIOD)
+				continue;
+
+			if (qh->endpoint_speed == high_speed) {
+				for (u = 0; u < 8; ++u) {
+					if (qh->interrupt_schedule_mask & (1 << u))
+						uload[f][u] += qh->usecs;
+				}
+			}
+			else {
+				fload[f] += qh->usecs;
+			}
+		}
+
+		chain = (n > chain) ? n : chain;
+
+		/* Every linked QH is reachable from the frames of its phase */
+		for (i = 0; i < TEST_QHS; ++i) {
+			if (!test_common.linked[i] || f % test_common.qhs[i]->period != test_common.qhs[i]->phase)
+				continue;
+
+			for (l = ehci_common.periodic_list[f]; !l.terminate && test_qh(l) != test_common.qhs[i]; l = test_qh(l)->horizontal)
+				;
+
+			TEST_CHECK(!l.terminate);
+		}
+	}
+
+	for (f = 0; f < EHCI_MAX_PERIOD; ++f) {
+		TEST_CHECK(fload[f] == ehci_common.frame_load[f] && fload[f] <= EHCI_FRAME_BUDGET);
+		maxf = (fload[f] > maxf) ? fload[f] : maxf;
+
+		for (u = 0; u < 8; ++u) {
+			TEST_CHECK(uload[f][u] == ehci_common.uframe_load[f][u] && uload[f][u] <= EHCI_UFRAME_BUDGET);
+			maxu = (uload[f][u] > maxu) ? uload[f][u] : maxu;
+			sumu += uload[f][u];
+		}
+	}
+
+	/* Endpoints are never polled less often than requested */
+	for (i = 0, n = 0; i < TEST_QHS; ++i) {
+		if (!test_common.linked[i])
+			continue;
+
+		++n;
+		qh = test_common.qhs[i];
+
+		if (qh->endpoint_speed == high_speed)
+			TEST_CHECK(test_uperiod(qh) <= (1u << (test_common.want[i] - 1)) || qh->period == EHCI_MAX_PERIOD);
+		else
+			TEST_CHECK(qh->period <= test_common.want[i] || test_common.want[i] == 0);
+	}
+
+	printf("%-20s %3d QHs, HS uframe max %3u us avg %5.1f us, FS frame max %3u us, longest chain %d\n",
+		name, n, maxu, sumu / (EHCI_MAX_PERIOD * 8.0), maxf, chain);
+
+	return EOK;
+}
+
+
+/* Unlinks and frees a QH, checks it was kept long enough and the wait was bounded */
+static int test_remove(int i)
+{
+	ehci_unlinkPeriodic(test_common.qhs[i]);
+	test_common.linked[i] = 0;
+
+	model.usleeps = 0;
+	ehci_freeQh(test_common.qhs[i]);
+	test_common.qhs[i] = NULL;
+
+	TEST_CHECK(!model.early && model.usleeps <= 16);
+
+	return EOK;
+}
+
+
+static int test_mix(void)
+{
+	int i, speed, mps, err, rejected = 0;
+
+	/* HID (LS/FS, 8 B, 10 ms), hubs (HS, 1 B, 256 ms), CDC notify and heavier HS interrupt endpoints */
+	for (i = 0; i < TEST_QHS; ++i) {
+		switch (rand() % 5) {
+			case 0:
+				speed = low_speed;
+				mps = 8;
+				test_common.want[i] = 10;
+				break;
+
+			case 1:
+				speed = full_speed;
+				mps = 8 << (rand() % 4);
+				test_common.want[i] = 1 + rand() % 32;
+				break;
+
+			case 2:
+				speed = high_speed;
+				mps = 1;
+				test_common.want[i] = 12;
+				break;
+
+			case 3:
+				speed = high_speed;
+				mps = 64;
+				test_common.want[i] = 1 + rand() % 9;
+				break;
+
+			default:
+				speed = high_speed;
+				mps = 512 << (rand() % 2);
+				test_common.want[i] = 4 + rand() % 4;
+				break;
+		}
+
+		test_common.qhs[i] = ehci_allocQh(i % 127 + 1, 1, transfer_interrupt, speed, mps);
+		TEST_CHECK(test_common.qhs[i] != NULL);
+
+		if ((err = ehci_linkPeriodic(test_common.qhs[i], test_common.want[i])) == -ENOSPC) {
+			++rejected;
+			ehci_freeQh(test_common.qhs[i]);
+			test_common.qhs[i] = NULL;
+			continue;
+		}
+
+		TEST_CHECK(err == EOK);
+		test_common.linked[i] = 1;
+	}
+
+	printf("linked %d, rejected %d for bandwidth\n", TEST_QHS - rejected, rejected);
+	TEST_CHECK(test_verify("after insert") == EOK);
+
+	for (i = 0; i < TEST_QHS; i += 2) {
+		if (test_common.linked[i])
+			TEST_CHECK(test_remove(i) == EOK);
+	}
+
+	TEST_CHECK(test_verify("after removing half") == EOK);
+
+	for (i = 0; i < TEST_QHS; ++i) {
+		if (test_common.linked[i])
+			TEST_CHECK(test_remove(i) == EOK);
+	}
+
+	TEST_CHECK(test_verify("after removing all") == EOK);
+
+	for (i = 0; i < EHCI_PERIODIC_SIZE; ++i)
+		TEST_CHECK(test_common.list[i].terminate && ehci_common.periodic_shadow[i] == NULL);
+
+	return EOK;
+}
+
+
+static int test_phases(void)
+{
+	int i, j;
+
+	/* Same period endpoints are spread over phases: 8 HID mice at 8 ms */
+	for (i = 0; i < 8; ++i) {
+		test_common.qhs[i] = ehci_allocQh(i + 1, 1, transfer_interrupt, low_speed, 8);
+		TEST_CHECK(ehci_linkPeriodic(test_common.qhs[i], 8) == EOK);
+		test_common.linked[i] = 1;
+		test_common.want[i] = 8;
+	}
+
+	for (i = 0; i < 8; ++i) {
+		for (j = 0; j < i; ++j)
+			TEST_CHECK(test_common.qhs[i]->phase != test_common.qhs[j]->phase);
+	}
+
+	TEST_CHECK(test_verify("8 HID at 8 ms") == EOK);
+
+	for (i = 0; i < 8; ++i)
+		TEST_CHECK(test_remove(i) == EOK);
+
+	return EOK;
+}
+
+
+/* Endpoint's bInterval is used as is and running out of bandwidth reaches the caller */
+static int test_insert(void)
+{
+	int i, err = EOK;
+
+	test_common.qhs[0] = ehci_allocQh(1, 1, transfer_interrupt, full_speed, 64);
+	TEST_CHECK(ehci_insertPeriodic(test_common.qhs[0], 16) == EOK);
+	TEST_CHECK(test_common.qhs[0]->period == 16);
+	test_common.linked[0] = 1;
+	test_common.want[0] = 16;
+
+	for (i = 1; i < TEST_QHS && err == EOK; ++i) {
+		test_common.qhs[i] = ehci_allocQh(2, 1, transfer_interrupt, high_speed, 1024);
+		if ((err = ehci_insertPeriodic(test_common.qhs[i], 1)) != EOK)
+			break;
+
+		test_common.linked[i] = 1;
+		test_common.want[i] = 1;
+	}
+
+	TEST_CHECK(err == -ENOSPC && i > 1);
+	ehci_freeQh(test_common.qhs[i]);
+	test_common.qhs[i] = NULL;
+
+	TEST_CHECK(test_verify("bInterval passed through") == EOK);
+
+	while (--i >= 0)
+		TEST_CHECK(test_remove(i) == EOK);
+
+	return EOK;
+}
+
+
+static int test_unlinkFrame(void)
+{
+	struct qh *qh;
+	unsigned int u;
+
+	/* Unlink at every microframe position and across the 7-bit wrap of the frame number */
+	for (u = 0; u < 16; ++u) {
+		*(ehci_common.usb2 + frindex) = (127 << 3) + u;
+
+		test_common.qhs[0] = ehci_allocQh(1, 1, transfer_interrupt, full_speed, 64);
+		TEST_CHECK(ehci_linkPeriodic(test_common.qhs[0], 1) == EOK);
+		test_common.linked[0] = 1;
+		TEST_CHECK(test_remove(0) == EOK);
+		TEST_CHECK(model.usleeps == 16 - u % 8);
+	}
+
+	/* Halted controller doesn't walk the schedule nor advance FRINDEX */
+	*(ehci_common.usb2 + usbsts) |= USBSTS_HCH;
+
+	qh = ehci_allocQh(1, 1, transfer_interrupt, full_speed, 64);
+	TEST_CHECK(ehci_linkPeriodic(qh, 1) == EOK);
+	ehci_unlinkPeriodic(qh);
+
+	model.usleeps = 0;
+	ehci_freeQh(qh);
+	TEST_CHECK(model.usleeps == 0);
+
+	*(ehci_common.usb2 + usbsts) &= ~USBSTS_HCH;
+
+	return EOK;
+}
+
+
+int main(void)
+{
+	int i;
+
+	srand(1);
+
+	ehci_common.usb2 = model.regs;
+	ehci_common.periodic_list = test_common.list;
+	ehci_common.periodic_shadow = calloc(EHCI_PERIODIC_SIZE, sizeof(struct qh *));
+
+	for (i = 0; i < EHCI_PERIODIC_SIZE; ++i)
+		test_common.list[i].terminate = 1;
+
+	TEST_CASE(test_mix());
+	TEST_CASE(test_phases());
+	TEST_CASE(test_insert());
+	TEST_CASE(test_unlinkFrame());
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}